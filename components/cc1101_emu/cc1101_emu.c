@@ -0,0 +1,440 @@
+#include "cc1101_emu.h"
+
+#include <string.h>
+
+// Header byte flags
+#define HEADER_READ  0x80
+#define HEADER_BURST 0x40
+
+// Registers the model cares about
+#define IOCFG2   0x00
+#define IOCFG0   0x02
+#define FREQ2    0x0D
+#define MCSM2    0x16
+#define MCSM0    0x18
+#define WOREVT1  0x1E
+#define WOREVT0  0x1F
+#define WORCTRL  0x20
+#define FSCAL3   0x23
+#define FSTEST   0x29
+#define PATABLE  0x3E
+#define FIFO     0x3F
+
+// Strobes
+#define SRES    0x30
+#define SFSTXON 0x31
+#define SCAL    0x33
+#define SRX     0x34
+#define STX     0x35
+#define SIDLE   0x36
+#define SWOR    0x38
+#define SPWD    0x39
+#define SWORRST 0x3C
+
+// Status registers
+#define PARTNUM   0x30
+#define VERSION   0x31
+#define LQI       0x33
+#define RSSI      0x34
+#define MARCSTATE 0x35
+#define PKTSTATUS 0x38
+
+// GDOx_CFG values
+#define GDO_SERIAL_DATA    0x0D
+#define GDO_CARRIER_SENSE  0x0E
+#define GDO_CHIP_RDYN      0x29
+#define GDO_HW0            0x2F
+#define GDO_INV            0x40
+
+#define RSSI_OFFSET 74
+
+// Reset values from the datasheet
+static const uint8_t reset_regs[CC1101_EMU_NUM_CONFIG_REGS] = {
+  0x29, 0x2E, 0x3F, 0x07, 0xD3, 0x91, 0xFF, 0x04,
+  0x45, 0x00, 0x00, 0x0F, 0x00, 0x1E, 0xC4, 0xEC,
+  0x8C, 0x22, 0x02, 0x22, 0xF8, 0x47, 0x07, 0x30,
+  0x04, 0x36, 0x6C, 0x03, 0x40, 0x91, 0x87, 0x6B,
+  0xF8, 0x56, 0x10, 0xA9, 0x0A, 0x20, 0x0D, 0x41,
+  0x00, 0x59, 0x7F, 0x3F, 0x88, 0x31, 0x0B,
+};
+
+static inline uint8_t fs_autocal(cc1101_emu_t* emu) {
+  return (emu->regs[MCSM0] >> 4) & 0x03;
+}
+
+static int64_t wor_event0_us(cc1101_emu_t* emu) {
+  uint32_t event0 = (emu->regs[WOREVT1] << 8) | emu->regs[WOREVT0];
+  uint8_t wor_res = emu->regs[WORCTRL] & 0x03;
+  // 750 crystal periods per EVENT0 step at 26 MHz
+  int64_t us = (int64_t) event0 * 750 / 26 << (5 * wor_res);
+  return us > 0 ? us : 1;
+}
+
+// RX time of a WOR poll. Exact for WOR_RES 0, the datasheet table is shorter for the others.
+static int64_t wor_rx_us(cc1101_emu_t* emu, int64_t event0_us) {
+  uint8_t rx_time = emu->regs[MCSM2] & 0x07;
+  int64_t rx_us = rx_time == 7 ? event0_us : (event0_us / 8) >> rx_time;
+  bool rx_time_rssi = emu->regs[MCSM2] & 0x10;
+  if (rx_time_rssi && emu->rssi_dbm < emu->carrier_sense_dbm && rx_us > CC1101_EMU_RSSI_CHECK_US) rx_us = CC1101_EMU_RSSI_CHECK_US;
+  return rx_us;
+}
+
+// In WOR the chip sleeps except for a short RX poll at the start of every EVENT0 period
+static bool wor_in_rx(cc1101_emu_t* emu, int64_t now) {
+  int64_t event0_us = wor_event0_us(emu);
+  int64_t phase = (now - emu->wor_started_at) % event0_us;
+  return phase < wor_rx_us(emu, event0_us);
+}
+
+static cc1101_emu_time_t time_class(uint8_t marcstate) {
+  switch (marcstate) {
+    case CC1101_EMU_MARCSTATE_SLEEP: return CC1101_EMU_TIME_SLEEP;
+    case CC1101_EMU_MARCSTATE_RX: return CC1101_EMU_TIME_RX;
+    case CC1101_EMU_MARCSTATE_TX: return CC1101_EMU_TIME_TX;
+    case CC1101_EMU_MARCSTATE_IDLE: return CC1101_EMU_TIME_IDLE;
+    default: return CC1101_EMU_TIME_CAL;
+  }
+}
+
+static cc1101_emu_calibration_t* find_calibration(cc1101_emu_t* emu) {
+  for (size_t i = 0; i < emu->num_cals; i++) {
+    if (memcmp(emu->cals[i].freq, &emu->regs[FREQ2], sizeof(emu->cals[i].freq)) == 0) return &emu->cals[i];
+  }
+  return NULL;
+}
+
+static void calibrate(cc1101_emu_t* emu) {
+  cc1101_emu_calibration_t* cal = find_calibration(emu);
+  if (cal == NULL) {
+    if (emu->num_cals == CC1101_EMU_MAX_CALIBRATIONS) {
+      memmove(&emu->cals[0], &emu->cals[1], (CC1101_EMU_MAX_CALIBRATIONS - 1) * sizeof(cc1101_emu_calibration_t));
+      emu->num_cals--;
+    }
+    cal = &emu->cals[emu->num_cals++];
+    memcpy(cal->freq, &emu->regs[FREQ2], sizeof(cal->freq));
+  }
+  // deterministic per frequency, so a calibration cached for another frequency does not match
+  cal->fscal[0] = 0xE9;
+  cal->fscal[1] = 0x2A;
+  cal->fscal[2] = (emu->regs[FREQ2 + 1] + emu->regs[FREQ2 + 2]) & 0x3F;
+  memcpy(&emu->regs[FSCAL3], cal->fscal, sizeof(cal->fscal));
+  emu->stats.calibrations++;
+}
+
+// Whether the synthesizer can lock without calibrating first
+static bool calibration_valid(cc1101_emu_t* emu) {
+  cc1101_emu_calibration_t* cal = find_calibration(emu);
+  return cal && memcmp(cal->fscal, &emu->regs[FSCAL3], sizeof(cal->fscal)) == 0;
+}
+
+static void lose_sleep_registers(cc1101_emu_t* emu) {
+  memcpy(&emu->regs[FSTEST], &reset_regs[FSTEST], CC1101_EMU_NUM_CONFIG_REGS - FSTEST);
+  memset(&emu->patable[1], 0, sizeof(emu->patable) - 1);
+  emu->stats.sleeps++;
+}
+
+// Account time from last_update to now, and finish a transition that is due
+static void advance(cc1101_emu_t* emu, int64_t now) {
+  int64_t from = emu->last_update;
+  if (now <= from) return;
+
+  if (emu->wor) {
+    // split by the poll duty cycle instead of walking every period
+    int64_t event0_us = wor_event0_us(emu);
+    int64_t rx_us = wor_rx_us(emu, event0_us);
+    int64_t elapsed = now - from;
+    emu->stats.time_us[CC1101_EMU_TIME_RX] += elapsed * rx_us / event0_us;
+    emu->stats.time_us[CC1101_EMU_TIME_SLEEP] += elapsed - elapsed * rx_us / event0_us;
+  } else if (emu->transitioning) {
+    int64_t end = now < emu->done_at ? now : emu->done_at;
+    emu->stats.time_us[CC1101_EMU_TIME_CAL] += end - from;
+    if (emu->pending_cal && now >= emu->cal_done_at) {
+      emu->pending_cal = false;
+      calibrate(emu);
+    }
+    if (now >= emu->done_at) {
+      emu->transitioning = false;
+      emu->marcstate = emu->target;
+      emu->stats.time_us[time_class(emu->marcstate)] += now - end;
+    }
+  } else {
+    emu->stats.time_us[time_class(emu->marcstate)] += now - from;
+  }
+  emu->last_update = now;
+}
+
+// SRES: everything but the RF input, the calibrations and the stats goes back to reset values
+static void reset(cc1101_emu_t* emu, int64_t now) {
+  int16_t rssi_dbm = emu->rssi_dbm;
+  bool carrier = emu->carrier;
+  int16_t carrier_sense_dbm = emu->carrier_sense_dbm;
+  cc1101_emu_stats_t stats = emu->stats;
+  cc1101_emu_calibration_t cals[CC1101_EMU_MAX_CALIBRATIONS];
+  uint8_t num_cals = emu->num_cals;
+  memcpy(cals, emu->cals, sizeof(cals));
+
+  memset(emu, 0, sizeof(*emu));
+  memcpy(emu->regs, reset_regs, sizeof(emu->regs));
+  emu->patable[0] = 0xC6;
+  emu->marcstate = CC1101_EMU_MARCSTATE_IDLE;
+  emu->ready_at = now + CC1101_EMU_XOSC_STARTUP_US;
+  emu->last_update = now;
+
+  emu->rssi_dbm = rssi_dbm;
+  emu->carrier = carrier;
+  emu->carrier_sense_dbm = carrier_sense_dbm;
+  emu->stats = stats;
+  memcpy(emu->cals, cals, sizeof(cals));
+  emu->num_cals = num_cals;
+}
+
+static void start_transition(cc1101_emu_t* emu, int64_t now, uint8_t target, bool cal, int64_t settle_us) {
+  emu->transitioning = true;
+  emu->target = target;
+  emu->pending_cal = cal;
+  emu->cal_done_at = now + (cal ? CC1101_EMU_CAL_US : 0);
+  emu->done_at = emu->cal_done_at + settle_us;
+  emu->marcstate = cal ? CC1101_EMU_MARCSTATE_STARTCAL : CC1101_EMU_MARCSTATE_FS_LOCK;
+}
+
+// IDLE to RX/TX/FSTXON, calibrating first if FS_AUTOCAL says so
+static void start_from_idle(cc1101_emu_t* emu, int64_t now, uint8_t target) {
+  bool cal = fs_autocal(emu) == 1;
+  if (!cal && !calibration_valid(emu)) emu->stats.unlocked_entries++;
+  start_transition(emu, now, target, cal, CC1101_EMU_SETTLE_US);
+}
+
+static void go_idle(cc1101_emu_t* emu, int64_t now) {
+  bool active = emu->marcstate == CC1101_EMU_MARCSTATE_RX || emu->marcstate == CC1101_EMU_MARCSTATE_TX ||
+                emu->marcstate == CC1101_EMU_MARCSTATE_FSTXON;
+  bool cal = false;
+  if (active && fs_autocal(emu) == 2) cal = true;
+  if (active && fs_autocal(emu) == 3) cal = ++emu->autocal_count % 4 == 0;
+
+  emu->wor = false;
+  if (cal) {
+    start_transition(emu, now, CC1101_EMU_MARCSTATE_IDLE, true, 0);
+  } else {
+    emu->transitioning = false;
+    emu->pending_cal = false;
+    emu->marcstate = CC1101_EMU_MARCSTATE_IDLE;
+  }
+}
+
+static void strobe(cc1101_emu_t* emu, int64_t now, uint8_t cmd) {
+  emu->stats.strobes++;
+  // strobes other than SIDLE/SRES are ignored while a transition runs, as on the chip
+  bool busy = emu->transitioning && emu->target != CC1101_EMU_MARCSTATE_IDLE;
+  uint8_t state = emu->marcstate;
+
+  switch (cmd) {
+    case SRES:
+      reset(emu, now);
+      break;
+    case SFSTXON:
+      if (!busy && state == CC1101_EMU_MARCSTATE_IDLE) start_from_idle(emu, now, CC1101_EMU_MARCSTATE_FSTXON);
+      break;
+    case SCAL:
+      if (!busy && state == CC1101_EMU_MARCSTATE_IDLE) start_transition(emu, now, CC1101_EMU_MARCSTATE_IDLE, true, 0);
+      break;
+    case SRX:
+      if (busy) break;
+      if (state == CC1101_EMU_MARCSTATE_IDLE) start_from_idle(emu, now, CC1101_EMU_MARCSTATE_RX);
+      else if (state == CC1101_EMU_MARCSTATE_TX || state == CC1101_EMU_MARCSTATE_FSTXON) {
+        start_transition(emu, now, CC1101_EMU_MARCSTATE_RX, false, CC1101_EMU_TX_TO_RX_US);
+      }
+      break;
+    case STX:
+      if (busy) break;
+      if (state == CC1101_EMU_MARCSTATE_IDLE) start_from_idle(emu, now, CC1101_EMU_MARCSTATE_TX);
+      else if (state == CC1101_EMU_MARCSTATE_RX || state == CC1101_EMU_MARCSTATE_FSTXON) {
+        start_transition(emu, now, CC1101_EMU_MARCSTATE_TX, false, CC1101_EMU_RX_TO_TX_US);
+      }
+      break;
+    case SIDLE:
+      go_idle(emu, now);
+      break;
+    case SWOR:
+      if (state != CC1101_EMU_MARCSTATE_IDLE || busy) break;
+      emu->wor = true;
+      emu->wor_started_at = now;
+      emu->marcstate = CC1101_EMU_MARCSTATE_SLEEP;
+      lose_sleep_registers(emu);
+      break;
+    case SPWD:
+      if (state == CC1101_EMU_MARCSTATE_IDLE) emu->pending_sleep = true;
+      break;
+    case SWORRST:
+      emu->wor_started_at = now;
+      break;
+    default:
+      // SXOFF, SAFC, SFRX, SFTX, SNOP
+      break;
+  }
+}
+
+static uint8_t status_byte(cc1101_emu_t* emu, int64_t now, bool read) {
+  uint8_t state;
+  switch (cc1101_emu_marcstate(emu, now)) {
+    case CC1101_EMU_MARCSTATE_SLEEP:
+    case CC1101_EMU_MARCSTATE_IDLE: state = 0; break;
+    case CC1101_EMU_MARCSTATE_RX: state = 1; break;
+    case CC1101_EMU_MARCSTATE_TX: state = 2; break;
+    case CC1101_EMU_MARCSTATE_FSTXON: state = 3; break;
+    case CC1101_EMU_MARCSTATE_STARTCAL: state = 4; break;
+    default: state = 5; break;
+  }
+  bool not_ready = now < emu->ready_at;
+  // FIFO bytes: nothing in the RX FIFO, TX FIFO all free, async mode never uses them
+  return (not_ready << 7) | (state << 4) | (read ? 0x00 : 0x0F);
+}
+
+static uint8_t read_status_register(cc1101_emu_t* emu, int64_t now, uint8_t addr) {
+  switch (addr) {
+    case PARTNUM: return 0x00;
+    case VERSION: return 0x14;
+    case LQI: return 0x80;
+    case RSSI: return (uint8_t) (int8_t) ((emu->rssi_dbm + RSSI_OFFSET) * 2);
+    case MARCSTATE: return cc1101_emu_marcstate(emu, now);
+    case PKTSTATUS: {
+      bool cs = cc1101_emu_marcstate(emu, now) == CC1101_EMU_MARCSTATE_RX && emu->rssi_dbm >= emu->carrier_sense_dbm;
+      return (cs << 6) | (cc1101_emu_gdo(emu, now, 2) << 2) | cc1101_emu_gdo(emu, now, 0);
+    }
+    default: return 0x00;
+  }
+}
+
+void cc1101_emu_init(cc1101_emu_t* emu, int64_t now_us) {
+  memset(emu, 0, sizeof(*emu));
+  emu->rssi_dbm = -110;
+  emu->carrier_sense_dbm = -90;
+  reset(emu, now_us);
+}
+
+void cc1101_emu_transfer(cc1101_emu_t* emu, int64_t now, const uint8_t* tx, uint8_t* rx, size_t len) {
+  advance(emu, now);
+  emu->stats.transactions++;
+  if (len == 0) return;
+
+  // CSn going low wakes the chip from SLEEP, or from the sleep part of a WOR period.
+  // SO stays high and nothing is clocked in until the crystal runs.
+  bool asleep = emu->sleeping || (emu->wor && !wor_in_rx(emu, now));
+  if (asleep) {
+    emu->sleeping = false;
+    emu->wor = false;
+    emu->marcstate = CC1101_EMU_MARCSTATE_IDLE;
+    emu->ready_at = now + CC1101_EMU_XOSC_STARTUP_US;
+  }
+  if (now < emu->ready_at) {
+    if (rx) memset(rx, 0xFF, len);
+    emu->stats.bytes_not_ready += len;
+    return;
+  }
+  // a WOR poll that is in RX answers like RX, until a strobe says otherwise
+  if (emu->wor) emu->marcstate = CC1101_EMU_MARCSTATE_RX;
+
+  size_t i = 0;
+  while (i < len) {
+    uint8_t header = tx[i];
+    uint8_t addr = header & 0x3F;
+    bool read = header & HEADER_READ;
+    bool burst = header & HEADER_BURST;
+    if (rx) rx[i] = status_byte(emu, now, read);
+    i++;
+
+    if (addr >= SRES && addr <= 0x3D) {
+      if (read && burst) {
+        // status registers, one byte each
+        if (i < len) {
+          if (rx) rx[i] = read_status_register(emu, now, addr);
+          i++;
+        }
+      } else {
+        strobe(emu, now, addr);
+      }
+    } else if (addr == PATABLE) {
+      // the index only resets when CSn goes high
+      do {
+        if (i >= len) break;
+        uint8_t* entry = &emu->patable[emu->patable_index++ & 0x07];
+        if (read) {
+          if (rx) rx[i] = *entry;
+        } else {
+          *entry = tx[i];
+        }
+        i++;
+      } while (burst);
+    } else if (addr == FIFO) {
+      // async serial mode does not use the FIFO
+      if (burst) i = len;
+      else i++;
+    } else {
+      do {
+        if (i >= len || addr >= CC1101_EMU_NUM_CONFIG_REGS) break;
+        if (read) {
+          if (rx) rx[i] = emu->regs[addr];
+        } else {
+          emu->regs[addr] = tx[i];
+        }
+        addr++;
+        i++;
+      } while (burst);
+      if (burst) i = len;
+    }
+  }
+
+  // CSn high
+  emu->patable_index = 0;
+  if (emu->pending_sleep) {
+    emu->pending_sleep = false;
+    emu->sleeping = true;
+    emu->marcstate = CC1101_EMU_MARCSTATE_SLEEP;
+    lose_sleep_registers(emu);
+  }
+}
+
+void cc1101_emu_set_rf(cc1101_emu_t* emu, int64_t now_us, int16_t rssi_dbm, bool carrier) {
+  advance(emu, now_us);
+  emu->rssi_dbm = rssi_dbm;
+  emu->carrier = carrier;
+}
+
+uint8_t cc1101_emu_marcstate(cc1101_emu_t* emu, int64_t now_us) {
+  advance(emu, now_us);
+  if (emu->sleeping) return CC1101_EMU_MARCSTATE_SLEEP;
+  if (emu->wor) return wor_in_rx(emu, now_us) ? CC1101_EMU_MARCSTATE_RX : CC1101_EMU_MARCSTATE_SLEEP;
+  // the synthesizer is locked once calibration is over
+  if (emu->transitioning && now_us >= emu->cal_done_at && emu->target != CC1101_EMU_MARCSTATE_IDLE) return CC1101_EMU_MARCSTATE_FS_LOCK;
+  return emu->marcstate;
+}
+
+bool cc1101_emu_gdo(cc1101_emu_t* emu, int64_t now_us, int pin) {
+  uint8_t cfg = emu->regs[pin == 0 ? IOCFG0 : IOCFG2];
+  uint8_t marcstate = cc1101_emu_marcstate(emu, now_us);
+  bool rx = marcstate == CC1101_EMU_MARCSTATE_RX;
+  bool level;
+
+  switch (cfg & 0x3F) {
+    case GDO_SERIAL_DATA:
+      // an input in TX, driven by the MCU
+      level = rx && emu->carrier;
+      break;
+    case GDO_CARRIER_SENSE:
+      level = rx && emu->rssi_dbm >= emu->carrier_sense_dbm;
+      break;
+    case GDO_CHIP_RDYN:
+      level = emu->sleeping || now_us < emu->ready_at;
+      break;
+    case GDO_HW0:
+    default:
+      // high impedance and the signals the model does not produce read low
+      level = false;
+      break;
+  }
+  return (cfg & GDO_INV) ? !level : level;
+}
+
+void cc1101_emu_get_stats(cc1101_emu_t* emu, int64_t now_us, cc1101_emu_stats_t* stats) {
+  advance(emu, now_us);
+  *stats = emu->stats;
+}
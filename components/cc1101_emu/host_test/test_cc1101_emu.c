@@ -0,0 +1,217 @@
+// Calibration, state transition and WOR timing of the emulator, on a virtual clock
+
+#include <stdio.h>
+#include "cc1101_emu.h"
+
+#define IOCFG2   0x00
+#define FREQ2    0x0D
+#define MCSM2    0x16
+#define MCSM0    0x18
+#define WOREVT1  0x1E
+#define WORCTRL  0x20
+#define FSCAL3   0x23
+#define SCAL     0x33
+#define SRX      0x34
+#define STX      0x35
+#define SIDLE    0x36
+#define SWOR     0x38
+#define SPWD     0x39
+#define MARCSTATE 0x35
+
+// MCSM0 with FS_AUTOCAL 0 (never) or 1 (from IDLE to RX/TX)
+#define MCSM0_NO_AUTOCAL   0x08
+#define MCSM0_AUTOCAL_IDLE 0x18
+
+static int failures;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+      printf("%s:%d: %s\n", __FILE__, __LINE__, #cond); \
+      failures++; \
+    } \
+  } while (0)
+
+static void write_regs(cc1101_emu_t* emu, int64_t now, uint8_t addr, const uint8_t* values, size_t len) {
+  uint8_t tx[16] = { addr | (len > 1 ? 0x40 : 0x00) };
+  for (size_t i = 0; i < len; i++) tx[i + 1] = values[i];
+  cc1101_emu_transfer(emu, now, tx, NULL, len + 1);
+}
+
+static void write_reg(cc1101_emu_t* emu, int64_t now, uint8_t addr, uint8_t value) {
+  write_regs(emu, now, addr, &value, 1);
+}
+
+static void read_regs(cc1101_emu_t* emu, int64_t now, uint8_t addr, uint8_t* values, size_t len) {
+  uint8_t tx[16] = { addr | 0xC0 };
+  uint8_t rx[16];
+  cc1101_emu_transfer(emu, now, tx, rx, len + 1);
+  for (size_t i = 0; i < len; i++) values[i] = rx[i + 1];
+}
+
+static void strobe(cc1101_emu_t* emu, int64_t now, uint8_t cmd) {
+  cc1101_emu_transfer(emu, now, &cmd, NULL, 1);
+}
+
+static uint32_t unlocked_entries(cc1101_emu_t* emu, int64_t now) {
+  cc1101_emu_stats_t stats;
+  cc1101_emu_get_stats(emu, now, &stats);
+  return stats.unlocked_entries;
+}
+
+// A profile switch with FSCAL cached per band, the way cc1101_profile_apply restores it
+static void test_calibration(void) {
+  static const uint8_t band_a[] = { 0x0C, 0x1D, 0x89 };
+  static const uint8_t band_b[] = { 0x10, 0xA7, 0x62 };
+  cc1101_emu_t emu;
+  int64_t t = 0;
+  cc1101_emu_init(&emu, t);
+  t += CC1101_EMU_XOSC_STARTUP_US;
+  write_reg(&emu, t, MCSM0, MCSM0_NO_AUTOCAL);
+  write_regs(&emu, t, FREQ2, band_a, 3);
+
+  // never calibrated, would not lock
+  strobe(&emu, t, SRX);
+  CHECK(unlocked_entries(&emu, t) == 1);
+  strobe(&emu, t, SIDLE);
+
+  strobe(&emu, t, SCAL);
+  CHECK(cc1101_emu_marcstate(&emu, t) == CC1101_EMU_MARCSTATE_STARTCAL);
+  t += CC1101_EMU_CAL_US;
+  CHECK(cc1101_emu_marcstate(&emu, t) == CC1101_EMU_MARCSTATE_IDLE);
+  uint8_t fscal_a[3];
+  read_regs(&emu, t, FSCAL3, fscal_a, 3);
+
+  write_regs(&emu, t, FREQ2, band_b, 3);
+  strobe(&emu, t, SCAL);
+  t += CC1101_EMU_CAL_US;
+  uint8_t fscal_b[3];
+  read_regs(&emu, t, FSCAL3, fscal_b, 3);
+  strobe(&emu, t, SRX);
+  CHECK(unlocked_entries(&emu, t) == 1);
+  strobe(&emu, t, SIDLE);
+
+  // back on band A with its cached values, no calibration needed
+  write_regs(&emu, t, FREQ2, band_a, 3);
+  write_regs(&emu, t, FSCAL3, fscal_a, 3);
+  strobe(&emu, t, SRX);
+  CHECK(unlocked_entries(&emu, t) == 1);
+  strobe(&emu, t, SIDLE);
+
+  // band B's values on band A do not lock
+  write_regs(&emu, t, FSCAL3, fscal_b, 3);
+  strobe(&emu, t, SRX);
+  CHECK(unlocked_entries(&emu, t) == 2);
+  strobe(&emu, t, SIDLE);
+
+  cc1101_emu_stats_t stats;
+  cc1101_emu_get_stats(&emu, t, &stats);
+  CHECK(stats.calibrations == 2);
+}
+
+static void test_transitions(void) {
+  cc1101_emu_t emu;
+  int64_t t = 0;
+  cc1101_emu_init(&emu, t);
+
+  // nothing is clocked in before the crystal runs
+  write_reg(&emu, t, MCSM0, MCSM0_AUTOCAL_IDLE);
+  cc1101_emu_stats_t stats;
+  cc1101_emu_get_stats(&emu, t, &stats);
+  CHECK(stats.bytes_not_ready == 2);
+  t += CC1101_EMU_XOSC_STARTUP_US;
+  write_reg(&emu, t, MCSM0, MCSM0_AUTOCAL_IDLE);
+
+  // IDLE to RX calibrates, then settles
+  int64_t start = t;
+  strobe(&emu, t, SRX);
+  CHECK(cc1101_emu_marcstate(&emu, start + CC1101_EMU_CAL_US - 1) == CC1101_EMU_MARCSTATE_STARTCAL);
+  CHECK(cc1101_emu_marcstate(&emu, start + CC1101_EMU_CAL_US) == CC1101_EMU_MARCSTATE_FS_LOCK);
+  CHECK(cc1101_emu_marcstate(&emu, start + CC1101_EMU_CAL_US + CC1101_EMU_SETTLE_US - 1) == CC1101_EMU_MARCSTATE_FS_LOCK);
+  t = start + CC1101_EMU_CAL_US + CC1101_EMU_SETTLE_US;
+  CHECK(cc1101_emu_marcstate(&emu, t) == CC1101_EMU_MARCSTATE_RX);
+  uint8_t marcstate;
+  read_regs(&emu, t, MARCSTATE, &marcstate, 1);
+  CHECK(marcstate == CC1101_EMU_MARCSTATE_RX);
+
+  // RX to TX and back without calibrating
+  strobe(&emu, t, STX);
+  CHECK(cc1101_emu_marcstate(&emu, t + CC1101_EMU_RX_TO_TX_US - 1) != CC1101_EMU_MARCSTATE_TX);
+  t += CC1101_EMU_RX_TO_TX_US;
+  CHECK(cc1101_emu_marcstate(&emu, t) == CC1101_EMU_MARCSTATE_TX);
+  strobe(&emu, t, SRX);
+  t += CC1101_EMU_TX_TO_RX_US;
+  CHECK(cc1101_emu_marcstate(&emu, t) == CC1101_EMU_MARCSTATE_RX);
+
+  // strobes other than SIDLE are ignored while a transition runs
+  strobe(&emu, t, STX);
+  strobe(&emu, t, SRX);
+  t += CC1101_EMU_RX_TO_TX_US;
+  CHECK(cc1101_emu_marcstate(&emu, t) == CC1101_EMU_MARCSTATE_TX);
+
+  strobe(&emu, t, SIDLE);
+  CHECK(cc1101_emu_marcstate(&emu, t) == CC1101_EMU_MARCSTATE_IDLE);
+  cc1101_emu_get_stats(&emu, t, &stats);
+  CHECK(stats.calibrations == 1);
+  CHECK(stats.unlocked_entries == 0);
+  CHECK(stats.time_us[CC1101_EMU_TIME_CAL] == CC1101_EMU_CAL_US + CC1101_EMU_SETTLE_US + 2 * CC1101_EMU_RX_TO_TX_US + CC1101_EMU_TX_TO_RX_US);
+
+  // SPWD sleeps once CSn goes high, and the next transaction only wakes the chip
+  strobe(&emu, t, SPWD);
+  CHECK(cc1101_emu_marcstate(&emu, t) == CC1101_EMU_MARCSTATE_SLEEP);
+  // GDO2 is CHIP_RDYn after reset
+  CHECK(cc1101_emu_gdo(&emu, t, 2) == true);
+  write_reg(&emu, t, IOCFG2, 0x29);
+  CHECK(cc1101_emu_marcstate(&emu, t) == CC1101_EMU_MARCSTATE_IDLE);
+  cc1101_emu_get_stats(&emu, t, &stats);
+  CHECK(stats.sleeps == 1);
+  CHECK(stats.bytes_not_ready == 4);
+}
+
+static void test_wor(void) {
+  // EVENT0 of 256 steps of 750 / 26 MHz, RX_TIME 2 is EVENT0 / 8 / 4
+  static const uint8_t wor[] = { 0x01, 0x00, 0x78 };
+  const int64_t event0_us = 256 * 750 / 26;
+  const int64_t rx_us = event0_us / 8 >> 2;
+  cc1101_emu_t emu;
+  int64_t t = 0;
+  cc1101_emu_init(&emu, t);
+  t += CC1101_EMU_XOSC_STARTUP_US;
+  write_regs(&emu, t, WOREVT1, wor, 3);
+  write_reg(&emu, t, MCSM2, 0x02);
+
+  int64_t start = t;
+  strobe(&emu, t, SWOR);
+  CHECK(cc1101_emu_marcstate(&emu, start) == CC1101_EMU_MARCSTATE_RX);
+  CHECK(cc1101_emu_marcstate(&emu, start + rx_us - 1) == CC1101_EMU_MARCSTATE_RX);
+  CHECK(cc1101_emu_marcstate(&emu, start + rx_us) == CC1101_EMU_MARCSTATE_SLEEP);
+  CHECK(cc1101_emu_marcstate(&emu, start + event0_us - 1) == CC1101_EMU_MARCSTATE_SLEEP);
+  CHECK(cc1101_emu_marcstate(&emu, start + event0_us) == CC1101_EMU_MARCSTATE_RX);
+
+  // the duty cycle over many periods, the model splits time by it and rounds down per update
+  t = start + 100 * event0_us;
+  cc1101_emu_stats_t stats;
+  cc1101_emu_get_stats(&emu, t, &stats);
+  int64_t rx_time = stats.time_us[CC1101_EMU_TIME_RX];
+  CHECK(rx_time >= 100 * rx_us - 5 && rx_time <= 100 * rx_us);
+  CHECK((int64_t) stats.time_us[CC1101_EMU_TIME_SLEEP] == 100 * event0_us - rx_time);
+  CHECK(stats.sleeps == 1);
+
+  // RX_TIME_RSSI ends a poll early on a quiet channel, and not with a carrier
+  write_reg(&emu, t, MCSM2, 0x17);
+  strobe(&emu, t, SWOR);
+  CHECK(cc1101_emu_marcstate(&emu, t + CC1101_EMU_RSSI_CHECK_US) == CC1101_EMU_MARCSTATE_SLEEP);
+  cc1101_emu_set_rf(&emu, t + event0_us, -60, true);
+  CHECK(cc1101_emu_marcstate(&emu, t + event0_us + CC1101_EMU_RSSI_CHECK_US) == CC1101_EMU_MARCSTATE_RX);
+}
+
+int main(void) {
+  test_calibration();
+  test_transitions();
+  test_wor();
+  if (failures) {
+    printf("%d checks failed\n", failures);
+    return 1;
+  }
+  printf("all checks passed\n");
+  return 0;
+}
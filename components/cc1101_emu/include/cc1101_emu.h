@@ -0,0 +1,122 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Register level model of a CC1101 for host builds.
+//
+// Time is passed in by the caller in us, so the model can run on a real clock behind the
+// SPI shim, or on a virtual clock in a test that wants exact timings.
+
+#define CC1101_EMU_NUM_CONFIG_REGS 0x2F
+
+// MARCSTATE values the model goes through
+#define CC1101_EMU_MARCSTATE_SLEEP    0x00
+#define CC1101_EMU_MARCSTATE_IDLE     0x01
+#define CC1101_EMU_MARCSTATE_STARTCAL 0x08
+#define CC1101_EMU_MARCSTATE_FS_LOCK  0x0A
+#define CC1101_EMU_MARCSTATE_RX       0x0D
+#define CC1101_EMU_MARCSTATE_FSTXON   0x12
+#define CC1101_EMU_MARCSTATE_TX       0x13
+
+// Datasheet timings for a 26 MHz crystal, in us
+#define CC1101_EMU_XOSC_STARTUP_US 150
+#define CC1101_EMU_CAL_US          721
+#define CC1101_EMU_SETTLE_US       88
+#define CC1101_EMU_RX_TO_TX_US     10
+#define CC1101_EMU_TX_TO_RX_US     22
+// how long a WOR poll stays in RX without a carrier when RX_TIME_RSSI is set
+#define CC1101_EMU_RSSI_CHECK_US   200
+
+// frequencies the model remembers a calibration for, the oldest one goes first
+#define CC1101_EMU_MAX_CALIBRATIONS 4
+
+typedef enum {
+  CC1101_EMU_TIME_SLEEP,
+  CC1101_EMU_TIME_IDLE,
+  CC1101_EMU_TIME_CAL,
+  CC1101_EMU_TIME_RX,
+  CC1101_EMU_TIME_TX,
+  CC1101_EMU_TIME_MAX,
+} cc1101_emu_time_t;
+
+typedef struct {
+  uint32_t transactions;
+  uint32_t strobes;
+  uint32_t calibrations;
+  // RX/TX entered without auto calibration and without the FSCAL values of a calibration at
+  // the current frequency, the synthesizer would not lock on real hardware
+  uint32_t unlocked_entries;
+  // bytes clocked in before the crystal was running after a wake up, ignored by the chip
+  uint32_t bytes_not_ready;
+  // times the chip went to SLEEP, which loses the TEST registers and most of the PA table
+  uint32_t sleeps;
+  uint64_t time_us[CC1101_EMU_TIME_MAX];
+} cc1101_emu_stats_t;
+
+// FSCAL3..FSCAL1 as a calibration at freq (FREQ2..FREQ0) left them
+typedef struct {
+  uint8_t freq[3];
+  uint8_t fscal[3];
+} cc1101_emu_calibration_t;
+
+typedef struct {
+  uint8_t regs[CC1101_EMU_NUM_CONFIG_REGS];
+  uint8_t patable[8];
+  uint8_t patable_index;
+
+  uint8_t marcstate;
+  // a transition in progress ends in target at done_at, after calibrating until cal_done_at
+  bool transitioning;
+  uint8_t target;
+  int64_t cal_done_at;
+  int64_t done_at;
+  bool pending_cal;
+
+  // calibration results, one per frequency. Restoring them is valid whenever the chip is
+  // back on that frequency, they belong to the synthesizer and survive SRES.
+  cc1101_emu_calibration_t cals[CC1101_EMU_MAX_CALIBRATIONS];
+  uint8_t num_cals;
+  // FS_AUTOCAL 3 calibrates every fourth return to IDLE
+  uint8_t autocal_count;
+
+  bool wor;
+  int64_t wor_started_at;
+  // crystal off, the next transaction only wakes the chip
+  bool sleeping;
+  // SPWD takes effect when CSn goes high
+  bool pending_sleep;
+  int64_t ready_at;
+
+  // RF input
+  int16_t rssi_dbm;
+  bool carrier;
+  int16_t carrier_sense_dbm;
+
+  int64_t last_update;
+  cc1101_emu_stats_t stats;
+} cc1101_emu_t;
+
+// Power-on reset at now_us
+void cc1101_emu_init(cc1101_emu_t* emu, int64_t now_us);
+
+/**
+ * @brief One SPI transaction with CSn held low for all of it
+ *
+ * rx may be NULL. The first byte clocked out is the chip status byte, as on the real part.
+ */
+void cc1101_emu_transfer(cc1101_emu_t* emu, int64_t now_us, const uint8_t* tx, uint8_t* rx, size_t len);
+
+/**
+ * @brief Set what the antenna sees
+ *
+ * carrier is the demodulated OOK level, it shows up on a GDO configured for serial data
+ * output while in RX. rssi_dbm is what the RSSI register and carrier sense report.
+ */
+void cc1101_emu_set_rf(cc1101_emu_t* emu, int64_t now_us, int16_t rssi_dbm, bool carrier);
+
+// Level of GDO0 (pin 0) or GDO2 (pin 2) given their IOCFG configuration
+bool cc1101_emu_gdo(cc1101_emu_t* emu, int64_t now_us, int pin);
+uint8_t cc1101_emu_marcstate(cc1101_emu_t* emu, int64_t now_us);
+void cc1101_emu_get_stats(cc1101_emu_t* emu, int64_t now_us, cc1101_emu_stats_t* stats);
@@ -0,0 +1,33 @@
+#include "cc1101.h"
+
+#include <stdlib.h>
+
+// SRES command strobe
+#define SRES 0x30
+
+esp_err_t cc1101_init(const cc1101_device_cfg_t* cfg, cc1101_device_t** device) {
+  cc1101_device_t* cc = calloc(1, sizeof(cc1101_device_t));
+  if (cc == NULL) return ESP_ERR_NO_MEM;
+  cc->cfg = *cfg;
+
+  spi_device_interface_config_t dev_cfg = {
+    .spics_io_num = cfg->cs_io_num,
+    .queue_size = 4,
+  };
+  esp_err_t err = spi_bus_add_device(cfg->spi_host, &dev_cfg, &cc->spi);
+  if (err != ESP_OK) {
+    free(cc);
+    return err;
+  }
+  *device = cc;
+  return ESP_OK;
+}
+
+esp_err_t cc1101_hard_reset(cc1101_device_t* device) {
+  uint8_t strobe = SRES;
+  spi_transaction_t trans = {
+    .length = 8,
+    .tx_buffer = &strobe,
+  };
+  return spi_device_polling_transmit(device->spi, &trans);
+}
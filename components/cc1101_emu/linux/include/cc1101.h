@@ -0,0 +1,31 @@
+#pragma once
+
+// The part of the cc1101-idf API the bridge uses, for the linux target. Everything past
+// bringing up the device goes through main/cc1101_spi.c, which talks to the emulated chip.
+
+#include "driver/spi_master.h"
+#include "esp_err.h"
+
+typedef enum {
+  CC1101_CRYSTAL_26MHZ,
+  CC1101_CRYSTAL_27MHZ,
+} cc1101_crystal_freq_t;
+
+typedef struct {
+  spi_host_device_t spi_host;
+  int gdo0_io_num;
+  int gdo2_io_num;
+  int cs_io_num;
+  int miso_io_num;
+  cc1101_crystal_freq_t crystal_freq;
+} cc1101_device_cfg_t;
+
+typedef struct {
+  spi_device_handle_t spi;
+  cc1101_device_cfg_t cfg;
+} cc1101_device_t;
+
+// Add the chip to the emulated bus, which powers it on
+esp_err_t cc1101_init(const cc1101_device_cfg_t* cfg, cc1101_device_t** device);
+// SRES
+esp_err_t cc1101_hard_reset(cc1101_device_t* device);
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "cc1101_emu.h"
+
+// Most devices on the emulated bus, one per chip select
+#define CC1101_EMU_SPI_MAX_DEVICES 4
+
+// Current time on the clock the emulated devices run on
+int64_t cc1101_emu_spi_now(void);
+
+/**
+ * @brief The emulated CC1101 behind a chip select, NULL if no device was added for it
+ *
+ * Use it to set the RF input and to read GDO levels and stats. The caller must not run
+ * SPI transactions on the same device at the same time.
+ */
+cc1101_emu_t* cc1101_emu_spi_get(int cs_io_num);
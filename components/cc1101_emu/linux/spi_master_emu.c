@@ -0,0 +1,102 @@
+#include "driver/spi_master.h"
+
+#include <string.h>
+#include <time.h>
+#include "cc1101_emu_spi.h"
+#include "esp_log.h"
+
+#define TAG "CC1101 Emu SPI"
+
+// matches the deepest queue cc1101-idf asks for
+#define QUEUE_DEPTH 4
+
+struct spi_device_t {
+  bool used;
+  int cs_io_num;
+  cc1101_emu_t emu;
+  // queued transactions run immediately and wait here to be collected
+  spi_transaction_t* done[QUEUE_DEPTH];
+  size_t done_head;
+  size_t done_count;
+};
+
+static struct spi_device_t devices[CC1101_EMU_SPI_MAX_DEVICES];
+
+int64_t cc1101_emu_spi_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+cc1101_emu_t* cc1101_emu_spi_get(int cs_io_num) {
+  for (size_t i = 0; i < CC1101_EMU_SPI_MAX_DEVICES; i++) {
+    if (devices[i].used && devices[i].cs_io_num == cs_io_num) return &devices[i].emu;
+  }
+  return NULL;
+}
+
+esp_err_t spi_bus_initialize(spi_host_device_t host_id, const spi_bus_config_t* bus_config, spi_dma_chan_t dma_chan) {
+  return ESP_OK;
+}
+
+esp_err_t spi_bus_free(spi_host_device_t host_id) {
+  return ESP_OK;
+}
+
+esp_err_t spi_bus_add_device(spi_host_device_t host_id, const spi_device_interface_config_t* dev_config, spi_device_handle_t* handle) {
+  for (size_t i = 0; i < CC1101_EMU_SPI_MAX_DEVICES; i++) {
+    struct spi_device_t* dev = &devices[i];
+    if (dev->used) continue;
+    memset(dev, 0, sizeof(*dev));
+    dev->used = true;
+    dev->cs_io_num = dev_config->spics_io_num;
+    // power on when it is first attached
+    cc1101_emu_init(&dev->emu, cc1101_emu_spi_now());
+    ESP_LOGI(TAG, "Emulated CC1101 on CS %d", dev->cs_io_num);
+    *handle = dev;
+    return ESP_OK;
+  }
+  return ESP_ERR_NO_MEM;
+}
+
+esp_err_t spi_bus_remove_device(spi_device_handle_t handle) {
+  handle->used = false;
+  return ESP_OK;
+}
+
+esp_err_t spi_device_polling_transmit(spi_device_handle_t handle, spi_transaction_t* trans) {
+  const uint8_t* tx = (trans->flags & SPI_TRANS_USE_TXDATA) ? trans->tx_data : trans->tx_buffer;
+  uint8_t* rx = (trans->flags & SPI_TRANS_USE_RXDATA) ? trans->rx_data : trans->rx_buffer;
+  if (tx == NULL) return ESP_ERR_INVALID_ARG;
+
+  cc1101_emu_transfer(&handle->emu, cc1101_emu_spi_now(), tx, rx, trans->length / 8);
+  return ESP_OK;
+}
+
+esp_err_t spi_device_transmit(spi_device_handle_t handle, spi_transaction_t* trans) {
+  return spi_device_polling_transmit(handle, trans);
+}
+
+esp_err_t spi_device_queue_trans(spi_device_handle_t handle, spi_transaction_t* trans, TickType_t ticks_to_wait) {
+  if (handle->done_count == QUEUE_DEPTH) return ESP_ERR_TIMEOUT;
+  esp_err_t err = spi_device_polling_transmit(handle, trans);
+  if (err != ESP_OK) return err;
+  handle->done[(handle->done_head + handle->done_count++) % QUEUE_DEPTH] = trans;
+  return ESP_OK;
+}
+
+esp_err_t spi_device_get_trans_result(spi_device_handle_t handle, spi_transaction_t** trans, TickType_t ticks_to_wait) {
+  if (handle->done_count == 0) return ESP_ERR_TIMEOUT;
+  *trans = handle->done[handle->done_head];
+  handle->done_head = (handle->done_head + 1) % QUEUE_DEPTH;
+  handle->done_count--;
+  return ESP_OK;
+}
+
+// Transactions are not interleaved in the model, so there is nothing to lock
+esp_err_t spi_device_acquire_bus(spi_device_handle_t device, TickType_t wait) {
+  return ESP_OK;
+}
+
+void spi_device_release_bus(spi_device_handle_t dev) {
+}
@@ -0,0 +1,26 @@
+#include "driver/gpio.h"
+
+static uint32_t levels;
+
+esp_err_t gpio_config(const gpio_config_t* config) {
+  return config->pin_bit_mask >> GPIO_NUM_MAX ? ESP_ERR_INVALID_ARG : ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level) {
+  if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX) return ESP_ERR_INVALID_ARG;
+  if (level) {
+    levels |= 1u << gpio_num;
+  } else {
+    levels &= ~(1u << gpio_num);
+  }
+  return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num) {
+  if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX) return 0;
+  return (levels >> gpio_num) & 1;
+}
+
+esp_err_t gpio_install_isr_service(int intr_alloc_flags) {
+  return ESP_OK;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "driver/rmt_types.h"
+
+esp_err_t rmt_enable(rmt_channel_handle_t channel);
+esp_err_t rmt_disable(rmt_channel_handle_t channel);
+esp_err_t rmt_del_channel(rmt_channel_handle_t channel);
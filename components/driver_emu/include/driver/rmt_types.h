@@ -0,0 +1,38 @@
+#pragma once
+
+// The subset of the RMT driver used by the bridge, for the linux target.
+// See rmt_emu.h for how frames get in and out.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "hal/rmt_types.h"
+
+#ifndef __containerof
+#define __containerof(ptr, type, member) ((type*) ((char*) (ptr) - offsetof(type, member)))
+#endif
+
+typedef struct rmt_channel_t* rmt_channel_handle_t;
+
+typedef enum {
+  RMT_ENCODING_RESET = 0,
+  RMT_ENCODING_COMPLETE = (1 << 0),
+  RMT_ENCODING_MEM_FULL = (1 << 1),
+} rmt_encode_state_t;
+
+typedef struct rmt_encoder_t rmt_encoder_t;
+typedef rmt_encoder_t* rmt_encoder_handle_t;
+
+struct rmt_encoder_t {
+  size_t (*encode)(rmt_encoder_t* encoder, rmt_channel_handle_t tx_channel, const void* primary_data, size_t data_size, rmt_encode_state_t* ret_state);
+  esp_err_t (*reset)(rmt_encoder_t* encoder);
+  esp_err_t (*del)(rmt_encoder_t* encoder);
+};
+
+typedef struct {
+  rmt_symbol_word_t* received_symbols;
+  size_t num_symbols;
+} rmt_rx_done_event_data_t;
+
+typedef bool (*rmt_rx_done_callback_t)(rmt_channel_handle_t rx_chan, const rmt_rx_done_event_data_t* edata, void* user_ctx);
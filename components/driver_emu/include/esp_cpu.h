@@ -0,0 +1,15 @@
+#pragma once
+
+// esp_hw_support has no CPU layer for the linux target. Cycle counts used for stats are
+// nanoseconds of the monotonic clock here.
+
+#include <stdint.h>
+#include <time.h>
+
+typedef uint32_t esp_cpu_cycle_count_t;
+
+static inline esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (esp_cpu_cycle_count_t) ((uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec);
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+// Same layout as the hardware symbol, so frames can be compared with device captures
+typedef union {
+  struct {
+    uint16_t duration0 : 15;
+    uint16_t level0 : 1;
+    uint16_t duration1 : 15;
+    uint16_t level1 : 1;
+  };
+  uint32_t val;
+} rmt_symbol_word_t;
+
+typedef enum {
+  RMT_CLK_SRC_DEFAULT = 0,
+} rmt_clock_source_t;
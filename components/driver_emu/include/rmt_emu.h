@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "driver/rmt_types.h"
+#include "esp_err.h"
+
+// RMT channels for the linux target.
+//
+// A TX channel runs its encoder into a symbol buffer and stays busy for as long as the symbols
+// last on air, so rmt_tx_wait_all_done blocks like on hardware. Every frame goes to the TX hook
+// with the time it starts. An RX channel takes frames from rmt_emu_rx_inject while it is armed
+// with rmt_receive, and calls its done callback from the injecting task like the driver ISR.
+
+#define RMT_EMU_MAX_CHANNELS 4
+// symbols one transmission can encode to
+#define RMT_EMU_TX_MAX_SYMBOLS 256
+
+typedef struct {
+  uint32_t tx_frames;
+  uint32_t rx_frames;
+  // injected while the receiver was not armed, lost as they would be on hardware
+  uint32_t rx_not_armed;
+} rmt_emu_stats_t;
+
+/**
+ * @brief Called for every frame a TX channel sends, repeats included
+ *
+ * @param start_us esp_timer time the frame starts on air, later than now when the channel is busy
+ */
+typedef void (*rmt_emu_tx_hook_t)(int gpio_num, const rmt_symbol_word_t* symbols, size_t num_symbols, int64_t start_us);
+
+void rmt_emu_set_tx_hook(rmt_emu_tx_hook_t hook);
+
+/**
+ * @brief Hand a frame to the RX channel on gpio_num
+ *
+ * @return ESP_ERR_INVALID_STATE if the channel is not armed, ESP_ERR_NOT_FOUND without a channel
+ */
+esp_err_t rmt_emu_rx_inject(int gpio_num, const rmt_symbol_word_t* symbols, size_t num_symbols);
+
+void rmt_emu_get_stats(rmt_emu_stats_t* stats);
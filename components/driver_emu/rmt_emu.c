@@ -0,0 +1,311 @@
+#include "rmt_emu.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include "driver/rmt_rx.h"
+#include "driver/rmt_tx.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define TAG "RMT Emu"
+
+struct rmt_channel_t {
+  bool used;
+  bool tx;
+  bool enabled;
+  int gpio_num;
+  uint32_t resolution_hz;
+
+  // TX: symbols of the transmission being encoded, and when the last one ends on air
+  rmt_symbol_word_t* symbols;
+  size_t num_symbols;
+  size_t max_symbols;
+  rmt_symbol_word_t tx_symbols[RMT_EMU_TX_MAX_SYMBOLS];
+  int64_t busy_until;
+
+  // RX
+  rmt_rx_done_callback_t on_recv_done;
+  void* user_data;
+  rmt_symbol_word_t* rx_buffer;
+  size_t rx_buffer_symbols;
+  bool armed;
+};
+
+typedef struct {
+  rmt_encoder_t base;
+  rmt_bytes_encoder_config_t config;
+  // next bit to encode, kept across calls that ran out of space
+  size_t position;
+} bytes_encoder_t;
+
+typedef struct {
+  rmt_encoder_t base;
+  size_t position;
+} copy_encoder_t;
+
+static struct rmt_channel_t channels[RMT_EMU_MAX_CHANNELS];
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+static rmt_emu_tx_hook_t tx_hook;
+static rmt_emu_stats_t stats;
+
+static bool emit(rmt_channel_handle_t channel, rmt_symbol_word_t symbol) {
+  if (channel->num_symbols == channel->max_symbols) return false;
+  channel->symbols[channel->num_symbols++] = symbol;
+  return true;
+}
+
+static size_t bytes_encode(rmt_encoder_t* encoder, rmt_channel_handle_t channel, const void* data, size_t data_size, rmt_encode_state_t* ret_state) {
+  bytes_encoder_t* bytes = __containerof(encoder, bytes_encoder_t, base);
+  const uint8_t* data_bytes = data;
+  size_t encoded = 0;
+
+  while (bytes->position < data_size * 8) {
+    size_t bit = bytes->position % 8;
+    if (bytes->config.flags.msb_first) bit = 7 - bit;
+    bool one = (data_bytes[bytes->position / 8] >> bit) & 1;
+    if (!emit(channel, one ? bytes->config.bit1 : bytes->config.bit0)) {
+      *ret_state = RMT_ENCODING_MEM_FULL;
+      return encoded;
+    }
+    bytes->position++;
+    encoded++;
+  }
+  bytes->position = 0;
+  *ret_state = RMT_ENCODING_COMPLETE;
+  return encoded;
+}
+
+static size_t copy_encode(rmt_encoder_t* encoder, rmt_channel_handle_t channel, const void* data, size_t data_size, rmt_encode_state_t* ret_state) {
+  copy_encoder_t* copy = __containerof(encoder, copy_encoder_t, base);
+  const rmt_symbol_word_t* symbols = data;
+  size_t encoded = 0;
+
+  while (copy->position < data_size / sizeof(rmt_symbol_word_t)) {
+    if (!emit(channel, symbols[copy->position])) {
+      *ret_state = RMT_ENCODING_MEM_FULL;
+      return encoded;
+    }
+    copy->position++;
+    encoded++;
+  }
+  copy->position = 0;
+  *ret_state = RMT_ENCODING_COMPLETE;
+  return encoded;
+}
+
+static esp_err_t bytes_reset(rmt_encoder_t* encoder) {
+  __containerof(encoder, bytes_encoder_t, base)->position = 0;
+  return ESP_OK;
+}
+
+static esp_err_t copy_reset(rmt_encoder_t* encoder) {
+  __containerof(encoder, copy_encoder_t, base)->position = 0;
+  return ESP_OK;
+}
+
+static esp_err_t bytes_del(rmt_encoder_t* encoder) {
+  free(__containerof(encoder, bytes_encoder_t, base));
+  return ESP_OK;
+}
+
+static esp_err_t copy_del(rmt_encoder_t* encoder) {
+  free(__containerof(encoder, copy_encoder_t, base));
+  return ESP_OK;
+}
+
+esp_err_t rmt_new_bytes_encoder(const rmt_bytes_encoder_config_t* config, rmt_encoder_handle_t* ret_encoder) {
+  bytes_encoder_t* bytes = calloc(1, sizeof(bytes_encoder_t));
+  if (bytes == NULL) return ESP_ERR_NO_MEM;
+  bytes->config = *config;
+  bytes->base.encode = bytes_encode;
+  bytes->base.reset = bytes_reset;
+  bytes->base.del = bytes_del;
+  *ret_encoder = &bytes->base;
+  return ESP_OK;
+}
+
+esp_err_t rmt_new_copy_encoder(const rmt_copy_encoder_config_t* config, rmt_encoder_handle_t* ret_encoder) {
+  copy_encoder_t* copy = calloc(1, sizeof(copy_encoder_t));
+  if (copy == NULL) return ESP_ERR_NO_MEM;
+  copy->base.encode = copy_encode;
+  copy->base.reset = copy_reset;
+  copy->base.del = copy_del;
+  *ret_encoder = &copy->base;
+  return ESP_OK;
+}
+
+esp_err_t rmt_del_encoder(rmt_encoder_handle_t encoder) {
+  return encoder->del(encoder);
+}
+
+esp_err_t rmt_encoder_reset(rmt_encoder_handle_t encoder) {
+  return encoder->reset(encoder);
+}
+
+void* rmt_alloc_encoder_mem(size_t size) {
+  return calloc(1, size);
+}
+
+static rmt_channel_handle_t new_channel(bool tx, int gpio_num, uint32_t resolution_hz) {
+  for (size_t i = 0; i < RMT_EMU_MAX_CHANNELS; i++) {
+    rmt_channel_handle_t channel = &channels[i];
+    if (channel->used) continue;
+    memset(channel, 0, sizeof(*channel));
+    channel->used = true;
+    channel->tx = tx;
+    channel->gpio_num = gpio_num;
+    channel->resolution_hz = resolution_hz;
+    return channel;
+  }
+  return NULL;
+}
+
+esp_err_t rmt_new_tx_channel(const rmt_tx_channel_config_t* config, rmt_channel_handle_t* ret_chan) {
+  rmt_channel_handle_t channel = new_channel(true, config->gpio_num, config->resolution_hz);
+  if (channel == NULL) return ESP_ERR_NOT_FOUND;
+  ESP_LOGI(TAG, "Emulated TX channel on GPIO %d", config->gpio_num);
+  *ret_chan = channel;
+  return ESP_OK;
+}
+
+esp_err_t rmt_new_rx_channel(const rmt_rx_channel_config_t* config, rmt_channel_handle_t* ret_chan) {
+  rmt_channel_handle_t channel = new_channel(false, config->gpio_num, config->resolution_hz);
+  if (channel == NULL) return ESP_ERR_NOT_FOUND;
+  ESP_LOGI(TAG, "Emulated RX channel on GPIO %d", config->gpio_num);
+  *ret_chan = channel;
+  return ESP_OK;
+}
+
+esp_err_t rmt_enable(rmt_channel_handle_t channel) {
+  if (channel->enabled) return ESP_ERR_INVALID_STATE;
+  channel->enabled = true;
+  return ESP_OK;
+}
+
+esp_err_t rmt_disable(rmt_channel_handle_t channel) {
+  if (!channel->enabled) return ESP_ERR_INVALID_STATE;
+  portENTER_CRITICAL(&lock);
+  channel->enabled = false;
+  channel->armed = false;
+  portEXIT_CRITICAL(&lock);
+  return ESP_OK;
+}
+
+esp_err_t rmt_del_channel(rmt_channel_handle_t channel) {
+  if (channel->enabled) return ESP_ERR_INVALID_STATE;
+  channel->used = false;
+  return ESP_OK;
+}
+
+// Encode a whole transmission into symbols, false if it does not fit
+static bool encode_all(rmt_channel_handle_t channel, rmt_encoder_handle_t encoder, const void* payload, size_t payload_bytes) {
+  channel->num_symbols = 0;
+  while (1) {
+    rmt_encode_state_t state = RMT_ENCODING_RESET;
+    encoder->encode(encoder, channel, payload, payload_bytes, &state);
+    if (state & RMT_ENCODING_COMPLETE) return true;
+    if (state & RMT_ENCODING_MEM_FULL) {
+      rmt_encoder_reset(encoder);
+      return false;
+    }
+  }
+}
+
+esp_err_t rmt_transmit(rmt_channel_handle_t channel, rmt_encoder_handle_t encoder, const void* payload, size_t payload_bytes, const rmt_transmit_config_t* config) {
+  if (!channel->tx || !channel->enabled) return ESP_ERR_INVALID_STATE;
+  channel->symbols = channel->tx_symbols;
+  channel->max_symbols = RMT_EMU_TX_MAX_SYMBOLS;
+  if (!encode_all(channel, encoder, payload, payload_bytes)) return ESP_ERR_INVALID_SIZE;
+
+  uint64_t ticks = 0;
+  for (size_t i = 0; i < channel->num_symbols; i++) {
+    ticks += channel->symbols[i].duration0 + channel->symbols[i].duration1;
+  }
+  int64_t frame_us = ticks * 1000000 / channel->resolution_hz;
+  // loop_count 0 sends once
+  int frames = config->loop_count > 0 ? config->loop_count : 1;
+
+  // queued behind what is still on air
+  int64_t now = esp_timer_get_time();
+  int64_t start = channel->busy_until > now ? channel->busy_until : now;
+  channel->busy_until = start + frames * frame_us;
+  stats.tx_frames += frames;
+
+  rmt_emu_tx_hook_t hook = tx_hook;
+  for (int i = 0; hook && i < frames; i++) {
+    hook(channel->gpio_num, channel->symbols, channel->num_symbols, start + i * frame_us);
+  }
+  return ESP_OK;
+}
+
+esp_err_t rmt_tx_wait_all_done(rmt_channel_handle_t channel, int timeout_ms) {
+  int64_t remaining_us = channel->busy_until - esp_timer_get_time();
+  if (remaining_us <= 0) return ESP_OK;
+  if (timeout_ms >= 0 && remaining_us > (int64_t) timeout_ms * 1000) {
+    vTaskDelay(pdMS_TO_TICKS(timeout_ms));
+    return ESP_ERR_TIMEOUT;
+  }
+  // whole ticks, rounded up so the frame is over when we return
+  TickType_t ticks = (remaining_us + portTICK_PERIOD_MS * 1000 - 1) / (portTICK_PERIOD_MS * 1000);
+  vTaskDelay(ticks);
+  return ESP_OK;
+}
+
+esp_err_t rmt_rx_register_event_callbacks(rmt_channel_handle_t channel, const rmt_rx_event_callbacks_t* cbs, void* user_data) {
+  if (channel->tx || channel->enabled) return ESP_ERR_INVALID_STATE;
+  channel->on_recv_done = cbs->on_recv_done;
+  channel->user_data = user_data;
+  return ESP_OK;
+}
+
+esp_err_t rmt_receive(rmt_channel_handle_t channel, void* buffer, size_t buffer_size, const rmt_receive_config_t* config) {
+  if (channel->tx || !channel->enabled) return ESP_ERR_INVALID_STATE;
+  portENTER_CRITICAL(&lock);
+  channel->rx_buffer = buffer;
+  channel->rx_buffer_symbols = buffer_size / sizeof(rmt_symbol_word_t);
+  channel->armed = true;
+  portEXIT_CRITICAL(&lock);
+  return ESP_OK;
+}
+
+esp_err_t rmt_emu_rx_inject(int gpio_num, const rmt_symbol_word_t* symbols, size_t num_symbols) {
+  rmt_channel_handle_t channel = NULL;
+  for (size_t i = 0; i < RMT_EMU_MAX_CHANNELS; i++) {
+    if (channels[i].used && !channels[i].tx && channels[i].gpio_num == gpio_num) channel = &channels[i];
+  }
+  if (channel == NULL) return ESP_ERR_NOT_FOUND;
+
+  portENTER_CRITICAL(&lock);
+  bool armed = channel->armed;
+  channel->armed = false;
+  if (armed) {
+    stats.rx_frames++;
+  } else {
+    stats.rx_not_armed++;
+  }
+  portEXIT_CRITICAL(&lock);
+  if (!armed) return ESP_ERR_INVALID_STATE;
+
+  // the driver stops at the end of the buffer too
+  if (num_symbols > channel->rx_buffer_symbols) num_symbols = channel->rx_buffer_symbols;
+  memcpy(channel->rx_buffer, symbols, num_symbols * sizeof(rmt_symbol_word_t));
+  rmt_rx_done_event_data_t edata = {
+    .received_symbols = channel->rx_buffer,
+    .num_symbols = num_symbols,
+  };
+  // may arm the channel again from within, as the ISR callback may
+  if (channel->on_recv_done) channel->on_recv_done(channel, &edata, channel->user_data);
+  return ESP_OK;
+}
+
+void rmt_emu_set_tx_hook(rmt_emu_tx_hook_t hook) {
+  tx_hook = hook;
+}
+
+void rmt_emu_get_stats(rmt_emu_stats_t* out) {
+  portENTER_CRITICAL(&lock);
+  *out = stats;
+  portEXIT_CRITICAL(&lock);
+}
@@ -0,0 +1,395 @@
+#include "bench.h"
+
+#ifdef CONFIG_RF_BRIDGE_BENCH
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include "esp_check.h"
+#include "esp_console.h"
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "event_queue.h"
+#include "mqtt.h"
+#include "mqtt_publish.h"
+#include "rf_light_encoder.h"
+#include "rf_light_rx.h"
+#include "sample_stats.h"
+
+#define TAG "bench"
+
+#define BENCH_DEFAULT_RUNS 64
+#define BENCH_MAX_RUNS 512
+// a frame is on air for about 50 ms
+#define BENCH_FRAME_TIMEOUT_MS 200
+#define BENCH_REPLY_TIMEOUT_MS 1000
+// frames of lookalike noise for the false positive rate
+#define BENCH_NOISE_FRAMES 2000
+// header and payload, the capture starts anywhere in this period
+#define BENCH_TRANSMISSION_SYMBOLS (RF_LIGHT_HEADER_SYMBOLS + RF_LIGHT_PAYLOAD_SYMBOLS)
+
+typedef enum {
+  VECTOR_CLEAN,
+  VECTOR_JITTER,
+  VECTOR_MID_HEADER,
+  VECTOR_NOISE,
+  VECTOR_LOOKALIKE,
+  VECTOR_MAX,
+} bench_vector_id_t;
+
+typedef struct {
+  const char* name;
+  // messages the decoder should find
+  size_t expected;
+  rmt_symbol_word_t symbols[SYMBOL_BUFFER_SIZE];
+} bench_vector_t;
+
+static radio_manager_t* bench_radios;
+static bench_vector_t vectors[VECTOR_MAX];
+// cycles, the turnaround keeps both directions
+static uint32_t samples[BENCH_MAX_RUNS];
+static uint32_t samples_back[BENCH_MAX_RUNS];
+
+static QueueHandle_t echo_requests;
+static QueueHandle_t echo_replies;
+
+static const char bench_topic[] = MQTT_PREFIX "bench";
+static TaskHandle_t publish_waiter;
+static volatile uint32_t publish_latency_us;
+static volatile bool publish_sent;
+
+// Deterministic -jitter..+jitter offset per symbol
+static inline int32_t jitter_us(size_t index, int32_t jitter) {
+  return ((int32_t) ((index * 7) % 5) - 2) * jitter / 2;
+}
+
+// Header and payload as transmitted, repeated, with the capture starting at symbol first of it
+static void build_transmission(bench_vector_t* vector, rf_light_message_t message, size_t first, int32_t jitter) {
+  for (size_t n = 0; n < SYMBOL_BUFFER_SIZE; n++) {
+    size_t position = (first + n) % BENCH_TRANSMISSION_SYMBOLS;
+    if (position < RF_LIGHT_HEADER_SYMBOLS) {
+      bool gap = position == RF_LIGHT_HEADER_SYMBOLS - 1;
+      vector->symbols[n] = rf_light_rx_symbol(RF_LIGHT_HEADER_DURATION_0 + jitter_us(n, jitter), (gap ? RF_LIGHT_HEADER_GAP_DURATION_1 : RF_LIGHT_HEADER_DURATION_1) + jitter_us(n + 1, jitter) / 2);
+      continue;
+    }
+    int bit = position - RF_LIGHT_HEADER_SYMBOLS;
+    bool one = message & (1 << bit);
+    uint32_t high = one ? RF_LIGHT_PAYLOAD_ONE_DURATION_0 : RF_LIGHT_PAYLOAD_ZERO_DURATION_0;
+    uint32_t low = one ? RF_LIGHT_PAYLOAD_ONE_DURATION_1 : RF_LIGHT_PAYLOAD_ZERO_DURATION_1;
+    // the trailing delay follows the last bit
+    if (bit == RF_LIGHT_PAYLOAD_SYMBOLS - 1) low += RF_LIGHT_TRAILING_DELAY_US;
+    vector->symbols[n] = rf_light_rx_symbol(high + jitter_us(n, jitter), low + jitter_us(n + 1, jitter));
+  }
+}
+
+static inline uint32_t next_random(uint32_t* seed) {
+  *seed = *seed * 1664525 + 1013904223;
+  return *seed >> 8;
+}
+
+// Payload symbols with random bits, like another remote with the same bit timing but no header
+static void build_lookalike(rmt_symbol_word_t* symbols, uint32_t* seed) {
+  for (size_t i = 0; i < SYMBOL_BUFFER_SIZE; i++) {
+    int32_t jitter = (int32_t) (next_random(seed) % 121) - 60;
+    if (next_random(seed) % 24 == 0) {
+      // broken up now and then
+      symbols[i] = rf_light_rx_symbol(40 + next_random(seed) % 1200, 40 + next_random(seed) % 6000);
+    } else if (next_random(seed) & 1) {
+      symbols[i] = rf_light_rx_symbol(RF_LIGHT_PAYLOAD_ONE_DURATION_0 + jitter, RF_LIGHT_PAYLOAD_ONE_DURATION_1 + jitter);
+    } else {
+      symbols[i] = rf_light_rx_symbol(RF_LIGHT_PAYLOAD_ZERO_DURATION_0 + jitter, RF_LIGHT_PAYLOAD_ZERO_DURATION_1 + jitter);
+    }
+  }
+}
+
+static void build_vectors(void) {
+  rf_light_payload_t on = { .channel = 'a', .on = true };
+  rf_light_payload_t off = { .channel = 'a', .on = false };
+
+  vectors[VECTOR_CLEAN].name = "clean";
+  vectors[VECTOR_CLEAN].expected = 1;
+  build_transmission(&vectors[VECTOR_CLEAN], encode_rf_light_payload(&on), 0, 0);
+
+  // about what a marginal reception looks like
+  vectors[VECTOR_JITTER].name = "jitter";
+  vectors[VECTOR_JITTER].expected = 1;
+  build_transmission(&vectors[VECTOR_JITTER], encode_rf_light_payload(&on), 0, 120);
+
+  // capture started mid transmission
+  vectors[VECTOR_MID_HEADER].name = "mid-header";
+  vectors[VECTOR_MID_HEADER].expected = 1;
+  build_transmission(&vectors[VECTOR_MID_HEADER], encode_rf_light_payload(&off), 20, 60);
+
+  vectors[VECTOR_NOISE].name = "noise";
+  vectors[VECTOR_NOISE].expected = 0;
+  uint32_t seed = 0x2545F491;
+  for (size_t i = 0; i < SYMBOL_BUFFER_SIZE; i++) {
+    seed = seed * 1664525 + 1013904223;
+    vectors[VECTOR_NOISE].symbols[i] = rf_light_rx_symbol(40 + (seed >> 16) % 1200, 40 + (seed >> 4) % 1200);
+  }
+
+  vectors[VECTOR_LOOKALIKE].name = "lookalike";
+  vectors[VECTOR_LOOKALIKE].expected = 0;
+  build_lookalike(vectors[VECTOR_LOOKALIKE].symbols, &seed);
+}
+
+// Sorts the samples, returns the median
+static uint32_t report(const char* name, uint32_t* cycles, size_t runs) {
+  sample_stats_sort(cycles, runs);
+  uint32_t mhz = esp_rom_get_cpu_ticks_per_us();
+  uint32_t median = cycles[runs / 2];
+  printf("%-18s %4zu runs | cycles min %8" PRIu32 " med %8" PRIu32 " max %8" PRIu32 " | us min %9.2f med %9.2f max %9.2f\n",
+         name, runs, cycles[0], median, cycles[runs - 1],
+         (double) cycles[0] / mhz, (double) median / mhz, (double) cycles[runs - 1] / mhz);
+  return median;
+}
+
+// First radio that transmits
+static radio_t* tx_radio(void) {
+  for (size_t i = 0; i < bench_radios->num_radios; i++) {
+    if (bench_radios->radios[i].config.role != RADIO_ROLE_RX) return &bench_radios->radios[i];
+  }
+  return NULL;
+}
+
+// Back to the state the radio rests in between TX windows
+static esp_err_t restore_radio(radio_t* radio) {
+  return radio->config.role == RADIO_ROLE_TX ? cc1101_stop(radio->cc1101) : cc1101_start_rx(radio->cc1101);
+}
+
+typedef size_t (*bench_decoder_t)(const rmt_symbol_word_t* symbols, size_t num_symbols, rf_light_message_t* messages, size_t max_messages);
+
+static esp_err_t bench_decode(size_t runs) {
+  static const struct {
+    const char* name;
+    bench_decoder_t decode;
+  } decoders[] = {
+    { "decode", rf_light_rx_decode_frame },
+    // before the header sync, for comparison
+    { "unsynced", rf_light_rx_decode_frame_unsynced },
+  };
+  rf_light_message_t messages[SYMBOL_BUFFER_SIZE / 16];
+  uint32_t mhz = esp_rom_get_cpu_ticks_per_us();
+
+  for (int d = 0; d < sizeof(decoders) / sizeof(decoders[0]); d++) {
+    for (int v = 0; v < VECTOR_MAX; v++) {
+      const bench_vector_t* vector = &vectors[v];
+      size_t decoded = 0;
+      for (size_t i = 0; i < runs; i++) {
+        uint32_t start = esp_cpu_get_cycle_count();
+        decoded = decoders[d].decode(vector->symbols, SYMBOL_BUFFER_SIZE, messages, SYMBOL_BUFFER_SIZE / 16);
+        samples[i] = esp_cpu_get_cycle_count() - start;
+      }
+
+      char name[24];
+      snprintf(name, sizeof(name), "%s %s", decoders[d].name, vector->name);
+      uint32_t median = report(name, samples, runs);
+      printf("%18s %zu symbols, %.2f Msymbols/s, %.1f cycles/symbol, %zu messages%s\n", "", (size_t) SYMBOL_BUFFER_SIZE,
+             (double) SYMBOL_BUFFER_SIZE * mhz / (median ? median : 1), (double) median / SYMBOL_BUFFER_SIZE, decoded,
+             decoded == vector->expected ? "" : " (unexpected)");
+    }
+
+    // every message out of lookalike noise is a false positive
+    rmt_symbol_word_t noise[SYMBOL_BUFFER_SIZE];
+    uint32_t seed = 1;
+    size_t false_positives = 0;
+    for (size_t f = 0; f < BENCH_NOISE_FRAMES; f++) {
+      build_lookalike(noise, &seed);
+      false_positives += decoders[d].decode(noise, SYMBOL_BUFFER_SIZE, messages, SYMBOL_BUFFER_SIZE / 16);
+    }
+    printf("%-18s %zu false positives in %d lookalike symbols, %.1f per million\n", decoders[d].name, false_positives,
+           BENCH_NOISE_FRAMES * SYMBOL_BUFFER_SIZE, false_positives * 1e6 / (BENCH_NOISE_FRAMES * SYMBOL_BUFFER_SIZE));
+  }
+  return ESP_OK;
+}
+
+// Real frames through the RMT encoder with the radio in IDLE, so nothing is radiated
+static esp_err_t bench_encode(size_t runs) {
+  radio_t* radio = tx_radio();
+  ESP_RETURN_ON_FALSE(radio, ESP_ERR_NOT_FOUND, TAG, "No transmitting radio");
+  rf_light_payload_t payload = { .channel = 'a', .on = true };
+  rf_light_message_t message = encode_rf_light_payload(&payload);
+  esp_err_t ret = ESP_OK;
+
+  xSemaphoreTake(radio->lock, portMAX_DELAY);
+  ESP_GOTO_ON_ERROR(cc1101_stop(radio->cc1101), out, TAG, "Failed to idle the radio");
+  rf_light_encoder_set_probe(samples, runs);
+  ESP_GOTO_ON_ERROR(rf_light_tx_enable(&radio->tx), out, TAG, "Failed to enable TX channel");
+  for (size_t i = 0; i < runs && ret == ESP_OK; i++) {
+    ret = rf_light_tx_send_frames(&radio->tx, message, 1);
+    if (ret == ESP_OK) ret = rf_light_tx_wait_done(&radio->tx, BENCH_FRAME_TIMEOUT_MS);
+  }
+  rf_light_tx_disable(&radio->tx);
+out:
+  rf_light_encoder_set_probe(NULL, 0);
+  if (restore_radio(radio) != ESP_OK) ESP_LOGE(TAG, "Failed to restore radio state");
+  xSemaphoreGive(radio->lock);
+  ESP_RETURN_ON_ERROR(ret, TAG, "Failed to send frames");
+
+  size_t count = rf_light_encoder_probe_count();
+  ESP_RETURN_ON_FALSE(count > 0, ESP_ERR_INVALID_STATE, TAG, "No frames were encoded");
+  report("encode frame", samples, count);
+  return ESP_OK;
+}
+
+// The TX channel is enabled so the data line idles low and the transmitter stays keyed off
+static esp_err_t bench_turnaround(size_t runs) {
+  radio_t* radio = tx_radio();
+  ESP_RETURN_ON_FALSE(radio, ESP_ERR_NOT_FOUND, TAG, "No transmitting radio");
+  esp_err_t ret = ESP_OK;
+
+  xSemaphoreTake(radio->lock, portMAX_DELAY);
+  ESP_GOTO_ON_ERROR(rf_light_tx_enable(&radio->tx), out, TAG, "Failed to enable TX channel");
+  ESP_GOTO_ON_ERROR(cc1101_start_rx(radio->cc1101), disable, TAG, "Failed to start RX");
+  for (size_t i = 0; i < runs; i++) {
+    uint32_t start = esp_cpu_get_cycle_count();
+    ESP_GOTO_ON_ERROR(cc1101_start_tx(radio->cc1101), disable, TAG, "Failed to start TX");
+    uint32_t in_tx = esp_cpu_get_cycle_count();
+    ESP_GOTO_ON_ERROR(cc1101_start_rx(radio->cc1101), disable, TAG, "Failed to start RX");
+    samples[i] = in_tx - start;
+    samples_back[i] = esp_cpu_get_cycle_count() - in_tx;
+  }
+disable:
+  rf_light_tx_disable(&radio->tx);
+out:
+  if (restore_radio(radio) != ESP_OK) ESP_LOGE(TAG, "Failed to restore radio state");
+  xSemaphoreGive(radio->lock);
+  ESP_RETURN_ON_ERROR(ret, TAG, "Turnaround failed");
+
+  report("rx -> tx", samples, runs);
+  report("tx -> rx", samples_back, runs);
+  return ESP_OK;
+}
+
+// Hands every event straight back, standing in for the dispatch loop
+static void echo_task(void* arg) {
+  event_queue_message_t* message;
+  while (1) {
+    if (xQueueReceive(echo_requests, &message, portMAX_DELAY)) xQueueSend(echo_replies, &message, portMAX_DELAY);
+  }
+}
+
+// Claim, queue, consumer wakes up, back again and release
+static esp_err_t bench_queue(size_t runs) {
+  if (echo_requests == NULL) {
+    echo_requests = event_queue_create();
+    echo_replies = event_queue_create();
+    ESP_RETURN_ON_FALSE(echo_requests && echo_replies, ESP_ERR_NO_MEM, TAG, "Failed to create echo queues");
+    // same priority as us, so every hop is a context switch like on the real path
+    ESP_RETURN_ON_FALSE(xTaskCreate(echo_task, "bench_echo", 2048, NULL, uxTaskPriorityGet(NULL), NULL) == pdPASS,
+                        ESP_ERR_NO_MEM, TAG, "Failed to create echo task");
+  }
+
+  for (size_t i = 0; i < runs; i++) {
+    uint32_t start = esp_cpu_get_cycle_count();
+    event_queue_message_t* message = event_queue_claim(EVENT_QUEUE_MESSAGE_RF_LIGHT);
+    ESP_RETURN_ON_FALSE(message, ESP_ERR_NO_MEM, TAG, "Event pool exhausted");
+    ESP_RETURN_ON_ERROR(event_queue_send(echo_requests, message), TAG, "Failed to queue event");
+    ESP_RETURN_ON_FALSE(xQueueReceive(echo_replies, &message, pdMS_TO_TICKS(BENCH_REPLY_TIMEOUT_MS)), ESP_ERR_TIMEOUT, TAG, "No reply");
+    event_queue_release(message);
+    samples[i] = esp_cpu_get_cycle_count() - start;
+  }
+  report("queue round trip", samples, runs);
+  return ESP_OK;
+}
+
+static void publish_probe(const char* topic, uint32_t latency_us, bool published) {
+  // the publisher hands out its own copy of the topic
+  if (strcmp(topic, bench_topic) != 0) return;
+  publish_latency_us = latency_us;
+  publish_sent = published;
+  xTaskNotifyGive(publish_waiter);
+}
+
+// Enqueue to socket write on the publisher task, one message at a time
+static esp_err_t bench_publish(size_t runs) {
+  uint32_t mhz = esp_rom_get_cpu_ticks_per_us();
+  esp_err_t ret = ESP_OK;
+
+  publish_waiter = xTaskGetCurrentTaskHandle();
+  ulTaskNotifyTake(pdTRUE, 0);
+  mqtt_publish_set_probe(publish_probe);
+  for (size_t i = 0; i < runs; i++) {
+    char payload[12];
+    snprintf(payload, sizeof(payload), "%zu", i);
+    ESP_GOTO_ON_ERROR(mqtt_publish_enqueue(bench_topic, payload, 0, 0, false), out, TAG, "Failed to enqueue");
+    ESP_GOTO_ON_FALSE(ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(BENCH_REPLY_TIMEOUT_MS)), ESP_ERR_TIMEOUT, out, TAG, "Publisher did not respond");
+    ESP_GOTO_ON_FALSE(publish_sent, ESP_ERR_INVALID_STATE, out, TAG, "MQTT is not connected");
+    samples[i] = publish_latency_us * mhz;
+  }
+out:
+  mqtt_publish_set_probe(NULL);
+  ESP_RETURN_ON_ERROR(ret, TAG, "Publish benchmark failed");
+  report("mqtt publish", samples, runs);
+  return ESP_OK;
+}
+
+typedef struct {
+  const char* name;
+  esp_err_t (*run)(size_t runs);
+} bench_t;
+
+static const bench_t benches[] = {
+  { "decode", bench_decode },
+  { "encode", bench_encode },
+  { "turnaround", bench_turnaround },
+  { "queue", bench_queue },
+  { "mqtt", bench_publish },
+};
+
+static int bench_command(int argc, char** argv) {
+  if (argc < 2) {
+    printf("usage: bench <decode|encode|turnaround|queue|mqtt|all> [runs]\n");
+    return 1;
+  }
+  size_t runs = argc > 2 ? strtoul(argv[2], NULL, 10) : BENCH_DEFAULT_RUNS;
+  if (runs < 1) runs = 1;
+  if (runs > BENCH_MAX_RUNS) runs = BENCH_MAX_RUNS;
+
+  bool all = strcmp(argv[1], "all") == 0;
+  bool found = false;
+  int failed = 0;
+  for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+    if (!all && strcmp(argv[1], benches[i].name) != 0) continue;
+    found = true;
+    if (benches[i].run(runs) != ESP_OK) failed++;
+  }
+  if (!found) {
+    printf("unknown benchmark %s\n", argv[1]);
+    return 1;
+  }
+  return failed ? 1 : 0;
+}
+
+esp_err_t bench_start(radio_manager_t* radios) {
+  bench_radios = radios;
+  build_vectors();
+
+  esp_console_repl_t* repl = NULL;
+  esp_console_repl_config_t repl_config = ESP_CONSOLE_REPL_CONFIG_DEFAULT();
+  repl_config.prompt = "rf-bridge>";
+#ifdef CONFIG_ESP_CONSOLE_USB_CDC
+  esp_console_dev_usb_cdc_config_t cdc_config = ESP_CONSOLE_DEV_CDC_CONFIG_DEFAULT();
+  ESP_RETURN_ON_ERROR(esp_console_new_repl_usb_cdc(&cdc_config, &repl_config, &repl), TAG, "Failed to create USB-CDC console");
+#else
+  esp_console_dev_uart_config_t uart_config = ESP_CONSOLE_DEV_UART_CONFIG_DEFAULT();
+  ESP_RETURN_ON_ERROR(esp_console_new_repl_uart(&uart_config, &repl_config, &repl), TAG, "Failed to create UART console");
+#endif
+
+  ESP_RETURN_ON_ERROR(esp_console_register_help_command(), TAG, "Failed to register help");
+  const esp_console_cmd_t command = {
+    .command = "bench",
+    .help = "Run built-in benchmarks, reported in CPU cycles and us as min/median/max",
+    .hint = "<decode|encode|turnaround|queue|mqtt|all> [runs]",
+    .func = bench_command,
+  };
+  ESP_RETURN_ON_ERROR(esp_console_cmd_register(&command), TAG, "Failed to register bench command");
+  return esp_console_start_repl(repl);
+}
+
+#endif
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "radio_manager.h"
+
+#ifdef CONFIG_RF_BRIDGE_BENCH
+
+/**
+ * @brief Start the console REPL with the "bench" command
+ *
+ * The benchmarks run on the console task, against the live radios, event pool and MQTT client.
+ */
+esp_err_t bench_start(radio_manager_t* radios);
+
+#else
+
+static inline esp_err_t bench_start(radio_manager_t* radios) { return ESP_OK; }
+
+#endif
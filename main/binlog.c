@@ -0,0 +1,182 @@
+#include "binlog.h"
+
+#ifdef CONFIG_RF_BRIDGE_BINARY_LOG
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "esp_attr.h"
+#include "esp_check.h"
+#include "esp_cpu.h"
+#include "esp_timer.h"
+
+#define TAG "binlog"
+
+#define DRAIN_INTERVAL_MS 50
+
+typedef struct {
+  // ring position this slot is ready for, see binlog_write
+  atomic_uint seq;
+  uint32_t format;
+  uint32_t tag;
+  // esp_timer is 64 bits, the low half alone wraps after about 71 minutes
+  int64_t timestamp_us;
+  uint8_t level;
+  uint8_t nargs;
+  uint32_t args[BINLOG_MAX_ARGS];
+} binlog_record_t;
+
+static binlog_record_t ring[BINLOG_RING_SIZE];
+static atomic_uint write_pos;
+// only the drain task reads
+static uint32_t read_pos;
+
+static atomic_uint written;
+static atomic_uint dropped;
+// best effort, a racing writer may lose an update
+static uint32_t write_cycles_max;
+static uint64_t write_cycles_total;
+
+// Bounded multi-producer queue: a producer claims a position by advancing write_pos, and
+// publishes the slot by setting its seq to position + 1. The consumer hands it back by
+// setting seq to position + BINLOG_RING_SIZE. No producer ever waits on another one.
+void IRAM_ATTR binlog_write(esp_log_level_t level, const char* tag, const char* format, uint32_t nargs, const uint32_t* args) {
+  uint32_t start = esp_cpu_get_cycle_count();
+  unsigned pos = atomic_load_explicit(&write_pos, memory_order_relaxed);
+  binlog_record_t* record;
+
+  while (1) {
+    record = &ring[pos & (BINLOG_RING_SIZE - 1)];
+    int diff = (int) (atomic_load_explicit(&record->seq, memory_order_acquire) - pos);
+    if (diff == 0) {
+      if (atomic_compare_exchange_weak_explicit(&write_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) break;
+    } else if (diff < 0) {
+      // the drain task is a full ring behind
+      atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+      return;
+    } else {
+      pos = atomic_load_explicit(&write_pos, memory_order_relaxed);
+    }
+  }
+
+  record->format = (uint32_t) (uintptr_t) format;
+  record->tag = (uint32_t) (uintptr_t) tag;
+  record->timestamp_us = esp_timer_get_time();
+  record->level = level;
+  record->nargs = nargs;
+  memcpy(record->args, args, nargs * sizeof(uint32_t));
+  atomic_store_explicit(&record->seq, pos + 1, memory_order_release);
+
+  atomic_fetch_add_explicit(&written, 1, memory_order_relaxed);
+  uint32_t cycles = esp_cpu_get_cycle_count() - start;
+  write_cycles_total += cycles;
+  if (cycles > write_cycles_max) write_cycles_max = cycles;
+}
+
+static inline char* put_hex(char* out, const void* data, size_t len) {
+  static const char digits[] = "0123456789abcdef";
+  const uint8_t* bytes = data;
+  for (size_t i = 0; i < len; i++) {
+    *out++ = digits[bytes[i] >> 4];
+    *out++ = digits[bytes[i] & 0xF];
+  }
+  return out;
+}
+
+// One line per record: format, tag, timestamp, level, nargs and the arguments, little endian
+static void print_record(const binlog_record_t* record) {
+  char line[4 + 2 * (18 + 4 * BINLOG_MAX_ARGS) + 2];
+  char* out = line;
+  memcpy(out, "#BL ", 4);
+  out += 4;
+  out = put_hex(out, &record->format, 4);
+  out = put_hex(out, &record->tag, 4);
+  out = put_hex(out, &record->timestamp_us, 8);
+  out = put_hex(out, &record->level, 1);
+  out = put_hex(out, &record->nargs, 1);
+  out = put_hex(out, record->args, record->nargs * sizeof(uint32_t));
+  *out++ = '\n';
+  fwrite(line, 1, out - line, stdout);
+}
+
+static void binlog_task(void* arg) {
+  uint32_t reported_dropped = 0;
+
+  while (1) {
+    while (1) {
+      binlog_record_t* record = &ring[read_pos & (BINLOG_RING_SIZE - 1)];
+      if (atomic_load_explicit(&record->seq, memory_order_acquire) != read_pos + 1) break;
+      binlog_record_t copy = *record;
+      atomic_store_explicit(&record->seq, read_pos + BINLOG_RING_SIZE, memory_order_release);
+      read_pos++;
+      print_record(&copy);
+    }
+    fflush(stdout);
+
+    uint32_t now_dropped = atomic_load_explicit(&dropped, memory_order_relaxed);
+    if (now_dropped != reported_dropped) {
+      ESP_LOGW(TAG, "%" PRIu32 " records dropped, ring full", now_dropped - reported_dropped);
+      reported_dropped = now_dropped;
+    }
+    // polled so writers never have to notify anyone
+    vTaskDelay(pdMS_TO_TICKS(DRAIN_INTERVAL_MS));
+  }
+}
+
+#ifdef CONFIG_RF_BRIDGE_PROFILING
+// Time the dispatch loop's per message log line both ways, on this console
+static void benchmark(void) {
+  const int runs = 8;
+  int64_t start = esp_timer_get_time();
+  for (int i = 0; i < runs; i++) {
+    ESP_LOGI(TAG, "Received RF light message | Radio: %d | Channel: %c | On: %d", 0, 'a', i & 1);
+  }
+  int64_t direct_us = esp_timer_get_time() - start;
+
+  start = esp_timer_get_time();
+  for (int i = 0; i < runs; i++) {
+    BINLOGI(TAG, "Received RF light message | Radio: %d | Channel: %c | On: %d", 0, 'a', i & 1);
+  }
+  int64_t deferred_us = esp_timer_get_time() - start;
+
+  ESP_LOGI(TAG, "Per message log line: ESP_LOGI %" PRId64 " us, binlog %" PRId64 " us", direct_us / runs, deferred_us / runs);
+}
+#endif
+
+esp_err_t binlog_start(void) {
+  for (unsigned i = 0; i < BINLOG_RING_SIZE; i++) {
+    atomic_init(&ring[i].seq, i);
+  }
+  // just above idle, printing is never more important than anything else
+  ESP_RETURN_ON_FALSE(xTaskCreate(binlog_task, "binlog", 3072, NULL, 1, NULL) == pdPASS, ESP_ERR_NO_MEM, TAG, "Failed to create binlog task");
+#ifdef CONFIG_RF_BRIDGE_PROFILING
+  benchmark();
+#endif
+  return ESP_OK;
+}
+
+void binlog_get_stats(binlog_stats_t* stats) {
+  stats->written = atomic_load(&written);
+  stats->dropped = atomic_load(&dropped);
+  stats->write_cycles_max = write_cycles_max;
+  stats->write_cycles_total = write_cycles_total;
+}
+
+#else
+
+void binlog_write(esp_log_level_t level, const char* tag, const char* format, uint32_t nargs, const uint32_t* args) {
+}
+
+esp_err_t binlog_start(void) {
+  return ESP_OK;
+}
+
+void binlog_get_stats(binlog_stats_t* stats) {
+  *stats = (binlog_stats_t) {0};
+}
+
+#endif
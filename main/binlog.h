@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_log.h"
+
+// Deferred binary logging for the RX/TX hot paths.
+//
+// A record is the address of the format string and tag plus the raw 32 bit arguments, written
+// into a lock-free ring. A low priority task prints each record as one "#BL" hex line, and
+// tools/binlog_decode.py turns them back into text using the strings in the firmware ELF.
+// Only integer and pointer arguments are supported; %s arguments must be static strings
+// wrapped in BINLOG_STR. Without CONFIG_RF_BRIDGE_BINARY_LOG these are plain ESP_LOGx calls.
+
+#define BINLOG_MAX_ARGS 6
+// power of two
+#define BINLOG_RING_SIZE 64
+
+typedef struct {
+  uint32_t written;
+  // records lost because the ring was full
+  uint32_t dropped;
+  // cost of binlog_write, to compare with the ESP_LOGx call it replaces
+  uint32_t write_cycles_max;
+  uint64_t write_cycles_total;
+} binlog_stats_t;
+
+#ifdef CONFIG_RF_BRIDGE_BINARY_LOG
+
+#define BINLOG_STR(s) ((uint32_t) (uintptr_t) (s))
+
+#define BINLOG_NARGS(...) BINLOG_NARGS_(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define BINLOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, N, ...) N
+
+#define BINLOG(level, tag, format, ...) do {                                                  \
+    _Static_assert(BINLOG_NARGS(__VA_ARGS__) <= BINLOG_MAX_ARGS, "too many binlog arguments"); \
+    if (LOG_LOCAL_LEVEL >= (level)) {                                                        \
+      binlog_write((level), (tag), (format), BINLOG_NARGS(__VA_ARGS__),                      \
+                   (const uint32_t[BINLOG_MAX_ARGS]) { __VA_ARGS__ });                       \
+    }                                                                                         \
+  } while (0)
+
+#define BINLOGI(tag, format, ...) BINLOG(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define BINLOGW(tag, format, ...) BINLOG(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+
+#else
+
+#define BINLOG_STR(s) (s)
+#define BINLOGI(tag, format, ...) ESP_LOGI(tag, format, ##__VA_ARGS__)
+#define BINLOGW(tag, format, ...) ESP_LOGW(tag, format, ##__VA_ARGS__)
+
+#endif
+
+/**
+ * @brief Record a log line without formatting it, safe from tasks and ISRs
+ *
+ * Never blocks, the record is dropped and counted if the ring is full.
+ */
+void binlog_write(esp_log_level_t level, const char* tag, const char* format, uint32_t nargs, const uint32_t* args);
+
+// Start the task that prints the records
+esp_err_t binlog_start(void);
+void binlog_get_stats(binlog_stats_t* stats);
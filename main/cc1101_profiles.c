@@ -0,0 +1,185 @@
+#include "cc1101_profiles.h"
+
+#include <string.h>
+#include <strings.h>
+#include <inttypes.h>
+#include "cc1101_spi.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define TAG "CC1101 Profiles"
+
+// MCSM0 FS_AUTOCAL field
+#define MCSM0_FS_AUTOCAL_MASK 0x30
+
+// Base register settings for CC1101 (315 MHz, AM650 modulation)
+// Exported from TI Smart RF
+static const uint8_t registers[CC1101_SPI_NUM_CONFIG_REGS] = {
+  0x0D,  // IOCFG2        GDO2 Output Pin Configuration
+  0x2E,  // IOCFG1        GDO1 Output Pin Configuration
+  0x0D,  // IOCFG0        GDO0 Output Pin Configuration
+  0x07,  // FIFOTHR       RX FIFO and TX FIFO Thresholds
+  0xD3,  // SYNC1         Sync Word, High Byte
+  0x91,  // SYNC0         Sync Word, Low Byte
+  0xFF,  // PKTLEN        Packet Length
+  0x04,  // PKTCTRL1      Packet Automation Control
+  0x32,  // PKTCTRL0      Packet Automation Control
+  0x00,  // ADDR          Device Address
+  0x00,  // CHANNR        Channel Number
+  0x06,  // FSCTRL1       Frequency Synthesizer Control
+  0x00,  // FSCTRL0       Frequency Synthesizer Control
+  0x0C,  // FREQ2         Frequency Control Word, High Byte
+  0x1D,  // FREQ1         Frequency Control Word, Middle Byte
+  0x89,  // FREQ0         Frequency Control Word, Low Byte
+  0x17,  // MDMCFG4       Modem Configuration
+  0x32,  // MDMCFG3       Modem Configuration
+  0x30,  // MDMCFG2       Modem Configuration
+  0x00,  // MDMCFG1       Modem Configuration
+  0x00,  // MDMCFG0       Modem Configuration
+  0x15,  // DEVIATN       Modem Deviation Setting
+  0x07,  // MCSM2         Main Radio Control State Machine Configuration
+  0x30,  // MCSM1         Main Radio Control State Machine Configuration
+  0x18,  // MCSM0         Main Radio Control State Machine Configuration
+  0x18,  // FOCCFG        Frequency Offset Compensation Configuration
+  0x6C,  // BSCFG         Bit Synchronization Configuration
+  0x07,  // AGCCTRL2      AGC Control
+  0x00,  // AGCCTRL1      AGC Control
+  0x91,  // AGCCTRL0      AGC Control
+  0x87,  // WOREVT1       High Byte Event0 Timeout
+  0x6B,  // WOREVT0       Low Byte Event0 Timeout
+  0xFB,  // WORCTRL       Wake On Radio Control
+  0x56,  // FREND1        Front End RX Configuration
+  0x11,  // FREND0        Front End TX Configuration
+  0xE9,  // FSCAL3        Frequency Synthesizer Calibration
+  0x2A,  // FSCAL2        Frequency Synthesizer Calibration
+  0x00,  // FSCAL1        Frequency Synthesizer Calibration
+  0x1F,  // FSCAL0        Frequency Synthesizer Calibration
+  0x41,  // RCCTRL1       RC Oscillator Configuration
+  0x00,  // RCCTRL0       RC Oscillator Configuration
+  0x59,  // FSTEST        Frequency Synthesizer Calibration Control
+  0x7F,  // PTEST         Production Test
+  0x3F,  // AGCTEST       AGC Test
+  0x88,  // TEST2         Various Test Settings
+  0x31,  // TEST1         Various Test Settings
+  0x0B,  // TEST0         Various Test Settings
+};
+
+// 433.92 MHz, AM650 modulation
+static const cc1101_reg_diff_t diff_433_am650[] = {
+  { CC1101_SPI_FREQ2, 0x10 },
+  { CC1101_SPI_FREQ1, 0xB0 },
+  { CC1101_SPI_FREQ0, 0x71 },
+  // VCO_SEL_CAL_EN off above 348 MHz
+  { CC1101_SPI_TEST0, 0x09 },
+};
+
+static const cc1101_profile_t profiles[CC1101_PROFILE_MAX] = {
+  [CC1101_PROFILE_315_AM650] = {
+    .name = "315_am650",
+    .diff = NULL,
+    .diff_len = 0,
+    .patable = {0x00, 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
+  },
+  [CC1101_PROFILE_433_AM650] = {
+    .name = "433_am650",
+    .diff = diff_433_am650,
+    .diff_len = sizeof(diff_433_am650) / sizeof(cc1101_reg_diff_t),
+    .patable = {0x00, 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},
+  },
+};
+
+// FSCAL3..FSCAL1 from the last calibration on each profile.
+// These drift with temperature, but the bridge sits indoors.
+typedef struct {
+  bool valid;
+  uint8_t fscal[3];
+} cc1101_profile_calibration_t;
+
+// Every chip has its own synthesizer, so profile and calibrations are tracked per device
+typedef struct {
+  cc1101_device_t* cc;
+  cc1101_profile_id_t current;
+  cc1101_profile_calibration_t calibrations[CC1101_PROFILE_MAX];
+} cc1101_profile_state_t;
+
+static cc1101_profile_state_t states[CC1101_PROFILE_MAX_RADIOS];
+
+// Find the state of a device, claiming a free one the first time it is seen
+static cc1101_profile_state_t* state_for(cc1101_device_t* cc) {
+  cc1101_profile_state_t* free_state = NULL;
+  for (size_t i = 0; i < CC1101_PROFILE_MAX_RADIOS; i++) {
+    if (states[i].cc == cc) return &states[i];
+    if (states[i].cc == NULL && free_state == NULL) free_state = &states[i];
+  }
+  if (free_state) {
+    free_state->cc = cc;
+    free_state->current = CC1101_PROFILE_MAX;
+  }
+  return free_state;
+}
+
+esp_err_t cc1101_profile_apply(cc1101_device_t* cc, cc1101_profile_id_t id) {
+  ESP_RETURN_ON_FALSE(id < CC1101_PROFILE_MAX, ESP_ERR_INVALID_ARG, TAG, "Invalid profile %d", id);
+  const cc1101_profile_t* profile = &profiles[id];
+  cc1101_profile_state_t* state = state_for(cc);
+  ESP_RETURN_ON_FALSE(state, ESP_ERR_NO_MEM, TAG, "Too many radios");
+  cc1101_profile_calibration_t* cal = &state->calibrations[id];
+  int64_t start = esp_timer_get_time();
+
+  // build the full register image so it goes out in one burst
+  uint8_t image[CC1101_SPI_NUM_CONFIG_REGS];
+  memcpy(image, registers, sizeof(image));
+  for (uint8_t i = 0; i < profile->diff_len; i++) {
+    image[profile->diff[i].addr] = profile->diff[i].value;
+  }
+  if (cal->valid) {
+    memcpy(&image[CC1101_SPI_FSCAL3], cal->fscal, sizeof(cal->fscal));
+    image[CC1101_SPI_MCSM0] &= ~MCSM0_FS_AUTOCAL_MASK;
+  }
+
+  // registers can only be changed safely in IDLE
+  cc1101_spi_seq_t seq;
+  cc1101_spi_seq_init(&seq, "apply_profile");
+  cc1101_spi_seq_strobe(&seq, CC1101_SPI_SIDLE);
+  cc1101_spi_seq_write(&seq, 0x00, image, sizeof(image));
+  cc1101_spi_seq_write(&seq, CC1101_SPI_PATABLE, profile->patable, sizeof(profile->patable));
+  ESP_RETURN_ON_ERROR(cc1101_spi_seq_run(cc, &seq), TAG, "Failed to write profile to CC1101");
+  state->current = id;
+
+  ESP_LOGI(TAG, "Applied profile %s in %" PRId64 " us (%s)", profile->name, esp_timer_get_time() - start,
+           cal->valid ? "cached calibration" : "needs calibration");
+  return ESP_OK;
+}
+
+esp_err_t cc1101_profile_save_calibration(cc1101_device_t* cc) {
+  cc1101_profile_state_t* state = state_for(cc);
+  if (state == NULL || state->current >= CC1101_PROFILE_MAX || state->calibrations[state->current].valid) return ESP_OK;
+
+  cc1101_profile_calibration_t* cal = &state->calibrations[state->current];
+  ESP_RETURN_ON_ERROR(cc1101_spi_read(cc, CC1101_SPI_FSCAL3, cal->fscal, sizeof(cal->fscal)), TAG, "Failed to read calibration");
+  cal->valid = true;
+  ESP_LOGI(TAG, "Cached calibration for %s: %02X %02X %02X", profiles[state->current].name, cal->fscal[0], cal->fscal[1], cal->fscal[2]);
+  return ESP_OK;
+}
+
+int cc1101_profile_find(const char* name, size_t len) {
+  for (int i = 0; i < CC1101_PROFILE_MAX; i++) {
+    if (strlen(profiles[i].name) == len && strncasecmp(profiles[i].name, name, len) == 0) return i;
+  }
+  return -1;
+}
+
+const char* cc1101_profile_name(cc1101_profile_id_t id) {
+  return id < CC1101_PROFILE_MAX ? profiles[id].name : "none";
+}
+
+bool cc1101_profile_calibrated(cc1101_device_t* cc) {
+  cc1101_profile_state_t* state = state_for(cc);
+  return state && state->current < CC1101_PROFILE_MAX && state->calibrations[state->current].valid;
+}
+
+cc1101_profile_id_t cc1101_profile_current(cc1101_device_t* cc) {
+  cc1101_profile_state_t* state = state_for(cc);
+  return state ? state->current : CC1101_PROFILE_MAX;
+}
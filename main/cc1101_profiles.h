@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "cc1101.h"
+#include "esp_err.h"
+
+// radios on the bus that can each have their own profile and calibrations
+#define CC1101_PROFILE_MAX_RADIOS 4
+
+typedef enum {
+  CC1101_PROFILE_315_AM650,
+  CC1101_PROFILE_433_AM650,
+  CC1101_PROFILE_MAX,
+} cc1101_profile_id_t;
+
+// A single register that differs from the base configuration
+typedef struct {
+  uint8_t addr;
+  uint8_t value;
+} cc1101_reg_diff_t;
+
+typedef struct {
+  const char* name;
+  const cc1101_reg_diff_t* diff;
+  uint8_t diff_len;
+  uint8_t patable[8];
+} cc1101_profile_t;
+
+/**
+ * @brief Put the radio in IDLE and load a profile with a single register burst
+ *
+ * If the profile has been calibrated before, the cached frequency synthesizer
+ * calibration is loaded with it and auto calibration is turned off, so the next
+ * RX/TX transition skips calibration.
+ */
+esp_err_t cc1101_profile_apply(cc1101_device_t* cc, cc1101_profile_id_t id);
+
+/**
+ * @brief Cache the calibration of the current profile. Call once the radio is in RX or TX.
+ */
+esp_err_t cc1101_profile_save_calibration(cc1101_device_t* cc);
+
+// Whether the current profile has a cached calibration, so there is nothing left to save
+bool cc1101_profile_calibrated(cc1101_device_t* cc);
+
+// Returns -1 if there is no profile with this name
+int cc1101_profile_find(const char* name, size_t len);
+const char* cc1101_profile_name(cc1101_profile_id_t id);
+// Profile last applied to this radio, CC1101_PROFILE_MAX before the first one
+cc1101_profile_id_t cc1101_profile_current(cc1101_device_t* cc);
@@ -1,68 +1,47 @@
 #include "cc1101_setup.h"
+#include <inttypes.h>
+#include "binlog.h"
 #include "cc1101.h"
+#include "cc1101_profiles.h"
+#include "cc1101_spi.h"
 #include "driver/spi_master.h"
 #include "driver/gpio.h"
 #include "esp_log.h"
 #include "esp_check.h"
+#include "esp_random.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
 
 #define TAG "CC1101 Setup"
 
-// Register settings for CC1101 (315 MHz, AM650 modulation)
-// Exported from TI Smart RF
-uint8_t registers[] = {
-  0x0D,  // IOCFG2        GDO2 Output Pin Configuration
-  0x2E,  // IOCFG1        GDO1 Output Pin Configuration
-  0x0D,  // IOCFG0        GDO0 Output Pin Configuration
-  0x07,  // FIFOTHR       RX FIFO and TX FIFO Thresholds
-  0xD3,  // SYNC1         Sync Word, High Byte
-  0x91,  // SYNC0         Sync Word, Low Byte
-  0xFF,  // PKTLEN        Packet Length
-  0x04,  // PKTCTRL1      Packet Automation Control
-  0x32,  // PKTCTRL0      Packet Automation Control
-  0x00,  // ADDR          Device Address
-  0x00,  // CHANNR        Channel Number
-  0x06,  // FSCTRL1       Frequency Synthesizer Control
-  0x00,  // FSCTRL0       Frequency Synthesizer Control
-  0x0C,  // FREQ2         Frequency Control Word, High Byte
-  0x1D,  // FREQ1         Frequency Control Word, Middle Byte
-  0x89,  // FREQ0         Frequency Control Word, Low Byte
-  0x17,  // MDMCFG4       Modem Configuration
-  0x32,  // MDMCFG3       Modem Configuration
-  0x30,  // MDMCFG2       Modem Configuration
-  0x00,  // MDMCFG1       Modem Configuration
-  0x00,  // MDMCFG0       Modem Configuration
-  0x15,  // DEVIATN       Modem Deviation Setting
-  0x07,  // MCSM2         Main Radio Control State Machine Configuration
-  0x30,  // MCSM1         Main Radio Control State Machine Configuration
-  0x18,  // MCSM0         Main Radio Control State Machine Configuration
-  0x18,  // FOCCFG        Frequency Offset Compensation Configuration
-  0x6C,  // BSCFG         Bit Synchronization Configuration
-  0x07,  // AGCCTRL2      AGC Control
-  0x00,  // AGCCTRL1      AGC Control
-  0x91,  // AGCCTRL0      AGC Control
-  0x87,  // WOREVT1       High Byte Event0 Timeout
-  0x6B,  // WOREVT0       Low Byte Event0 Timeout
-  0xFB,  // WORCTRL       Wake On Radio Control
-  0x56,  // FREND1        Front End RX Configuration
-  0x11,  // FREND0        Front End TX Configuration
-  0xE9,  // FSCAL3        Frequency Synthesizer Calibration
-  0x2A,  // FSCAL2        Frequency Synthesizer Calibration
-  0x00,  // FSCAL1        Frequency Synthesizer Calibration
-  0x1F,  // FSCAL0        Frequency Synthesizer Calibration
-  0x41,  // RCCTRL1       RC Oscillator Configuration
-  0x00,  // RCCTRL0       RC Oscillator Configuration
-  0x59,  // FSTEST        Frequency Synthesizer Calibration Control
-  0x7F,  // PTEST         Production Test
-  0x3F,  // AGCTEST       AGC Test
-  0x88,  // TEST2         Various Test Settings
-  0x31,  // TEST1         Various Test Settings
-  0x0B,  // TEST0         Various Test Settings
-};
-
-// -15 dBm on 315 MHz configuration
-uint8_t patable[8] = {0x00, 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-
-esp_err_t init_cc1101(cc1101_device_t** cc1101_handle) {
+// RSSI offset from the datasheet for our data rate
+#define CC1101_RSSI_OFFSET 74
+
+// IDLE is reached within a few us, RX/TX within ~800 us including calibration
+#define CC1101_IDLE_TIMEOUT_US 1000
+#define CC1101_SETTLE_TIMEOUT_US 5000
+
+// OOK has no carrier during the low periods, so take the peak of a few samples
+#define LBT_SAMPLES 4
+#define LBT_SAMPLE_INTERVAL_US 500
+
+// the datasheet gives ~150 us for the crystal to start after CSn goes low
+#define CC1101_XOSC_STARTUP_US 500
+// GDO2 high while the RSSI is above the carrier sense threshold
+#define CC1101_IOCFG2_CARRIER_SENSE 0x0E
+// RX_TIME_RSSI: end an RX poll early without a carrier, RX_TIME 2: poll for ~3% of EVENT0
+#define CC1101_MCSM2_WOR 0x12
+// RC oscillator on, RC calibration on, WOR_RES 0 (EVENT0 in 750/fXOSC steps), and EVENT1 7,
+// 48 RC periods of 750/fXOSC: 48 * 750 / 26 MHz = 1.385 ms from EVENT0 to the RX poll
+#define CC1101_WORCTRL_WOR 0x78
+
+// set while the radio is in WOR, where the chip sleeps between RX polls
+static bool radio_sleeping;
+
+// set once the shared bus has been brought up by the first radio
+static bool spi_bus_ready;
+
+esp_err_t init_cc1101(const cc1101_pins_t* pins, cc1101_profile_id_t profile, cc1101_device_t** cc1101_handle) {
   spi_bus_config_t spi_bus_cfg = {
     .miso_io_num = GPIO_NUM_13,
     .mosi_io_num = GPIO_NUM_11,
@@ -71,9 +50,9 @@ esp_err_t init_cc1101(cc1101_device_t** cc1101_handle) {
 
   cc1101_device_cfg_t cfg = {
     .spi_host = SPI2_HOST,
-    .gdo0_io_num = GPIO_NUM_8,
-    .gdo2_io_num = GPIO_NUM_9,
-    .cs_io_num = GPIO_NUM_10,
+    .gdo0_io_num = pins->gdo0_io_num,
+    .gdo2_io_num = pins->gdo2_io_num,
+    .cs_io_num = pins->cs_io_num,
     .miso_io_num = GPIO_NUM_13,
     // Check your hardware for setting the correct value!
     .crystal_freq = CC1101_CRYSTAL_26MHZ
@@ -82,46 +61,202 @@ esp_err_t init_cc1101(cc1101_device_t** cc1101_handle) {
   cc1101_device_t* cc;
 
   // Initialize SPI, CC1101, and reset CC1101
-  ESP_LOGI(TAG, "Initialize CC1101");
-  ESP_RETURN_ON_ERROR(spi_bus_initialize(SPI2_HOST, &spi_bus_cfg, SPI_DMA_CH_AUTO), TAG, "Failed to initialize CC1101 SPI bus");
+  ESP_LOGI(TAG, "Initialize CC1101 on CS %d", pins->cs_io_num);
+  if (!spi_bus_ready) {
+    ESP_RETURN_ON_ERROR(spi_bus_initialize(SPI2_HOST, &spi_bus_cfg, SPI_DMA_CH_AUTO), TAG, "Failed to initialize CC1101 SPI bus");
+    spi_bus_ready = true;
+  }
   ESP_RETURN_ON_ERROR(cc1101_init(&cfg, &cc), TAG, "Failed to initialize CC1101");
   ESP_RETURN_ON_ERROR(cc1101_hard_reset(cc), TAG, "Failed to reset CC1101");
 
   // Configure registers and PA Table
   ESP_LOGI(TAG, "Configure CC1101");
-  ESP_RETURN_ON_ERROR(cc1101_write_burst(cc, CC1101_FIRST_CFG_REG, registers, sizeof(registers)), TAG, "Failed to write register configuration to CC1101");
-  ESP_RETURN_ON_ERROR(cc1101_write_patable(cc, patable), TAG, "Failed to write PA Table to CC1101");
+  ESP_RETURN_ON_ERROR(cc1101_profile_apply(cc, profile), TAG, "Failed to apply radio profile");
 
   *cc1101_handle = cc;
 
   return ESP_OK;
 }
-esp_err_t cc1101_start_rx(cc1101_device_t* cc) {
-    // set idle
-    ESP_LOGI(TAG, "Set idle");
-    ESP_RETURN_ON_ERROR(cc1101_set_idle(cc), TAG, "Failed to set CC1101 idle");
+static esp_err_t cc1101_idle(cc1101_device_t* cc) {
+  cc1101_spi_seq_t seq;
+  BINLOGI(TAG, "Set idle");
+  cc1101_spi_seq_init(&seq, "idle");
+  cc1101_spi_seq_strobe(&seq, CC1101_SPI_SIDLE);
+  ESP_RETURN_ON_ERROR(cc1101_spi_seq_run(cc, &seq), TAG, "Failed to set CC1101 idle");
+  return cc1101_spi_wait_state(cc, CC1101_SPI_MARCSTATE_IDLE, CC1101_IDLE_TIMEOUT_US);
+}
+// Go through IDLE into RX or TX, and wait for the radio to get there instead of sleeping a tick
+static esp_err_t cc1101_enter_state(cc1101_device_t* cc, const char* name, uint8_t strobe, uint8_t marcstate) {
+  ESP_RETURN_ON_ERROR(cc1101_wake(cc), TAG, "Failed to wake CC1101");
+
+  int64_t start = esp_timer_get_time();
+  cc1101_spi_seq_t seq;
+
+  ESP_RETURN_ON_ERROR(cc1101_idle(cc), TAG, "CC1101 did not go idle");
+
+  BINLOGI(TAG, "Start %s mode", BINLOG_STR(name));
+  cc1101_spi_seq_init(&seq, name);
+  cc1101_spi_seq_strobe(&seq, strobe);
+  ESP_RETURN_ON_ERROR(cc1101_spi_seq_run(cc, &seq), TAG, "Failed to enable CC1101 %s mode", name);
+  // includes auto calibration when it is enabled
+  ESP_RETURN_ON_ERROR(cc1101_spi_wait_state(cc, marcstate, CC1101_SETTLE_TIMEOUT_US), TAG, "CC1101 did not enter %s", name);
 
-    vTaskDelay(1); // Wait
-  // Start RX mode
-  ESP_LOGI(TAG, "Start RX mode");
-  ESP_RETURN_ON_ERROR(cc1101_enable_rx(cc, CC1101_TRANS_MODE_ASYNCHRONOUS), TAG, "Failed to enable CC1101 RX mode");
+  cc1101_spi_record_timing(strobe == CC1101_SPI_SRX ? "to_rx" : "to_tx", esp_timer_get_time() - start);
+  return ESP_OK;
+}
+
+// The asynchronous serial mode itself is configured by the register profile (PKTCTRL0, IOCFGx),
+// so entering RX/TX is only a matter of strobes.
+esp_err_t cc1101_start_rx(cc1101_device_t* cc) {
+  ESP_RETURN_ON_ERROR(cc1101_enter_state(cc, "RX", CC1101_SPI_SRX, CC1101_SPI_MARCSTATE_RX), TAG, "Failed to start RX");
 
-  vTaskDelay(1); // Wait for auto calibration to finish.
+  // one FSCAL read per profile, the first time it is entered
+  if (!cc1101_profile_calibrated(cc)) {
+    ESP_RETURN_ON_ERROR(cc1101_profile_save_calibration(cc), TAG, "Failed to cache calibration");
+  }
 
   return ESP_OK;
 }
 esp_err_t cc1101_start_tx(cc1101_device_t* cc) {
-    // set idle
-    ESP_LOGI(TAG, "Set idle");
-    ESP_RETURN_ON_ERROR(cc1101_set_idle(cc), TAG, "Failed to set CC1101 idle");
+  ESP_RETURN_ON_ERROR(cc1101_enter_state(cc, "TX", CC1101_SPI_STX, CC1101_SPI_MARCSTATE_TX), TAG, "Failed to start TX");
 
-    vTaskDelay(1); // Wait
+  // a transmit only radio never enters RX, so it has to cache its calibration here, once
+  if (!cc1101_profile_calibrated(cc)) {
+    ESP_RETURN_ON_ERROR(cc1101_profile_save_calibration(cc), TAG, "Failed to cache calibration");
+  }
 
-  // Start TX mode
-  ESP_LOGI(TAG, "Start TX mode");
-  ESP_RETURN_ON_ERROR(cc1101_enable_tx(cc, CC1101_TRANS_MODE_ASYNCHRONOUS), TAG, "Failed to enable CC1101 TX mode");
+  return ESP_OK;
+}
+esp_err_t cc1101_stop(cc1101_device_t* cc) {
+  ESP_RETURN_ON_ERROR(cc1101_wake(cc), TAG, "Failed to wake CC1101");
+  return cc1101_idle(cc);
+}
+#ifdef CONFIG_RF_BRIDGE_WOR
+esp_err_t cc1101_start_wor(cc1101_device_t* cc) {
+  // EVENT0 in units of 750 crystal periods
+  uint16_t event0 = (uint32_t) CONFIG_RF_BRIDGE_WOR_INTERVAL_MS * 26000 / 750;
+  uint8_t wor[] = { event0 >> 8, event0 & 0xFF, CC1101_WORCTRL_WOR };
+  uint8_t iocfg2 = CC1101_IOCFG2_CARRIER_SENSE;
+  uint8_t mcsm2 = CC1101_MCSM2_WOR;
 
-  vTaskDelay(1); // Wait for auto calibration to finish.
+  // GDO2 switches from demodulated data to carrier sense, which is what wakes the ESP
+  cc1101_spi_seq_t seq;
+  cc1101_spi_seq_init(&seq, "start_wor");
+  cc1101_spi_seq_strobe(&seq, CC1101_SPI_SIDLE);
+  cc1101_spi_seq_write(&seq, CC1101_SPI_IOCFG2, &iocfg2, 1);
+  cc1101_spi_seq_write(&seq, CC1101_SPI_MCSM2, &mcsm2, 1);
+  cc1101_spi_seq_write(&seq, CC1101_SPI_WOREVT1, wor, sizeof(wor));
+  cc1101_spi_seq_strobe(&seq, CC1101_SPI_SWORRST);
+  cc1101_spi_seq_strobe(&seq, CC1101_SPI_SWOR);
+  ESP_RETURN_ON_ERROR(cc1101_spi_seq_run(cc, &seq), TAG, "Failed to start WOR");
 
+  radio_sleeping = true;
   return ESP_OK;
 }
+#endif
+esp_err_t cc1101_wake(cc1101_device_t* cc) {
+  if (!radio_sleeping) return ESP_OK;
+  int64_t start = esp_timer_get_time();
+
+  // CSn going low starts the crystal, the strobe itself is not reliable until it runs
+  ESP_RETURN_ON_ERROR(cc1101_spi_strobe(cc, CC1101_SPI_SNOP), TAG, "Failed to wake CC1101");
+  esp_rom_delay_us(CC1101_XOSC_STARTUP_US);
+  radio_sleeping = false;
+
+  // the TEST registers and most of the PA table are lost in SLEEP, and WOR changed GDO2/MCSM2
+  ESP_RETURN_ON_ERROR(cc1101_profile_apply(cc, cc1101_profile_current(cc)), TAG, "Failed to restore profile");
+
+  cc1101_spi_record_timing("wake", esp_timer_get_time() - start);
+  return ESP_OK;
+}
+bool cc1101_is_sleeping(void) {
+  return radio_sleeping;
+}
+void cc1101_dump_regs(cc1101_device_t* cc) {
+  uint8_t config[CC1101_SPI_NUM_CONFIG_REGS];
+  uint8_t patable[8];
+  uint8_t partnum, version, marcstate, rssi;
+
+  // one bus acquisition instead of one transaction per register
+  cc1101_spi_seq_t seq;
+  cc1101_spi_seq_init(&seq, "dump");
+  cc1101_spi_seq_read(&seq, 0x00, config, sizeof(config));
+  cc1101_spi_seq_read(&seq, CC1101_SPI_PATABLE, patable, sizeof(patable));
+  cc1101_spi_seq_read_status(&seq, CC1101_SPI_PARTNUM, &partnum);
+  cc1101_spi_seq_read_status(&seq, CC1101_SPI_VERSION, &version);
+  cc1101_spi_seq_read_status(&seq, CC1101_SPI_MARCSTATE, &marcstate);
+  cc1101_spi_seq_read_status(&seq, CC1101_SPI_RSSI, &rssi);
+  if (cc1101_spi_seq_run(cc, &seq) != ESP_OK) return;
+
+  ESP_LOGI(TAG, "PARTNUM 0x%02X | VERSION 0x%02X | MARCSTATE 0x%02X | RSSI 0x%02X", partnum, version, marcstate & 0x1F, rssi);
+  ESP_LOG_BUFFER_HEX_LEVEL(TAG, config, sizeof(config), ESP_LOG_INFO);
+  ESP_LOG_BUFFER_HEX_LEVEL(TAG, patable, sizeof(patable), ESP_LOG_INFO);
+}
+esp_err_t cc1101_read_rssi(cc1101_device_t* cc, int16_t* rssi_dbm) {
+  uint8_t raw;
+  ESP_RETURN_ON_ERROR(cc1101_spi_read_status(cc, CC1101_SPI_RSSI, &raw), TAG, "Failed to read RSSI");
+  // two's complement, half dB steps
+  *rssi_dbm = (int16_t) (int8_t) raw / 2 - CC1101_RSSI_OFFSET;
+  return ESP_OK;
+}
+
+esp_err_t cc1101_read_rssi_peak(cc1101_device_t* cc, int samples, uint32_t interval_us, int16_t* peak_dbm) {
+  *peak_dbm = INT16_MIN;
+  for (int i = 0; i < samples; i++) {
+    int16_t rssi;
+    ESP_RETURN_ON_ERROR(cc1101_read_rssi(cc, &rssi), TAG, "Failed to sample RSSI");
+    if (rssi > *peak_dbm) *peak_dbm = rssi;
+    if (i + 1 < samples) esp_rom_delay_us(interval_us);
+  }
+  return ESP_OK;
+}
+
+#ifdef CONFIG_RF_BRIDGE_LBT
+static cc1101_lbt_stats_t lbt_stats;
+
+esp_err_t cc1101_listen_before_talk(cc1101_device_t* cc) {
+  int64_t start = esp_timer_get_time();
+  uint32_t window_ms = CONFIG_RF_BRIDGE_LBT_SLOT_MS;
+  bool deferred = false;
+
+  lbt_stats.checks++;
+  // RSSI is only valid in RX
+  if (radio_sleeping) ESP_RETURN_ON_ERROR(cc1101_start_rx(cc), TAG, "Failed to leave WOR");
+
+  while (1) {
+    int16_t rssi;
+    ESP_RETURN_ON_ERROR(cc1101_read_rssi_peak(cc, LBT_SAMPLES, LBT_SAMPLE_INTERVAL_US, &rssi), TAG, "Clear channel assessment failed");
+
+    if (rssi < CONFIG_RF_BRIDGE_LBT_RSSI_DBM) {
+      if (deferred) {
+        lbt_stats.collisions_avoided++;
+        ESP_LOGI(TAG, "Channel clear after %" PRId64 " ms", (esp_timer_get_time() - start) / 1000);
+      } else {
+        lbt_stats.clear_first_try++;
+      }
+      return ESP_OK;
+    }
+
+    int64_t waited_ms = (esp_timer_get_time() - start) / 1000;
+    if (waited_ms >= CONFIG_RF_BRIDGE_LBT_MAX_DEFERRAL_MS) {
+      lbt_stats.forced++;
+      ESP_LOGW(TAG, "Channel still busy (%d dBm) after %" PRId64 " ms", rssi, waited_ms);
+      return ESP_ERR_TIMEOUT;
+    }
+
+    // random backoff in [1, window], doubling the window each time
+    uint32_t backoff_ms = 1 + esp_random() % window_ms;
+    if (window_ms < CONFIG_RF_BRIDGE_LBT_MAX_WINDOW_MS) window_ms *= 2;
+    lbt_stats.deferrals++;
+    deferred = true;
+    ESP_LOGD(TAG, "Channel busy (%d dBm), backing off %" PRIu32 " ms", rssi, backoff_ms);
+
+    TickType_t ticks = pdMS_TO_TICKS(backoff_ms);
+    vTaskDelay(ticks ? ticks : 1);
+  }
+}
+
+void cc1101_lbt_get_stats(cc1101_lbt_stats_t* stats) {
+  *stats = lbt_stats;
+}
+#endif
@@ -1,7 +1,67 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
 #include "cc1101.h"
+#include "cc1101_profiles.h"
+#include "driver/gpio.h"
 
-esp_err_t init_cc1101(cc1101_device_t** cc1101_handle);
+// Per radio pins, SCLK/MOSI/MISO of SPI2_HOST are shared by every radio
+typedef struct {
+  gpio_num_t cs_io_num;
+  // TX data in
+  gpio_num_t gdo0_io_num;
+  // RX data out
+  gpio_num_t gdo2_io_num;
+} cc1101_pins_t;
+
+// The first call brings up the SPI bus, later calls only add their chip select to it
+esp_err_t init_cc1101(const cc1101_pins_t* pins, cc1101_profile_id_t profile, cc1101_device_t** cc1101_handle);
 esp_err_t cc1101_start_rx(cc1101_device_t* cc1101_handle);
 esp_err_t cc1101_start_tx(cc1101_device_t* cc1101_handle);
+// Park the radio in IDLE, for a transmit only radio between TX windows
+esp_err_t cc1101_stop(cc1101_device_t* cc1101_handle);
+void cc1101_dump_regs(cc1101_device_t* cc1101_handle);
+
+/**
+ * @brief Put the radio in Wake-on-Radio, polling RX every CONFIG_RF_BRIDGE_WOR_INTERVAL_MS
+ *
+ * GDO2 reports carrier sense instead of data until the radio is woken again.
+ * cc1101_start_rx and cc1101_start_tx wake it automatically.
+ */
+esp_err_t cc1101_start_wor(cc1101_device_t* cc1101_handle);
+// Bring the radio out of WOR into IDLE with the profile restored, no-op when awake
+esp_err_t cc1101_wake(cc1101_device_t* cc1101_handle);
+bool cc1101_is_sleeping(void);
+
+// Current RSSI in dBm, only meaningful while in RX
+esp_err_t cc1101_read_rssi(cc1101_device_t* cc1101_handle, int16_t* rssi_dbm);
+
+/**
+ * @brief Peak RSSI of a few samples, only meaningful while in RX
+ *
+ * OOK has no carrier during the low periods, so a single sample may miss a transmission.
+ * Busy waits interval_us between samples.
+ */
+esp_err_t cc1101_read_rssi_peak(cc1101_device_t* cc1101_handle, int samples, uint32_t interval_us, int16_t* peak_dbm);
+
+typedef struct {
+  // clear channel assessments performed
+  uint32_t checks;
+  uint32_t clear_first_try;
+  // backoffs taken because the channel was busy
+  uint32_t deferrals;
+  // transmissions that found the channel busy, waited and then went out on a clear channel
+  uint32_t collisions_avoided;
+  // transmissions sent on a busy channel after the maximum deferral time
+  uint32_t forced;
+} cc1101_lbt_stats_t;
+
+/**
+ * @brief Wait for a clear channel before transmitting, with randomized exponential backoff
+ *
+ * Must be called while the radio is still in RX. Gives up after the configured maximum
+ * deferral time and returns ESP_ERR_TIMEOUT, in which case the caller may send anyway.
+ */
+esp_err_t cc1101_listen_before_talk(cc1101_device_t* cc1101_handle);
+void cc1101_lbt_get_stats(cc1101_lbt_stats_t* stats);
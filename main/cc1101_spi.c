@@ -0,0 +1,228 @@
+#include "cc1101_spi.h"
+
+#include <string.h>
+#include "driver/spi_master.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define TAG "CC1101 SPI"
+
+// header byte + a full config register burst
+#define CC1101_SPI_MAX_TRANSFER (1 + CC1101_SPI_NUM_CONFIG_REGS)
+
+static portMUX_TYPE seq_stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static cc1101_spi_seq_stats_t seq_stats[CC1101_SPI_SEQ_MAX_STATS];
+
+// cc1101-idf keeps the SPI device handle it added to the bus, we reuse it so the bus lock serializes us.
+// The field is not part of its API, so fail the build rather than talk to the wrong thing if it changes.
+_Static_assert(__builtin_types_compatible_p(__typeof__(((cc1101_device_t*) 0)->spi), spi_device_handle_t),
+               "cc1101_device_t no longer holds the SPI device handle, cc1101_spi.c needs updating for this cc1101-idf revision");
+
+static inline spi_device_handle_t cc1101_spi_device(cc1101_device_t* cc) {
+  return cc->spi;
+}
+
+static esp_err_t cc1101_spi_transfer(cc1101_device_t* cc, const uint8_t* tx, uint8_t* rx, size_t len) {
+  spi_transaction_t trans = {
+    .length = len * 8,
+    .tx_buffer = tx,
+    .rx_buffer = rx,
+  };
+  return spi_device_polling_transmit(cc1101_spi_device(cc), &trans);
+}
+
+esp_err_t cc1101_spi_read(cc1101_device_t* cc, uint8_t addr, uint8_t* data, size_t len) {
+  ESP_RETURN_ON_FALSE(len > 0 && len < CC1101_SPI_MAX_TRANSFER, ESP_ERR_INVALID_SIZE, TAG, "Invalid read length %zu", len);
+  uint8_t tx[CC1101_SPI_MAX_TRANSFER] = { addr | CC1101_SPI_READ | (len > 1 ? CC1101_SPI_BURST : 0) };
+  uint8_t rx[CC1101_SPI_MAX_TRANSFER];
+  ESP_RETURN_ON_ERROR(cc1101_spi_transfer(cc, tx, rx, len + 1), TAG, "Failed to read 0x%02X", addr);
+  memcpy(data, rx + 1, len);
+  return ESP_OK;
+}
+
+esp_err_t cc1101_spi_write(cc1101_device_t* cc, uint8_t addr, const uint8_t* data, size_t len) {
+  ESP_RETURN_ON_FALSE(len > 0 && len < CC1101_SPI_MAX_TRANSFER, ESP_ERR_INVALID_SIZE, TAG, "Invalid write length %zu", len);
+  uint8_t tx[CC1101_SPI_MAX_TRANSFER] = { addr | (len > 1 ? CC1101_SPI_BURST : 0) };
+  memcpy(tx + 1, data, len);
+  ESP_RETURN_ON_ERROR(cc1101_spi_transfer(cc, tx, NULL, len + 1), TAG, "Failed to write 0x%02X", addr);
+  return ESP_OK;
+}
+
+esp_err_t cc1101_spi_read_status(cc1101_device_t* cc, uint8_t addr, uint8_t* value) {
+  // status registers share addresses with the strobes, the burst bit selects them
+  uint8_t tx[2] = { addr | CC1101_SPI_READ | CC1101_SPI_BURST, 0 };
+  uint8_t rx[2];
+  ESP_RETURN_ON_ERROR(cc1101_spi_transfer(cc, tx, rx, 2), TAG, "Failed to read status 0x%02X", addr);
+  *value = rx[1];
+  return ESP_OK;
+}
+
+esp_err_t cc1101_spi_strobe(cc1101_device_t* cc, uint8_t strobe) {
+  ESP_RETURN_ON_ERROR(cc1101_spi_transfer(cc, &strobe, NULL, 1), TAG, "Failed to strobe 0x%02X", strobe);
+  return ESP_OK;
+}
+
+void cc1101_spi_seq_init(cc1101_spi_seq_t* seq, const char* name) {
+  seq->name = name;
+  seq->num_ops = 0;
+  seq->buf_used = 0;
+  seq->err = ESP_OK;
+}
+
+// Reserve an operation with `len` bytes on the wire, returns NULL if the sequence is full
+static spi_transaction_t* cc1101_spi_seq_add(cc1101_spi_seq_t* seq, uint8_t header, size_t len, uint8_t* out) {
+  if (seq->num_ops == CC1101_SPI_SEQ_MAX_OPS) {
+    seq->err = ESP_ERR_NO_MEM;
+    return NULL;
+  }
+  spi_transaction_t* trans = &seq->trans[seq->num_ops];
+  memset(trans, 0, sizeof(*trans));
+  trans->length = len * 8;
+
+  if (len <= 4) {
+    // fits in the transaction itself
+    trans->flags = SPI_TRANS_USE_TXDATA | SPI_TRANS_USE_RXDATA;
+    trans->tx_data[0] = header;
+  } else {
+    // keep every burst word aligned
+    seq->buf_used = (seq->buf_used + 3) & ~3;
+    if (seq->buf_used + len > CC1101_SPI_SEQ_BUF) {
+      seq->err = ESP_ERR_NO_MEM;
+      return NULL;
+    }
+    seq->tx_buf[seq->buf_used] = header;
+    trans->tx_buffer = &seq->tx_buf[seq->buf_used];
+    trans->rx_buffer = &seq->rx_buf[seq->buf_used];
+    seq->buf_used += len;
+  }
+
+  seq->out[seq->num_ops++] = out;
+  return trans;
+}
+
+void cc1101_spi_seq_strobe(cc1101_spi_seq_t* seq, uint8_t strobe) {
+  cc1101_spi_seq_add(seq, strobe, 1, NULL);
+}
+
+void cc1101_spi_seq_read_status(cc1101_spi_seq_t* seq, uint8_t addr, uint8_t* value) {
+  cc1101_spi_seq_add(seq, addr | CC1101_SPI_READ | CC1101_SPI_BURST, 2, value);
+}
+
+void cc1101_spi_seq_read(cc1101_spi_seq_t* seq, uint8_t addr, uint8_t* data, size_t len) {
+  spi_transaction_t* trans = cc1101_spi_seq_add(seq, addr | CC1101_SPI_READ | (len > 1 ? CC1101_SPI_BURST : 0), len + 1, data);
+  // remember the length for copying out
+  if (trans) trans->user = (void*) len;
+}
+
+void cc1101_spi_seq_write(cc1101_spi_seq_t* seq, uint8_t addr, const uint8_t* data, size_t len) {
+  spi_transaction_t* trans = cc1101_spi_seq_add(seq, addr | (len > 1 ? CC1101_SPI_BURST : 0), len + 1, NULL);
+  if (trans == NULL) return;
+  uint8_t* payload = (trans->flags & SPI_TRANS_USE_TXDATA) ? &trans->tx_data[1] : (uint8_t*) trans->tx_buffer + 1;
+  memcpy(payload, data, len);
+}
+
+void cc1101_spi_record_timing(const char* name, uint32_t elapsed_us) {
+  portENTER_CRITICAL(&seq_stats_lock);
+  for (size_t i = 0; i < CC1101_SPI_SEQ_MAX_STATS; i++) {
+    cc1101_spi_seq_stats_t* stats = &seq_stats[i];
+    if (stats->name != name && stats->name != NULL) continue;
+    if (stats->name == NULL) {
+      stats->name = name;
+      stats->min_us = UINT32_MAX;
+    }
+    stats->runs++;
+    stats->total_us += elapsed_us;
+    if (elapsed_us < stats->min_us) stats->min_us = elapsed_us;
+    if (elapsed_us > stats->max_us) stats->max_us = elapsed_us;
+    break;
+  }
+  portEXIT_CRITICAL(&seq_stats_lock);
+}
+
+esp_err_t cc1101_spi_seq_run(cc1101_device_t* cc, cc1101_spi_seq_t* seq) {
+  ESP_RETURN_ON_ERROR(seq->err, TAG, "Sequence %s does not fit", seq->name);
+  spi_device_handle_t dev = cc1101_spi_device(cc);
+  int64_t start = esp_timer_get_time();
+  esp_err_t ret = ESP_OK;
+  size_t queued = 0;
+
+  ESP_RETURN_ON_ERROR(spi_device_acquire_bus(dev, portMAX_DELAY), TAG, "Failed to acquire bus");
+  for (size_t i = 0; i < seq->num_ops && ret == ESP_OK; i++) {
+    spi_transaction_t* trans = &seq->trans[i];
+    if (trans->flags & SPI_TRANS_USE_TXDATA) {
+      ret = spi_device_polling_transmit(dev, trans);
+    } else {
+      // only keep one burst in flight, cc1101-idf picks the device queue depth and a result
+      // that does not fit its return queue is lost
+      if (queued) {
+        spi_transaction_t* done;
+        ret = spi_device_get_trans_result(dev, &done, portMAX_DELAY);
+        queued--;
+        if (ret != ESP_OK) break;
+      }
+      ret = spi_device_queue_trans(dev, trans, portMAX_DELAY);
+      if (ret == ESP_OK) queued++;
+    }
+  }
+  while (queued--) {
+    spi_transaction_t* done;
+    esp_err_t err = spi_device_get_trans_result(dev, &done, portMAX_DELAY);
+    if (ret == ESP_OK) ret = err;
+  }
+  spi_device_release_bus(dev);
+  ESP_RETURN_ON_ERROR(ret, TAG, "Sequence %s failed", seq->name);
+
+  // copy out reads, skipping the status byte clocked out with the header
+  for (size_t i = 0; i < seq->num_ops; i++) {
+    spi_transaction_t* trans = &seq->trans[i];
+    if (seq->out[i] == NULL) continue;
+    if (trans->flags & SPI_TRANS_USE_RXDATA) {
+      memcpy(seq->out[i], &trans->rx_data[1], trans->length / 8 - 1);
+    } else {
+      memcpy(seq->out[i], (uint8_t*) trans->rx_buffer + 1, (size_t) trans->user);
+    }
+  }
+
+  cc1101_spi_record_timing(seq->name, esp_timer_get_time() - start);
+  return ESP_OK;
+}
+
+esp_err_t cc1101_spi_wait_state(cc1101_device_t* cc, uint8_t marcstate, uint32_t timeout_us) {
+  spi_device_handle_t dev = cc1101_spi_device(cc);
+  int64_t start = esp_timer_get_time();
+  esp_err_t ret = ESP_ERR_TIMEOUT;
+
+  spi_transaction_t trans = {
+    .flags = SPI_TRANS_USE_TXDATA | SPI_TRANS_USE_RXDATA,
+    .length = 16,
+    .tx_data = { CC1101_SPI_MARCSTATE | CC1101_SPI_READ | CC1101_SPI_BURST },
+  };
+
+  ESP_RETURN_ON_ERROR(spi_device_acquire_bus(dev, portMAX_DELAY), TAG, "Failed to acquire bus");
+  do {
+    esp_err_t err = spi_device_polling_transmit(dev, &trans);
+    if (err != ESP_OK) {
+      ret = err;
+      break;
+    }
+    if ((trans.rx_data[1] & 0x1F) == marcstate) {
+      ret = ESP_OK;
+      break;
+    }
+  } while (esp_timer_get_time() - start < timeout_us);
+  spi_device_release_bus(dev);
+
+  ESP_RETURN_ON_ERROR(ret, TAG, "Timed out waiting for state 0x%02X (last 0x%02X)", marcstate, trans.rx_data[1] & 0x1F);
+  return ESP_OK;
+}
+
+size_t cc1101_spi_get_seq_stats(cc1101_spi_seq_stats_t* stats, size_t max) {
+  size_t count = 0;
+  portENTER_CRITICAL(&seq_stats_lock);
+  for (size_t i = 0; i < CC1101_SPI_SEQ_MAX_STATS && count < max && seq_stats[i].name != NULL; i++) {
+    stats[count++] = seq_stats[i];
+  }
+  portEXIT_CRITICAL(&seq_stats_lock);
+  return count;
+}
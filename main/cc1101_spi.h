@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "cc1101.h"
+#include "driver/spi_master.h"
+#include "esp_err.h"
+
+// Raw register access for things cc1101-idf does not cover (status registers, partial reads)
+
+// Header byte flags
+#define CC1101_SPI_READ  0x80
+#define CC1101_SPI_BURST 0x40
+
+// Config registers
+#define CC1101_SPI_IOCFG2   0x00
+#define CC1101_SPI_IOCFG0   0x02
+#define CC1101_SPI_FREQ2    0x0D
+#define CC1101_SPI_FREQ1    0x0E
+#define CC1101_SPI_FREQ0    0x0F
+#define CC1101_SPI_MCSM2    0x16
+#define CC1101_SPI_MCSM1    0x17
+#define CC1101_SPI_MCSM0    0x18
+#define CC1101_SPI_AGCCTRL1 0x1C
+#define CC1101_SPI_WOREVT1  0x1E
+#define CC1101_SPI_WOREVT0  0x1F
+#define CC1101_SPI_WORCTRL  0x20
+#define CC1101_SPI_FSCAL3   0x23
+#define CC1101_SPI_FSCAL2   0x24
+#define CC1101_SPI_FSCAL1   0x25
+#define CC1101_SPI_TEST0    0x2E
+#define CC1101_SPI_NUM_CONFIG_REGS 0x2F
+#define CC1101_SPI_PATABLE  0x3E
+
+// Command strobes
+#define CC1101_SPI_SCAL  0x33
+#define CC1101_SPI_SRX   0x34
+#define CC1101_SPI_STX   0x35
+#define CC1101_SPI_SIDLE 0x36
+#define CC1101_SPI_SWOR  0x38
+#define CC1101_SPI_SWORRST 0x3C
+#define CC1101_SPI_SNOP  0x3D
+
+// Status registers (read with the burst bit set)
+#define CC1101_SPI_PARTNUM   0x30
+#define CC1101_SPI_VERSION   0x31
+#define CC1101_SPI_LQI       0x33
+#define CC1101_SPI_RSSI      0x34
+#define CC1101_SPI_MARCSTATE 0x35
+#define CC1101_SPI_PKTSTATUS 0x38
+#define CC1101_SPI_RXBYTES   0x3B
+
+// MARCSTATE values
+#define CC1101_SPI_MARCSTATE_SLEEP 0x00
+#define CC1101_SPI_MARCSTATE_IDLE  0x01
+#define CC1101_SPI_MARCSTATE_RX    0x0D
+#define CC1101_SPI_MARCSTATE_TX    0x13
+
+esp_err_t cc1101_spi_read(cc1101_device_t* cc, uint8_t addr, uint8_t* data, size_t len);
+esp_err_t cc1101_spi_write(cc1101_device_t* cc, uint8_t addr, const uint8_t* data, size_t len);
+esp_err_t cc1101_spi_read_status(cc1101_device_t* cc, uint8_t addr, uint8_t* value);
+esp_err_t cc1101_spi_strobe(cc1101_device_t* cc, uint8_t strobe);
+
+// Most operations in one sequence
+#define CC1101_SPI_SEQ_MAX_OPS 8
+// Scratch space for burst headers and data in one sequence
+#define CC1101_SPI_SEQ_BUF 128
+// Distinct sequence names that get timing stats
+#define CC1101_SPI_SEQ_MAX_STATS 12
+
+/**
+ * A batch of SPI operations that runs with the bus acquired once.
+ *
+ * Strobes and single register accesses are polled, which avoids the interrupt and
+ * bus lock overhead of a full transaction each. Bursts go out as DMA transactions, one
+ * in flight at a time: the device queue depth is set by cc1101-idf, so a whole sequence
+ * is not queued ahead.
+ */
+typedef struct {
+  const char* name;
+  spi_transaction_t trans[CC1101_SPI_SEQ_MAX_OPS];
+  // where to copy the result of each read, NULL for writes and strobes
+  uint8_t* out[CC1101_SPI_SEQ_MAX_OPS];
+  size_t num_ops;
+  // word aligned so the driver can DMA straight from them
+  uint8_t tx_buf[CC1101_SPI_SEQ_BUF] __attribute__((aligned(4)));
+  uint8_t rx_buf[CC1101_SPI_SEQ_BUF] __attribute__((aligned(4)));
+  size_t buf_used;
+  // set when an operation did not fit, reported by cc1101_spi_seq_run
+  esp_err_t err;
+} cc1101_spi_seq_t;
+
+typedef struct {
+  const char* name;
+  uint32_t runs;
+  uint32_t min_us;
+  uint32_t max_us;
+  uint64_t total_us;
+} cc1101_spi_seq_stats_t;
+
+// name must be a string literal, it is used as the stats key
+void cc1101_spi_seq_init(cc1101_spi_seq_t* seq, const char* name);
+void cc1101_spi_seq_strobe(cc1101_spi_seq_t* seq, uint8_t strobe);
+void cc1101_spi_seq_read_status(cc1101_spi_seq_t* seq, uint8_t addr, uint8_t* value);
+void cc1101_spi_seq_read(cc1101_spi_seq_t* seq, uint8_t addr, uint8_t* data, size_t len);
+void cc1101_spi_seq_write(cc1101_spi_seq_t* seq, uint8_t addr, const uint8_t* data, size_t len);
+esp_err_t cc1101_spi_seq_run(cc1101_device_t* cc, cc1101_spi_seq_t* seq);
+
+/**
+ * @brief Poll MARCSTATE with the bus held until the radio reaches a state
+ */
+esp_err_t cc1101_spi_wait_state(cc1101_device_t* cc, uint8_t marcstate, uint32_t timeout_us);
+
+// Add a timing sample for something that is not a single sequence, such as a state transition
+void cc1101_spi_record_timing(const char* name, uint32_t elapsed_us);
+// Returns the number of entries written
+size_t cc1101_spi_get_seq_stats(cc1101_spi_seq_stats_t* stats, size_t max);
@@ -0,0 +1,91 @@
+#include "event_queue.h"
+
+#include <assert.h>
+#include "esp_attr.h"
+#include "esp_timer.h"
+
+static_assert(EVENT_POOL_SIZE <= 32, "free buffers are tracked in a 32 bit mask");
+
+static event_queue_message_t pool[EVENT_POOL_SIZE];
+// bit i set while pool[i] is free
+static uint32_t free_mask = (EVENT_POOL_SIZE == 32) ? UINT32_MAX : (1u << EVENT_POOL_SIZE) - 1;
+static portMUX_TYPE pool_lock = portMUX_INITIALIZER_UNLOCKED;
+static event_queue_stats_t stats;
+
+// Called with pool_lock held
+static inline event_queue_message_t* IRAM_ATTR take_buffer(void) {
+  if (free_mask == 0) {
+    stats.exhausted++;
+    return NULL;
+  }
+  int index = __builtin_ctz(free_mask);
+  free_mask &= ~(1u << index);
+  stats.claimed++;
+  if (++stats.in_use > stats.high_water) stats.high_water = stats.in_use;
+  return &pool[index];
+}
+
+// Only the header is reset, producers fill the payload they use
+static inline void IRAM_ATTR init_message(event_queue_message_t* message, event_queue_message_type_t type) {
+  message->type = type;
+  message->radio = 0;
+  message->rssi_dbm = INT16_MIN;
+  message->len = 0;
+  message->timestamp_us = esp_timer_get_time();
+}
+
+QueueHandle_t event_queue_create(void) {
+  return xQueueCreate(EVENT_POOL_SIZE, sizeof(event_queue_message_t*));
+}
+
+event_queue_message_t* event_queue_claim(event_queue_message_type_t type) {
+  portENTER_CRITICAL(&pool_lock);
+  event_queue_message_t* message = take_buffer();
+  portEXIT_CRITICAL(&pool_lock);
+  if (message) init_message(message, type);
+  return message;
+}
+
+event_queue_message_t* IRAM_ATTR event_queue_claim_from_isr(event_queue_message_type_t type) {
+  portENTER_CRITICAL_ISR(&pool_lock);
+  event_queue_message_t* message = take_buffer();
+  portEXIT_CRITICAL_ISR(&pool_lock);
+  if (message) init_message(message, type);
+  return message;
+}
+
+esp_err_t event_queue_send(QueueHandle_t queue, event_queue_message_t* message) {
+  // the queue holds the whole pool, so this only fails on a foreign pointer
+  if (xQueueSend(queue, &message, 0) != pdTRUE) {
+    event_queue_release(message);
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+esp_err_t IRAM_ATTR event_queue_send_from_isr(QueueHandle_t queue, event_queue_message_t* message, BaseType_t* high_task_wakeup) {
+  if (xQueueSendFromISR(queue, &message, high_task_wakeup) != pdTRUE) {
+    portENTER_CRITICAL_ISR(&pool_lock);
+    free_mask |= 1u << (message - pool);
+    stats.in_use--;
+    portEXIT_CRITICAL_ISR(&pool_lock);
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+void event_queue_release(event_queue_message_t* message) {
+  size_t index = message - pool;
+  assert(index < EVENT_POOL_SIZE);
+  portENTER_CRITICAL(&pool_lock);
+  assert(!(free_mask & (1u << index)));
+  free_mask |= 1u << index;
+  stats.in_use--;
+  portEXIT_CRITICAL(&pool_lock);
+}
+
+void event_queue_get_stats(event_queue_stats_t* out) {
+  portENTER_CRITICAL(&pool_lock);
+  *out = stats;
+  portEXIT_CRITICAL(&pool_lock);
+}
@@ -1,18 +1,87 @@
 #pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_err.h"
 #include "mqtt.h"
 #include "rf_light_encoder.h"
+#include "cc1101_profiles.h"
+#include "rf_arbiter.h"
+#include "rf_code_registry.h"
+#include "rf_rules.h"
+
+// Events live in a fixed pool and only a pointer goes through the queue, so a large payload
+// costs nothing on the way and the queue can hold every event in the pool.
+#define EVENT_POOL_SIZE 12
+// room for a full frame of 64 RMT symbols
+#define EVENT_POOL_PAYLOAD_SIZE 256
 
 typedef union {
     mqtt_message_t mqtt_message;
+    mqtt_bulk_message_t mqtt_bulk;
     rf_light_message_t rf_light_message;
+    cc1101_profile_id_t radio_profile;
+    bool learning;
+    rf_code_bind_t bind_code;
+    rf_arbiter_announcement_t announcement;
+    rf_rules_table_t rules;
 } event_queue_message_data_t;
 
 typedef enum {
     EVENT_QUEUE_MESSAGE_MQTT,
     EVENT_QUEUE_MESSAGE_RF_LIGHT,
+    EVENT_QUEUE_MESSAGE_RADIO_PROFILE,
+    EVENT_QUEUE_MESSAGE_LEARN,
+    EVENT_QUEUE_MESSAGE_BIND_CODE,
+    EVENT_QUEUE_MESSAGE_ARBITRATION,
+    EVENT_QUEUE_MESSAGE_RULES,
+    EVENT_QUEUE_MESSAGE_MQTT_BULK,
 } event_queue_message_type_t;
 
 typedef struct {
     event_queue_message_type_t type;
-    event_queue_message_data_t data;
+    // radio a received message came from
+    uint8_t radio;
+    // RSSI of a received message, INT16_MIN if unknown
+    int16_t rssi_dbm;
+    // bytes used in raw, for variable size payloads
+    uint16_t len;
+    // esp_timer time the event was claimed
+    int64_t timestamp_us;
+    union {
+        event_queue_message_data_t data;
+        uint8_t raw[EVENT_POOL_PAYLOAD_SIZE];
+    };
 } event_queue_message_t;
+
+typedef struct {
+    uint32_t claimed;
+    // claims that found every buffer taken, the event was dropped by its producer
+    uint32_t exhausted;
+    uint32_t in_use;
+    uint32_t high_water;
+} event_queue_stats_t;
+
+// Queue for event pointers, deep enough for the whole pool
+QueueHandle_t event_queue_create(void);
+
+/**
+ * @brief Take a buffer from the pool, without ever waiting or allocating
+ *
+ * @return NULL when the pool is exhausted
+ */
+event_queue_message_t* event_queue_claim(event_queue_message_type_t type);
+event_queue_message_t* event_queue_claim_from_isr(event_queue_message_type_t type);
+
+/**
+ * @brief Pass a claimed event to the consumer, which releases it
+ *
+ * The event is released here if it cannot be queued.
+ */
+esp_err_t event_queue_send(QueueHandle_t queue, event_queue_message_t* message);
+esp_err_t event_queue_send_from_isr(QueueHandle_t queue, event_queue_message_t* message, BaseType_t* high_task_wakeup);
+
+void event_queue_release(event_queue_message_t* message);
+void event_queue_get_stats(event_queue_stats_t* stats);
@@ -0,0 +1,406 @@
+#include "loadgen.h"
+
+#ifdef CONFIG_RF_BRIDGE_LOADGEN
+
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/task.h>
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "event_queue.h"
+#include "mqtt.h"
+#include "mqtt_client.h"
+#include "mqtt_publish.h"
+#include "rf_light_encoder.h"
+#include "rf_light_rx.h"
+#include "rmt_emu.h"
+#include "sample_stats.h"
+
+#define TAG "loadgen"
+
+#define STATE_TOPIC_PREFIX MQTT_PREFIX "light_channel_"
+#define STATE_TOPIC_SUFFIX "/state"
+#define STATE_TOPIC_LEN (sizeof(STATE_TOPIC_PREFIX) - 1 + 1 + sizeof(STATE_TOPIC_SUFFIX) - 1)
+// time for the broker to settle the subscriptions of both clients
+#define SETTLE_MS 1000
+// after the last command or frame, for the stragglers
+#define DRAIN_MS 2000
+
+#define SUBSCRIBED_BIT BIT0
+
+typedef struct {
+  char channel;
+  bool on;
+  int64_t at_us;
+} outstanding_t;
+
+typedef struct {
+  outstanding_t entries[LOADGEN_MAX_OUTSTANDING];
+  size_t count;
+  // us
+  uint32_t* samples;
+  size_t num_samples;
+  uint32_t matched;
+  // commands replaced before they went out, frames that were never published
+  uint32_t lost;
+  // sent with nothing left to match, repeats mostly
+  uint32_t unmatched;
+} stream_t;
+
+static radio_manager_t* loadgen_radios;
+static esp_mqtt_client_handle_t client;
+static EventGroupHandle_t events;
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+static stream_t commands;
+static stream_t frames;
+static uint32_t commands_sent;
+static uint32_t commands_failed;
+static uint32_t frames_injected;
+static uint32_t frames_not_armed;
+// sent by the transmitter but rejected by the bridge's own decoder, a TX/RX timing mismatch
+static uint32_t tx_undecoded;
+
+static const char* const command_topics[] = {
+  MQTT_PREFIX "light_channel_a/set",
+  MQTT_PREFIX "light_channel_e/set",
+};
+static const char command_channels[] = {'a', 'e'};
+static const char frame_channels[] = {'a', 'd', 'e'};
+#define NUM_FRAMES (2 * sizeof(frame_channels))
+// every frame the generator sends, header and payload as a remote transmits them
+static rmt_symbol_word_t frame_symbols[NUM_FRAMES][SYMBOL_BUFFER_SIZE];
+static size_t frame_num_symbols[NUM_FRAMES];
+
+static int env_int(const char* name, int fallback) {
+  const char* value = getenv(name);
+  return value && *value ? atoi(value) : fallback;
+}
+
+// Caller holds the lock
+static void add_outstanding(stream_t* stream, char channel, bool on, int64_t at_us) {
+  if (stream->count == LOADGEN_MAX_OUTSTANDING) {
+    memmove(&stream->entries[0], &stream->entries[1], (LOADGEN_MAX_OUTSTANDING - 1) * sizeof(outstanding_t));
+    stream->count--;
+    stream->lost++;
+  }
+  stream->entries[stream->count++] = (outstanding_t) { .channel = channel, .on = on, .at_us = at_us };
+}
+
+// Caller holds the lock
+static void add_sample(stream_t* stream, int64_t latency_us) {
+  if (stream->num_samples < LOADGEN_MAX_SAMPLES) stream->samples[stream->num_samples++] = latency_us > 0 ? latency_us : 0;
+  stream->matched++;
+}
+
+// Caller holds the lock. Drops entry index, and every older one on channel as lost (any channel for 0)
+static void remove_outstanding(stream_t* stream, size_t index, char channel) {
+  size_t kept = 0;
+  for (size_t i = 0; i < stream->count; i++) {
+    if (i == index) continue;
+    if (i < index && (channel == 0 || stream->entries[i].channel == channel)) {
+      stream->lost++;
+      continue;
+    }
+    stream->entries[kept++] = stream->entries[i];
+  }
+  stream->count = kept;
+}
+
+// Caller holds the lock. Takes back the entry recorded at at_us, it was never sent
+static void cancel_outstanding(stream_t* stream, char channel, int64_t at_us) {
+  for (size_t i = stream->count; i > 0; i--) {
+    if (stream->entries[i - 1].channel == channel && stream->entries[i - 1].at_us == at_us) {
+      memmove(&stream->entries[i - 1], &stream->entries[i], (stream->count - i) * sizeof(outstanding_t));
+      stream->count--;
+      return;
+    }
+  }
+}
+
+static size_t build_frame(rmt_symbol_word_t* symbols, rf_light_message_t message) {
+  size_t n = 0;
+  for (int i = 0; i < RF_LIGHT_HEADER_SYMBOLS; i++) {
+    bool gap = i == RF_LIGHT_HEADER_SYMBOLS - 1;
+    symbols[n++] = rf_light_rx_symbol(RF_LIGHT_HEADER_DURATION_0, gap ? RF_LIGHT_HEADER_GAP_DURATION_1 : RF_LIGHT_HEADER_DURATION_1);
+  }
+  for (int bit = 0; bit < RF_LIGHT_PAYLOAD_SYMBOLS; bit++) {
+    bool one = message & (1 << bit);
+    uint32_t low = one ? RF_LIGHT_PAYLOAD_ONE_DURATION_1 : RF_LIGHT_PAYLOAD_ZERO_DURATION_1;
+    // the trailing delay follows the last bit
+    if (bit == RF_LIGHT_PAYLOAD_SYMBOLS - 1) low += RF_LIGHT_TRAILING_DELAY_US;
+    symbols[n++] = rf_light_rx_symbol(one ? RF_LIGHT_PAYLOAD_ONE_DURATION_0 : RF_LIGHT_PAYLOAD_ZERO_DURATION_0, low);
+  }
+  return n;
+}
+
+// Message in a frame from the encoder, through the same decoder as the RX path
+static bool read_tx_frame(const rmt_symbol_word_t* symbols, size_t num_symbols, rf_light_message_t* message) {
+  return rf_light_rx_decode_frame(symbols, num_symbols, message, 1) == 1;
+}
+
+// Every frame the emulated transmitter sends, on the TX scheduler task
+static void on_tx_frame(int gpio_num, const rmt_symbol_word_t* symbols, size_t num_symbols, int64_t start_us) {
+  rf_light_message_t message;
+  rf_light_payload_t payload;
+  if (!read_tx_frame(symbols, num_symbols, &message) || decode_rf_light_payload(message, &payload)) {
+    portENTER_CRITICAL(&lock);
+    tx_undecoded++;
+    portEXIT_CRITICAL(&lock);
+    return;
+  }
+
+  portENTER_CRITICAL(&lock);
+  // the scheduler sends the newest command of a channel, the ones before it were superseded
+  size_t i = commands.count;
+  while (i > 0) {
+    const outstanding_t* entry = &commands.entries[i - 1];
+    if (entry->channel == payload.channel && entry->on == payload.on && entry->at_us <= start_us) break;
+    i--;
+  }
+  if (i > 0) {
+    add_sample(&commands, start_us - commands.entries[i - 1].at_us);
+    remove_outstanding(&commands, i - 1, payload.channel);
+  } else {
+    commands.unmatched++;
+  }
+  portEXIT_CRITICAL(&lock);
+}
+
+static void on_state(char channel, bool on) {
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&lock);
+  // the dispatch loop and the publisher keep the order, so everything before it is gone
+  size_t i = 0;
+  while (i < frames.count && !(frames.entries[i].channel == channel && frames.entries[i].on == on)) i++;
+  if (i < frames.count) {
+    add_sample(&frames, now - frames.entries[i].at_us);
+    remove_outstanding(&frames, i, 0);
+  } else {
+    frames.unmatched++;
+  }
+  portEXIT_CRITICAL(&lock);
+}
+
+static void mqtt_event_handler(void* handler_args, esp_event_base_t base, int32_t event_id, void* event_data) {
+  esp_mqtt_event_handle_t event = event_data;
+  switch ((esp_mqtt_event_id_t) event_id) {
+  case MQTT_EVENT_CONNECTED:
+    esp_mqtt_client_subscribe(client, STATE_TOPIC_PREFIX "+" STATE_TOPIC_SUFFIX, 0);
+    break;
+  case MQTT_EVENT_SUBSCRIBED:
+    xEventGroupSetBits(events, SUBSCRIBED_BIT);
+    break;
+  case MQTT_EVENT_DISCONNECTED:
+    ESP_LOGW(TAG, "Disconnected from the broker");
+    break;
+  case MQTT_EVENT_DATA:
+    if (event->topic_len == STATE_TOPIC_LEN && strncmp(event->topic, STATE_TOPIC_PREFIX, strlen(STATE_TOPIC_PREFIX)) == 0) {
+      on_state(event->topic[strlen(STATE_TOPIC_PREFIX)], event->data_len == 2 && strncmp(event->data, "ON", 2) == 0);
+    }
+    break;
+  default: break;
+  }
+}
+
+static void send_command(uint32_t i) {
+  size_t c = i % 2;
+  bool on = (i / 2) % 2 == 0;
+  int64_t now = esp_timer_get_time();
+  // recorded first, the bridge may act on it before publish returns
+  portENTER_CRITICAL(&lock);
+  add_outstanding(&commands, command_channels[c], on, now);
+  portEXIT_CRITICAL(&lock);
+  if (esp_mqtt_client_publish(client, command_topics[c], on ? "ON" : "OFF", 0, 0, false) < 0) {
+    commands_failed++;
+  } else {
+    commands_sent++;
+  }
+}
+
+static void inject_frame(uint32_t i, gpio_num_t gpio_num) {
+  size_t f = i % NUM_FRAMES;
+  char channel = frame_channels[f / 2];
+  int64_t now = esp_timer_get_time();
+  // recorded first, the publish may come back before the injection returns
+  portENTER_CRITICAL(&lock);
+  add_outstanding(&frames, channel, f % 2 == 0, now);
+  portEXIT_CRITICAL(&lock);
+
+  esp_err_t err = rmt_emu_rx_inject(gpio_num, frame_symbols[f], frame_num_symbols[f]);
+  if (err == ESP_OK) {
+    frames_injected++;
+    return;
+  }
+  // never made it into the bridge, so it is not waiting for a publish either
+  portENTER_CRITICAL(&lock);
+  cancel_outstanding(&frames, channel, now);
+  portEXIT_CRITICAL(&lock);
+  frames_not_armed++;
+}
+
+typedef struct {
+  size_t count;
+  uint32_t p50, p90, p99, max;
+} percentiles_t;
+
+static percentiles_t percentiles(stream_t* stream, uint32_t* scratch) {
+  portENTER_CRITICAL(&lock);
+  size_t n = stream->num_samples;
+  portEXIT_CRITICAL(&lock);
+  // samples are only appended, the first n do not change
+  memcpy(scratch, stream->samples, n * sizeof(uint32_t));
+
+  percentiles_t p = { .count = n };
+  if (n == 0) return p;
+  sample_stats_sort(scratch, n);
+  p.p50 = scratch[n * 50 / 100];
+  p.p90 = scratch[n * 90 / 100];
+  p.p99 = scratch[n * 99 / 100];
+  p.max = scratch[n - 1];
+  return p;
+}
+
+static void report(int64_t elapsed_ms, uint32_t* scratch, bool final, int cmd_rate, int rf_rate) {
+  percentiles_t cmd = percentiles(&commands, scratch);
+  percentiles_t rx = percentiles(&frames, scratch);
+  event_queue_stats_t pool;
+  event_queue_get_stats(&pool);
+  mqtt_publish_stats_t publish;
+  mqtt_publish_get_stats(&publish);
+  rmt_emu_stats_t rmt;
+  rmt_emu_get_stats(&rmt);
+
+  rf_light_tx_sched_stats_t sched = {0};
+  for (size_t i = 0; i < loadgen_radios->num_radios; i++) {
+    rf_light_tx_sched_t* radio_sched = &loadgen_radios->radios[i].tx_sched;
+    if (radio_sched->task == NULL) continue;
+    rf_light_tx_sched_stats_t s;
+    rf_light_tx_sched_get_stats(radio_sched, &s);
+    sched.commands += s.commands;
+    sched.frames += s.frames;
+    sched.superseded += s.superseded;
+    sched.truncated += s.truncated;
+    sched.dropped += s.dropped;
+    sched.errors += s.errors;
+  }
+
+  portENTER_CRITICAL(&lock);
+  uint32_t cmd_matched = commands.matched;
+  uint32_t cmd_superseded = commands.lost;
+  size_t cmd_pending = commands.count;
+  uint32_t rx_matched = frames.matched;
+  uint32_t rx_lost = frames.lost;
+  size_t rx_pending = frames.count;
+  portEXIT_CRITICAL(&lock);
+
+  printf("--- %" PRIi64 " s\n", elapsed_ms / 1000);
+  printf("command -> TX   %6zu | p50 %7" PRIu32 " p90 %7" PRIu32 " p99 %7" PRIu32 " max %7" PRIu32 " us | sent %" PRIu32 " failed %" PRIu32 " superseded %" PRIu32 " pending %zu\n",
+         cmd.count, cmd.p50, cmd.p90, cmd.p99, cmd.max, commands_sent, commands_failed, cmd_superseded, cmd_pending);
+  printf("RX -> publish   %6zu | p50 %7" PRIu32 " p90 %7" PRIu32 " p99 %7" PRIu32 " max %7" PRIu32 " us | injected %" PRIu32 " not armed %" PRIu32 " lost %" PRIu32 " pending %zu\n",
+         rx.count, rx.p50, rx.p90, rx.p99, rx.max, frames_injected, frames_not_armed, rx_lost, rx_pending);
+  printf("event pool      high water %" PRIu32 "/%d in use %" PRIu32 " exhausted %" PRIu32 "\n",
+         pool.high_water, EVENT_POOL_SIZE, pool.in_use, pool.exhausted);
+  printf("publish queue   high water %" PRIu32 "/%d published %" PRIu32 " dropped %" PRIu32 " failed %" PRIu32 "\n",
+         publish.queue_high_water, MQTT_PUBLISH_QUEUE_LENGTH, publish.published, publish.dropped, publish.failed);
+  printf("TX scheduler    commands %" PRIu32 " frames %" PRIu32 " superseded %" PRIu32 " truncated %" PRIu32 " dropped %" PRIu32 " errors %" PRIu32 "\n",
+         sched.commands, sched.frames, sched.superseded, sched.truncated, sched.dropped, sched.errors);
+  printf("RMT             tx frames %" PRIu32 " tx undecoded %" PRIu32 " rx frames %" PRIu32 " rx not armed %" PRIu32 "\n",
+         rmt.tx_frames, tx_undecoded, rmt.rx_frames, rmt.rx_not_armed);
+
+  if (final) {
+    printf("RESULT cmd_rate=%d rf_rate=%d seconds=%" PRIi64 " commands=%" PRIu32 " cmd_matched=%" PRIu32 " cmd_p50_us=%" PRIu32 " cmd_p90_us=%" PRIu32
+           " cmd_p99_us=%" PRIu32 " cmd_max_us=%" PRIu32 " cmd_superseded=%" PRIu32 " cmd_pending=%zu frames=%" PRIu32 " rx_matched=%" PRIu32
+           " rx_p50_us=%" PRIu32 " rx_p90_us=%" PRIu32 " rx_p99_us=%" PRIu32 " rx_max_us=%" PRIu32 " rx_lost=%" PRIu32 " rx_pending=%zu rx_not_armed=%" PRIu32
+           " pool_high_water=%" PRIu32 " pool_exhausted=%" PRIu32 " publish_high_water=%" PRIu32 " publish_dropped=%" PRIu32
+           " sched_superseded=%" PRIu32 " sched_truncated=%" PRIu32 " sched_dropped=%" PRIu32 " tx_undecoded=%" PRIu32 "\n",
+           cmd_rate, rf_rate, elapsed_ms / 1000, commands_sent, cmd_matched, cmd.p50, cmd.p90, cmd.p99, cmd.max, cmd_superseded, cmd_pending, frames_injected, rx_matched,
+           rx.p50, rx.p90, rx.p99, rx.max, rx_lost, rx_pending, frames_not_armed, pool.high_water, pool.exhausted, publish.queue_high_water, publish.dropped,
+           sched.superseded, sched.truncated, sched.dropped, tx_undecoded);
+  }
+  fflush(stdout);
+}
+
+static void loadgen_task(void* arg) {
+  int cmd_rate = env_int("LOADGEN_CMD_RATE", LOADGEN_DEFAULT_CMD_RATE);
+  int rf_rate = env_int("LOADGEN_RF_RATE", LOADGEN_DEFAULT_RF_RATE);
+  int seconds = env_int("LOADGEN_SECONDS", LOADGEN_DEFAULT_SECONDS);
+  uint32_t* scratch = malloc(LOADGEN_MAX_SAMPLES * sizeof(uint32_t));
+  assert(scratch);
+
+  for (size_t f = 0; f < NUM_FRAMES; f++) {
+    rf_light_payload_t payload = { .channel = frame_channels[f / 2], .on = f % 2 == 0 };
+    frame_num_symbols[f] = build_frame(frame_symbols[f], encode_rf_light_payload(&payload));
+  }
+  radio_t* rx_radio = radio_manager_rx_radio(loadgen_radios);
+  assert(rx_radio);
+
+  xEventGroupWaitBits(events, SUBSCRIBED_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+  vTaskDelay(pdMS_TO_TICKS(SETTLE_MS));
+  ESP_LOGI(TAG, "%d commands/s, %d frames/s for %d s", cmd_rate, rf_rate, seconds);
+
+  int64_t started = esp_timer_get_time();
+  int64_t end = started + (int64_t) seconds * 1000000;
+  int64_t next_command = started;
+  int64_t next_frame = started;
+  int64_t next_report = started + LOADGEN_REPORT_MS * 1000;
+  uint32_t command = 0;
+  uint32_t frame = 0;
+
+  while (1) {
+    int64_t now = esp_timer_get_time();
+    if (now >= end) break;
+    // catch up after a late wakeup, so the rate holds on average
+    while (cmd_rate > 0 && next_command <= now) {
+      send_command(command++);
+      next_command += 1000000 / cmd_rate;
+    }
+    while (rf_rate > 0 && next_frame <= now) {
+      inject_frame(frame++, rx_radio->config.pins.gdo2_io_num);
+      next_frame += 1000000 / rf_rate;
+    }
+    if (now >= next_report) {
+      report((now - started) / 1000, scratch, false, cmd_rate, rf_rate);
+      next_report += LOADGEN_REPORT_MS * 1000;
+    }
+    vTaskDelay(1);
+  }
+
+  vTaskDelay(pdMS_TO_TICKS(DRAIN_MS));
+  report((esp_timer_get_time() - started) / 1000, scratch, true, cmd_rate, rf_rate);
+  exit(0);
+}
+
+esp_err_t loadgen_start(radio_manager_t* radios) {
+  loadgen_radios = radios;
+  commands.samples = malloc(LOADGEN_MAX_SAMPLES * sizeof(uint32_t));
+  frames.samples = malloc(LOADGEN_MAX_SAMPLES * sizeof(uint32_t));
+  ESP_RETURN_ON_FALSE(commands.samples && frames.samples, ESP_ERR_NO_MEM, TAG, "No memory for samples");
+  events = xEventGroupCreate();
+  ESP_RETURN_ON_FALSE(events, ESP_ERR_NO_MEM, TAG, "Failed to create event group");
+  rmt_emu_set_tx_hook(on_tx_frame);
+
+  esp_mqtt_client_config_t mqtt_cfg = {
+    .broker.address.uri = CONFIG_MQTT_BROKER_ADDRESS,
+    .credentials = {
+      // next to the bridge's own session on the same broker
+      .client_id = "rf_bridge_loadgen",
+      .username = CONFIG_MQTT_USERNAME,
+      .authentication.password = CONFIG_MQTT_PASSWORD,
+    },
+  };
+  client = esp_mqtt_client_init(&mqtt_cfg);
+  ESP_RETURN_ON_FALSE(client, ESP_FAIL, TAG, "Failed to create MQTT client");
+  ESP_RETURN_ON_ERROR(esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, NULL), TAG, "Failed to register MQTT events");
+  ESP_RETURN_ON_ERROR(esp_mqtt_client_start(client), TAG, "Failed to start MQTT client");
+  ESP_RETURN_ON_FALSE(xTaskCreate(loadgen_task, "loadgen", 8192, NULL, 2, NULL) == pdPASS, ESP_ERR_NO_MEM, TAG, "Failed to create load generator task");
+  return ESP_OK;
+}
+
+#endif
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "radio_manager.h"
+
+// Load generator for the host build.
+//
+// A second MQTT client in the same process floods light_channel_{a,e}/set and the emulated
+// receiver gets synthetic RF frames, while the generator times each command to the start of
+// its first frame on the emulated transmitter, and each injected frame to its state publish.
+// Rates and duration come from the environment:
+//
+//   LOADGEN_CMD_RATE  commands per second, 0 for none (default 20)
+//   LOADGEN_RF_RATE   received frames per second, 0 for none (default 20)
+//   LOADGEN_SECONDS   how long to generate load (default 30)
+//
+// A report goes to stdout every LOADGEN_REPORT_MS, the last one ends with a single
+// "RESULT key=value ..." line for scripts, then the process exits.
+
+#define LOADGEN_DEFAULT_CMD_RATE 20
+#define LOADGEN_DEFAULT_RF_RATE 20
+#define LOADGEN_DEFAULT_SECONDS 30
+#define LOADGEN_REPORT_MS 5000
+// latency samples kept per stream
+#define LOADGEN_MAX_SAMPLES 65536
+// commands and frames waiting for their TX or publish, older ones are counted lost
+#define LOADGEN_MAX_OUTSTANDING 256
+
+#ifdef CONFIG_RF_BRIDGE_LOADGEN
+
+/**
+ * @brief Connect the generator's MQTT client and start generating once it is subscribed
+ *
+ * Call after the radios are started, frames are injected on the first receiving radio.
+ */
+esp_err_t loadgen_start(radio_manager_t* radios);
+
+#else
+
+static inline esp_err_t loadgen_start(radio_manager_t* radios) { return ESP_OK; }
+
+#endif
@@ -14,34 +14,112 @@
 
 #include "mqtt.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <stddef.h>
+#include <inttypes.h>
 #include <string.h>
 
+#include <ctype.h>
+#include "esp_check.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_tls.h"
+#include "esp_transport_ssl.h"
 #include "event_queue.h"
 #include "mqtt_client.h"
+#include "ota.h"
 #include "portmacro.h"
+#include "profiling.h"
+#include "mqtt_publish.h"
+#include "rf_arbiter.h"
+#include "rf_rules.h"
+#include "wifi.h"
+#include "wifi_power.h"
 #include <strings.h>
 #include <sys/param.h>
 
-#define MQTT_PREFIX "devices/rf_bridge_2/"
 #define MQTT_SET_LIGHT_PREFIX MQTT_PREFIX "light_channel_"
 #define MQTT_SET_LIGHT_SUFFIX "/set"
-// devices/rf_bridge_2/light_channel_
-#define MQTT_SET_LIGHT_TOPIC_LEN_PREFIX 34
+// devices/<bridge id>/light_channel_
+#define MQTT_SET_LIGHT_TOPIC_LEN_PREFIX (sizeof(MQTT_SET_LIGHT_PREFIX) - 1)
 // /set
 #define MQTT_SET_LIGHT_TOPIC_LEN_SUFFIX 4
 #define MQTT_SET_LIGHT_TOPIC_LEN (MQTT_SET_LIGHT_TOPIC_LEN_PREFIX + 1 + MQTT_SET_LIGHT_TOPIC_LEN_SUFFIX)
+#define MQTT_SET_RADIO_PROFILE_TOPIC MQTT_PREFIX "radio_profile/set"
+#define MQTT_SET_LEARN_TOPIC MQTT_PREFIX "learn/set"
+#define MQTT_BIND_CODE_TOPIC MQTT_PREFIX "learn/bind"
+#define MQTT_SET_LIGHTS_TOPIC MQTT_PREFIX "lights/set"
 
 static const char *TAG = "mqtts_example";
 
 extern const uint8_t isrgrootx1_pem_start[]   asm("_binary_isrgrootx1_pem_start");
 extern const uint8_t isrgrootx1_pem_end[]   asm("_binary_isrgrootx1_pem_end");
 
+// Reconnect instrumentation, all esp_timer timestamps in us
+static int64_t disconnected_at;
+static int64_t connect_started_at;
+static int64_t connected_at;
+static int pending_subscriptions;
+
 extern const char discovery_start[]   asm("_binary_discovery_payload_json_start");
 extern const char discovery_end[]   asm("_binary_discovery_payload_json_end");
 
+#define DISCOVERY_TOPIC "homeassistant/device/" MQTT_HA_DEVICE_ID "/config"
+
+// placeholders in discovery_payload.json
+static const struct {
+  const char* placeholder;
+  const char* value;
+} discovery_substitutions[] = {
+  { "${ID}", CONFIG_RF_BRIDGE_ID },
+  { "${DEVICE_ID}", MQTT_HA_DEVICE_ID },
+  { "${DEVICE_NAME}", MQTT_HA_DEVICE_NAME },
+  { "${UNIQUE_ID_PREFIX}", MQTT_HA_UNIQUE_ID_PREFIX },
+};
+
+// Commands are dropped rather than blocking the MQTT task when the event pool is exhausted
+static event_queue_message_t* claim_event(event_queue_message_type_t type) {
+  event_queue_message_t* evt = event_queue_claim(type);
+  if (evt == NULL) ESP_LOGW(TAG, "Event pool exhausted, dropping command");
+  return evt;
+}
+
+// Index of the placeholder that starts at p, -1 for none
+static int discovery_placeholder(const char* p) {
+  for (int i = 0; i < sizeof(discovery_substitutions) / sizeof(discovery_substitutions[0]); i++) {
+    if (strncmp(p, discovery_substitutions[i].placeholder, strlen(discovery_substitutions[i].placeholder)) == 0) return i;
+  }
+  return -1;
+}
+
+// Copies in to out with the placeholders filled in, out NULL only measures. Returns the length.
+static size_t substitute_discovery(const char* in, char* out) {
+  size_t len = 0;
+  while (*in) {
+    int i = *in == '$' ? discovery_placeholder(in) : -1;
+    if (i < 0) {
+      if (out) out[len] = *in;
+      len++;
+      in++;
+      continue;
+    }
+    size_t value_len = strlen(discovery_substitutions[i].value);
+    if (out) memcpy(out + len, discovery_substitutions[i].value, value_len);
+    len += value_len;
+    in += strlen(discovery_substitutions[i].placeholder);
+  }
+  if (out) out[len] = '\0';
+  return len;
+}
+
+// The discovery document with this bridge's topics and Home Assistant ids, free() it after use
+static char* discovery_payload(void) {
+  char* payload = malloc(substitute_discovery(discovery_start, NULL) + 1);
+  if (payload) substitute_discovery(discovery_start, payload);
+  return payload;
+}
+
 /*
  * @brief Event handler registered to receive MQTT events
  *
@@ -55,32 +133,119 @@ extern const char discovery_end[]   asm("_binary_discovery_payload_json_end");
 static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
 {
   //ESP_LOGD(TAG, "Event dispatched from event loop base=%s, event_id=%" PRIi32, base, event_id);
+  PROFILING_BEGIN(handler);
   esp_mqtt_event_handle_t event = event_data;
   esp_mqtt_client_handle_t client = event->client;
   QueueHandle_t recv_queue = (QueueHandle_t) handler_args;
 
   switch ((esp_mqtt_event_id_t)event_id) {
+  case MQTT_EVENT_BEFORE_CONNECT:
+    connect_started_at = esp_timer_get_time();
+    break;
+
   case MQTT_EVENT_CONNECTED:
+    connected_at = esp_timer_get_time();
     // subscribe to topics
-    esp_mqtt_client_subscribe(client, MQTT_PREFIX "onboard_led/set", 0);
-    esp_mqtt_client_subscribe(client, MQTT_PREFIX "light_channel_e/set", 0);
-    esp_mqtt_client_subscribe(client, MQTT_PREFIX "light_channel_a/set", 0);
+    pending_subscriptions = 0;
+    if (esp_mqtt_client_subscribe(client, MQTT_PREFIX "onboard_led/set", 0) >= 0) pending_subscriptions++;
+    if (esp_mqtt_client_subscribe(client, MQTT_PREFIX "light_channel_e/set", 0) >= 0) pending_subscriptions++;
+    if (esp_mqtt_client_subscribe(client, MQTT_PREFIX "light_channel_a/set", 0) >= 0) pending_subscriptions++;
+    if (esp_mqtt_client_subscribe(client, MQTT_SET_RADIO_PROFILE_TOPIC, 0) >= 0) pending_subscriptions++;
+    if (esp_mqtt_client_subscribe(client, MQTT_SET_LEARN_TOPIC, 0) >= 0) pending_subscriptions++;
+    if (esp_mqtt_client_subscribe(client, MQTT_BIND_CODE_TOPIC, 0) >= 0) pending_subscriptions++;
+    if (esp_mqtt_client_subscribe(client, MQTT_SET_LIGHTS_TOPIC, 0) >= 0) pending_subscriptions++;
+    pending_subscriptions += ota_subscribe(client);
+    pending_subscriptions += rf_arbiter_subscribe(client);
+    pending_subscriptions += rf_rules_subscribe(client);
+    pending_subscriptions += wifi_power_subscribe(client);
 
-    ESP_LOGI(TAG, "Connected");
+    // a resumed session skips the certificate chain verification, which shows up here
+    ESP_LOGI(TAG, "Connected | TLS + CONNACK took %" PRIi64 " ms", (connected_at - connect_started_at) / 1000);
+    mqtt_publish_set_connected(true);
+    ota_set_connected(true);
+    break;
+
+  case MQTT_EVENT_SUBSCRIBED:
+    if (pending_subscriptions > 0 && --pending_subscriptions == 0) {
+      int64_t now = esp_timer_get_time();
+      // first connection after boot has no disconnect time
+      int64_t down_ms = disconnected_at ? (now - disconnected_at) / 1000 : -1;
+      int64_t connect_ms = (connected_at - connect_started_at) / 1000;
+      int64_t subscribe_ms = (now - connected_at) / 1000;
+      ESP_LOGI(TAG, "Subscribed | %" PRIi64 " ms since disconnect | connect %" PRIi64 " ms | subscribe %" PRIi64 " ms", down_ms, connect_ms, subscribe_ms);
+
+      // the Wi-Fi part of the outage, and of the boot
+      wifi_stats_t wifi;
+      wifi_get_stats(&wifi);
+
+      char stats[160];
+      int len = snprintf(stats, sizeof(stats), "{\"down_ms\":%" PRIi64 ",\"connect_ms\":%" PRIi64 ",\"subscribe_ms\":%" PRIi64 ",\"wifi_ms\":%" PRIi64 ",\"boot_ip_ms\":%" PRIi64 "}",
+                         down_ms, connect_ms, subscribe_ms, wifi.disconnect_to_ip_ms, wifi.boot_to_ip_ms);
+      mqtt_publish_enqueue(MQTT_PREFIX "reconnect", stats, len, 0, false);
+    }
+    break;
+
+  case MQTT_EVENT_DISCONNECTED:
+    ESP_LOGI(TAG, "Disconnected");
+    disconnected_at = esp_timer_get_time();
+    mqtt_publish_set_connected(false);
+    ota_set_connected(false);
     break;
 
   case MQTT_EVENT_DATA:
     ESP_LOGD(TAG, "MQTT message. | Message(%d): %.*s | Topic(%d): %.*s", event->data_len, event->data_len, event->data,  event->topic_len, event->topic_len, event->topic);
+    // the latency probe coming back is not activity
+    if (wifi_power_handle_message(event->topic, event->topic_len, event->data, event->data_len)) break;
+    wifi_power_activity();
+    // firmware chunks go straight to the update task
+    if (ota_handle_message(event->topic, event->topic_len, event->data, event->data_len, event->total_data_len)) break;
+    if (rf_arbiter_handle_message(recv_queue, event->topic, event->topic_len, event->data, event->data_len)) break;
+    if (rf_rules_handle_message(recv_queue, event->topic, event->topic_len, event->data, event->data_len, event->total_data_len)) break;
     // check equal to 39 chars
     if (event->topic_len == MQTT_SET_LIGHT_TOPIC_LEN && strncasecmp(event->topic, MQTT_SET_LIGHT_PREFIX, MQTT_SET_LIGHT_TOPIC_LEN_PREFIX) == 0) {
-        char light_id = event->topic[MQTT_SET_LIGHT_TOPIC_LEN_PREFIX];
-        bool turn_on = event->data_len == 2 && strncasecmp(event->data, "on", 2) == 0;
-        event_queue_message_t evt = {
-            .data.mqtt_message.light_id = light_id,
-            .data.mqtt_message.turn_on = turn_on,
-            .type = EVENT_QUEUE_MESSAGE_MQTT
-        };
-        xQueueSend(recv_queue, &evt, portMAX_DELAY);
+        event_queue_message_t* evt = claim_event(EVENT_QUEUE_MESSAGE_MQTT);
+        if (evt) {
+          evt->data.mqtt_message.light_id = event->topic[MQTT_SET_LIGHT_TOPIC_LEN_PREFIX];
+          evt->data.mqtt_message.turn_on = event->data_len == 2 && strncasecmp(event->data, "on", 2) == 0;
+          event_queue_send(recv_queue, evt);
+        }
+    } else if (event->topic_len == strlen(MQTT_SET_LIGHTS_TOPIC) && strncmp(event->topic, MQTT_SET_LIGHTS_TOPIC, event->topic_len) == 0) {
+        // parsed straight into the event, a scene is one event and one submission
+        event_queue_message_t* evt = claim_event(EVENT_QUEUE_MESSAGE_MQTT_BULK);
+        if (evt) {
+          if (mqtt_parse_bulk(event->data, event->data_len, &evt->data.mqtt_bulk) == ESP_OK) {
+            event_queue_send(recv_queue, evt);
+          } else {
+            event_queue_release(evt);
+          }
+        }
+    } else if (event->topic_len == strlen(MQTT_SET_RADIO_PROFILE_TOPIC) && strncmp(event->topic, MQTT_SET_RADIO_PROFILE_TOPIC, event->topic_len) == 0) {
+        int profile = cc1101_profile_find(event->data, event->data_len);
+        if (profile < 0) {
+          ESP_LOGW(TAG, "Unknown radio profile %.*s", event->data_len, event->data);
+        } else {
+          event_queue_message_t* evt = claim_event(EVENT_QUEUE_MESSAGE_RADIO_PROFILE);
+          if (evt) {
+            evt->data.radio_profile = profile;
+            event_queue_send(recv_queue, evt);
+          }
+        }
+    } else if (event->topic_len == strlen(MQTT_SET_LEARN_TOPIC) && strncmp(event->topic, MQTT_SET_LEARN_TOPIC, event->topic_len) == 0) {
+        event_queue_message_t* evt = claim_event(EVENT_QUEUE_MESSAGE_LEARN);
+        if (evt) {
+          evt->data.learning = event->data_len == 2 && strncasecmp(event->data, "on", 2) == 0;
+          event_queue_send(recv_queue, evt);
+        }
+    } else if (event->topic_len == strlen(MQTT_BIND_CODE_TOPIC) && strncmp(event->topic, MQTT_BIND_CODE_TOPIC, event->topic_len) == 0) {
+        // the registry itself is only touched from the dispatch loop
+        rf_code_bind_t bind;
+        if (rf_code_registry_parse_bind(event->data, event->data_len, &bind) == ESP_OK) {
+          event_queue_message_t* evt = claim_event(EVENT_QUEUE_MESSAGE_BIND_CODE);
+          if (evt) {
+            evt->data.bind_code = bind;
+            event_queue_send(recv_queue, evt);
+          }
+        }
     }
     break;
 
@@ -100,12 +265,60 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
   default: break;
   }
 
+  PROFILING_END(handler, PROFILING_SECTION_MQTT_HANDLER);
+}
+
+esp_err_t mqtt_parse_bulk(const char* data, size_t len, mqtt_bulk_message_t* bulk) {
+  bulk->count = 0;
+  size_t pos = 0;
+  while (pos < len) {
+    if (data[pos] == ',' || data[pos] == ' ') {
+      pos++;
+      continue;
+    }
+    const char* item = &data[pos];
+    while (pos < len && data[pos] != ',' && data[pos] != ' ') pos++;
+    const char* item_end = &data[pos];
+
+    ESP_RETURN_ON_FALSE(bulk->count < MQTT_BULK_MAX_COMMANDS, ESP_ERR_INVALID_SIZE, TAG, "More than %d commands", MQTT_BULK_MAX_COMMANDS);
+    char channel = tolower((unsigned char) item[0]);
+    ESP_RETURN_ON_FALSE(item_end - item >= 4 && item[1] == ':' && mqtt_light_state_topic(channel) != NULL, ESP_ERR_INVALID_ARG, TAG,
+                        "Invalid command %.*s", (int) (item_end - item), item);
+
+    const char* state = item + 2;
+    const char* state_end = memchr(state, ':', item_end - state);
+    if (state_end == NULL) state_end = item_end;
+    bool on = state_end - state == 2 && strncasecmp(state, "on", 2) == 0;
+    ESP_RETURN_ON_FALSE(on || (state_end - state == 3 && strncasecmp(state, "off", 3) == 0), ESP_ERR_INVALID_ARG, TAG,
+                        "Invalid state in %.*s", (int) (item_end - item), item);
+
+    // 0 leaves it to the channel policy
+    uint32_t repeats = 0;
+    if (state_end < item_end) {
+      const char* digits = state_end + 1;
+      ESP_RETURN_ON_FALSE(digits < item_end && item_end - digits <= 3, ESP_ERR_INVALID_ARG, TAG, "Invalid repeats in %.*s", (int) (item_end - item), item);
+      for (const char* c = digits; c < item_end; c++) {
+        ESP_RETURN_ON_FALSE(isdigit((unsigned char) *c), ESP_ERR_INVALID_ARG, TAG, "Invalid repeats in %.*s", (int) (item_end - item), item);
+        repeats = repeats * 10 + (*c - '0');
+      }
+      ESP_RETURN_ON_FALSE(repeats >= 1 && repeats <= UINT8_MAX, ESP_ERR_INVALID_ARG, TAG, "Repeats out of range in %.*s", (int) (item_end - item), item);
+    }
+
+    bulk->commands[bulk->count++] = (rf_light_tx_command_t) {
+      .payload = { .channel = channel, .on = on },
+      .repeats = repeats,
+    };
+  }
+  ESP_RETURN_ON_FALSE(bulk->count > 0, ESP_ERR_INVALID_ARG, TAG, "No commands");
+  return ESP_OK;
 }
 
 esp_mqtt_client_handle_t mqtt_app_start(QueueHandle_t recv_queue)
 {
-  const esp_mqtt_client_config_t mqtt_cfg = {
+  esp_mqtt_client_config_t mqtt_cfg = {
     .credentials = {
+      // bridges sharing a broker must not take over each other's session
+      .client_id = CONFIG_RF_BRIDGE_ID,
       .username = CONFIG_MQTT_USERNAME,
       .authentication = {
         .password = CONFIG_MQTT_PASSWORD
@@ -122,13 +335,49 @@ esp_mqtt_client_handle_t mqtt_app_start(QueueHandle_t recv_queue)
 
   assert(recv_queue);
 
+#ifdef CONFIG_RF_BRIDGE_OTA
+  // a whole update chunk has to arrive in one piece
+  mqtt_cfg.buffer.size = 2048;
+#endif
+
+#ifdef CONFIG_MQTT_TLS_GLOBAL_CA_STORE
+  // parse the CA certificate once here instead of on every handshake
+  ESP_ERROR_CHECK(esp_tls_init_global_ca_store());
+  ESP_ERROR_CHECK(esp_tls_set_global_ca_store(isrgrootx1_pem_start, isrgrootx1_pem_end - isrgrootx1_pem_start));
+  mqtt_cfg.broker.verification.certificate = NULL;
+  mqtt_cfg.broker.verification.use_global_ca_store = true;
+#endif
+
+#ifdef CONFIG_MQTT_TLS_SESSION_TICKETS
+  // esp-mqtt does not expose session tickets, so we create the TLS transport ourselves.
+  // It lives as long as the client, so the cached session is reused on every reconnect.
+  esp_transport_handle_t transport = esp_transport_ssl_init();
+  assert(transport);
+  esp_transport_set_default_port(transport, 8883);
+#ifdef CONFIG_MQTT_TLS_GLOBAL_CA_STORE
+  esp_transport_ssl_enable_global_ca_store(transport);
+#else
+  esp_transport_ssl_set_cert_data(transport, (const char*) isrgrootx1_pem_start, isrgrootx1_pem_end - isrgrootx1_pem_start);
+#endif
+  esp_transport_ssl_set_common_name(transport, CONFIG_MQTT_CERT_COMMON_NAME);
+  esp_transport_ssl_session_tickets_enable(transport);
+  mqtt_cfg.network.transport = transport;
+#endif
+
   esp_mqtt_client_handle_t client = esp_mqtt_client_init(&mqtt_cfg);
   /* The last argument may be used to pass data to the event handler, in this example mqtt_event_handler */
   esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, recv_queue);
+  ESP_ERROR_CHECK(mqtt_publish_start(client));
   esp_mqtt_client_start(client);
 
   // MQTT discovery
-  esp_mqtt_client_publish(client, "homeassistant/device/rf-bridge-2/config", discovery_start, 0, 0, 0);
+  char* discovery = discovery_payload();
+  if (discovery) {
+    esp_mqtt_client_publish(client, DISCOVERY_TOPIC, discovery, 0, 0, 0);
+    free(discovery);
+  } else {
+    ESP_LOGE(TAG, "No memory for the discovery payload");
+  }
 
   return client;
 }
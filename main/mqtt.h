@@ -1,12 +1,45 @@
 #pragma once
+#include "sdkconfig.h"
 #include "freertos/idf_additions.h"
 #include "mqtt_client.h"
+#include "rf_light_tx_sched.h"
 
 #define MQTT_MESSAGE_QUEUE_LENGTH 4
 
+// every bridge on a broker has its own topics, so each only acts on its own commands
+#define MQTT_PREFIX "devices/" CONFIG_RF_BRIDGE_ID "/"
+
+// Home Assistant ids. With the default bridge name they are the ones the first bridge always
+// had, other bridges get their name in them.
+#ifdef CONFIG_RF_BRIDGE_LEGACY_HA_IDS
+#define MQTT_HA_DEVICE_ID "rf-bridge-2"
+#define MQTT_HA_DEVICE_NAME "RF Bridge 2"
+#define MQTT_HA_UNIQUE_ID_PREFIX ""
+#else
+#define MQTT_HA_DEVICE_ID CONFIG_RF_BRIDGE_ID
+#define MQTT_HA_DEVICE_NAME "RF Bridge " CONFIG_RF_BRIDGE_ID
+#define MQTT_HA_UNIQUE_ID_PREFIX CONFIG_RF_BRIDGE_ID "_"
+#endif
+
 typedef struct {
     char light_id;
     bool turn_on;
 } mqtt_message_t;
 
+// Several channels from lights/set, submitted to the TX scheduler as one unit
+#define MQTT_BULK_MAX_COMMANDS RF_LIGHT_TX_SCHED_MAX_PENDING
+_Static_assert(MQTT_BULK_MAX_COMMANDS <= 32, "The accepted commands of a bulk message are a 32 bit mask");
+
+typedef struct {
+    uint8_t count;
+    rf_light_tx_command_t commands[MQTT_BULK_MAX_COMMANDS];
+} mqtt_bulk_message_t;
+
+/**
+ * @brief Parse a lights/set payload, "<channel>:<on|off>[:<repeats>]" separated by commas or spaces
+ *
+ * For example "a:on,e:off:5". Repeats default to the channel policy.
+ */
+esp_err_t mqtt_parse_bulk(const char* data, size_t len, mqtt_bulk_message_t* bulk);
+
 esp_mqtt_client_handle_t mqtt_app_start(QueueHandle_t recv_queue);
@@ -0,0 +1,135 @@
+#include "mqtt_publish.h"
+
+#include <string.h>
+#include <inttypes.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "mqtt.h"
+
+#define TAG "mqtt-publish"
+
+typedef struct {
+  char topic[MQTT_PUBLISH_MAX_TOPIC];
+  int64_t enqueued_at;
+  uint8_t qos;
+  bool retain;
+  uint8_t len;
+  char payload[MQTT_PUBLISH_MAX_PAYLOAD];
+} mqtt_publish_item_t;
+
+static QueueHandle_t publish_queue;
+static esp_mqtt_client_handle_t publish_client;
+static volatile bool publish_connected;
+static volatile mqtt_publish_probe_t publish_probe;
+
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static mqtt_publish_stats_t stats = { .latency_min_us = UINT32_MAX };
+
+const char* mqtt_light_state_topic(char channel) {
+  switch (channel) {
+  case 'a': return MQTT_PREFIX "light_channel_a/state";
+  case 'd': return MQTT_PREFIX "light_channel_d/state";
+  case 'e': return MQTT_PREFIX "light_channel_e/state";
+  default: return NULL;
+  }
+}
+
+static void publish_task(void* arg) {
+  mqtt_publish_item_t item;
+
+  while (1) {
+    if (!xQueueReceive(publish_queue, &item, portMAX_DELAY)) continue;
+
+    int msg_id;
+    bool deferred = !publish_connected;
+    if (deferred) {
+      // keep it in the client outbox until we reconnect instead of blocking here
+      msg_id = esp_mqtt_client_enqueue(publish_client, item.topic, item.payload, item.len, item.qos, item.retain, true);
+    } else {
+      msg_id = esp_mqtt_client_publish(publish_client, item.topic, item.payload, item.len, item.qos, item.retain);
+    }
+    uint32_t latency = esp_timer_get_time() - item.enqueued_at;
+
+    portENTER_CRITICAL(&stats_lock);
+    if (msg_id < 0) {
+      stats.failed++;
+    } else if (deferred) {
+      stats.deferred++;
+    } else {
+      stats.published++;
+      stats.latency_total_us += latency;
+      if (latency < stats.latency_min_us) stats.latency_min_us = latency;
+      if (latency > stats.latency_max_us) stats.latency_max_us = latency;
+    }
+    portEXIT_CRITICAL(&stats_lock);
+
+    if (msg_id < 0) ESP_LOGW(TAG, "Failed to publish to %s", item.topic);
+
+    mqtt_publish_probe_t probe = publish_probe;
+    if (probe) probe(item.topic, latency, msg_id >= 0 && !deferred);
+  }
+}
+
+esp_err_t mqtt_publish_start(esp_mqtt_client_handle_t client) {
+  publish_client = client;
+  publish_queue = xQueueCreate(MQTT_PUBLISH_QUEUE_LENGTH, sizeof(mqtt_publish_item_t));
+  ESP_RETURN_ON_FALSE(publish_queue, ESP_ERR_NO_MEM, TAG, "Failed to create publish queue");
+  ESP_RETURN_ON_FALSE(xTaskCreate(publish_task, "mqtt_publish", 4096, NULL, 1, NULL) == pdPASS, ESP_ERR_NO_MEM, TAG, "Failed to create publish task");
+  return ESP_OK;
+}
+
+esp_err_t mqtt_publish_enqueue(const char* topic, const char* payload, size_t len, int qos, bool retain) {
+  if (len == 0) len = strlen(payload);
+  if (len > MQTT_PUBLISH_MAX_PAYLOAD) return ESP_ERR_INVALID_SIZE;
+
+  mqtt_publish_item_t item = {
+    .enqueued_at = esp_timer_get_time(),
+    .qos = qos,
+    .retain = retain,
+    .len = len,
+  };
+  // the caller's topic may be rewritten before the publisher gets to it, e.g. a renamed code
+  if (strlcpy(item.topic, topic, sizeof(item.topic)) >= sizeof(item.topic)) return ESP_ERR_INVALID_SIZE;
+  memcpy(item.payload, payload, len);
+
+  // never wait on the publisher: if it has fallen behind, the oldest message is the least useful
+  while (xQueueSend(publish_queue, &item, 0) != pdTRUE) {
+    mqtt_publish_item_t oldest;
+    if (xQueueReceive(publish_queue, &oldest, 0) == pdTRUE) {
+      portENTER_CRITICAL(&stats_lock);
+      stats.dropped++;
+      portEXIT_CRITICAL(&stats_lock);
+    }
+  }
+
+  UBaseType_t depth = uxQueueMessagesWaiting(publish_queue);
+  portENTER_CRITICAL(&stats_lock);
+  if (depth > stats.queue_high_water) stats.queue_high_water = depth;
+  portEXIT_CRITICAL(&stats_lock);
+
+  return ESP_OK;
+}
+
+esp_err_t mqtt_publish_light_state(char channel, bool on) {
+  const char* topic = mqtt_light_state_topic(channel);
+  if (topic == NULL) return ESP_ERR_NOT_FOUND;
+  return mqtt_publish_enqueue(topic, on ? "ON" : "OFF", on ? 2 : 3, 0, false);
+}
+
+void mqtt_publish_set_probe(mqtt_publish_probe_t probe) {
+  publish_probe = probe;
+}
+
+void mqtt_publish_set_connected(bool connected) {
+  publish_connected = connected;
+}
+
+void mqtt_publish_get_stats(mqtt_publish_stats_t* out) {
+  portENTER_CRITICAL(&stats_lock);
+  *out = stats;
+  portEXIT_CRITICAL(&stats_lock);
+}
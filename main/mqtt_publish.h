@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "mqtt_client.h"
+
+#define MQTT_PUBLISH_QUEUE_LENGTH 16
+// state updates are only "ON"/"OFF", but leave room for small JSON payloads
+#define MQTT_PUBLISH_MAX_PAYLOAD 128
+// including the terminator, the longest is a learned code's topic
+#define MQTT_PUBLISH_MAX_TOPIC 64
+
+typedef struct {
+  uint32_t published;
+  // dropped from the publish queue to make room for newer messages
+  uint32_t dropped;
+  // stored in the client outbox because we were not connected
+  uint32_t deferred;
+  // rejected by the MQTT client
+  uint32_t failed;
+  uint32_t queue_high_water;
+  // enqueue to socket write latency
+  uint32_t latency_min_us;
+  uint32_t latency_max_us;
+  uint64_t latency_total_us;
+} mqtt_publish_stats_t;
+
+/**
+ * @brief Start the publisher task that owns all outbound publishes for this client
+ */
+esp_err_t mqtt_publish_start(esp_mqtt_client_handle_t client);
+
+/**
+ * @brief Queue a message for publishing without waiting on the socket
+ *
+ * @param topic Copied into the queue, so it may change or go away once this returns
+ * @param len Payload length, or 0 to use strlen(payload)
+ * @return ESP_OK if queued, ESP_ERR_INVALID_SIZE if the topic or payload is too large
+ */
+esp_err_t mqtt_publish_enqueue(const char* topic, const char* payload, size_t len, int qos, bool retain);
+
+/**
+ * @brief Queue a state update for a light channel
+ */
+esp_err_t mqtt_publish_light_state(char channel, bool on);
+
+// Precomputed state topic for a light channel, or NULL if the channel is unknown
+const char* mqtt_light_state_topic(char channel);
+
+/**
+ * @brief Called by the publisher task after every publish, for benchmarks
+ *
+ * @param published false if the message was deferred to the client outbox or rejected
+ */
+typedef void (*mqtt_publish_probe_t)(const char* topic, uint32_t latency_us, bool published);
+
+// Install a probe, or NULL to remove it
+void mqtt_publish_set_probe(mqtt_publish_probe_t probe);
+
+void mqtt_publish_set_connected(bool connected);
+void mqtt_publish_get_stats(mqtt_publish_stats_t* stats);
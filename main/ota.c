@@ -0,0 +1,582 @@
+#include "ota.h"
+
+#ifdef CONFIG_RF_BRIDGE_OTA
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include "esp_app_desc.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+#include "esp_system.h"
+#include "mqtt.h"
+#include "mqtt_publish.h"
+#include "nvs.h"
+#include "rom/miniz.h"
+
+#define TAG "OTA"
+
+#define OTA_TOPIC_PREFIX MQTT_PREFIX "ota/"
+#define OTA_BEGIN_TOPIC OTA_TOPIC_PREFIX "begin"
+#define OTA_CHUNK_TOPIC OTA_TOPIC_PREFIX "chunk"
+#define OTA_ABORT_TOPIC OTA_TOPIC_PREFIX "abort"
+#define OTA_REQUEST_TOPIC OTA_TOPIC_PREFIX "request"
+#define OTA_STATE_TOPIC OTA_TOPIC_PREFIX "state"
+
+#define NVS_NAMESPACE "ota"
+#define NVS_KEY "progress"
+
+#define SECTOR_SIZE 4096
+#define DELTA_MAGIC "RFD1"
+#define DELTA_BLOCK_STORED 0
+#define DELTA_BLOCK_DEFLATE 1
+
+typedef enum {
+  OTA_ITEM_BEGIN,
+  OTA_ITEM_CHUNK,
+  OTA_ITEM_ABORT,
+  OTA_ITEM_CONNECTED,
+} ota_item_type_t;
+
+typedef struct {
+  uint8_t type;
+  uint16_t len;
+  // stream offset of a chunk
+  uint32_t offset;
+  uint8_t data[OTA_CHUNK_SIZE];
+} ota_item_t;
+
+// A delta stream is this header, then one block for every flash sector of the new image
+typedef struct __attribute__((packed)) {
+  char magic[4];
+  uint32_t image_size;
+  // the running image the delta was made against
+  uint8_t base_sha256[32];
+} ota_delta_header_t;
+
+typedef struct __attribute__((packed)) {
+  uint8_t type;
+  uint8_t reserved;
+  uint16_t out_len;
+  uint16_t data_len;
+  // base image bytes preloaded as the deflate dictionary, so unchanged code costs almost nothing
+  uint16_t dict_len;
+  uint32_t dict_offset;
+} ota_delta_block_t;
+
+typedef enum {
+  DELTA_FILE_HEADER,
+  DELTA_BLOCK_HEADER,
+  DELTA_BLOCK_DATA,
+} ota_delta_state_t;
+
+// What goes to NVS, the stream up to stream_offset is in flash up to image_offset
+typedef struct {
+  uint8_t sha256[32];
+  uint32_t size;
+  uint8_t delta;
+  uint32_t partition_address;
+  uint32_t stream_offset;
+  uint32_t image_offset;
+  // from the delta header, which is not sent again on resume
+  uint32_t image_size;
+} ota_progress_t;
+
+static QueueHandle_t ota_queue;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static ota_stats_t stats;
+
+// Owned by the OTA task
+static struct {
+  bool active;
+  ota_progress_t progress;
+  const esp_partition_t* partition;
+  const esp_partition_t* base;
+  // stream bytes consumed, and the end of the window asked for
+  uint32_t position;
+  uint32_t requested_end;
+  // windows asked for again without progress
+  uint32_t retries;
+  // image bytes in flash, the sector buffer comes after them
+  uint32_t written;
+  uint32_t image_size;
+  uint8_t* sector;
+  size_t sector_fill;
+  uint32_t sectors_since_checkpoint;
+  // delta parser
+  ota_delta_state_t delta_state;
+  uint8_t header[sizeof(ota_delta_header_t)];
+  size_t header_fill;
+  ota_delta_block_t block;
+  uint8_t* block_data;
+  size_t block_fill;
+  // dictionary followed by the decompressed sector
+  uint8_t* work;
+  tinfl_decompressor* inflator;
+} ota;
+
+static void publish_state(const char* state) {
+  char payload[MQTT_PUBLISH_MAX_PAYLOAD];
+  int len = snprintf(payload, sizeof(payload), "{\"state\":\"%s\",\"offset\":%" PRIu32 ",\"size\":%" PRIu32 ",\"version\":\"%s\"}",
+                     state, ota.position, ota.progress.size, esp_app_get_description()->version);
+  mqtt_publish_enqueue(OTA_STATE_TOPIC, payload, MIN(len, sizeof(payload) - 1), 0, true);
+}
+
+static void request_window(void) {
+  uint32_t len = MIN(OTA_WINDOW_CHUNKS * OTA_CHUNK_SIZE, ota.progress.size - ota.position);
+  ota.requested_end = ota.position + len;
+  char payload[24];
+  int n = snprintf(payload, sizeof(payload), "%" PRIu32 " %" PRIu32, ota.position, len);
+  mqtt_publish_enqueue(OTA_REQUEST_TOPIC, payload, n, 0, false);
+}
+
+static esp_err_t save_progress(void) {
+  nvs_handle_t nvs;
+  ESP_RETURN_ON_ERROR(nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs), TAG, "Failed to open NVS");
+  esp_err_t ret = nvs_set_blob(nvs, NVS_KEY, &ota.progress, sizeof(ota.progress));
+  if (ret == ESP_OK) ret = nvs_commit(nvs);
+  nvs_close(nvs);
+  return ret;
+}
+
+static esp_err_t load_progress(ota_progress_t* progress) {
+  nvs_handle_t nvs;
+  ESP_RETURN_ON_ERROR(nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs), TAG, "No update in progress");
+  size_t size = sizeof(*progress);
+  esp_err_t ret = nvs_get_blob(nvs, NVS_KEY, progress, &size);
+  nvs_close(nvs);
+  if (ret == ESP_OK && size != sizeof(*progress)) ret = ESP_ERR_INVALID_SIZE;
+  return ret;
+}
+
+static void clear_progress(void) {
+  nvs_handle_t nvs;
+  if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) return;
+  nvs_erase_key(nvs, NVS_KEY);
+  nvs_commit(nvs);
+  nvs_close(nvs);
+  ota.progress = (ota_progress_t) {0};
+  ota.position = 0;
+}
+
+static void release(void) {
+  free(ota.sector);
+  free(ota.block_data);
+  free(ota.work);
+  free(ota.inflator);
+  ota.sector = NULL;
+  ota.block_data = NULL;
+  ota.work = NULL;
+  ota.inflator = NULL;
+  ota.active = false;
+}
+
+// Give up on the update, the next begin starts from scratch
+static void fail(esp_err_t err) {
+  ESP_LOGE(TAG, "Update failed at %" PRIu32 " of %" PRIu32 ": %s", ota.position, ota.progress.size, esp_err_to_name(err));
+  release();
+  publish_state("failed");
+  clear_progress();
+}
+
+static esp_err_t flush_sector(void) {
+  if (ota.sector_fill == 0) return ESP_OK;
+  ESP_RETURN_ON_FALSE(ota.written + SECTOR_SIZE <= ota.partition->size, ESP_ERR_INVALID_SIZE, TAG, "Image larger than the partition");
+  ESP_RETURN_ON_ERROR(esp_partition_erase_range(ota.partition, ota.written, SECTOR_SIZE), TAG, "Failed to erase at %" PRIu32, ota.written);
+  ESP_RETURN_ON_ERROR(esp_partition_write(ota.partition, ota.written, ota.sector, ota.sector_fill), TAG, "Failed to write at %" PRIu32, ota.written);
+  ota.written += ota.sector_fill;
+  portENTER_CRITICAL(&stats_lock);
+  stats.bytes_written += ota.sector_fill;
+  portEXIT_CRITICAL(&stats_lock);
+  ota.sector_fill = 0;
+  ota.sectors_since_checkpoint++;
+  return ESP_OK;
+}
+
+static esp_err_t write_image(const uint8_t* data, size_t len) {
+  while (len > 0) {
+    size_t n = MIN(len, SECTOR_SIZE - ota.sector_fill);
+    memcpy(ota.sector + ota.sector_fill, data, n);
+    ota.sector_fill += n;
+    data += n;
+    len -= n;
+    if (ota.sector_fill == SECTOR_SIZE) ESP_RETURN_ON_ERROR(flush_sector(), TAG, "Failed to flush sector");
+  }
+  return ESP_OK;
+}
+
+// Called where the stream can be picked up again: between blocks, with the sector buffer empty
+static void checkpoint(void) {
+  if (ota.sector_fill != 0 || ota.sectors_since_checkpoint < OTA_CHECKPOINT_SECTORS) return;
+  ota.progress.stream_offset = ota.position;
+  ota.progress.image_offset = ota.written;
+  ota.progress.image_size = ota.image_size;
+  ota.sectors_since_checkpoint = 0;
+  // losing one only means a longer resume
+  ESP_ERROR_CHECK_WITHOUT_ABORT(save_progress());
+  publish_state("receiving");
+}
+
+static esp_err_t consume_image(const uint8_t* data, size_t len) {
+  while (len > 0) {
+    size_t n = MIN(len, SECTOR_SIZE - ota.sector_fill);
+    ESP_RETURN_ON_ERROR(write_image(data, n), TAG, "Failed to write image");
+    ota.position += n;
+    data += n;
+    len -= n;
+    checkpoint();
+  }
+  return ESP_OK;
+}
+
+static esp_err_t start_delta(void) {
+  ota_delta_header_t header;
+  memcpy(&header, ota.header, sizeof(header));
+  ESP_RETURN_ON_FALSE(memcmp(header.magic, DELTA_MAGIC, sizeof(header.magic)) == 0, ESP_ERR_INVALID_ARG, TAG, "Not a delta image");
+  ESP_RETURN_ON_FALSE(header.image_size <= ota.partition->size, ESP_ERR_INVALID_SIZE, TAG, "Image larger than the partition");
+
+  uint8_t running[32];
+  ESP_RETURN_ON_ERROR(esp_partition_get_sha256(ota.base, running), TAG, "Failed to hash the running image");
+  ESP_RETURN_ON_FALSE(memcmp(running, header.base_sha256, sizeof(running)) == 0, ESP_ERR_INVALID_VERSION, TAG, "Delta was made against another image");
+
+  ota.image_size = header.image_size;
+  ota.delta_state = DELTA_BLOCK_HEADER;
+  return ESP_OK;
+}
+
+static esp_err_t finish_block(void) {
+  const ota_delta_block_t* block = &ota.block;
+  if (block->type == DELTA_BLOCK_STORED) {
+    ESP_RETURN_ON_ERROR(write_image(ota.block_data, block->out_len), TAG, "Failed to write image");
+  } else {
+    if (block->dict_len) {
+      ESP_RETURN_ON_ERROR(esp_partition_read(ota.base, block->dict_offset, ota.work, block->dict_len), TAG, "Failed to read the running image");
+    }
+    // non wrapping output, so back references may reach into the dictionary in front of it
+    size_t in_len = block->data_len;
+    size_t out_len = block->out_len;
+    tinfl_init(ota.inflator);
+    tinfl_status status = tinfl_decompress(ota.inflator, ota.block_data, &in_len, ota.work, ota.work + block->dict_len, &out_len,
+                                           TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF);
+    ESP_RETURN_ON_FALSE(status == TINFL_STATUS_DONE && out_len == block->out_len, ESP_ERR_INVALID_RESPONSE, TAG,
+                        "Bad delta block for image offset %" PRIu32, (uint32_t) (ota.written + ota.sector_fill));
+    ESP_RETURN_ON_ERROR(write_image(ota.work + block->dict_len, out_len), TAG, "Failed to write image");
+  }
+  ota.delta_state = DELTA_BLOCK_HEADER;
+  checkpoint();
+  return ESP_OK;
+}
+
+static esp_err_t start_block(void) {
+  memcpy(&ota.block, ota.header, sizeof(ota.block));
+  const ota_delta_block_t* block = &ota.block;
+  bool valid = block->out_len <= SECTOR_SIZE && block->data_len <= SECTOR_SIZE && block->dict_len <= OTA_DELTA_MAX_DICT &&
+               block->dict_offset + block->dict_len <= ota.base->size &&
+               (block->type == DELTA_BLOCK_DEFLATE || (block->type == DELTA_BLOCK_STORED && block->data_len == block->out_len));
+  ESP_RETURN_ON_FALSE(valid, ESP_ERR_INVALID_ARG, TAG, "Bad delta block header at %" PRIu32, ota.position);
+  ota.block_fill = 0;
+  ota.delta_state = DELTA_BLOCK_DATA;
+  return block->data_len == 0 ? finish_block() : ESP_OK;
+}
+
+static esp_err_t consume_delta(const uint8_t* data, size_t len) {
+  while (len > 0) {
+    size_t n;
+    bool done = false;
+    if (ota.delta_state == DELTA_BLOCK_DATA) {
+      n = MIN(len, ota.block.data_len - ota.block_fill);
+      memcpy(ota.block_data + ota.block_fill, data, n);
+      ota.block_fill += n;
+      done = ota.block_fill == ota.block.data_len;
+    } else {
+      size_t size = ota.delta_state == DELTA_FILE_HEADER ? sizeof(ota_delta_header_t) : sizeof(ota_delta_block_t);
+      n = MIN(len, size - ota.header_fill);
+      memcpy(ota.header + ota.header_fill, data, n);
+      ota.header_fill += n;
+      done = ota.header_fill == size;
+    }
+    ota.position += n;
+    data += n;
+    len -= n;
+    if (!done) continue;
+
+    if (ota.delta_state == DELTA_BLOCK_DATA) {
+      ESP_RETURN_ON_ERROR(finish_block(), TAG, "Failed to apply delta block");
+    } else {
+      ota.header_fill = 0;
+      ESP_RETURN_ON_ERROR(ota.delta_state == DELTA_FILE_HEADER ? start_delta() : start_block(), TAG, "Failed to parse delta");
+    }
+  }
+  return ESP_OK;
+}
+
+static esp_err_t finish(void) {
+  ESP_RETURN_ON_ERROR(flush_sector(), TAG, "Failed to flush sector");
+  ESP_RETURN_ON_FALSE(!ota.progress.delta || (ota.delta_state == DELTA_BLOCK_HEADER && ota.header_fill == 0), ESP_ERR_INVALID_SIZE, TAG, "Truncated delta");
+  ESP_RETURN_ON_FALSE(ota.written == ota.image_size, ESP_ERR_INVALID_SIZE, TAG, "Image is %" PRIu32 " bytes, expected %" PRIu32, ota.written, ota.image_size);
+
+  publish_state("verifying");
+  uint8_t sha256[32];
+  ESP_RETURN_ON_ERROR(esp_partition_get_sha256(ota.partition, sha256), TAG, "New image is not valid");
+  ESP_RETURN_ON_FALSE(memcmp(sha256, ota.progress.sha256, sizeof(sha256)) == 0, ESP_ERR_INVALID_CRC, TAG, "SHA-256 of the new image does not match");
+  ESP_RETURN_ON_ERROR(esp_ota_set_boot_partition(ota.partition), TAG, "Failed to set boot partition");
+
+  ESP_LOGI(TAG, "Update complete, %" PRIu32 " bytes received for a %" PRIu32 " byte image", ota.progress.size, ota.image_size);
+  release();
+  publish_state("rebooting");
+  clear_progress();
+  // give the publisher time to send the state
+  vTaskDelay(pdMS_TO_TICKS(1000));
+  esp_restart();
+  return ESP_OK;
+}
+
+static int hex_value(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// "<image|delta> <stream size> <sha256 of the new image>"
+static esp_err_t begin(const char* text) {
+  char kind[8];
+  char sha_hex[65];
+  uint32_t size;
+  ESP_RETURN_ON_FALSE(sscanf(text, "%7s %" SCNu32 " %64s", kind, &size, sha_hex) == 3 && strlen(sha_hex) == 64 && size > 0,
+                      ESP_ERR_INVALID_ARG, TAG, "Bad begin message: %s", text);
+  ESP_RETURN_ON_FALSE(strcmp(kind, "image") == 0 || strcmp(kind, "delta") == 0, ESP_ERR_INVALID_ARG, TAG, "Unknown update kind %s", kind);
+
+  ota_progress_t update = { .size = size, .delta = strcmp(kind, "delta") == 0 };
+  for (int i = 0; i < 32; i++) {
+    int high = hex_value(sha_hex[2 * i]);
+    int low = hex_value(sha_hex[2 * i + 1]);
+    ESP_RETURN_ON_FALSE(high >= 0 && low >= 0, ESP_ERR_INVALID_ARG, TAG, "Bad SHA-256 %s", sha_hex);
+    update.sha256[i] = high << 4 | low;
+  }
+
+  const esp_partition_t* partition = esp_ota_get_next_update_partition(NULL);
+  ESP_RETURN_ON_FALSE(partition, ESP_ERR_NOT_FOUND, TAG, "No OTA partition to update");
+  ESP_RETURN_ON_FALSE(update.delta || size <= partition->size, ESP_ERR_INVALID_SIZE, TAG, "Image larger than the partition");
+  update.partition_address = partition->address;
+
+  bool same = memcmp(update.sha256, ota.progress.sha256, sizeof(update.sha256)) == 0 && update.size == ota.progress.size &&
+              update.delta == ota.progress.delta && update.partition_address == ota.progress.partition_address;
+  if (ota.active && same) {
+    // the sender restarted, carry on
+    request_window();
+    return ESP_OK;
+  }
+  release();
+
+  ota.partition = partition;
+  ota.base = esp_ota_get_running_partition();
+  ota.sector = malloc(SECTOR_SIZE);
+  if (update.delta) {
+    ota.block_data = malloc(SECTOR_SIZE);
+    ota.work = malloc(OTA_DELTA_MAX_DICT + SECTOR_SIZE);
+    ota.inflator = malloc(sizeof(tinfl_decompressor));
+  }
+  if (!ota.sector || (update.delta && (!ota.block_data || !ota.work || !ota.inflator))) {
+    release();
+    return ESP_ERR_NO_MEM;
+  }
+
+  ota.sector_fill = 0;
+  ota.header_fill = 0;
+  ota.sectors_since_checkpoint = 0;
+  ota.retries = 0;
+  if (same && ota.progress.stream_offset <= size) {
+    ota.position = ota.progress.stream_offset;
+    ota.written = ota.progress.image_offset;
+    ota.image_size = update.delta ? ota.progress.image_size : size;
+    ota.delta_state = ota.position == 0 ? DELTA_FILE_HEADER : DELTA_BLOCK_HEADER;
+    portENTER_CRITICAL(&stats_lock);
+    stats.resumed++;
+    portEXIT_CRITICAL(&stats_lock);
+    ESP_LOGI(TAG, "Resuming %s update at %" PRIu32 " of %" PRIu32, kind, ota.position, size);
+  } else {
+    ota.progress = update;
+    ota.position = 0;
+    ota.written = 0;
+    // known once the delta header is in
+    ota.image_size = update.delta ? 0 : size;
+    ota.delta_state = DELTA_FILE_HEADER;
+    ESP_RETURN_ON_ERROR(save_progress(), TAG, "Failed to save update progress");
+    ESP_LOGI(TAG, "Starting %s update, %" PRIu32 " bytes to %s", kind, size, partition->label);
+  }
+
+  ota.active = true;
+  portENTER_CRITICAL(&stats_lock);
+  stats.updates++;
+  portEXIT_CRITICAL(&stats_lock);
+  publish_state("receiving");
+  request_window();
+  return ESP_OK;
+}
+
+static esp_err_t handle_chunk(const ota_item_t* item) {
+  if (item->offset != ota.position || item->len > ota.progress.size - ota.position) {
+    // a repeat from an earlier window, or one after a lost chunk that will be asked for again
+    portENTER_CRITICAL(&stats_lock);
+    stats.chunks_dropped++;
+    portEXIT_CRITICAL(&stats_lock);
+    return ESP_OK;
+  }
+  ota.retries = 0;
+  portENTER_CRITICAL(&stats_lock);
+  stats.chunks++;
+  stats.bytes_received += item->len;
+  portEXIT_CRITICAL(&stats_lock);
+
+  if (ota.progress.delta) {
+    ESP_RETURN_ON_ERROR(consume_delta(item->data, item->len), TAG, "Failed to apply chunk");
+  } else {
+    ESP_RETURN_ON_ERROR(consume_image(item->data, item->len), TAG, "Failed to write chunk");
+  }
+
+  if (ota.position == ota.progress.size) return finish();
+  if (ota.position >= ota.requested_end) request_window();
+  return ESP_OK;
+}
+
+// Mark a freshly updated image good once it has reached the broker, so it is not rolled back
+static void confirm_image(void) {
+  esp_ota_img_states_t state;
+  if (esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) == ESP_OK && state == ESP_OTA_IMG_PENDING_VERIFY) {
+    ESP_LOGI(TAG, "Connected with the new image, cancelling rollback");
+    ESP_ERROR_CHECK_WITHOUT_ABORT(esp_ota_mark_app_valid_cancel_rollback());
+  }
+}
+
+static void ota_task(void* arg) {
+  // too large for the stack
+  static ota_item_t item;
+
+  while (1) {
+    if (!xQueueReceive(ota_queue, &item, ota.active ? pdMS_TO_TICKS(OTA_RETRY_MS) : portMAX_DELAY)) {
+      if (++ota.retries > OTA_MAX_RETRIES) {
+        // the sender is gone, the saved progress lets it continue later
+        ESP_LOGW(TAG, "No update data for %d s, pausing at %" PRIu32, OTA_MAX_RETRIES * OTA_RETRY_MS / 1000, ota.progress.stream_offset);
+        release();
+        ota.position = ota.progress.stream_offset;
+        publish_state("paused");
+        continue;
+      }
+      // lost chunks or a lost request, ask again from where we are
+      portENTER_CRITICAL(&stats_lock);
+      stats.retries++;
+      portEXIT_CRITICAL(&stats_lock);
+      request_window();
+      continue;
+    }
+
+    esp_err_t err = ESP_OK;
+    switch (item.type) {
+    case OTA_ITEM_BEGIN:
+      err = begin((const char*) item.data);
+      break;
+    case OTA_ITEM_CHUNK:
+      if (ota.active) err = handle_chunk(&item);
+      break;
+    case OTA_ITEM_ABORT:
+      ESP_LOGI(TAG, "Update aborted");
+      release();
+      clear_progress();
+      publish_state("idle");
+      break;
+    case OTA_ITEM_CONNECTED:
+      confirm_image();
+      if (ota.active) {
+        request_window();
+      } else {
+        // an interrupted update waits for the sender to begin it again
+        publish_state(ota.progress.size ? "paused" : "idle");
+      }
+      break;
+    }
+    if (err != ESP_OK) fail(err);
+  }
+}
+
+// Only called from the MQTT task, so one buffer is enough
+static void post(ota_item_type_t type, uint32_t offset, const void* data, size_t len) {
+  static ota_item_t item;
+  if (ota_queue == NULL) return;
+  item.type = type;
+  item.offset = offset;
+  item.len = len;
+  if (len) memcpy(item.data, data, len);
+  if (xQueueSend(ota_queue, &item, 0) != pdTRUE) {
+    // the sender is ignoring the window, the retry asks for it again
+    portENTER_CRITICAL(&stats_lock);
+    stats.chunks_dropped++;
+    portEXIT_CRITICAL(&stats_lock);
+  }
+}
+
+bool ota_handle_message(const char* topic, size_t topic_len, const char* data, size_t data_len, size_t total_len) {
+  if (topic_len <= strlen(OTA_TOPIC_PREFIX) || strncmp(topic, OTA_TOPIC_PREFIX, strlen(OTA_TOPIC_PREFIX)) != 0) return false;
+  if (data_len != total_len) {
+    ESP_LOGW(TAG, "Dropping update message split by the MQTT client, %zu of %zu bytes", data_len, total_len);
+    return true;
+  }
+
+  if (topic_len == strlen(OTA_CHUNK_TOPIC) && strncmp(topic, OTA_CHUNK_TOPIC, topic_len) == 0) {
+    if (data_len < 4 || data_len - 4 > OTA_CHUNK_SIZE) return true;
+    const uint8_t* bytes = (const uint8_t*) data;
+    uint32_t offset = bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t) bytes[3] << 24;
+    post(OTA_ITEM_CHUNK, offset, bytes + 4, data_len - 4);
+  } else if (topic_len == strlen(OTA_BEGIN_TOPIC) && strncmp(topic, OTA_BEGIN_TOPIC, topic_len) == 0) {
+    char text[96];
+    if (data_len >= sizeof(text)) return true;
+    memcpy(text, data, data_len);
+    text[data_len] = '\0';
+    post(OTA_ITEM_BEGIN, 0, text, data_len + 1);
+  } else if (topic_len == strlen(OTA_ABORT_TOPIC) && strncmp(topic, OTA_ABORT_TOPIC, topic_len) == 0) {
+    post(OTA_ITEM_ABORT, 0, NULL, 0);
+  }
+  return true;
+}
+
+int ota_subscribe(esp_mqtt_client_handle_t client) {
+  int subscribed = 0;
+  if (esp_mqtt_client_subscribe(client, OTA_BEGIN_TOPIC, 0) >= 0) subscribed++;
+  if (esp_mqtt_client_subscribe(client, OTA_CHUNK_TOPIC, 0) >= 0) subscribed++;
+  if (esp_mqtt_client_subscribe(client, OTA_ABORT_TOPIC, 0) >= 0) subscribed++;
+  return subscribed;
+}
+
+void ota_set_connected(bool connected) {
+  if (connected) post(OTA_ITEM_CONNECTED, 0, NULL, 0);
+}
+
+esp_err_t ota_start(void) {
+  if (load_progress(&ota.progress) == ESP_OK) {
+    ota.position = ota.progress.stream_offset;
+    ESP_LOGI(TAG, "Interrupted update at %" PRIu32 " of %" PRIu32 ", waiting for the sender", ota.position, ota.progress.size);
+  } else {
+    ota.progress = (ota_progress_t) {0};
+  }
+
+  // room for a full window plus control messages
+  ota_queue = xQueueCreate(OTA_WINDOW_CHUNKS + 2, sizeof(ota_item_t));
+  ESP_RETURN_ON_FALSE(ota_queue, ESP_ERR_NO_MEM, TAG, "Failed to create OTA queue");
+  ESP_RETURN_ON_FALSE(xTaskCreate(ota_task, "ota", 4096, NULL, 1, NULL) == pdPASS, ESP_ERR_NO_MEM, TAG, "Failed to create OTA task");
+  return ESP_OK;
+}
+
+void ota_get_stats(ota_stats_t* out) {
+  portENTER_CRITICAL(&stats_lock);
+  *out = stats;
+  portEXIT_CRITICAL(&stats_lock);
+}
+
+#endif
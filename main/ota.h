@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "mqtt_client.h"
+
+// Firmware updates streamed over the MQTT session, see tools/ota.py for the sending side.
+//
+// The sender announces an update on ota/begin with "<image|delta> <stream size> <image sha256>".
+// The bridge then asks for the stream a window at a time on ota/request with "<offset> <length>",
+// and every chunk comes back on ota/chunk as a little endian offset followed by the data.
+// Progress is saved to NVS, so after a reboot or a lost connection the same update continues
+// where it left off. ota/state reports progress, retained.
+
+// stream bytes per chunk message, sized with its header to fit the MQTT receive buffer
+#define OTA_CHUNK_SIZE 1024
+// chunks requested at once, also the depth of the chunk queue so a window never overflows it
+#define OTA_WINDOW_CHUNKS 4
+// a window that makes no progress for this long is requested again
+#define OTA_RETRY_MS 5000
+// then the update is paused until the sender begins it again
+#define OTA_MAX_RETRIES 12
+// progress is saved every this many flash sectors, a resume repeats at most that much
+#define OTA_CHECKPOINT_SECTORS 16
+// base image bytes a delta block may reference, before and after its own offset
+#define OTA_DELTA_MAX_DICT 8192
+
+typedef struct {
+  uint32_t updates;
+  uint32_t resumed;
+  uint32_t chunks;
+  // out of order or repeated chunks that were dropped
+  uint32_t chunks_dropped;
+  // windows requested again after OTA_RETRY_MS
+  uint32_t retries;
+  uint32_t bytes_received;
+  uint32_t bytes_written;
+} ota_stats_t;
+
+#ifdef CONFIG_RF_BRIDGE_OTA
+
+// Load the progress of an interrupted update and start the update task
+esp_err_t ota_start(void);
+
+// Subscribe to the update topics, returns the number of subscriptions made
+int ota_subscribe(esp_mqtt_client_handle_t client);
+
+/**
+ * @brief Take an update message off the MQTT task
+ *
+ * @return false if the topic is not an update topic
+ */
+bool ota_handle_message(const char* topic, size_t topic_len, const char* data, size_t data_len, size_t total_len);
+
+/**
+ * @brief Tell the updater about the broker connection
+ *
+ * The first connection confirms a freshly updated image, so it is not rolled back, and an
+ * update in progress asks for its missing data right away.
+ */
+void ota_set_connected(bool connected);
+
+void ota_get_stats(ota_stats_t* stats);
+
+#else
+
+static inline esp_err_t ota_start(void) { return ESP_OK; }
+static inline int ota_subscribe(esp_mqtt_client_handle_t client) { return 0; }
+static inline bool ota_handle_message(const char* topic, size_t topic_len, const char* data, size_t data_len, size_t total_len) { return false; }
+static inline void ota_set_connected(bool connected) {}
+
+#endif
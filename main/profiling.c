@@ -0,0 +1,200 @@
+#include "profiling.h"
+
+#ifdef CONFIG_RF_BRIDGE_PROFILING
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "mqtt.h"
+#include "mqtt_publish.h"
+#include "binlog.h"
+#include "cc1101_spi.h"
+#include "event_queue.h"
+#include "rf_arbiter.h"
+#include "rf_capture.h"
+#include "rf_rules.h"
+#include "wifi_power.h"
+
+#define TAG "profiling"
+
+// more than enough for main, mqtt, wifi, BLE, timers and idle
+#define PROFILING_MAX_TASKS 24
+
+typedef struct {
+  uint64_t cycles;
+  uint32_t count;
+  uint32_t max_cycles;
+} profiling_counter_t;
+
+static const char* section_names[PROFILING_SECTION_MAX] = {
+  [PROFILING_SECTION_RX_CALLBACK] = "rx_callback",
+  [PROFILING_SECTION_MQTT_HANDLER] = "mqtt_handler",
+  [PROFILING_SECTION_DISPATCH] = "dispatch",
+};
+
+static portMUX_TYPE counters_lock = portMUX_INITIALIZER_UNLOCKED;
+static profiling_counter_t counters[PROFILING_SECTION_MAX];
+
+// previous snapshot, used to compute deltas
+static profiling_counter_t previous_counters[PROFILING_SECTION_MAX];
+static TaskStatus_t tasks[PROFILING_MAX_TASKS];
+static TaskStatus_t previous_tasks[PROFILING_MAX_TASKS];
+static UBaseType_t previous_num_tasks;
+static configRUN_TIME_COUNTER_TYPE previous_total_runtime;
+
+IRAM_ATTR void profiling_section_add(profiling_section_t section, uint32_t cycles) {
+  portENTER_CRITICAL_SAFE(&counters_lock);
+  profiling_counter_t* counter = &counters[section];
+  counter->cycles += cycles;
+  counter->count++;
+  if (cycles > counter->max_cycles) counter->max_cycles = cycles;
+  portEXIT_CRITICAL_SAFE(&counters_lock);
+}
+
+// Runtime of the task with the same number in the previous snapshot
+static configRUN_TIME_COUNTER_TYPE previous_task_runtime(UBaseType_t task_number) {
+  for (UBaseType_t i = 0; i < previous_num_tasks; i++) {
+    if (previous_tasks[i].xTaskNumber == task_number) return previous_tasks[i].ulRunTimeCounter;
+  }
+  return 0;
+}
+
+static void profiling_task(void* arg) {
+  esp_mqtt_client_handle_t mqtt = (esp_mqtt_client_handle_t) arg;
+  uint32_t cycles_per_us = esp_rom_get_cpu_ticks_per_us();
+  char payload[768];
+
+  while (1) {
+    vTaskDelay(pdMS_TO_TICKS(CONFIG_RF_BRIDGE_PROFILING_INTERVAL_MS));
+
+    configRUN_TIME_COUNTER_TYPE total_runtime;
+    UBaseType_t num_tasks = uxTaskGetSystemState(tasks, PROFILING_MAX_TASKS, &total_runtime);
+    // runtime counter is esp_timer based, so this is in us
+    uint32_t elapsed = total_runtime - previous_total_runtime;
+    if (elapsed == 0) continue;
+
+    profiling_counter_t current[PROFILING_SECTION_MAX];
+    portENTER_CRITICAL(&counters_lock);
+    memcpy(current, counters, sizeof(counters));
+    // max is per snapshot
+    for (int i = 0; i < PROFILING_SECTION_MAX; i++) counters[i].max_cycles = 0;
+    portEXIT_CRITICAL(&counters_lock);
+
+    int len = snprintf(payload, sizeof(payload), "{\"interval_us\":%" PRIu32 ",\"tasks\":{", elapsed);
+
+    ESP_LOGI(TAG, "CPU share over the last %" PRIu32 " ms:", elapsed / 1000);
+    for (UBaseType_t i = 0; i < num_tasks; i++) {
+      uint32_t task_elapsed = tasks[i].ulRunTimeCounter - previous_task_runtime(tasks[i].xTaskNumber);
+      float share = 100.0f * task_elapsed / elapsed;
+      ESP_LOGI(TAG, "  task %-16s %5.1f%%", tasks[i].pcTaskName, share);
+      if (len < (int) sizeof(payload)) {
+        len += snprintf(payload + len, sizeof(payload) - len, "%s\"%s\":%.1f", i == 0 ? "" : ",", tasks[i].pcTaskName, share);
+      }
+    }
+    if (len < (int) sizeof(payload)) len += snprintf(payload + len, sizeof(payload) - len, "},\"sections\":{");
+
+    for (int i = 0; i < PROFILING_SECTION_MAX; i++) {
+      uint64_t cycles = current[i].cycles - previous_counters[i].cycles;
+      uint32_t count = current[i].count - previous_counters[i].count;
+      float share = 100.0f * (cycles / cycles_per_us) / elapsed;
+      uint32_t max_us = current[i].max_cycles / cycles_per_us;
+      ESP_LOGI(TAG, "  section %-13s %5.1f%% | %" PRIu32 " calls | max %" PRIu32 " us", section_names[i], share, count, max_us);
+      if (len < (int) sizeof(payload)) {
+        len += snprintf(payload + len, sizeof(payload) - len, "%s\"%s\":{\"share\":%.2f,\"calls\":%" PRIu32 ",\"max_us\":%" PRIu32 "}",
+                        i == 0 ? "" : ",", section_names[i], share, count, max_us);
+      }
+    }
+
+    cc1101_spi_seq_stats_t spi[CC1101_SPI_SEQ_MAX_STATS];
+    size_t num_spi = cc1101_spi_get_seq_stats(spi, CC1101_SPI_SEQ_MAX_STATS);
+    for (size_t i = 0; i < num_spi; i++) {
+      ESP_LOGI(TAG, "  spi %-14s %" PRIu32 " runs | min %" PRIu32 " us | avg %" PRIu32 " us | max %" PRIu32 " us", spi[i].name,
+               spi[i].runs, spi[i].min_us, (uint32_t) (spi[i].total_us / spi[i].runs), spi[i].max_us);
+    }
+
+    // per symbol, so backends with one interrupt per frame and one per edge can be compared
+    rf_capture_stats_t capture[RF_CAPTURE_MAX_BACKENDS];
+    size_t num_capture = rf_capture_get_stats(capture, RF_CAPTURE_MAX_BACKENDS);
+    for (size_t i = 0; i < num_capture; i++) {
+      if (capture[i].symbols == 0) continue;
+      ESP_LOGI(TAG, "  capture %-10s %" PRIu32 " frames | %" PRIu32 " symbols | %.2f irq/symbol | capture %" PRIu32 " cycles/symbol%s | decode %" PRIu32 " cycles/symbol",
+               capture[i].name, capture[i].frames, capture[i].symbols, (float) capture[i].interrupts / capture[i].symbols,
+               (uint32_t) (capture[i].capture_cycles / capture[i].symbols), capture[i].capture_excludes_isr ? " (excl. driver ISR)" : "",
+               (uint32_t) (capture[i].callback_cycles / capture[i].symbols));
+    }
+
+    event_queue_stats_t events;
+    event_queue_get_stats(&events);
+    ESP_LOGI(TAG, "  events %" PRIu32 " claimed | %" PRIu32 " exhausted | %" PRIu32 "/%d in use at most",
+             events.claimed, events.exhausted, events.high_water, EVENT_POOL_SIZE);
+
+#ifdef CONFIG_RF_BRIDGE_BINARY_LOG
+    // compare with the dispatch section, which includes any ESP_LOGx still on the path
+    binlog_stats_t binlog;
+    binlog_get_stats(&binlog);
+    if (binlog.written > 0) {
+      ESP_LOGI(TAG, "  binlog %" PRIu32 " records | %" PRIu32 " dropped | avg %" PRIu32 " cycles | max %" PRIu32 " cycles",
+               binlog.written, binlog.dropped, (uint32_t) (binlog.write_cycles_total / binlog.written), binlog.write_cycles_max);
+    }
+#endif
+
+#ifdef CONFIG_RF_BRIDGE_ARBITRATION
+    rf_arbiter_stats_t arbiter;
+    rf_arbiter_get_stats(&arbiter);
+    ESP_LOGI(TAG, "  arbiter %" PRIu32 " won (%" PRIu32 " alone) | %" PRIu32 " lost | %" PRIu32 " repeats | %" PRIu32 " heard | %" PRIu32 " late | %" PRIu32 " full",
+             arbiter.won, arbiter.alone, arbiter.lost, arbiter.repeats, arbiter.heard, arbiter.late, arbiter.full);
+#endif
+
+#ifdef CONFIG_RF_BRIDGE_RULES
+    rf_rules_stats_t rules;
+    rf_rules_get_stats(&rules);
+    ESP_LOGI(TAG, "  rules %zu | %" PRIu32 " matched | %" PRIu32 " fired | %" PRIu32 " dropped | reaction last %" PRIu32 " us max %" PRIu32 " us",
+             rules.rules, rules.matched, rules.fired, rules.dropped, rules.reaction_last_us, rules.reaction_max_us);
+#endif
+
+#ifdef CONFIG_RF_BRIDGE_WIFI_POWER
+    wifi_power_stats_t power;
+    wifi_power_get_stats(&power);
+    for (int i = 0; i < WIFI_POWER_MODES; i++) {
+      const wifi_power_mode_stats_t* mode = &power.modes[i];
+      ESP_LOGI(TAG, "  wifi %-6s %" PRIu32 " s | %" PRIu32 " times | probe avg %" PRIu32 " us max %" PRIu32 " us over %" PRIu32,
+               i == WIFI_POWER_ACTIVE ? "active" : "sleep", (uint32_t) (mode->time_us / 1000000), mode->entered,
+               mode->probes ? (uint32_t) (mode->rtt_total_us / mode->probes) : 0, mode->rtt_max_us, mode->probes);
+    }
+#endif
+
+    mqtt_publish_stats_t pub;
+    mqtt_publish_get_stats(&pub);
+    uint32_t pub_avg_us = pub.published ? pub.latency_total_us / pub.published : 0;
+    ESP_LOGI(TAG, "  publish %" PRIu32 " sent | %" PRIu32 " dropped | avg %" PRIu32 " us | max %" PRIu32 " us",
+             pub.published, pub.dropped, pub_avg_us, pub.latency_max_us);
+    if (len < (int) sizeof(payload)) {
+      len += snprintf(payload + len, sizeof(payload) - len, "},\"publish\":{\"sent\":%" PRIu32 ",\"dropped\":%" PRIu32 ",\"avg_us\":%" PRIu32 ",\"max_us\":%" PRIu32 "}}",
+                      pub.published, pub.dropped, pub_avg_us, pub.latency_max_us);
+    }
+
+    if (len < (int) sizeof(payload)) {
+      esp_mqtt_client_publish(mqtt, MQTT_PREFIX "profiling", payload, len, 0, 0);
+    } else {
+      ESP_LOGW(TAG, "Snapshot too large to publish (%d bytes)", len);
+    }
+
+    memcpy(previous_counters, current, sizeof(current));
+    memcpy(previous_tasks, tasks, sizeof(TaskStatus_t) * num_tasks);
+    previous_num_tasks = num_tasks;
+    previous_total_runtime = total_runtime;
+  }
+}
+
+void profiling_start(esp_mqtt_client_handle_t mqtt) {
+  previous_num_tasks = uxTaskGetSystemState(previous_tasks, PROFILING_MAX_TASKS, &previous_total_runtime);
+  // lowest priority above idle so it does not disturb what it measures
+  xTaskCreate(profiling_task, "profiling", 4096, mqtt, 1, NULL);
+}
+
+#endif
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_cpu.h"
+#include "mqtt_client.h"
+
+// Code sections that are cycle-counted in addition to the FreeRTOS task stats
+typedef enum {
+  PROFILING_SECTION_RX_CALLBACK,
+  PROFILING_SECTION_MQTT_HANDLER,
+  PROFILING_SECTION_DISPATCH,
+  PROFILING_SECTION_MAX,
+} profiling_section_t;
+
+#ifdef CONFIG_RF_BRIDGE_PROFILING
+
+// Safe to call from ISRs
+void profiling_section_add(profiling_section_t section, uint32_t cycles);
+
+/**
+ * @brief Start the task which periodically prints and publishes CPU share snapshots
+ */
+void profiling_start(esp_mqtt_client_handle_t mqtt);
+
+#define PROFILING_BEGIN(name) uint32_t _profiling_start_##name = esp_cpu_get_cycle_count()
+#define PROFILING_END(name, section) profiling_section_add(section, esp_cpu_get_cycle_count() - _profiling_start_##name)
+
+#else
+
+static inline void profiling_start(esp_mqtt_client_handle_t mqtt) {}
+
+#define PROFILING_BEGIN(name)
+#define PROFILING_END(name, section)
+
+#endif
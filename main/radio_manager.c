@@ -0,0 +1,162 @@
+#include "radio_manager.h"
+
+#include "esp_check.h"
+#include "esp_log.h"
+
+#define TAG "Radio Manager"
+
+static const char* role_names[] = {
+  [RADIO_ROLE_RX_TX] = "rx+tx",
+  [RADIO_ROLE_RX] = "rx",
+  [RADIO_ROLE_TX] = "tx",
+};
+
+static inline bool receives(const radio_t* radio) {
+  return radio->config.role != RADIO_ROLE_TX;
+}
+
+static inline bool transmits(const radio_t* radio) {
+  return radio->config.role != RADIO_ROLE_RX;
+}
+
+// State a radio rests in between TX windows
+static esp_err_t enter_role(radio_t* radio) {
+  return receives(radio) ? cc1101_start_rx(radio->cc1101) : cc1101_stop(radio->cc1101);
+}
+
+esp_err_t radio_manager_add(radio_manager_t* mgr, const radio_config_t* config) {
+  ESP_RETURN_ON_FALSE(mgr->num_radios < RADIO_MANAGER_MAX_RADIOS, ESP_ERR_NO_MEM, TAG, "Too many radios");
+  size_t index = mgr->num_radios;
+  radio_t* radio = &mgr->radios[index];
+  radio->config = *config;
+
+  ESP_RETURN_ON_ERROR(init_cc1101(&config->pins, config->profile, &radio->cc1101), TAG, "Failed to initialize radio %zu", index);
+  radio->lock = xSemaphoreCreateMutex();
+  ESP_RETURN_ON_FALSE(radio->lock, ESP_ERR_NO_MEM, TAG, "Failed to create radio lock");
+
+  if (receives(radio)) {
+    radio->rx.parsed_message_queue = mgr->event_queue;
+    radio->rx.radio = index;
+    ESP_RETURN_ON_ERROR(rf_light_initialize_rx(config->pins.gdo2_io_num, &radio->rx), TAG, "Failed to initialize RX on radio %zu", index);
+  }
+  if (transmits(radio)) {
+    ESP_RETURN_ON_ERROR(rf_light_initialize_tx(&radio->tx, config->pins.gdo0_io_num), TAG, "Failed to initialize TX on radio %zu", index);
+  }
+
+  ESP_LOGI(TAG, "Radio %zu | CS %d | role %s | %s", index, config->pins.cs_io_num, role_names[config->role], cc1101_profile_name(config->profile));
+  mgr->num_radios++;
+  return ESP_OK;
+}
+
+esp_err_t radio_manager_start(radio_manager_t* mgr) {
+  for (size_t i = 0; i < mgr->num_radios; i++) {
+    radio_t* radio = &mgr->radios[i];
+    ESP_RETURN_ON_ERROR(enter_role(radio), TAG, "Failed to start radio %zu", i);
+    cc1101_dump_regs(radio->cc1101);
+    if (!transmits(radio)) continue;
+
+    radio->tx_sched.radio_lock = radio->lock;
+    if (!receives(radio)) {
+      radio->tx_sched.tx_only = true;
+      // the receiver is in RX already, so checking the channel there costs no transition
+      for (size_t j = 0; j < mgr->num_radios; j++) {
+        radio_t* other = &mgr->radios[j];
+        if (receives(other) && other->config.profile == radio->config.profile) {
+          radio->tx_sched.lbt_cc1101 = other->cc1101;
+          radio->tx_sched.lbt_lock = other->lock;
+          break;
+        }
+      }
+    }
+    ESP_RETURN_ON_ERROR(rf_light_tx_sched_start(&radio->tx_sched, &radio->tx, radio->cc1101), TAG, "Failed to start TX on radio %zu", i);
+  }
+  return ESP_OK;
+}
+
+esp_err_t radio_manager_submit(radio_manager_t* mgr, const rf_light_tx_command_t* commands, size_t count, uint32_t* accepted) {
+  if (accepted) *accepted = 0;
+  radio_t* fallback = NULL;
+  for (size_t i = 0; i < mgr->num_radios; i++) {
+    radio_t* radio = &mgr->radios[i];
+    if (!transmits(radio)) continue;
+    if (radio->config.profile == mgr->light_profile) {
+      return rf_light_tx_sched_submit(&radio->tx_sched, commands, count, accepted);
+    }
+    if (fallback == NULL) fallback = radio;
+  }
+  // nothing on the light band, better than dropping the command
+  ESP_RETURN_ON_FALSE(fallback, ESP_ERR_NOT_FOUND, TAG, "No radio can transmit");
+  return rf_light_tx_sched_submit(&fallback->tx_sched, commands, count, accepted);
+}
+
+// Called with the radio lock held
+static esp_err_t switch_profile(radio_t* radio, cc1101_profile_id_t profile) {
+  ESP_RETURN_ON_ERROR(cc1101_wake(radio->cc1101), TAG, "Failed to wake radio");
+  ESP_RETURN_ON_ERROR(cc1101_profile_apply(radio->cc1101, profile), TAG, "Failed to apply profile");
+  radio->config.profile = profile;
+  return enter_role(radio);
+}
+
+static esp_err_t switch_radio(radio_t* radio, cc1101_profile_id_t profile) {
+  xSemaphoreTake(radio->lock, portMAX_DELAY);
+  esp_err_t err = switch_profile(radio, profile);
+  xSemaphoreGive(radio->lock);
+  return err;
+}
+
+esp_err_t radio_manager_set_profile(radio_manager_t* mgr, cc1101_profile_id_t profile) {
+  cc1101_profile_id_t old = mgr->light_profile;
+  // a radio dedicated to that band already, switching the light band radio too would leave its band uncovered
+  for (size_t i = 0; i < mgr->num_radios; i++) {
+    if (profile != old && transmits(&mgr->radios[i]) && mgr->radios[i].config.profile == profile) {
+      ESP_LOGI(TAG, "Light band moves to radio %zu on %s", i, cc1101_profile_name(profile));
+      mgr->light_profile = profile;
+      return ESP_OK;
+    }
+  }
+
+  esp_err_t ret = ESP_OK;
+  size_t failed = 0;
+  for (size_t i = 0; i < mgr->num_radios; i++) {
+    if (mgr->radios[i].config.profile != old) continue;
+    ret = switch_radio(&mgr->radios[i], profile);
+    if (ret != ESP_OK) {
+      failed = i;
+      break;
+    }
+  }
+  if (ret == ESP_OK) {
+    mgr->light_profile = profile;
+    return ESP_OK;
+  }
+
+  ESP_LOGE(TAG, "Failed to switch radio %zu to %s, back to %s", failed, cc1101_profile_name(profile), cc1101_profile_name(old));
+  // the radios switched before it, and the one that failed part way
+  for (size_t i = 0; i <= failed; i++) {
+    radio_t* radio = &mgr->radios[i];
+    if (i != failed && radio->config.profile != profile) continue;
+    if (switch_radio(radio, old) != ESP_OK) {
+      // its profile says what it is on, so light commands skip it
+      ESP_LOGE(TAG, "Radio %zu stays on %s", i, cc1101_profile_name(radio->config.profile));
+    }
+  }
+  return ret;
+}
+
+radio_t* radio_manager_rx_radio(radio_manager_t* mgr) {
+  for (size_t i = 0; i < mgr->num_radios; i++) {
+    if (receives(&mgr->radios[i])) return &mgr->radios[i];
+  }
+  return NULL;
+}
+
+esp_err_t radio_manager_read_rssi(radio_manager_t* mgr, size_t index, int16_t* rssi_dbm) {
+  ESP_RETURN_ON_FALSE(index < mgr->num_radios, ESP_ERR_INVALID_ARG, TAG, "No radio %zu", index);
+  radio_t* radio = &mgr->radios[index];
+  *rssi_dbm = INT16_MIN;
+  // a radio in the middle of a TX window or a state change has no reception to measure
+  if (!receives(radio) || xSemaphoreTake(radio->lock, 0) != pdTRUE) return ESP_ERR_INVALID_STATE;
+  esp_err_t err = cc1101_read_rssi_peak(radio->cc1101, RADIO_MANAGER_RSSI_SAMPLES, RADIO_MANAGER_RSSI_INTERVAL_US, rssi_dbm);
+  xSemaphoreGive(radio->lock);
+  return err;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include "cc1101.h"
+#include "cc1101_profiles.h"
+#include "cc1101_setup.h"
+#include "esp_err.h"
+#include "rf_light_rx.h"
+#include "rf_light_tx.h"
+#include "rf_light_tx_sched.h"
+
+// the S2 has four RMT channels, enough for two radios that both receive and transmit
+#define RADIO_MANAGER_MAX_RADIOS 2
+// RSSI of a received message, the peak over the next ~1 ms while the remote keeps repeating
+#define RADIO_MANAGER_RSSI_SAMPLES 4
+#define RADIO_MANAGER_RSSI_INTERVAL_US 250
+
+typedef enum {
+  RADIO_ROLE_RX_TX,
+  // stays in RX, so reception continues while another radio transmits
+  RADIO_ROLE_RX,
+  // sits in IDLE between TX windows
+  RADIO_ROLE_TX,
+} radio_role_t;
+
+typedef struct {
+  cc1101_pins_t pins;
+  radio_role_t role;
+  // band the radio starts on, radios on different bands split the work per band
+  cc1101_profile_id_t profile;
+} radio_config_t;
+
+typedef struct {
+  radio_config_t config;
+  cc1101_device_t* cc1101;
+  // taken around every state change of this radio, also the TX scheduler's radio_lock
+  SemaphoreHandle_t lock;
+  rf_light_rx_data_t rx;
+  rf_light_tx_t tx;
+  rf_light_tx_sched_t tx_sched;
+} radio_t;
+
+typedef struct {
+  // every receiving radio posts its decoded messages here
+  QueueHandle_t event_queue;
+  radio_t radios[RADIO_MANAGER_MAX_RADIOS];
+  size_t num_radios;
+  // band the lights are on, light commands go to a transmitter on it
+  cc1101_profile_id_t light_profile;
+} radio_manager_t;
+
+/**
+ * @brief Bring up a radio and its RX capture and/or TX channel according to its role
+ *
+ * The radio gets the next index, which tags the events it receives.
+ */
+esp_err_t radio_manager_add(radio_manager_t* mgr, const radio_config_t* config);
+
+/**
+ * @brief Put every radio in the state of its role and start the TX schedulers
+ *
+ * A transmit only radio does its listen before talk on a receiving radio of the same band.
+ */
+esp_err_t radio_manager_start(radio_manager_t* mgr);
+
+// Hand light commands to a transmitter on the light band, accepted as in rf_light_tx_sched_submit
+esp_err_t radio_manager_submit(radio_manager_t* mgr, const rf_light_tx_command_t* commands, size_t count, uint32_t* accepted);
+
+/**
+ * @brief Move every radio on the light band to another profile
+ *
+ * Radios dedicated to another band keep theirs. When one of them is on the new profile
+ * already, the light band moves to it instead and no radio switches, so both bands stay
+ * covered. If a radio fails to switch, the ones that did go back and the light band stays.
+ */
+esp_err_t radio_manager_set_profile(radio_manager_t* mgr, cc1101_profile_id_t profile);
+
+// First radio that receives, NULL if there is none
+radio_t* radio_manager_rx_radio(radio_manager_t* mgr);
+
+/**
+ * @brief Sample the RSSI on a receiving radio, right after it decoded a message
+ *
+ * Does not wait for the radio lock, and returns ESP_ERR_INVALID_STATE with INT16_MIN
+ * while the radio is transmitting or changing state.
+ */
+esp_err_t radio_manager_read_rssi(radio_manager_t* mgr, size_t index, int16_t* rssi_dbm);
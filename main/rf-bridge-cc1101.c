@@ -1,26 +1,59 @@
 #include <stdio.h>
 #include "esp_system.h"
+#include "bench.h"
+#include "binlog.h"
 #include "event_queue.h"
+#include "loadgen.h"
 #include "freertos/idf_additions.h"
 #include "nvs_flash.h"
 #include "esp_event.h"
 #include "esp_netif.h"
 #include "rf_light_encoder.h"
 #include "rf_light_tx.h"
+#include "rf_light_tx_sched.h"
 #include "wifi.h"
+#include "wifi_power.h"
 #include "mqtt.h"
+#include "mqtt_publish.h"
+#include "ota.h"
+#include "profiling.h"
+#include "radio_manager.h"
+#include "rf_arbiter.h"
+#include "rf_code_registry.h"
+#include "rf_rules.h"
 #include "cc1101_setup.h"
+#include "cc1101_profiles.h"
 #include "rf_light_rx.h"
+#include "rf_light_rx_gate.h"
+#include "rf_light_wor.h"
 #include "mqtt_client.h"
 #include "esp_log.h"
 #include "driver/gpio.h"
 
 #define TAG "rf-bridge-cc1101"
 
+// A received code this bridge publishes, right away or after winning the arbitration
+static void deliver_code(uint16_t code, uint8_t radio, int16_t rssi_dbm) {
+  rf_light_payload_t decoded_message;
+  if (decode_rf_light_payload(code, &decoded_message)) {
+    // not one of the lights, may be a learned remote
+    rf_code_registry_received(code);
+  } else {
+    BINLOGI(TAG, "Received RF light message | Radio: %d | Channel: %c | On: %d | RSSI: %d", radio, decoded_message.channel, decoded_message.on, rssi_dbm);
+    rf_rules_set_light(decoded_message.channel, decoded_message.on);
+
+    // handed off to the publisher task so we never wait on the socket here
+    mqtt_publish_light_state(decoded_message.channel, decoded_message.on);
+  }
+}
+
 void app_main(void)
 {
     ESP_LOGI(TAG, "last reset reason %d", esp_reset_reason());
 
+  // first, so hot path logging before it is not lost
+  ESP_ERROR_CHECK(binlog_start());
+
   // general ESP32 initializations
   ESP_ERROR_CHECK(nvs_flash_init());
   ESP_ERROR_CHECK(esp_netif_init());
@@ -42,28 +75,66 @@ void app_main(void)
 
   // Wi-Fi
   initialize_wifi();
-
-  // init cc1101
-  cc1101_device_t* cc1101;
-  ESP_ERROR_CHECK(init_cc1101(&cc1101));
-
-  QueueHandle_t message_queue = xQueueCreate(PARSED_MESSAGE_QUEUE_LENGTH, sizeof(event_queue_message_t));
-
-  // init RMT receiver and start RX
-  rf_light_rx_data_t rx_data = {0};
-  rx_data.parsed_message_queue = message_queue;
-  ESP_ERROR_CHECK(rf_light_initialize_rx(GPIO_NUM_9, &rx_data));
-  rf_light_tx_t tx = {0};
-  ESP_ERROR_CHECK(rf_light_initialize_tx(&tx, GPIO_NUM_8));
-
+  ESP_ERROR_CHECK(wifi_power_start());
+
+  QueueHandle_t message_queue = event_queue_create();
+
+  // init the radios with their RX capture and TX channels
+  static radio_manager_t radios = {0};
+  radios.event_queue = message_queue;
+  radios.light_profile = CONFIG_RF_BRIDGE_DEFAULT_RADIO_PROFILE;
+  radio_config_t radio0 = {
+    .pins = { .cs_io_num = GPIO_NUM_10, .gdo0_io_num = GPIO_NUM_8, .gdo2_io_num = GPIO_NUM_9 },
+    .role = RADIO_ROLE_RX_TX,
+    .profile = CONFIG_RF_BRIDGE_DEFAULT_RADIO_PROFILE,
+  };
+#ifdef CONFIG_RF_BRIDGE_RADIO1
+  radio_config_t radio1 = {
+    .pins = {
+      .cs_io_num = CONFIG_RF_BRIDGE_RADIO1_CS_GPIO,
+      .gdo0_io_num = CONFIG_RF_BRIDGE_RADIO1_GDO0_GPIO,
+      .gdo2_io_num = CONFIG_RF_BRIDGE_RADIO1_GDO2_GPIO,
+    },
+    .role = RADIO_ROLE_RX_TX,
+    .profile = CONFIG_RF_BRIDGE_DEFAULT_RADIO_PROFILE,
+  };
+#ifdef CONFIG_RF_BRIDGE_RADIO_ROLES_SPLIT
+  radio0.role = RADIO_ROLE_RX;
+  radio1.role = RADIO_ROLE_TX;
+#else
+  // the other band
+  radio1.profile = CONFIG_RF_BRIDGE_DEFAULT_RADIO_PROFILE == CC1101_PROFILE_315_AM650 ? CC1101_PROFILE_433_AM650 : CC1101_PROFILE_315_AM650;
+#endif
+#endif
+  ESP_ERROR_CHECK(radio_manager_add(&radios, &radio0));
+#ifdef CONFIG_RF_BRIDGE_RADIO1
+  ESP_ERROR_CHECK(radio_manager_add(&radios, &radio1));
+#endif
+
+  ESP_ERROR_CHECK(ota_start());
   esp_mqtt_client_handle_t mqtt = mqtt_app_start(message_queue);
-
-  ESP_ERROR_CHECK(cc1101_start_rx(cc1101));
-  cc1101_debug_print_regs(cc1101);
-
-  event_queue_message_t message_payload;
-
-  rf_light_payload_t decoded_message;
+  profiling_start(mqtt);
+  ESP_ERROR_CHECK(rf_code_registry_start(mqtt));
+
+  ESP_ERROR_CHECK(radio_manager_start(&radios));
+  // the select shows the boot profile until the first switch, retained for Home Assistant restarts
+  mqtt_publish_enqueue(MQTT_PREFIX "radio_profile/state", cc1101_profile_name(radios.light_profile), 0, 0, true);
+  ESP_ERROR_CHECK(rf_rules_start(&radios));
+#if defined(CONFIG_RF_BRIDGE_RX_GATE) || defined(CONFIG_RF_BRIDGE_WOR)
+  radio_t* rx_radio = radio_manager_rx_radio(&radios);
+#endif
+#ifdef CONFIG_RF_BRIDGE_RX_GATE
+  ESP_ERROR_CHECK(rf_light_rx_gate_start(rx_radio->cc1101, rx_radio->lock, &rx_radio->rx));
+#endif
+#ifdef CONFIG_RF_BRIDGE_WOR
+  ESP_ERROR_CHECK(rf_light_wor_start(rx_radio->cc1101, &rx_radio->rx, rx_radio->lock, rx_radio->config.pins.gdo2_io_num));
+#endif
+  ESP_ERROR_CHECK(bench_start(&radios));
+  ESP_ERROR_CHECK(loadgen_start(&radios));
+
+  event_queue_message_t* message_payload;
+  // until the next arbitration window ends
+  TickType_t wait = portMAX_DELAY;
 
   gpio_set_level(GPIO_NUM_14, 0);
 
@@ -71,32 +142,60 @@ void app_main(void)
 
   while (1) {
     // wait for RX done signal
-    if (xQueueReceive(message_queue, &message_payload, portMAX_DELAY)) {
-        if (message_payload.type == EVENT_QUEUE_MESSAGE_RF_LIGHT) {
-
-            if (decode_rf_light_payload(message_payload.data.rf_light_message, &decoded_message)) {
-                // error
-                ESP_LOGW(TAG, "Received invalid RF Light message: %04X", message_payload.data.rf_light_message);
+    if (xQueueReceive(message_queue, &message_payload, wait)) {
+        PROFILING_BEGIN(dispatch);
+        if (message_payload->type == EVENT_QUEUE_MESSAGE_RF_LIGHT) {
+            // a press is often followed by commands from Home Assistant
+            wifi_power_activity();
+            // local automations first, they do not wait for the RSSI or the arbitration
+            rf_rules_received(message_payload->data.rf_light_message, message_payload->timestamp_us);
+            // the remote is still repeating the frame, so this measures the same transmission
+            radio_manager_read_rssi(&radios, message_payload->radio, &message_payload->rssi_dbm);
+            uint16_t code = message_payload->data.rf_light_message;
+            if (rf_arbiter_received(code, message_payload->radio, message_payload->rssi_dbm)) {
+                deliver_code(code, message_payload->radio, message_payload->rssi_dbm);
+            }
+        } else if (message_payload->type == EVENT_QUEUE_MESSAGE_ARBITRATION) {
+            rf_arbiter_announced(&message_payload->data.announcement);
+        } else if (message_payload->type == EVENT_QUEUE_MESSAGE_RULES) {
+            ESP_ERROR_CHECK_WITHOUT_ABORT(rf_rules_load(&message_payload->data.rules));
+        } else if (message_payload->type == EVENT_QUEUE_MESSAGE_MQTT) {
+            BINLOGI(TAG, "Received MQTT message | Channel: %c | On: %d", message_payload->data.mqtt_message.light_id, message_payload->data.mqtt_message.turn_on);
+            rf_light_tx_command_t command = {
+                .payload.channel = message_payload->data.mqtt_message.light_id,
+                .payload.on = message_payload->data.mqtt_message.turn_on,
+            };
+            // the TX task owns the radio while sending, so this never blocks the loop
+            if (radio_manager_submit(&radios, &command, 1, NULL) != ESP_OK) {
+                BINLOGW(TAG, "TX scheduler full, dropped command for channel %c", command.payload.channel);
             } else {
-                ESP_LOGI(TAG, "Received RF light message | Channel: %c | On: %d", decoded_message.channel, decoded_message.on);
-
-                char topic[42];
-                snprintf(topic, 42, "devices/rf_bridge_2/light_channel_%c/state", decoded_message.channel);
-
-                esp_mqtt_client_publish(mqtt, topic, decoded_message.on ? "ON" : "OFF", 0, 0, 0);
+                rf_rules_set_light(command.payload.channel, command.payload.on);
+            }
+        } else if (message_payload->type == EVENT_QUEUE_MESSAGE_MQTT_BULK) {
+            const mqtt_bulk_message_t* bulk = &message_payload->data.mqtt_bulk;
+            BINLOGI(TAG, "Received MQTT bulk message | %d commands", bulk->count);
+            uint32_t accepted;
+            if (radio_manager_submit(&radios, bulk->commands, bulk->count, &accepted) != ESP_OK) {
+                BINLOGW(TAG, "TX scheduler full, dropped part of a bulk message");
+            }
+            // the rules only see the states that will go out
+            for (size_t i = 0; i < bulk->count; i++) {
+                if (accepted & (1u << i)) rf_rules_set_light(bulk->commands[i].payload.channel, bulk->commands[i].payload.on);
             }
-        } else if (message_payload.type == EVENT_QUEUE_MESSAGE_MQTT) {
-            ESP_LOGI(TAG, "Received MQTT message | Channel: %c | On: %d", message_payload.data.mqtt_message.light_id, message_payload.data.mqtt_message.turn_on);
-            decoded_message.channel = message_payload.data.mqtt_message.light_id;
-            decoded_message.on = message_payload.data.mqtt_message.turn_on;
-            // encode
-            rf_light_message_t message = encode_rf_light_payload(&decoded_message);
-            ESP_LOGI(TAG, "Sending message %04X", message);
-            ESP_ERROR_CHECK(cc1101_start_tx(cc1101));
-            ESP_ERROR_CHECK(rf_light_tx_send(&tx, message));
-            vTaskDelay(2000 / portTICK_PERIOD_MS);
-            ESP_ERROR_CHECK(cc1101_start_rx(cc1101));
+        } else if (message_payload->type == EVENT_QUEUE_MESSAGE_RADIO_PROFILE) {
+            // on failure the light band stays on the old profile, publishing it reverts the select
+            ESP_ERROR_CHECK_WITHOUT_ABORT(radio_manager_set_profile(&radios, message_payload->data.radio_profile));
+            const char* name = cc1101_profile_name(radios.light_profile);
+            mqtt_publish_enqueue(MQTT_PREFIX "radio_profile/state", name, 0, 0, true);
+        } else if (message_payload->type == EVENT_QUEUE_MESSAGE_LEARN) {
+            rf_code_registry_set_learning(message_payload->data.learning);
+        } else if (message_payload->type == EVENT_QUEUE_MESSAGE_BIND_CODE) {
+            ESP_ERROR_CHECK_WITHOUT_ABORT(rf_code_registry_bind(&message_payload->data.bind_code));
         }
+        // back to the pool for the producers
+        event_queue_release(message_payload);
+        PROFILING_END(dispatch, PROFILING_SECTION_DISPATCH);
     }
+    wait = rf_arbiter_poll(deliver_code);
   }
 }
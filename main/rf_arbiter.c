@@ -0,0 +1,201 @@
+#include "rf_arbiter.h"
+
+#ifdef CONFIG_RF_BRIDGE_ARBITRATION
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "event_queue.h"
+#include "mqtt_publish.h"
+
+#define TAG "RF Arbiter"
+
+#define WINDOW_US ((int64_t) CONFIG_RF_BRIDGE_ARBITRATION_WINDOW_MS * 1000)
+#define HOLD_US ((int64_t) CONFIG_RF_BRIDGE_ARBITRATION_HOLD_MS * 1000)
+
+typedef struct {
+  bool used;
+  bool decided;
+  // set once this bridge received the code and told the others
+  bool announced;
+  uint16_t code;
+  uint8_t radio;
+  // as announced, INT16_MIN until received here
+  int16_t own_rssi_dbm;
+  // strongest other bridge so far, INT16_MIN if none
+  int16_t best_rssi_dbm;
+  char best_bridge[RF_ARBITER_ID_LEN];
+  int64_t deadline_us;
+  // the press is over once the code has not been seen for HOLD_US
+  int64_t last_seen_us;
+} press_t;
+
+static press_t presses[RF_ARBITER_MAX_PRESSES];
+static rf_arbiter_stats_t stats;
+
+int rf_arbiter_subscribe(esp_mqtt_client_handle_t client) {
+  return esp_mqtt_client_subscribe(client, RF_ARBITER_TOPIC, 0) >= 0 ? 1 : 0;
+}
+
+bool rf_arbiter_handle_message(QueueHandle_t queue, const char* topic, size_t topic_len, const char* data, size_t data_len) {
+  if (topic_len != strlen(RF_ARBITER_TOPIC) || strncmp(topic, RF_ARBITER_TOPIC, topic_len) != 0) return false;
+
+  char payload[64];
+  if (data_len >= sizeof(payload)) return true;
+  memcpy(payload, data, data_len);
+  payload[data_len] = '\0';
+
+  rf_arbiter_announcement_t announcement;
+  unsigned code;
+  int rssi;
+  uint32_t uptime_ms;
+  if (sscanf(payload, "%23s %x %d %" SCNu32, announcement.bridge, &code, &rssi, &uptime_ms) != 4 || code > UINT16_MAX) {
+    ESP_LOGW(TAG, "Malformed announcement %s", payload);
+    return true;
+  }
+  // our own, back from the broker
+  if (strcmp(announcement.bridge, CONFIG_RF_BRIDGE_ID) == 0) return true;
+  announcement.code = code;
+  announcement.rssi_dbm = rssi;
+  announcement.uptime_ms = uptime_ms;
+
+  event_queue_message_t* evt = event_queue_claim(EVENT_QUEUE_MESSAGE_ARBITRATION);
+  if (evt == NULL) {
+    ESP_LOGW(TAG, "Event pool exhausted, dropping announcement");
+    return true;
+  }
+  evt->data.announcement = announcement;
+  event_queue_send(queue, evt);
+  return true;
+}
+
+// Press for code that is still going on at now, or NULL
+static press_t* find(uint16_t code, int64_t now) {
+  for (size_t i = 0; i < RF_ARBITER_MAX_PRESSES; i++) {
+    press_t* press = &presses[i];
+    if (!press->used || press->code != code) continue;
+    if (press->decided && now - press->last_seen_us >= HOLD_US) {
+      press->used = false;
+      return NULL;
+    }
+    return press;
+  }
+  return NULL;
+}
+
+static press_t* open_press(uint16_t code, int64_t now) {
+  for (size_t i = 0; i < RF_ARBITER_MAX_PRESSES; i++) {
+    press_t* press = &presses[i];
+    if (press->used && !(press->decided && now - press->last_seen_us >= HOLD_US)) continue;
+    *press = (press_t) {
+      .used = true,
+      .code = code,
+      .own_rssi_dbm = INT16_MIN,
+      .best_rssi_dbm = INT16_MIN,
+      .deadline_us = now + WINDOW_US,
+      .last_seen_us = now,
+    };
+    return press;
+  }
+  return NULL;
+}
+
+static void announce(press_t* press, int64_t now) {
+  char payload[64];
+  int len = snprintf(payload, sizeof(payload), "%s %04x %d %" PRIu32, CONFIG_RF_BRIDGE_ID, press->code, press->own_rssi_dbm, (uint32_t) (now / 1000));
+  if (mqtt_publish_enqueue(RF_ARBITER_TOPIC, payload, len, 0, false) == ESP_OK) stats.announced++;
+  press->announced = true;
+}
+
+bool rf_arbiter_received(uint16_t code, uint8_t radio, int16_t rssi_dbm) {
+  int64_t now = esp_timer_get_time();
+  press_t* press = find(code, now);
+  if (press == NULL) {
+    press = open_press(code, now);
+    if (press == NULL) {
+      stats.full++;
+      return true;
+    }
+  }
+
+  press->last_seen_us = now;
+  if (press->decided) {
+    stats.repeats++;
+    return false;
+  }
+  // the others decide on the announced RSSI, so ours must not change after it
+  if (!press->announced) {
+    press->radio = radio;
+    press->own_rssi_dbm = rssi_dbm;
+    announce(press, now);
+  }
+  return false;
+}
+
+void rf_arbiter_announced(const rf_arbiter_announcement_t* announcement) {
+  int64_t now = esp_timer_get_time();
+  stats.heard++;
+  press_t* press = find(announcement->code, now);
+  if (press == NULL) {
+    // heard elsewhere first, the window starts now in case we receive it too
+    press = open_press(announcement->code, now);
+    if (press == NULL) return;
+  }
+
+  if (press->decided) {
+    stats.late++;
+    return;
+  }
+  if (announcement->rssi_dbm > press->best_rssi_dbm ||
+      (announcement->rssi_dbm == press->best_rssi_dbm && strcmp(announcement->bridge, press->best_bridge) < 0)) {
+    press->best_rssi_dbm = announcement->rssi_dbm;
+    strlcpy(press->best_bridge, announcement->bridge, sizeof(press->best_bridge));
+  }
+}
+
+static void decide(press_t* press, rf_arbiter_deliver_t deliver) {
+  press->decided = true;
+  // only heard elsewhere
+  if (!press->announced) return;
+
+  bool alone = press->best_rssi_dbm == INT16_MIN && press->best_bridge[0] == '\0';
+  bool won = alone || press->own_rssi_dbm > press->best_rssi_dbm ||
+             (press->own_rssi_dbm == press->best_rssi_dbm && strcmp(CONFIG_RF_BRIDGE_ID, press->best_bridge) < 0);
+  if (won) {
+    stats.won++;
+    if (alone) stats.alone++;
+    deliver(press->code, press->radio, press->own_rssi_dbm);
+  } else {
+    stats.lost++;
+  }
+  if (!alone) {
+    ESP_LOGI(TAG, "Code %04x | %d dBm here | %d dBm at %s | %s", press->code, press->own_rssi_dbm, press->best_rssi_dbm,
+             press->best_bridge, won ? "published" : "suppressed");
+  }
+}
+
+TickType_t rf_arbiter_poll(rf_arbiter_deliver_t deliver) {
+  int64_t now = esp_timer_get_time();
+  int64_t next = INT64_MAX;
+  for (size_t i = 0; i < RF_ARBITER_MAX_PRESSES; i++) {
+    press_t* press = &presses[i];
+    if (!press->used || press->decided) continue;
+    if (now >= press->deadline_us) {
+      decide(press, deliver);
+    } else if (press->deadline_us < next) {
+      next = press->deadline_us;
+    }
+  }
+  if (next == INT64_MAX) return portMAX_DELAY;
+  // rounded up, so the window has ended when the loop comes back
+  return (next - now + portTICK_PERIOD_MS * 1000 - 1) / (portTICK_PERIOD_MS * 1000);
+}
+
+void rf_arbiter_get_stats(rf_arbiter_stats_t* stats_out) {
+  *stats_out = stats;
+}
+
+#endif
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_err.h"
+#include "mqtt_client.h"
+
+// Duplicate suppression between bridges in range of the same remotes.
+//
+// A bridge that receives a code announces it on the shared topic with "<bridge> <code hex>
+// <rssi dBm> <uptime ms>" and waits CONFIG_RF_BRIDGE_ARBITRATION_WINDOW_MS for the others.
+// Only the bridge that heard the press strongest publishes it, ties go to the lowest bridge
+// name. Repeats of the code within CONFIG_RF_BRIDGE_ARBITRATION_HOLD_MS belong to the same
+// press. Times are each bridge's own arrival times, the uptime in the announcement is only
+// there for whoever reads the topic.
+
+#define RF_ARBITER_TOPIC "rf_bridges/arbitration"
+// bridge names, including the terminator
+#define RF_ARBITER_ID_LEN 24
+// presses being arbitrated or held at once
+#define RF_ARBITER_MAX_PRESSES 8
+
+typedef struct {
+  char bridge[RF_ARBITER_ID_LEN];
+  uint16_t code;
+  int16_t rssi_dbm;
+  uint32_t uptime_ms;
+} rf_arbiter_announcement_t;
+
+typedef struct {
+  uint32_t announced;
+  // announcements from other bridges
+  uint32_t heard;
+  // presses published here, and the ones no other bridge reported
+  uint32_t won;
+  uint32_t alone;
+  // presses another bridge heard stronger
+  uint32_t lost;
+  // announcements that came after the press was decided
+  uint32_t late;
+  // repeats of a decided press
+  uint32_t repeats;
+  // presses published without arbitration because every slot was taken
+  uint32_t full;
+} rf_arbiter_stats_t;
+
+// Called for every press this bridge won, from rf_arbiter_poll
+typedef void (*rf_arbiter_deliver_t)(uint16_t code, uint8_t radio, int16_t rssi_dbm);
+
+#ifdef CONFIG_RF_BRIDGE_ARBITRATION
+
+// Subscribe to the shared topic, returns the number of subscriptions made
+int rf_arbiter_subscribe(esp_mqtt_client_handle_t client);
+
+/**
+ * @brief Take an announcement off the MQTT task and queue it for the dispatch loop
+ *
+ * @return false if the topic is not the arbitration topic
+ */
+bool rf_arbiter_handle_message(QueueHandle_t queue, const char* topic, size_t topic_len, const char* data, size_t data_len);
+
+/**
+ * @brief Report a code received here
+ *
+ * Not thread safe, this and the functions below are called from the dispatch loop only.
+ *
+ * @param rssi_dbm INT16_MIN if the RSSI could not be read, such a press only wins alone
+ * @return true if the code has to be delivered right away, without arbitration
+ */
+bool rf_arbiter_received(uint16_t code, uint8_t radio, int16_t rssi_dbm);
+
+void rf_arbiter_announced(const rf_arbiter_announcement_t* announcement);
+
+/**
+ * @brief Decide the presses whose window has ended
+ *
+ * @return Ticks until the next window ends, portMAX_DELAY if none is open
+ */
+TickType_t rf_arbiter_poll(rf_arbiter_deliver_t deliver);
+
+void rf_arbiter_get_stats(rf_arbiter_stats_t* stats);
+
+#else
+
+static inline int rf_arbiter_subscribe(esp_mqtt_client_handle_t client) { return 0; }
+static inline bool rf_arbiter_handle_message(QueueHandle_t queue, const char* topic, size_t topic_len, const char* data, size_t data_len) { return false; }
+static inline bool rf_arbiter_received(uint16_t code, uint8_t radio, int16_t rssi_dbm) { return true; }
+static inline void rf_arbiter_announced(const rf_arbiter_announcement_t* announcement) {}
+static inline TickType_t rf_arbiter_poll(rf_arbiter_deliver_t deliver) { return portMAX_DELAY; }
+
+#endif
@@ -0,0 +1,45 @@
+#include "rf_capture.h"
+
+#include <freertos/FreeRTOS.h>
+#include "esp_attr.h"
+#include "esp_cpu.h"
+
+static portMUX_TYPE registry_lock = portMUX_INITIALIZER_UNLOCKED;
+static rf_capture_t* registry[RF_CAPTURE_MAX_BACKENDS];
+static size_t num_registered;
+
+void rf_capture_register(rf_capture_t* capture, rf_capture_frame_cb_t on_frame, void* user_data) {
+  capture->on_frame = on_frame;
+  capture->user_data = user_data;
+
+  portENTER_CRITICAL(&registry_lock);
+  if (num_registered < RF_CAPTURE_MAX_BACKENDS) registry[num_registered++] = capture;
+  portEXIT_CRITICAL(&registry_lock);
+}
+
+IRAM_ATTR bool rf_capture_deliver(rf_capture_t* capture, const rmt_symbol_word_t* symbols, size_t num_symbols) {
+  uint32_t start = esp_cpu_get_cycle_count();
+  bool high_task_wakeup = capture->on_frame(capture, symbols, num_symbols, capture->user_data);
+
+  portENTER_CRITICAL_ISR(&registry_lock);
+  capture->stats.frames++;
+  capture->stats.symbols += num_symbols;
+  capture->stats.callback_cycles += esp_cpu_get_cycle_count() - start;
+  portEXIT_CRITICAL_ISR(&registry_lock);
+  return high_task_wakeup;
+}
+
+IRAM_ATTR void rf_capture_account_interrupt(rf_capture_t* capture, uint32_t cycles) {
+  portENTER_CRITICAL_ISR(&registry_lock);
+  capture->stats.interrupts++;
+  capture->stats.capture_cycles += cycles;
+  portEXIT_CRITICAL_ISR(&registry_lock);
+}
+
+size_t rf_capture_get_stats(rf_capture_stats_t* stats, size_t max) {
+  size_t n = 0;
+  portENTER_CRITICAL(&registry_lock);
+  for (; n < num_registered && n < max; n++) stats[n] = registry[n]->stats;
+  portEXIT_CRITICAL(&registry_lock);
+  return n;
+}
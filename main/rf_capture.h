@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "driver/gpio.h"
+#include "esp_err.h"
+#include "hal/rmt_types.h"
+
+// longest frame handed to the decoder, same as the RMT channel memory
+#define RF_CAPTURE_MAX_SYMBOLS 64
+// backends registered for stats
+#define RF_CAPTURE_MAX_BACKENDS 4
+// symbol durations are in ticks of this resolution for every backend
+#define RF_CAPTURE_RESOLUTION_HZ (1000000 / 2)
+// a level held longer than this ends the frame
+#define RF_CAPTURE_IDLE_US 6000
+
+typedef struct rf_capture_t rf_capture_t;
+
+/**
+ * @brief Called from interrupt context with a complete frame
+ *
+ * Symbols are high/low pairs in RF_CAPTURE_RESOLUTION_HZ ticks, the same layout the RMT
+ * driver produces. The backend stays disarmed until arm is called again, which is allowed
+ * from within the callback.
+ *
+ * @return whether a higher priority task was woken
+ */
+typedef bool (*rf_capture_frame_cb_t)(rf_capture_t* capture, const rmt_symbol_word_t* symbols, size_t num_symbols, void* user_data);
+
+typedef struct {
+  const char* name;
+  uint32_t frames;
+  uint32_t symbols;
+  // interrupts taken by the backend itself
+  uint32_t interrupts;
+  // CPU cycles spent in the backend's own interrupt code, and in the frame callback
+  uint64_t capture_cycles;
+  uint64_t callback_cycles;
+  // capture_cycles start in a driver callback, the driver's ISR before it is not counted
+  bool capture_excludes_isr;
+} rf_capture_stats_t;
+
+/**
+ * A source of demodulated OOK frames.
+ *
+ * Backends embed this as their first member, like the RMT encoders do.
+ */
+struct rf_capture_t {
+  esp_err_t (*enable)(rf_capture_t* capture);
+  esp_err_t (*disable)(rf_capture_t* capture);
+  // capture the next frame, ISR safe
+  esp_err_t (*arm)(rf_capture_t* capture);
+  esp_err_t (*del)(rf_capture_t* capture);
+
+  rf_capture_frame_cb_t on_frame;
+  void* user_data;
+  rf_capture_stats_t stats;
+};
+
+// RMT RX channel, edges are timed in hardware and the CPU sees one interrupt per frame
+esp_err_t rf_capture_new_rmt(gpio_num_t gpio_num, rf_capture_t** capture);
+// GPIO edge interrupt timestamped with a gptimer, frees the RMT channel for another radio
+esp_err_t rf_capture_new_gpio(gpio_num_t gpio_num, rf_capture_t** capture);
+
+/**
+ * @brief Set the frame callback and register the backend for stats. Call before enabling.
+ */
+void rf_capture_register(rf_capture_t* capture, rf_capture_frame_cb_t on_frame, void* user_data);
+
+// For backends: hand a complete frame to the callback, accounting for its cost. ISR only.
+bool rf_capture_deliver(rf_capture_t* capture, const rmt_symbol_word_t* symbols, size_t num_symbols);
+// For backends: count one interrupt and the cycles it took, excluding any delivered frame. ISR only.
+void rf_capture_account_interrupt(rf_capture_t* capture, uint32_t cycles);
+
+// Returns the number of entries written
+size_t rf_capture_get_stats(rf_capture_stats_t* stats, size_t max);
@@ -0,0 +1,180 @@
+#include "rf_capture.h"
+
+#include <stdlib.h>
+#include "driver/gptimer.h"
+#include "esp_attr.h"
+#include "esp_check.h"
+#include "esp_cpu.h"
+#include "esp_log.h"
+
+#define TAG "RF Capture GPIO"
+
+#define IDLE_TICKS ((uint64_t) RF_CAPTURE_IDLE_US * RF_CAPTURE_RESOLUTION_HZ / 1000000)
+// duration fields are 15 bits
+#define MAX_DURATION 0x7FFF
+
+typedef struct {
+  rf_capture_t base;
+  gpio_num_t gpio_num;
+  gptimer_handle_t timer;
+  volatile bool armed;
+  bool in_frame;
+  uint64_t last_edge;
+  // symbols[num_symbols - 1] is waiting for its low period while the line is low
+  size_t num_symbols;
+  rmt_symbol_word_t symbols[RF_CAPTURE_MAX_SYMBOLS];
+} rf_capture_gpio_t;
+
+static inline uint32_t clamp_duration(uint64_t ticks) {
+  return ticks > MAX_DURATION ? MAX_DURATION : ticks;
+}
+
+// Hand the frame over like the RMT driver does, then stop listening unless re-armed
+static bool IRAM_ATTR finish_frame(rf_capture_gpio_t* gpio) {
+  bool high_task_wakeup = false;
+  gpio->in_frame = false;
+  gpio->armed = false;
+  if (gpio->num_symbols > 0) {
+    high_task_wakeup = rf_capture_deliver(&gpio->base, gpio->symbols, gpio->num_symbols);
+  }
+  gpio->num_symbols = 0;
+  // the callback may have armed us again
+  if (!gpio->armed) gpio_intr_disable(gpio->gpio_num);
+  return high_task_wakeup;
+}
+
+static void IRAM_ATTR edge_isr(void* arg) {
+  uint32_t start = esp_cpu_get_cycle_count();
+  rf_capture_gpio_t* gpio = (rf_capture_gpio_t*) arg;
+  uint64_t now;
+  gptimer_get_raw_count(gpio->timer, &now);
+  // read instead of toggling a tracked level, so a missed edge only costs one symbol
+  int level = gpio_get_level(gpio->gpio_num);
+  uint32_t duration = clamp_duration(now - gpio->last_edge);
+  bool high_task_wakeup = false;
+  uint32_t delivered = 0;
+
+  if (level) {
+    // rising edge: the low period that just ended belongs to the previous symbol
+    if (gpio->in_frame && gpio->num_symbols > 0) {
+      gpio->symbols[gpio->num_symbols - 1].duration1 = duration;
+      if (gpio->num_symbols == RF_CAPTURE_MAX_SYMBOLS) {
+        uint32_t finish_start = esp_cpu_get_cycle_count();
+        high_task_wakeup = finish_frame(gpio);
+        delivered = esp_cpu_get_cycle_count() - finish_start;
+      }
+    }
+    gpio->in_frame = gpio->armed;
+  } else if (gpio->in_frame && gpio->num_symbols < RF_CAPTURE_MAX_SYMBOLS) {
+    // falling edge: the high period starts a new symbol
+    gpio->symbols[gpio->num_symbols++] = (rmt_symbol_word_t) {
+      .level0 = 1,
+      .duration0 = duration,
+      .level1 = 0,
+      .duration1 = 0,
+    };
+  }
+  gpio->last_edge = now;
+
+  // frame ends once the line stays put for the idle time
+  if (gpio->in_frame) {
+    gptimer_alarm_config_t alarm = {
+      .alarm_count = now + IDLE_TICKS,
+    };
+    gptimer_set_alarm_action(gpio->timer, &alarm);
+  }
+
+  // the frame callback is accounted separately
+  rf_capture_account_interrupt(&gpio->base, esp_cpu_get_cycle_count() - start - delivered);
+  if (high_task_wakeup) {
+    portYIELD_FROM_ISR();
+  }
+}
+
+static bool IRAM_ATTR idle_alarm_callback(gptimer_handle_t timer, const gptimer_alarm_event_data_t* edata, void* user_data) {
+  uint32_t start = esp_cpu_get_cycle_count();
+  rf_capture_gpio_t* gpio = (rf_capture_gpio_t*) user_data;
+  if (!gpio->in_frame) return false;
+  rf_capture_account_interrupt(&gpio->base, esp_cpu_get_cycle_count() - start);
+  // like the RMT, the last symbol has no low period
+  return finish_frame(gpio);
+}
+
+static esp_err_t rf_capture_gpio_enable(rf_capture_t* capture) {
+  rf_capture_gpio_t* gpio = __containerof(capture, rf_capture_gpio_t, base);
+  ESP_RETURN_ON_ERROR(gptimer_enable(gpio->timer), TAG, "Failed to enable timer");
+  return gptimer_start(gpio->timer);
+}
+
+static esp_err_t rf_capture_gpio_disable(rf_capture_t* capture) {
+  rf_capture_gpio_t* gpio = __containerof(capture, rf_capture_gpio_t, base);
+  gpio_intr_disable(gpio->gpio_num);
+  gpio->armed = false;
+  gpio->in_frame = false;
+  gpio->num_symbols = 0;
+  ESP_RETURN_ON_ERROR(gptimer_stop(gpio->timer), TAG, "Failed to stop timer");
+  // also drops the timer's power management lock
+  return gptimer_disable(gpio->timer);
+}
+
+static esp_err_t IRAM_ATTR rf_capture_gpio_arm(rf_capture_t* capture) {
+  rf_capture_gpio_t* gpio = __containerof(capture, rf_capture_gpio_t, base);
+  gpio->armed = true;
+  return gpio_intr_enable(gpio->gpio_num);
+}
+
+static esp_err_t rf_capture_gpio_del(rf_capture_t* capture) {
+  rf_capture_gpio_t* gpio = __containerof(capture, rf_capture_gpio_t, base);
+  gpio_isr_handler_remove(gpio->gpio_num);
+  if (gpio->timer) ESP_RETURN_ON_ERROR(gptimer_del_timer(gpio->timer), TAG, "Failed to free timer");
+  free(gpio);
+  return ESP_OK;
+}
+
+esp_err_t rf_capture_new_gpio(gpio_num_t gpio_num, rf_capture_t** capture) {
+  rf_capture_gpio_t* gpio = calloc(1, sizeof(rf_capture_gpio_t));
+  ESP_RETURN_ON_FALSE(gpio, ESP_ERR_NO_MEM, TAG, "No memory for GPIO capture");
+  gpio->gpio_num = gpio_num;
+
+  // same tick as the RMT backend so the decoder does not care which one it is fed by
+  gptimer_config_t timer_cfg = {
+    .clk_src = GPTIMER_CLK_SRC_DEFAULT,
+    .direction = GPTIMER_COUNT_UP,
+    .resolution_hz = RF_CAPTURE_RESOLUTION_HZ,
+  };
+  esp_err_t ret = gptimer_new_timer(&timer_cfg, &gpio->timer);
+  if (ret != ESP_OK) {
+    free(gpio);
+    ESP_RETURN_ON_ERROR(ret, TAG, "Failed to create timer");
+  }
+
+  gptimer_event_callbacks_t cbs = {
+    .on_alarm = idle_alarm_callback,
+  };
+  ESP_GOTO_ON_ERROR(gptimer_register_event_callbacks(gpio->timer, &cbs, gpio), fail, TAG, "Failed to add alarm callback");
+
+  gpio_config_t io_config = {
+    .intr_type = GPIO_INTR_ANYEDGE,
+    .mode = GPIO_MODE_INPUT,
+    .pin_bit_mask = (1ULL << gpio_num),
+    .pull_down_en = 0,
+    .pull_up_en = 0
+  };
+  ESP_GOTO_ON_ERROR(gpio_config(&io_config), fail, TAG, "Failed to configure GPIO");
+  // needs the ISR service installed by app_main
+  ESP_GOTO_ON_ERROR(gpio_isr_handler_add(gpio_num, edge_isr, gpio), fail, TAG, "Failed to add edge ISR");
+  gpio_intr_disable(gpio_num);
+
+  gpio->base.enable = rf_capture_gpio_enable;
+  gpio->base.disable = rf_capture_gpio_disable;
+  gpio->base.arm = rf_capture_gpio_arm;
+  gpio->base.del = rf_capture_gpio_del;
+  gpio->base.stats.name = "gpio";
+
+  *capture = &gpio->base;
+  return ESP_OK;
+
+fail:
+  rf_capture_gpio_del(&gpio->base);
+  return ret;
+}
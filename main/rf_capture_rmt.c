@@ -0,0 +1,90 @@
+#include "rf_capture.h"
+
+#include <stdlib.h>
+#include <driver/rmt_rx.h>
+#include "esp_check.h"
+#include "esp_cpu.h"
+#include "esp_log.h"
+
+#define TAG "RF Capture RMT"
+
+typedef struct {
+  rf_capture_t base;
+  rmt_channel_handle_t channel;
+  rmt_receive_config_t config;
+  rmt_symbol_word_t symbols[RF_CAPTURE_MAX_SYMBOLS];
+} rf_capture_rmt_t;
+
+static bool rf_capture_rmt_done_callback(rmt_channel_handle_t channel, const rmt_rx_done_event_data_t* edata, void* user_data) {
+  uint32_t start = esp_cpu_get_cycle_count();
+  rf_capture_rmt_t* rmt = (rf_capture_rmt_t*) user_data;
+
+  // the peripheral timed the edges and the driver ISR copied the symbols out before this,
+  // neither of which is visible from here
+  rf_capture_account_interrupt(&rmt->base, esp_cpu_get_cycle_count() - start);
+  return rf_capture_deliver(&rmt->base, edata->received_symbols, edata->num_symbols);
+}
+
+static esp_err_t rf_capture_rmt_enable(rf_capture_t* capture) {
+  rf_capture_rmt_t* rmt = __containerof(capture, rf_capture_rmt_t, base);
+  return rmt_enable(rmt->channel);
+}
+
+static esp_err_t rf_capture_rmt_disable(rf_capture_t* capture) {
+  rf_capture_rmt_t* rmt = __containerof(capture, rf_capture_rmt_t, base);
+  return rmt_disable(rmt->channel);
+}
+
+static esp_err_t rf_capture_rmt_arm(rf_capture_t* capture) {
+  rf_capture_rmt_t* rmt = __containerof(capture, rf_capture_rmt_t, base);
+  return rmt_receive(rmt->channel, rmt->symbols, sizeof(rmt->symbols), &rmt->config);
+}
+
+static esp_err_t rf_capture_rmt_del(rf_capture_t* capture) {
+  rf_capture_rmt_t* rmt = __containerof(capture, rf_capture_rmt_t, base);
+  if (rmt->channel) ESP_RETURN_ON_ERROR(rmt_del_channel(rmt->channel), TAG, "Failed to free channel");
+  free(rmt);
+  return ESP_OK;
+}
+
+esp_err_t rf_capture_new_rmt(gpio_num_t gpio_num, rf_capture_t** capture) {
+  rf_capture_rmt_t* rmt = calloc(1, sizeof(rf_capture_rmt_t));
+  ESP_RETURN_ON_FALSE(rmt, ESP_ERR_NO_MEM, TAG, "No memory for RMT capture");
+
+  rmt_rx_channel_config_t rx_channel_cfg = {
+    .clk_src = RMT_CLK_SRC_DEFAULT,
+    .resolution_hz = RF_CAPTURE_RESOLUTION_HZ, // 1 tick = 2us
+    .mem_block_symbols = RF_CAPTURE_MAX_SYMBOLS,
+    .gpio_num = gpio_num
+  };
+  esp_err_t err = rmt_new_rx_channel(&rx_channel_cfg, &rmt->channel);
+  if (err != ESP_OK) {
+    free(rmt);
+    ESP_RETURN_ON_ERROR(err, TAG, "Failed to initialize channel");
+  }
+
+  rmt_rx_event_callbacks_t cbs = {
+    .on_recv_done = rf_capture_rmt_done_callback,
+  };
+  err = rmt_rx_register_event_callbacks(rmt->channel, &cbs, rmt);
+  if (err != ESP_OK) {
+    rf_capture_rmt_del(&rmt->base);
+    ESP_RETURN_ON_ERROR(err, TAG, "Failed to add RX callback");
+  }
+
+  // 3 us minimum time (the actual value is bigger, but the driver doesn't go higher)
+  rmt->config.signal_range_min_ns = 3 * 1000;
+  // max delay between messages
+  rmt->config.signal_range_max_ns = RF_CAPTURE_IDLE_US * 1000;
+
+  rmt->base.enable = rf_capture_rmt_enable;
+  rmt->base.disable = rf_capture_rmt_disable;
+  rmt->base.arm = rf_capture_rmt_arm;
+  rmt->base.del = rf_capture_rmt_del;
+  rmt->base.stats.name = "rmt";
+  // the driver owns the ISR, only the callback can be timed
+  rmt->base.stats.capture_excludes_isr = true;
+
+  *capture = &rmt->base;
+  return ESP_OK;
+}
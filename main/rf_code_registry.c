@@ -0,0 +1,275 @@
+#include "rf_code_registry.h"
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "binlog.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "mqtt.h"
+#include "mqtt_publish.h"
+#include "nvs.h"
+
+#define TAG "RF Code Registry"
+
+#define NUM_SLOTS (1 << RF_CODE_REGISTRY_SLOT_BITS)
+#define EMPTY_SLOT 0xFF
+
+#define NVS_NAMESPACE "rf_codes"
+#define NVS_KEY "codes"
+
+#define DISCOVERY_TOPIC_FORMAT "homeassistant/binary_sensor/" MQTT_HA_DEVICE_ID "/%s/config"
+
+// What goes to NVS, hit counts are not worth a flash write
+typedef struct {
+  uint16_t code;
+  uint8_t bound;
+  char name[RF_CODE_NAME_LEN];
+} rf_code_saved_t;
+
+static esp_mqtt_client_handle_t mqtt_client;
+static bool learning;
+static rf_code_entry_t entries[RF_CODE_REGISTRY_MAX_CODES];
+// open addressing index into entries, rebuilt when an entry is removed
+static uint8_t slots[NUM_SLOTS];
+static rf_code_registry_stats_t stats;
+
+// Fibonacci hashing, the remotes' codes differ mostly in the high nybbles
+static inline size_t hash_code(uint16_t code) {
+  return (uint16_t) (code * 40503u) >> (16 - RF_CODE_REGISTRY_SLOT_BITS);
+}
+
+// Slot holding code, or the empty slot where it would go
+static size_t find_slot(uint16_t code) {
+  size_t slot = hash_code(code);
+  stats.lookups++;
+  while (1) {
+    stats.probes++;
+    if (slots[slot] == EMPTY_SLOT || entries[slots[slot]].code == code) return slot;
+    slot = (slot + 1) & (NUM_SLOTS - 1);
+  }
+}
+
+static void rebuild_index(void) {
+  memset(slots, EMPTY_SLOT, sizeof(slots));
+  stats.codes = 0;
+  for (size_t i = 0; i < RF_CODE_REGISTRY_MAX_CODES; i++) {
+    if (!entries[i].used) continue;
+    slots[find_slot(entries[i].code)] = i;
+    stats.codes++;
+  }
+}
+
+static void set_name(rf_code_entry_t* entry, const char* name) {
+  strlcpy(entry->name, name, sizeof(entry->name));
+  snprintf(entry->topic, sizeof(entry->topic), MQTT_PREFIX "code/%s", entry->name);
+}
+
+// shared by save and load, too large for the main task stack
+static rf_code_saved_t saved[RF_CODE_REGISTRY_MAX_CODES];
+
+static esp_err_t save(void) {
+  size_t count = 0;
+  for (size_t i = 0; i < RF_CODE_REGISTRY_MAX_CODES; i++) {
+    rf_code_entry_t* entry = &entries[i];
+    if (!entry->used || !(entry->learned || entry->bound)) continue;
+    saved[count].code = entry->code;
+    saved[count].bound = entry->bound;
+    memcpy(saved[count].name, entry->name, sizeof(saved[count].name));
+    count++;
+  }
+
+  nvs_handle_t nvs;
+  ESP_RETURN_ON_ERROR(nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs), TAG, "Failed to open NVS");
+  esp_err_t ret = nvs_set_blob(nvs, NVS_KEY, saved, count * sizeof(saved[0]));
+  if (ret == ESP_OK) ret = nvs_commit(nvs);
+  nvs_close(nvs);
+  ESP_RETURN_ON_ERROR(ret, TAG, "Failed to save codes");
+  return ESP_OK;
+}
+
+static esp_err_t load(void) {
+  size_t size = sizeof(saved);
+
+  nvs_handle_t nvs;
+  esp_err_t ret = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs);
+  // nothing saved yet
+  if (ret == ESP_ERR_NVS_NOT_FOUND) return ESP_OK;
+  ESP_RETURN_ON_ERROR(ret, TAG, "Failed to open NVS");
+  ret = nvs_get_blob(nvs, NVS_KEY, saved, &size);
+  nvs_close(nvs);
+  if (ret == ESP_ERR_NVS_NOT_FOUND) return ESP_OK;
+  ESP_RETURN_ON_ERROR(ret, TAG, "Failed to load codes");
+
+  for (size_t i = 0; i < size / sizeof(saved[0]); i++) {
+    rf_code_entry_t* entry = &entries[i];
+    entry->used = true;
+    entry->learned = true;
+    entry->bound = saved[i].bound;
+    entry->code = saved[i].code;
+    saved[i].name[RF_CODE_NAME_LEN - 1] = '\0';
+    set_name(entry, saved[i].name);
+  }
+  return ESP_OK;
+}
+
+// Per component discovery next to the device discovery, an empty config removes the entity
+static void announce(const rf_code_entry_t* entry, bool present) {
+  char topic[96];
+  char config[256];
+  int len = 0;
+  snprintf(topic, sizeof(topic), DISCOVERY_TOPIC_FORMAT, entry->name);
+  if (present) {
+    len = snprintf(config, sizeof(config),
+                   "{\"name\":\"%s\",\"unique_id\":\"" MQTT_HA_UNIQUE_ID_PREFIX "rf_code_%s\",\"state_topic\":\"%s\",\"off_delay\":1,\"dev\":{\"ids\":\"" MQTT_HA_DEVICE_ID "\"}}",
+                   entry->name, entry->name, entry->topic);
+    // a truncated config is not valid JSON
+    if (len < 0 || len >= (int) sizeof(config)) {
+      ESP_LOGW(TAG, "Discovery config for %s too long", entry->name);
+      return;
+    }
+  }
+  // too large for the publish queue, and rare enough to go straight to the client outbox
+  esp_mqtt_client_enqueue(mqtt_client, topic, config, len, 1, true, true);
+}
+
+// Entry to put a new code in, preferring free ones over codes that were only seen once
+static rf_code_entry_t* alloc_entry(void) {
+  rf_code_entry_t* candidate = NULL;
+  for (size_t i = 0; i < RF_CODE_REGISTRY_MAX_CODES; i++) {
+    if (!entries[i].used) return &entries[i];
+    if (!entries[i].learned && !entries[i].bound && candidate == NULL) candidate = &entries[i];
+  }
+  if (candidate) {
+    candidate->used = false;
+    rebuild_index();
+  }
+  return candidate;
+}
+
+static rf_code_entry_t* insert(uint16_t code) {
+  rf_code_entry_t* entry = alloc_entry();
+  if (entry == NULL) return NULL;
+  memset(entry, 0, sizeof(*entry));
+  entry->used = true;
+  entry->code = code;
+  slots[find_slot(code)] = entry - entries;
+  stats.codes++;
+  return entry;
+}
+
+esp_err_t rf_code_registry_start(esp_mqtt_client_handle_t client) {
+  mqtt_client = client;
+  ESP_RETURN_ON_ERROR(load(), TAG, "Failed to load registry");
+  rebuild_index();
+
+  for (size_t i = 0; i < RF_CODE_REGISTRY_MAX_CODES; i++) {
+    if (entries[i].used && entries[i].bound) announce(&entries[i], true);
+  }
+  mqtt_publish_enqueue(MQTT_PREFIX "learn/state", "OFF", 0, 0, true);
+  ESP_LOGI(TAG, "Loaded %zu codes", stats.codes);
+  return ESP_OK;
+}
+
+void rf_code_registry_received(uint16_t code) {
+  uint8_t index = slots[find_slot(code)];
+  rf_code_entry_t* entry = index == EMPTY_SLOT ? NULL : &entries[index];
+
+  if (entry && entry->bound) {
+    entry->hits++;
+    // the entity turns itself off after off_delay
+    mqtt_publish_enqueue(entry->topic, "ON", 0, 0, false);
+    return;
+  }
+  if (!learning) {
+    BINLOGW(TAG, "Received unknown RF code: %04X", code);
+    return;
+  }
+
+  if (entry == NULL) {
+    entry = insert(code);
+    if (entry == NULL) {
+      stats.full++;
+      ESP_LOGW(TAG, "Registry full, not learning %04X", code);
+      return;
+    }
+  }
+  entry->hits++;
+  if (entry->learned || entry->hits < RF_CODE_REGISTRY_MIN_HITS) return;
+
+  entry->learned = true;
+  stats.learned++;
+  ESP_LOGI(TAG, "Learned code %04X", code);
+  char hex[5];
+  snprintf(hex, sizeof(hex), "%04X", code);
+  mqtt_publish_enqueue(MQTT_PREFIX "learn/code", hex, 4, 0, true);
+  ESP_ERROR_CHECK_WITHOUT_ABORT(save());
+}
+
+void rf_code_registry_set_learning(bool enabled) {
+  learning = enabled;
+  ESP_LOGI(TAG, "Learning %s", enabled ? "on" : "off");
+  mqtt_publish_enqueue(MQTT_PREFIX "learn/state", enabled ? "ON" : "OFF", 0, 0, true);
+}
+
+esp_err_t rf_code_registry_bind(const rf_code_bind_t* bind) {
+  uint8_t index = slots[find_slot(bind->code)];
+  rf_code_entry_t* entry = index == EMPTY_SLOT ? NULL : &entries[index];
+
+  if (bind->name[0] == '\0') {
+    ESP_RETURN_ON_FALSE(entry, ESP_ERR_NOT_FOUND, TAG, "Code %04X is not in the registry", bind->code);
+    if (entry->bound) announce(entry, false);
+    entry->used = false;
+    rebuild_index();
+    ESP_LOGI(TAG, "Forgot code %04X", bind->code);
+    return save();
+  }
+
+  // a name can only belong to one code
+  for (size_t i = 0; i < RF_CODE_REGISTRY_MAX_CODES; i++) {
+    rf_code_entry_t* other = &entries[i];
+    ESP_RETURN_ON_FALSE(!other->used || !other->bound || other == entry || strcmp(other->name, bind->name) != 0,
+                        ESP_ERR_INVALID_STATE, TAG, "%s is already bound to %04X", bind->name, other->code);
+  }
+
+  if (entry == NULL) {
+    entry = insert(bind->code);
+    ESP_RETURN_ON_FALSE(entry, ESP_ERR_NO_MEM, TAG, "Registry full");
+  }
+  // renaming removes the old entity
+  if (entry->bound && strcmp(entry->name, bind->name) != 0) announce(entry, false);
+  entry->learned = true;
+  entry->bound = true;
+  set_name(entry, bind->name);
+  announce(entry, true);
+  ESP_LOGI(TAG, "Bound code %04X to %s", entry->code, entry->name);
+  return save();
+}
+
+esp_err_t rf_code_registry_parse_bind(const char* data, size_t len, rf_code_bind_t* bind) {
+  char buf[8 + RF_CODE_NAME_LEN];
+  ESP_RETURN_ON_FALSE(len < sizeof(buf), ESP_ERR_INVALID_SIZE, TAG, "Bind request too long");
+  memcpy(buf, data, len);
+  buf[len] = '\0';
+
+  char* end;
+  unsigned long code = strtoul(buf, &end, 16);
+  ESP_RETURN_ON_FALSE(end != buf && code <= UINT16_MAX, ESP_ERR_INVALID_ARG, TAG, "Invalid code in %s", buf);
+  while (*end == ' ') end++;
+
+  size_t name_len = strlen(end);
+  ESP_RETURN_ON_FALSE(name_len < RF_CODE_NAME_LEN, ESP_ERR_INVALID_SIZE, TAG, "Name too long");
+  for (size_t i = 0; i < name_len; i++) {
+    // names end up in topics and unique ids
+    ESP_RETURN_ON_FALSE(islower((unsigned char) end[i]) || isdigit((unsigned char) end[i]) || end[i] == '_', ESP_ERR_INVALID_ARG, TAG, "Invalid name %s", end);
+  }
+  bind->code = code;
+  memcpy(bind->name, end, name_len + 1);
+  return ESP_OK;
+}
+
+void rf_code_registry_get_stats(rf_code_registry_stats_t* out) {
+  *out = stats;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "mqtt_client.h"
+#include "mqtt_publish.h"
+
+// codes the registry holds, learned and bound together
+#define RF_CODE_REGISTRY_MAX_CODES 64
+// hash slots, kept at twice the codes so probe chains stay short
+#define RF_CODE_REGISTRY_SLOT_BITS 7
+// entity names, including the terminator
+#define RF_CODE_NAME_LEN 16
+// a code has to be received this many times while learning before it is kept,
+// so a single noise burst that happens to decode does not take a slot
+#define RF_CODE_REGISTRY_MIN_HITS 2
+
+typedef struct {
+  uint16_t code;
+  char name[RF_CODE_NAME_LEN];
+} rf_code_bind_t;
+
+typedef struct {
+  bool used;
+  // bound codes have a Home Assistant entity and are published when received
+  bool bound;
+  // not counted towards MIN_HITS until then
+  bool learned;
+  uint16_t code;
+  uint32_t hits;
+  char name[RF_CODE_NAME_LEN];
+  // precomputed, the publish queue takes a copy
+  char topic[MQTT_PUBLISH_MAX_TOPIC];
+} rf_code_entry_t;
+
+typedef struct {
+  uint32_t lookups;
+  uint32_t probes;
+  uint32_t learned;
+  // codes seen while learning with no free entry left
+  uint32_t full;
+  size_t codes;
+} rf_code_registry_stats_t;
+
+/**
+ * @brief Load the registry from NVS and announce the entities of bound codes
+ *
+ * Not thread safe, everything after this is called from the dispatch loop only.
+ */
+esp_err_t rf_code_registry_start(esp_mqtt_client_handle_t client);
+
+/**
+ * @brief Handle a 16-bit message the light decoder did not recognize
+ *
+ * Publishes a press for a bound code, and records the code while learning.
+ * One hash lookup whatever the number of codes.
+ */
+void rf_code_registry_received(uint16_t code);
+
+void rf_code_registry_set_learning(bool learning);
+
+/**
+ * @brief Bind a code to a new binary_sensor entity, or forget the code with an empty name
+ *
+ * The code does not need to have been learned first. Names are limited to [a-z0-9_].
+ */
+esp_err_t rf_code_registry_bind(const rf_code_bind_t* bind);
+
+// Parse "<hex code> <name>", as published to the bind topic
+esp_err_t rf_code_registry_parse_bind(const char* data, size_t len, rf_code_bind_t* bind);
+
+void rf_code_registry_get_stats(rf_code_registry_stats_t* stats);
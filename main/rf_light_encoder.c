@@ -2,6 +2,7 @@
 #include "driver/rmt_encoder.h"
 #include "driver/rmt_types.h"
 #include "esp_check.h"
+#include "esp_cpu.h"
 #include "esp_err.h"
 #include "hal/rmt_types.h"
 
@@ -15,6 +16,26 @@
 static uint64_t RF_LIGHT_HEADER = 0x7fffffffff;
 #define RF_LIGHT_NUM_PAYLOAD 4
 
+#ifdef CONFIG_RF_BRIDGE_BENCH
+static uint32_t* volatile probe_samples;
+static size_t probe_max;
+static volatile size_t probe_count;
+// cycles of the frame being encoded so far
+static uint32_t probe_frame_cycles;
+
+void rf_light_encoder_set_probe(uint32_t* samples, size_t max) {
+    probe_samples = NULL;
+    probe_max = max;
+    probe_count = 0;
+    probe_frame_cycles = 0;
+    probe_samples = samples;
+}
+
+size_t rf_light_encoder_probe_count(void) {
+    return probe_count;
+}
+#endif
+
 RMT_ENCODER_FUNC_ATTR
 static inline void encode_payload(rmt_channel_handle_t channel, rf_light_message_t *message, rf_light_encoder_t *rf_light_encoder, rmt_encode_state_t *state, size_t* encoded_symbols) {
     rmt_encode_state_t session_state;
@@ -50,6 +71,9 @@ static size_t rf_light_encode(rmt_encoder_t* encoder, rmt_channel_handle_t chann
     rmt_encode_state_t state = RMT_ENCODING_RESET;
     size_t encoded_symbols = 0;
     rf_light_message_t *message = (rf_light_message_t*) data;
+#ifdef CONFIG_RF_BRIDGE_BENCH
+    uint32_t probe_start = esp_cpu_get_cycle_count();
+#endif
 
     switch (rf_light_encoder->state) {
     case RF_LIGHT_ENCODER_STATE_RESET:
@@ -107,6 +131,15 @@ static size_t rf_light_encode(rmt_encoder_t* encoder, rmt_channel_handle_t chann
         rf_light_encoder->state = RF_LIGHT_ENCODER_STATE_RESET;
     }
     *ret_state = state;
+#ifdef CONFIG_RF_BRIDGE_BENCH
+    if (probe_samples) {
+        probe_frame_cycles += esp_cpu_get_cycle_count() - probe_start;
+        if ((state & RMT_ENCODING_COMPLETE) && probe_count < probe_max) {
+            probe_samples[probe_count++] = probe_frame_cycles;
+            probe_frame_cycles = 0;
+        }
+    }
+#endif
     return encoded_symbols;
 }
 
@@ -145,16 +178,16 @@ esp_err_t rf_light_encoder_new(rmt_encoder_handle_t *encoder) {
         // 1 w/ delay
         .bit0 = {
             .level0 = 1,
-            .duration0 = 264 / 2, // 264 us, 1 tick = 2 us
+            .duration0 = RF_LIGHT_HEADER_DURATION_0 / 2, // 264 us, 1 tick = 2 us
             .level1 = 0,
-            .duration1 = (4000 + 160) / 2
+            .duration1 = RF_LIGHT_HEADER_GAP_DURATION_1 / 2
         },
         // identical
         .bit1 = {
             .level0 = 1,
-            .duration0 = 264 / 2, // 264 us, 1 tick = 2 us
+            .duration0 = RF_LIGHT_HEADER_DURATION_0 / 2, // 264 us, 1 tick = 2 us
             .level1 = 0,
-            .duration1 = 160 / 2
+            .duration1 = RF_LIGHT_HEADER_DURATION_1 / 2
         },
         .flags.msb_first = false
     };
@@ -167,12 +200,12 @@ esp_err_t rf_light_encoder_new(rmt_encoder_handle_t *encoder) {
             .level1 = 0,
             .duration1 = RF_LIGHT_PAYLOAD_ZERO_DURATION_1 / 2
         },
-        // identical
+        // same 843 us period, the high part is longer
         .bit1 = {
             .level0 = 1,
-            .duration0 = RF_LIGHT_PAYLOAD_ONE_DURATION_0 / 2, // 264 us, 1 tick = 2 us
+            .duration0 = RF_LIGHT_PAYLOAD_ONE_DURATION_0 / 2, // 685 us, 1 tick = 2 us
             .level1 = 0,
-            .duration1 = RF_LIGHT_PAYLOAD_ZERO_DURATION_1 / 2
+            .duration1 = RF_LIGHT_PAYLOAD_ONE_DURATION_1 / 2
         },
     };
     ESP_GOTO_ON_ERROR(rmt_new_bytes_encoder(&payload_encoder_config, &rf_light_encoder->payload_encoder), err, TAG, "create payload encoder failed");
@@ -181,8 +214,8 @@ esp_err_t rf_light_encoder_new(rmt_encoder_handle_t *encoder) {
     rmt_copy_encoder_config_t copy_encoder_config = {};
     ESP_GOTO_ON_ERROR(rmt_new_copy_encoder(&copy_encoder_config, &rf_light_encoder->copy_encoder), err, TAG, "create copy encoder failed");
 
-    rf_light_encoder->delay_symbol.duration0 = 2000 / 2;
-    rf_light_encoder->delay_symbol.duration1 = 2000 / 2; // 4 ms total
+    rf_light_encoder->delay_symbol.duration0 = RF_LIGHT_TRAILING_DELAY_US / 2 / 2;
+    rf_light_encoder->delay_symbol.duration1 = RF_LIGHT_TRAILING_DELAY_US / 2 / 2; // 4 ms total
     rf_light_encoder->delay_symbol.level0 = 0;
     rf_light_encoder->delay_symbol.level1 = 0;
 
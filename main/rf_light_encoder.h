@@ -1,27 +1,18 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 #include "driver/rmt_encoder.h"
 #include "driver/rmt_types.h"
 #include "esp_err.h"
 #include "hal/rmt_types.h"
+#include "rf_light_timing.h"
 
 typedef struct {
     char channel;
     bool on;
 } rf_light_payload_t;
 
-typedef uint16_t rf_light_message_t;
-#define RF_LIGHT_PAYLOAD_ZERO_DURATION_0  263
-#define RF_LIGHT_PAYLOAD_ZERO_DURATION_1  (843-263)
-#define RF_LIGHT_PAYLOAD_ONE_DURATION_0   685
-#define RF_LIGHT_PAYLOAD_ONE_DURATION_1   (843-685)
-
-#define RF_LIGHT_PAYLOAD_ZERO_DECODE_DURATION_0  250
-#define RF_LIGHT_PAYLOAD_ZERO_DECODE_DURATION_1  600
-#define RF_LIGHT_PAYLOAD_ONE_DECODE_DURATION_0   650
-#define RF_LIGHT_PAYLOAD_ONE_DECODE_DURATION_1   200
-
 /// Defines what has _already been sent_
 typedef enum {
     RF_LIGHT_ENCODER_STATE_RESET,
@@ -50,5 +41,15 @@ typedef struct {
 
 esp_err_t rf_light_encoder_new(rmt_encoder_handle_t *encoder);
 
+#ifdef CONFIG_RF_BRIDGE_BENCH
+/**
+ * @brief Record the cycles spent encoding each frame, summed over the rf_light_encode calls for it
+ *
+ * Samples are taken until max are collected, samples NULL stops recording.
+ */
+void rf_light_encoder_set_probe(uint32_t* samples, size_t max);
+size_t rf_light_encoder_probe_count(void);
+#endif
+
 uint16_t encode_rf_light_payload(rf_light_payload_t* payload);
 int decode_rf_light_payload(uint16_t message, rf_light_payload_t* payload);
@@ -1,18 +1,17 @@
 #include "rf_light_rx.h"
 
-#include <driver/rmt_rx.h>
 #include <esp_log.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/event_groups.h>
 #include "esp_check.h"
 #include "event_queue.h"
-#include "rom/ets_sys.h"
+#include "profiling.h"
 
-#define TAG "RF Light RMT RX"
+#define TAG "RF Light RX"
 
 // Debug tool to print a whole received message
-static void print_rmt_frame(size_t num, rmt_symbol_word_t* symbols) {
+static void print_rmt_frame(size_t num, const rmt_symbol_word_t* symbols) {
   fprintf(stderr, "Received Raw: ");
 
   for (int i =0 ; i < num; i++) {
@@ -22,20 +21,19 @@ static void print_rmt_frame(size_t num, rmt_symbol_word_t* symbols) {
   fprintf(stderr, "\n");
 }
 
-// timing definitions for our protocol ar ein encoder.h
-#define RF_LIGHT_DECODE_MARGIN 200
+// timing definitions for our protocol are in rf_light_timing.h
 
 static inline bool rf_light_check_in_range(uint32_t signal_duration, uint32_t spec_duration)
 {
-  // mul by 2 for clock
-    return (signal_duration*2 < (spec_duration + RF_LIGHT_DECODE_MARGIN)) &&
-           (signal_duration*2 > (spec_duration - RF_LIGHT_DECODE_MARGIN));
+  // ticks to us
+    return (signal_duration*RF_LIGHT_RMT_TICK_US < (spec_duration + RF_LIGHT_DECODE_MARGIN)) &&
+           (signal_duration*RF_LIGHT_RMT_TICK_US > (spec_duration - RF_LIGHT_DECODE_MARGIN));
 }
 
 /**
  * @brief Check whether a RMT symbol represents RF_LIGHT logic zero
  */
-static bool rf_light_parse_logic0(rmt_symbol_word_t *rmt_rf_light_symbols, bool last)
+static bool rf_light_parse_logic0(const rmt_symbol_word_t *rmt_rf_light_symbols, bool last)
 {
     return rf_light_check_in_range(rmt_rf_light_symbols->duration0, RF_LIGHT_PAYLOAD_ZERO_DECODE_DURATION_0) &&
       (last || rf_light_check_in_range(rmt_rf_light_symbols->duration1, RF_LIGHT_PAYLOAD_ZERO_DECODE_DURATION_1));
@@ -44,18 +42,90 @@ static bool rf_light_parse_logic0(rmt_symbol_word_t *rmt_rf_light_symbols, bool
 /**
  * @brief Check whether a RMT symbol represents RF_LIGHT logic one
  */
-static bool rf_light_parse_logic1(rmt_symbol_word_t *rmt_rf_light_symbols, bool last)
+static bool rf_light_parse_logic1(const rmt_symbol_word_t *rmt_rf_light_symbols, bool last)
 {
     return rf_light_check_in_range(rmt_rf_light_symbols->duration0, RF_LIGHT_PAYLOAD_ONE_DECODE_DURATION_0) &&
       // don't check duration1 if this is the last bit
       (last || rf_light_check_in_range(rmt_rf_light_symbols->duration1, RF_LIGHT_PAYLOAD_ONE_DECODE_DURATION_1));
 }
 
-// Parse an entire frame for any messages within
-static void parse_rmt_frame(size_t num_items, rmt_symbol_word_t* x, QueueHandle_t parsed_message_queue, BaseType_t* high_task_wakeup) {
+// lo < us < hi, lo clamped at 0 for the short header low time
+#define WINDOW_LO(spec, margin) ((spec) > (margin) ? (spec) - (margin) : 0)
+#define WINDOW_HI(spec, margin) ((spec) + (margin))
+
+static inline bool rf_light_in_window(uint32_t ticks, uint32_t lo, uint32_t hi)
+{
+  uint32_t us = ticks * RF_LIGHT_RMT_TICK_US;
+  return us > lo && us < hi;
+}
+
+static inline bool rf_light_header_high(const rmt_symbol_word_t* symbol)
+{
+  return rf_light_in_window(symbol->duration0, WINDOW_LO(RF_LIGHT_HEADER_DURATION_0, RF_LIGHT_DECODE_MARGIN), WINDOW_HI(RF_LIGHT_HEADER_DURATION_0, RF_LIGHT_DECODE_MARGIN));
+}
+
+static inline bool rf_light_header_short(const rmt_symbol_word_t* symbol)
+{
+  return rf_light_in_window(symbol->duration1, WINDOW_LO(RF_LIGHT_HEADER_DURATION_1, RF_LIGHT_DECODE_MARGIN), WINDOW_HI(RF_LIGHT_HEADER_DURATION_1, RF_LIGHT_DECODE_MARGIN));
+}
+
+static inline bool rf_light_header_gap(const rmt_symbol_word_t* symbol)
+{
+  return rf_light_in_window(symbol->duration1, WINDOW_LO(RF_LIGHT_HEADER_GAP_DURATION_1, RF_LIGHT_HEADER_GAP_MARGIN), WINDOW_HI(RF_LIGHT_HEADER_GAP_DURATION_1, RF_LIGHT_HEADER_GAP_MARGIN));
+}
+
+size_t rf_light_rx_decode_frame(const rmt_symbol_word_t* x, size_t num_items, rf_light_message_t* messages, size_t max_messages) {
+  // header symbols in a row, or -1 while reading a payload
+  int header = 0;
   int bit = 0;
   rf_light_message_t message = 0;
   rf_light_message_t previous_message = 0;
+  size_t decoded = 0;
+
+  for (size_t i = 0; i < num_items; i++) {
+    if (header >= 0) {
+      // most noise fails here, it cannot be part of a header
+      if (!rf_light_header_high(&x[i])) {
+        header = 0;
+      } else if (rf_light_header_short(&x[i])) {
+        header++;
+      } else if (header >= RF_LIGHT_HEADER_MIN_SYMBOLS && rf_light_header_gap(&x[i])) {
+        // locked, exactly one payload follows
+        header = -1;
+        bit = 0;
+      } else {
+        header = 0;
+      }
+      continue;
+    }
+
+    if (rf_light_parse_logic0(&x[i], bit == 15)) {
+      message &= ~(1 << (bit++));
+    } else if (rf_light_parse_logic1(&x[i], bit == 15)) {
+      message |= (1 << (bit++));
+    } else {
+      // lost it, this symbol may already start the next header
+      header = rf_light_header_high(&x[i]) && rf_light_header_short(&x[i]) ? 1 : 0;
+      continue;
+    }
+
+    if (bit == 16) {
+      header = 0;
+      // many repeat messages
+      if (message != previous_message && decoded < max_messages) {
+        messages[decoded++] = message;
+      }
+      previous_message = message;
+    }
+  }
+  return decoded;
+}
+
+size_t rf_light_rx_decode_frame_unsynced(const rmt_symbol_word_t* x, size_t num_items, rf_light_message_t* messages, size_t max_messages) {
+  int bit = 0;
+  rf_light_message_t message = 0;
+  rf_light_message_t previous_message = 0;
+  size_t decoded = 0;
 
   for (size_t i = 0; i < num_items; i++) {
     // test for logic 0 or logic 1
@@ -72,73 +142,110 @@ static void parse_rmt_frame(size_t num_items, rmt_symbol_word_t* x, QueueHandle_
       // done
       bit = 0;
       // many repeat messages
-      if (message != previous_message) {
+      if (message != previous_message && decoded < max_messages) {
         //ESP_LOGW(TAG, "Successfully received message %04X", message);
-
-        event_queue_message_t msg = {
-            .data.rf_light_message = message,
-            .type = EVENT_QUEUE_MESSAGE_RF_LIGHT
-        };
-
-        // send this to the queue
-        xQueueSendFromISR(parsed_message_queue, &msg, high_task_wakeup);
+        messages[decoded++] = message;
       }
 
       previous_message = message;
     }
   }
+  return decoded;
 }
 
-static bool rf_light_rx_done_callback(rmt_channel_handle_t channel, const rmt_rx_done_event_data_t *edata, void *user_data)
+// Parse an entire frame for any messages within, returns how many were queued
+static uint32_t parse_rmt_frame(size_t num_items, const rmt_symbol_word_t* x, const rf_light_rx_data_t* rx_data, BaseType_t* high_task_wakeup) {
+  rf_light_message_t messages[SYMBOL_BUFFER_SIZE / 16];
+  size_t decoded = rf_light_rx_decode_frame(x, num_items, messages, SYMBOL_BUFFER_SIZE / 16);
+  uint32_t queued = 0;
+
+  for (size_t i = 0; i < decoded; i++) {
+    // counted by the pool when it is exhausted
+    event_queue_message_t* msg = event_queue_claim_from_isr(EVENT_QUEUE_MESSAGE_RF_LIGHT);
+    if (!msg) continue;
+    msg->data.rf_light_message = messages[i];
+    msg->radio = rx_data->radio;
+
+    // send this to the queue
+    if (event_queue_send_from_isr(rx_data->parsed_message_queue, msg, high_task_wakeup) == ESP_OK) queued++;
+  }
+  return queued;
+}
+
+// Called by the capture backend for every completed frame
+static bool rf_light_rx_frame_callback(rf_capture_t* capture, const rmt_symbol_word_t* symbols, size_t num_symbols, void* user_data)
 {
+  PROFILING_BEGIN(callback);
   BaseType_t high_task_wakeup = pdFALSE;
 
   // print the frame
-  //print_rmt_frame(edata->num_symbols, edata->received_symbols);
+  //print_rmt_frame(num_symbols, symbols);
 
   rf_light_rx_data_t* rx_data = (rf_light_rx_data_t*) user_data;
+  rx_data->frames++;
+
+  if (rx_data->gated && !rx_data->carrier_present) {
+    // noise, stay disarmed until the carrier comes back
+    rx_data->frames_gated++;
+    rx_data->armed = false;
+  } else {
+    // parse messages and send to queue
+    rx_data->messages += parse_rmt_frame(num_symbols, symbols, rx_data, &high_task_wakeup);
+
+    // start receiving again
+    ESP_ERROR_CHECK(capture->arm(capture));
+  }
 
-  // parse messages and send to queue
-  parse_rmt_frame(edata->num_symbols, edata->received_symbols, rx_data->parsed_message_queue, &high_task_wakeup);
-
-  // start receiving again
-  ESP_ERROR_CHECK(rmt_receive(rx_data->channel, rx_data->symbols, sizeof(rx_data->symbols), &rx_data->config));
-
+  PROFILING_END(callback, PROFILING_SECTION_RX_CALLBACK);
   return high_task_wakeup == pdTRUE;
 }
 
 esp_err_t rf_light_initialize_rx(gpio_num_t rx_gpio_num, rf_light_rx_data_t* rx_data) {
-  // Initialize RMT channel
+#ifdef CONFIG_RF_BRIDGE_CAPTURE_GPIO
+  ESP_LOGI(TAG, "Initialize GPIO edge capture");
+  ESP_RETURN_ON_ERROR(rf_capture_new_gpio(rx_gpio_num, &rx_data->capture), TAG, "Failed to initialize capture");
+#else
   ESP_LOGI(TAG, "Initialize RMT channel");
-  rmt_rx_channel_config_t rx_channel_cfg = {
-    .clk_src = RMT_CLK_SRC_DEFAULT,
-    .resolution_hz = 1000000 / 2, // 1 tick = 2us
-    .mem_block_symbols = SYMBOL_BUFFER_SIZE, // Store 64 symbols
-    .gpio_num = rx_gpio_num
-  };
-  ESP_RETURN_ON_ERROR(rmt_new_rx_channel(&rx_channel_cfg, &rx_data->channel), TAG, "Failed to initialize channel");
+  ESP_RETURN_ON_ERROR(rf_capture_new_rmt(rx_gpio_num, &rx_data->capture), TAG, "Failed to initialize capture");
+#endif
 
   // Initialize the data queue
   assert(rx_data->parsed_message_queue);
 
-  // Setup the callbacks
-  rmt_rx_event_callbacks_t cbs = {
-    .on_recv_done = rf_light_rx_done_callback,
-  };
-  // pass the rx_data struct in the data param
-  ESP_RETURN_ON_ERROR(rmt_rx_register_event_callbacks(rx_data->channel, &cbs, rx_data), TAG, "Failed to add RX callback");
+  // pass the rx_data struct to the frame callback
+  rf_capture_register(rx_data->capture, rf_light_rx_frame_callback, rx_data);
 
-  // Timing thresholds for the RMT driver
+  // Enable the capture and begin receiving
+  ESP_RETURN_ON_ERROR(rx_data->capture->enable(rx_data->capture), TAG, "Failed to enable capture");
+  rx_data->armed = true;
+  esp_err_t err = rx_data->capture->arm(rx_data->capture);
+  ESP_RETURN_ON_ERROR(err, TAG, "Failed to begin receiving: %d", err);
 
-  // 3 us minimum time (the actual value is bigger, but the driver doesn't go higher)
-  rx_data->config.signal_range_min_ns = 3 * 1000;
-  // 6000 us maximum time (max delay between messages)
-  rx_data->config.signal_range_max_ns =  6000 * 1000;
+  return ESP_OK;
+}
 
-  // Enable the channel and begin receiving
-  ESP_RETURN_ON_ERROR(rmt_enable(rx_data->channel), TAG, "Failed to enable channel");
-  esp_err_t err = rmt_receive(rx_data->channel, rx_data->symbols, sizeof(rx_data->symbols), &rx_data->config);
-  ESP_RETURN_ON_ERROR(err, TAG, "Failed to begin receiving: %d", err);
+esp_err_t rf_light_rx_set_carrier(rf_light_rx_data_t* rx_data, bool present) {
+  rx_data->gated = true;
+  // set before checking armed: the callback only disarms after seeing no carrier
+  rx_data->carrier_present = present;
+
+  if (present && !rx_data->armed) {
+    rx_data->armed = true;
+    ESP_RETURN_ON_ERROR(rx_data->capture->arm(rx_data->capture), TAG, "Failed to re-arm receiver");
+  }
+  return ESP_OK;
+}
+
+esp_err_t rf_light_rx_suspend(rf_light_rx_data_t* rx_data) {
+  rx_data->armed = false;
+  // also drops the backend's power management lock
+  ESP_RETURN_ON_ERROR(rx_data->capture->disable(rx_data->capture), TAG, "Failed to disable capture");
+  return ESP_OK;
+}
 
+esp_err_t rf_light_rx_resume(rf_light_rx_data_t* rx_data) {
+  ESP_RETURN_ON_ERROR(rx_data->capture->enable(rx_data->capture), TAG, "Failed to enable capture");
+  rx_data->armed = true;
+  ESP_RETURN_ON_ERROR(rx_data->capture->arm(rx_data->capture), TAG, "Failed to begin receiving");
   return ESP_OK;
 }
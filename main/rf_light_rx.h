@@ -1,18 +1,60 @@
 #pragma once
 
-#include <driver/rmt_rx.h>
 #include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include "driver/gpio.h"
+#include "rf_capture.h"
 #include "rf_light_encoder.h"
 
 // each actual message is only 16 symbols, so 64 is plenty
 #define SYMBOL_BUFFER_SIZE 64
-#define PARSED_MESSAGE_QUEUE_LENGTH 4
+
+// A symbol as the capture records it, from durations in us, for synthetic frames
+static inline rmt_symbol_word_t rf_light_rx_symbol(uint32_t high_us, uint32_t low_us) {
+  return (rmt_symbol_word_t) { .level0 = 1, .duration0 = high_us / RF_LIGHT_RMT_TICK_US, .level1 = 0, .duration1 = low_us / RF_LIGHT_RMT_TICK_US };
+}
 
 typedef struct {
   QueueHandle_t parsed_message_queue;
-  rmt_channel_handle_t channel;
-  rmt_symbol_word_t symbols[SYMBOL_BUFFER_SIZE];
-  rmt_receive_config_t config;
+  // index of the radio feeding this receiver, copied into every event
+  uint8_t radio;
+  // RMT or GPIO edge capture, picked by CONFIG_RF_BRIDGE_CAPTURE_*
+  rf_capture_t* capture;
+  // carrier sense gating, see rf_light_rx_set_carrier
+  bool gated;
+  volatile bool carrier_present;
+  volatile bool armed;
+  // frames completed by the capture backend, and the ones dropped because there was no carrier
+  volatile uint32_t frames;
+  volatile uint32_t frames_gated;
+  // messages handed to the queue
+  volatile uint32_t messages;
 } rf_light_rx_data_t;
 
 esp_err_t rf_light_initialize_rx(gpio_num_t rx_gpio_num, rf_light_rx_data_t* rx_data);
+
+/**
+ * @brief Report whether the radio currently sees a carrier
+ *
+ * Once called, the receiver only decodes and re-arms the capture while a carrier is
+ * present, so noise on a quiet band no longer produces a constant stream of frames.
+ */
+esp_err_t rf_light_rx_set_carrier(rf_light_rx_data_t* rx_data, bool present);
+
+/**
+ * @brief Decode every message in a frame of RMT symbols, without queueing them
+ *
+ * A payload is only read right after the header gap, preceded by at least
+ * RF_LIGHT_HEADER_MIN_SYMBOLS short header symbols. Back to back repeats of a message are
+ * only reported once, like on the RX path.
+ *
+ * @return Number of messages written to messages
+ */
+size_t rf_light_rx_decode_frame(const rmt_symbol_word_t* symbols, size_t num_symbols, rf_light_message_t* messages, size_t max_messages);
+
+// The decoder without header sync, any 16 payload symbols in a row, for comparison on the bench
+size_t rf_light_rx_decode_frame_unsynced(const rmt_symbol_word_t* symbols, size_t num_symbols, rf_light_message_t* messages, size_t max_messages);
+
+// Stop capturing and release the capture backend so the chip can enter light sleep
+esp_err_t rf_light_rx_suspend(rf_light_rx_data_t* rx_data);
+esp_err_t rf_light_rx_resume(rf_light_rx_data_t* rx_data);
@@ -0,0 +1,81 @@
+#include "rf_light_rx_gate.h"
+
+#include <inttypes.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "cc1101_setup.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define TAG "RF Light RX Gate"
+
+// how often the capture counters are logged
+#define RX_GATE_STATS_INTERVAL_US (60 * 1000 * 1000)
+
+typedef struct {
+  cc1101_device_t* cc1101;
+  SemaphoreHandle_t radio_lock;
+  rf_light_rx_data_t* rx_data;
+} rx_gate_args_t;
+
+static rx_gate_args_t gate_args;
+
+static void rx_gate_task(void* arg) {
+  rx_gate_args_t* args = (rx_gate_args_t*) arg;
+  rf_light_rx_data_t* rx_data = args->rx_data;
+
+  TickType_t poll_ticks = pdMS_TO_TICKS(CONFIG_RF_BRIDGE_RX_GATE_POLL_MS);
+  if (poll_ticks == 0) poll_ticks = 1;
+
+  bool present = false;
+  int64_t last_carrier = 0;
+  int64_t stats_since = esp_timer_get_time();
+  uint32_t stats_frames = rx_data->frames;
+  uint32_t stats_gated = rx_data->frames_gated;
+
+  rf_light_rx_set_carrier(rx_data, false);
+
+  while (1) {
+    vTaskDelay(poll_ticks);
+    int64_t now = esp_timer_get_time();
+
+    // never waits, the TX scheduler may hold the radio for a whole window
+    if (xSemaphoreTake(args->radio_lock, 0) != pdTRUE) continue;
+    int16_t rssi;
+    esp_err_t err = cc1101_read_rssi(args->cc1101, &rssi);
+    xSemaphoreGive(args->radio_lock);
+    if (err != ESP_OK) continue;
+
+    if (rssi >= CONFIG_RF_BRIDGE_RX_GATE_RSSI_DBM) {
+      last_carrier = now;
+      if (!present) {
+        present = true;
+        rf_light_rx_set_carrier(rx_data, true);
+      }
+    } else if (present && now - last_carrier > CONFIG_RF_BRIDGE_RX_GATE_HOLD_MS * 1000) {
+      // OOK has no carrier during the low periods, so only drop it after a quiet hold time
+      present = false;
+      rf_light_rx_set_carrier(rx_data, false);
+    }
+
+    if (now - stats_since >= RX_GATE_STATS_INTERVAL_US) {
+      uint32_t frames = rx_data->frames - stats_frames;
+      uint32_t gated = rx_data->frames_gated - stats_gated;
+      uint32_t seconds = (now - stats_since) / 1000000;
+      ESP_LOGI(TAG, "%" PRIu32 " callbacks/s | %" PRIu32 " decoded | %" PRIu32 " gated", frames / seconds, frames - gated, gated);
+      stats_since = now;
+      stats_frames = rx_data->frames;
+      stats_gated = rx_data->frames_gated;
+    }
+  }
+}
+
+esp_err_t rf_light_rx_gate_start(cc1101_device_t* cc1101, SemaphoreHandle_t radio_lock, rf_light_rx_data_t* rx_data) {
+  gate_args.cc1101 = cc1101;
+  gate_args.radio_lock = radio_lock;
+  gate_args.rx_data = rx_data;
+  // above the main loop so carrier changes are not delayed by dispatching
+  ESP_RETURN_ON_FALSE(xTaskCreate(rx_gate_task, "rx_gate", 3072, &gate_args, 2, NULL) == pdPASS, ESP_ERR_NO_MEM, TAG, "Failed to create gate task");
+  return ESP_OK;
+}
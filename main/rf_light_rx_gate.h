@@ -0,0 +1,15 @@
+#pragma once
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "cc1101.h"
+#include "esp_err.h"
+#include "rf_light_rx.h"
+
+/**
+ * @brief Start polling the CC1101 RSSI and gate RMT capture on carrier presence
+ *
+ * A poll is skipped while radio_lock is held, the radio is then transmitting or changing
+ * state and its RSSI says nothing about the channel.
+ */
+esp_err_t rf_light_rx_gate_start(cc1101_device_t* cc1101, SemaphoreHandle_t radio_lock, rf_light_rx_data_t* rx_data);
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+
+// Timing of the RF light protocol, in us. No IDF includes, so host tools can share it.
+
+typedef uint16_t rf_light_message_t;
+#define RF_LIGHT_PAYLOAD_ZERO_DURATION_0  263
+#define RF_LIGHT_PAYLOAD_ZERO_DURATION_1  (843-263)
+#define RF_LIGHT_PAYLOAD_ONE_DURATION_0   685
+#define RF_LIGHT_PAYLOAD_ONE_DURATION_1   (843-685)
+#define RF_LIGHT_PAYLOAD_SYMBOLS 16
+// a zero and a one take the same time
+#define RF_LIGHT_PAYLOAD_PERIOD (RF_LIGHT_PAYLOAD_ZERO_DURATION_0 + RF_LIGHT_PAYLOAD_ZERO_DURATION_1)
+// silence after the last payload symbol, before the next repeat
+#define RF_LIGHT_TRAILING_DELAY_US 4000
+
+// header, 39 short symbols then one with the long gap that comes right before the payload
+#define RF_LIGHT_HEADER_SYMBOLS 40
+#define RF_LIGHT_HEADER_DURATION_0 264
+#define RF_LIGHT_HEADER_DURATION_1 160
+#define RF_LIGHT_HEADER_GAP_DURATION_1 4160
+
+// header + payload + trailing delay, in us
+#define RF_LIGHT_FRAME_AIRTIME_US ((RF_LIGHT_HEADER_SYMBOLS - 1) * (RF_LIGHT_HEADER_DURATION_0 + RF_LIGHT_HEADER_DURATION_1) + \
+                                   (RF_LIGHT_HEADER_DURATION_0 + RF_LIGHT_HEADER_GAP_DURATION_1) +                         \
+                                   RF_LIGHT_PAYLOAD_SYMBOLS * RF_LIGHT_PAYLOAD_PERIOD + RF_LIGHT_TRAILING_DELAY_US)
+
+#define RF_LIGHT_PAYLOAD_ZERO_DECODE_DURATION_0  250
+#define RF_LIGHT_PAYLOAD_ZERO_DECODE_DURATION_1  600
+#define RF_LIGHT_PAYLOAD_ONE_DECODE_DURATION_0   650
+#define RF_LIGHT_PAYLOAD_ONE_DECODE_DURATION_1   200
+// a received duration matches within this, either way
+#define RF_LIGHT_DECODE_MARGIN 200
+// the gap is long enough for a wider window
+#define RF_LIGHT_HEADER_GAP_MARGIN 1000
+// short header symbols seen before the gap to lock on, a capture can start mid header
+#define RF_LIGHT_HEADER_MIN_SYMBOLS 4
+
+// RX symbol durations are in ticks of the 500 kHz RMT clock
+#define RF_LIGHT_RMT_TICK_US 2
@@ -25,7 +25,7 @@ esp_err_t rf_light_initialize_tx(rf_light_tx_t* rf_light_tx, gpio_num_t tx_gpio_
     .flags.invert_out = false,
   };
   ESP_RETURN_ON_ERROR(rmt_new_tx_channel(&tx_channel_cfg, &rf_light_tx->channel), TAG, "Failed to initialize channel");
-  ESP_RETURN_ON_ERROR(rmt_enable(rf_light_tx->channel), TAG, "Failed to enable channel");
+  // enabled per TX window, an enabled channel holds a power management lock
 
   // INitialize encoder
   ESP_RETURN_ON_ERROR(rf_light_encoder_new(&rf_light_tx->encoder), TAG, "Failed to initialize encoder");
@@ -34,12 +34,28 @@ esp_err_t rf_light_initialize_tx(rf_light_tx_t* rf_light_tx, gpio_num_t tx_gpio_
 }
 
 esp_err_t rf_light_tx_send(rf_light_tx_t *rf_light_tx, rf_light_message_t message) {
+    return rf_light_tx_send_frames(rf_light_tx, message, 10);
+}
+esp_err_t rf_light_tx_send_frames(rf_light_tx_t *rf_light_tx, rf_light_message_t message, int frames) {
     rmt_transmit_config_t transmit_config = {
-        .loop_count = 10,
+        // 0 = sent once
+        .loop_count = frames > 1 ? frames : 0,
     };
     ESP_RETURN_ON_ERROR(rmt_transmit(rf_light_tx->channel, rf_light_tx->encoder, &message, sizeof(rf_light_message_t), &transmit_config), TAG, "Failed to send tx");
     return ESP_OK;
 }
+esp_err_t rf_light_tx_wait_done(rf_light_tx_t *rf_light_tx, int timeout_ms) {
+    ESP_RETURN_ON_ERROR(rmt_tx_wait_all_done(rf_light_tx->channel, timeout_ms), TAG, "Failed to wait for tx");
+    return ESP_OK;
+}
+esp_err_t rf_light_tx_enable(rf_light_tx_t *rf_light_tx) {
+    ESP_RETURN_ON_ERROR(rmt_enable(rf_light_tx->channel), TAG, "Failed to enable channel");
+    return ESP_OK;
+}
+esp_err_t rf_light_tx_disable(rf_light_tx_t *rf_light_tx) {
+    ESP_RETURN_ON_ERROR(rmt_disable(rf_light_tx->channel), TAG, "Failed to disable channel");
+    return ESP_OK;
+}
 esp_err_t rf_light_tx_free(rf_light_tx_t *rf_light_tx) {
     if (rf_light_tx->channel != NULL) ESP_RETURN_ON_ERROR(rmt_del_channel(rf_light_tx->channel), TAG, "Failed to free channel");
     if (rf_light_tx->encoder != NULL) ESP_RETURN_ON_ERROR(rmt_del_encoder(rf_light_tx->encoder), TAG, "Failed to free encoder");
@@ -13,5 +13,11 @@ typedef struct {
 } rf_light_tx_t;
 
 esp_err_t rf_light_initialize_tx(rf_light_tx_t *rf_light_tx, gpio_num_t tx_gpio_num);
+// The channel starts disabled, enable it around sends
+esp_err_t rf_light_tx_enable(rf_light_tx_t *rf_light_tx);
+esp_err_t rf_light_tx_disable(rf_light_tx_t *rf_light_tx);
 esp_err_t rf_light_tx_send(rf_light_tx_t *rf_light_tx, rf_light_message_t message);
+// Queue a message to be sent `frames` times back to back
+esp_err_t rf_light_tx_send_frames(rf_light_tx_t *rf_light_tx, rf_light_message_t message, int frames);
+esp_err_t rf_light_tx_wait_done(rf_light_tx_t *rf_light_tx, int timeout_ms);
 esp_err_t rf_light_tx_free(rf_light_tx_t *rf_light_tx);
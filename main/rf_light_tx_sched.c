@@ -0,0 +1,266 @@
+#include "rf_light_tx_sched.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include "binlog.h"
+#include "cc1101_setup.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "mqtt.h"
+#include "mqtt_publish.h"
+
+#define TAG "RF Light TX Sched"
+
+#define BUCKET_US ((int64_t) CONFIG_RF_BRIDGE_TX_AIRTIME_WINDOW_MS * 1000 / RF_LIGHT_TX_SCHED_BUCKETS)
+// generous upper bound for a single frame to leave the RMT channel
+#define FRAME_TIMEOUT_MS (RF_LIGHT_FRAME_AIRTIME_US / 1000 * 2)
+// how long to wait for the receiver used for listen before talk, e.g. while it switches profile
+#define LBT_LOCK_TIMEOUT_MS 20
+
+// indexed by channel - 'a'
+static rf_light_tx_policy_t policies[26];
+
+static rf_light_tx_policy_t* policy_for(char channel) {
+  static rf_light_tx_policy_t fallback;
+  if (channel < 'a' || channel > 'z') return &fallback;
+  return &policies[channel - 'a'];
+}
+
+void rf_light_tx_sched_set_policy(char channel, uint8_t repeats, uint16_t gap_ms) {
+  rf_light_tx_policy_t* policy = policy_for(channel);
+  policy->repeats = repeats;
+  policy->gap_ms = gap_ms;
+}
+
+// Advance the sliding window and return the airtime used in it
+static uint32_t airtime_used(rf_light_tx_sched_t* sched, int64_t now) {
+  size_t steps = 0;
+  while (now - sched->bucket_started_at >= BUCKET_US && steps++ < RF_LIGHT_TX_SCHED_BUCKETS) {
+    sched->bucket = (sched->bucket + 1) % RF_LIGHT_TX_SCHED_BUCKETS;
+    sched->airtime_buckets[sched->bucket] = 0;
+    sched->bucket_started_at += BUCKET_US;
+  }
+  // idle for longer than the whole window
+  if (now - sched->bucket_started_at >= BUCKET_US) sched->bucket_started_at = now;
+
+  uint32_t total = 0;
+  for (size_t i = 0; i < RF_LIGHT_TX_SCHED_BUCKETS; i++) total += sched->airtime_buckets[i];
+  return total;
+}
+
+static void remove_pending(rf_light_tx_sched_t* sched, size_t index) {
+  sched->pending[index] = sched->pending[--sched->num_pending];
+}
+
+/**
+ * @brief Pick the next frame to send. Must hold the lock.
+ *
+ * Fresh commands (fewest frames sent) go first, then the oldest. Once the airtime budget
+ * is used up, commands that already got their minimum repeats are finished early.
+ *
+ * @return index of the command to send, or -1 with *wait_us set to when the next one is due
+ */
+static int pick_pending(rf_light_tx_sched_t* sched, int64_t now, int64_t* wait_us) {
+  bool over_budget = airtime_used(sched, now) + RF_LIGHT_FRAME_AIRTIME_US > CONFIG_RF_BRIDGE_TX_AIRTIME_BUDGET_MS * 1000;
+  int best = -1;
+  *wait_us = INT64_MAX;
+
+  for (size_t i = 0; i < sched->num_pending; i++) {
+    rf_light_tx_pending_t* p = &sched->pending[i];
+    if (over_budget && p->frames_sent >= CONFIG_RF_BRIDGE_TX_MIN_REPEATS) {
+      sched->stats.truncated += p->command.repeats - p->frames_sent;
+      sched->stats.commands++;
+      remove_pending(sched, i--);
+      continue;
+    }
+    if (p->next_frame_at > now) {
+      if (p->next_frame_at - now < *wait_us) *wait_us = p->next_frame_at - now;
+      continue;
+    }
+    if (best < 0 || p->frames_sent < sched->pending[best].frames_sent ||
+        (p->frames_sent == sched->pending[best].frames_sent && p->submitted_at < sched->pending[best].submitted_at)) {
+      best = i;
+    }
+  }
+  return best;
+}
+
+// Send everything that is pending, staying in TX until the last frame
+static void run_tx_window(rf_light_tx_sched_t* sched) {
+  esp_err_t ret = ESP_OK;
+  bool tx_enabled = false;
+  xSemaphoreTake(sched->radio_lock, portMAX_DELAY);
+
+#ifdef CONFIG_RF_BRIDGE_LBT
+  cc1101_lbt_stats_t lbt;
+  cc1101_lbt_get_stats(&lbt);
+  uint32_t deferrals = lbt.deferrals;
+  // without a receiver on the band, a transmit only radio has to go through RX to check
+  if (sched->tx_only && sched->lbt_cc1101 == sched->cc1101) {
+    ESP_GOTO_ON_ERROR(cc1101_start_rx(sched->cc1101), out, TAG, "Failed to start RX for LBT");
+  }
+  if (sched->lbt_lock && xSemaphoreTake(sched->lbt_lock, pdMS_TO_TICKS(LBT_LOCK_TIMEOUT_MS)) != pdTRUE) {
+    // the receiver is changing state, its RSSI would say nothing about the channel
+    BINLOGW(TAG, "LBT radio busy, sending without checking the channel");
+  } else {
+    if (cc1101_listen_before_talk(sched->lbt_cc1101) != ESP_OK) {
+      BINLOGW(TAG, "Sending on a busy channel");
+    }
+    if (sched->lbt_lock) xSemaphoreGive(sched->lbt_lock);
+  }
+  cc1101_lbt_get_stats(&lbt);
+  if (lbt.deferrals != deferrals) {
+    char stats[112];
+    int len = snprintf(stats, sizeof(stats), "{\"checks\":%" PRIu32 ",\"deferrals\":%" PRIu32 ",\"avoided\":%" PRIu32 ",\"forced\":%" PRIu32 "}",
+                       lbt.checks, lbt.deferrals, lbt.collisions_avoided, lbt.forced);
+    mqtt_publish_enqueue(MQTT_PREFIX "lbt", stats, len, 0, false);
+  }
+#endif
+  ESP_GOTO_ON_ERROR(rf_light_tx_enable(sched->tx), out, TAG, "Failed to enable TX channel");
+  tx_enabled = true;
+  ESP_GOTO_ON_ERROR(cc1101_start_tx(sched->cc1101), out, TAG, "Failed to start TX");
+
+  while (1) {
+    int64_t now = esp_timer_get_time();
+    int64_t wait_us;
+
+    portENTER_CRITICAL(&sched->lock);
+    if (sched->num_pending == 0) {
+      portEXIT_CRITICAL(&sched->lock);
+      break;
+    }
+    int index = pick_pending(sched, now, &wait_us);
+    rf_light_tx_pending_t frame;
+    if (index >= 0) frame = sched->pending[index];
+    portEXIT_CRITICAL(&sched->lock);
+
+    if (index < 0) {
+      if (wait_us == INT64_MAX) continue;
+      // wait for the inter-frame gap, a new command wakes us early
+      TickType_t ticks = pdMS_TO_TICKS(wait_us / 1000);
+      ulTaskNotifyTake(pdTRUE, ticks ? ticks : 1);
+      continue;
+    }
+
+    int64_t frame_start = esp_timer_get_time();
+    ESP_GOTO_ON_ERROR(rf_light_tx_send_frames(sched->tx, frame.message, 1), out, TAG, "Failed to send frame");
+    ESP_GOTO_ON_ERROR(rf_light_tx_wait_done(sched->tx, FRAME_TIMEOUT_MS), out, TAG, "Frame did not finish");
+    int64_t frame_end = esp_timer_get_time();
+
+    portENTER_CRITICAL(&sched->lock);
+    sched->airtime_buckets[sched->bucket] += frame_end - frame_start;
+    sched->stats.frames++;
+    // the slot may have been replaced or moved while we were sending
+    for (size_t i = 0; i < sched->num_pending; i++) {
+      rf_light_tx_pending_t* p = &sched->pending[i];
+      if (p->seq != frame.seq) continue;
+      p->frames_sent++;
+      p->next_frame_at = frame_end + policy_for(p->command.payload.channel)->gap_ms * 1000;
+      if (p->frames_sent >= p->command.repeats) {
+        sched->stats.commands++;
+        remove_pending(sched, i);
+      }
+      break;
+    }
+    portEXIT_CRITICAL(&sched->lock);
+  }
+
+out:
+  if (ret != ESP_OK) {
+    // better lost than sent late, a retry would also likely fail the same way
+    portENTER_CRITICAL(&sched->lock);
+    sched->stats.errors++;
+    sched->stats.dropped += sched->num_pending;
+    sched->num_pending = 0;
+    portEXIT_CRITICAL(&sched->lock);
+  }
+  // back to where the radio rests, also after an error so the next window starts clean
+  if (tx_enabled) ESP_ERROR_CHECK_WITHOUT_ABORT(rf_light_tx_disable(sched->tx));
+  ESP_ERROR_CHECK_WITHOUT_ABORT(sched->tx_only ? cc1101_stop(sched->cc1101) : cc1101_start_rx(sched->cc1101));
+  xSemaphoreGive(sched->radio_lock);
+}
+
+static void tx_sched_task(void* arg) {
+  rf_light_tx_sched_t* sched = (rf_light_tx_sched_t*) arg;
+
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    // commands that arrived during the last window have already been sent
+    if (sched->num_pending == 0) continue;
+    run_tx_window(sched);
+
+    rf_light_tx_sched_stats_t stats;
+    rf_light_tx_sched_get_stats(sched, &stats);
+    BINLOGI(TAG, "TX window done | %" PRIu32 " commands | %" PRIu32 " frames | %" PRIu32 " superseded | %" PRIu32 " truncated | %" PRIu32 " errors | airtime %" PRIu32 " ms/%d ms",
+             stats.commands, stats.frames, stats.superseded, stats.truncated, stats.errors, stats.airtime_window_us / 1000, CONFIG_RF_BRIDGE_TX_AIRTIME_WINDOW_MS);
+  }
+}
+
+esp_err_t rf_light_tx_sched_start(rf_light_tx_sched_t* sched, rf_light_tx_t* tx, cc1101_device_t* cc1101) {
+  for (size_t i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+    if (policies[i].repeats == 0) rf_light_tx_sched_set_policy('a' + i, CONFIG_RF_BRIDGE_TX_REPEATS, CONFIG_RF_BRIDGE_TX_GAP_MS);
+  }
+
+  sched->tx = tx;
+  sched->cc1101 = cc1101;
+  portMUX_INITIALIZE(&sched->lock);
+  sched->bucket_started_at = esp_timer_get_time();
+  if (sched->lbt_cc1101 == NULL) sched->lbt_cc1101 = cc1101;
+  if (sched->radio_lock == NULL) sched->radio_lock = xSemaphoreCreateMutex();
+  ESP_RETURN_ON_FALSE(sched->radio_lock, ESP_ERR_NO_MEM, TAG, "Failed to create radio lock");
+  // above the main loop so a busy dispatch loop does not stretch the TX window
+  ESP_RETURN_ON_FALSE(xTaskCreate(tx_sched_task, "rf_tx", 4096, sched, 3, &sched->task) == pdPASS, ESP_ERR_NO_MEM, TAG, "Failed to create TX task");
+  return ESP_OK;
+}
+
+esp_err_t rf_light_tx_sched_submit(rf_light_tx_sched_t* sched, const rf_light_tx_command_t* commands, size_t count, uint32_t* accepted) {
+  int64_t now = esp_timer_get_time();
+  esp_err_t ret = ESP_OK;
+  uint32_t queued = 0;
+
+  portENTER_CRITICAL(&sched->lock);
+  for (size_t c = 0; c < count; c++) {
+    const rf_light_tx_command_t* command = &commands[c];
+    rf_light_tx_pending_t* slot = NULL;
+
+    for (size_t i = 0; i < sched->num_pending; i++) {
+      if (sched->pending[i].command.payload.channel == command->payload.channel) {
+        // only the latest state matters, drop the stale repeats
+        slot = &sched->pending[i];
+        sched->stats.superseded++;
+        break;
+      }
+    }
+    if (slot == NULL) {
+      if (sched->num_pending == RF_LIGHT_TX_SCHED_MAX_PENDING) {
+        sched->stats.dropped++;
+        ret = ESP_ERR_NO_MEM;
+        continue;
+      }
+      slot = &sched->pending[sched->num_pending++];
+    }
+
+    slot->command = *command;
+    if (slot->command.repeats == 0) slot->command.repeats = policy_for(command->payload.channel)->repeats;
+    slot->message = encode_rf_light_payload(&slot->command.payload);
+    slot->seq = sched->next_seq++;
+    slot->frames_sent = 0;
+    slot->submitted_at = now;
+    slot->next_frame_at = now;
+    queued |= 1u << c;
+  }
+  portEXIT_CRITICAL(&sched->lock);
+
+  xTaskNotifyGive(sched->task);
+  if (accepted) *accepted = queued;
+  return ret;
+}
+
+void rf_light_tx_sched_get_stats(rf_light_tx_sched_t* sched, rf_light_tx_sched_stats_t* stats) {
+  portENTER_CRITICAL(&sched->lock);
+  sched->stats.airtime_window_us = airtime_used(sched, esp_timer_get_time());
+  *stats = sched->stats;
+  portEXIT_CRITICAL(&sched->lock);
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include "cc1101.h"
+#include "esp_err.h"
+#include "rf_light_encoder.h"
+#include "rf_light_tx.h"
+
+// one pending command per channel, a newer command for the same channel replaces it
+#define RF_LIGHT_TX_SCHED_MAX_PENDING 8
+// the sliding airtime window is tracked in this many buckets
+#define RF_LIGHT_TX_SCHED_BUCKETS 10
+
+typedef struct {
+  rf_light_payload_t payload;
+  // 0 to use the channel policy
+  uint8_t repeats;
+} rf_light_tx_command_t;
+
+typedef struct {
+  uint8_t repeats;
+  uint16_t gap_ms;
+} rf_light_tx_policy_t;
+
+typedef struct {
+  rf_light_tx_command_t command;
+  rf_light_message_t message;
+  // changes when a newer command replaces this slot
+  uint32_t seq;
+  uint8_t frames_sent;
+  int64_t submitted_at;
+  int64_t next_frame_at;
+} rf_light_tx_pending_t;
+
+typedef struct {
+  uint32_t commands;
+  uint32_t frames;
+  // replaced by a newer command for the same channel before all repeats were sent
+  uint32_t superseded;
+  // repeats skipped because the airtime budget was exhausted
+  uint32_t truncated;
+  // submissions dropped because every pending slot was taken, or pending when a window failed
+  uint32_t dropped;
+  // TX windows cut short by a radio or RMT error
+  uint32_t errors;
+  uint32_t airtime_window_us;
+} rf_light_tx_sched_stats_t;
+
+typedef struct {
+  rf_light_tx_t* tx;
+  cc1101_device_t* cc1101;
+  TaskHandle_t task;
+  // protects pending and stats
+  portMUX_TYPE lock;
+  // held by the scheduler for a whole TX window, take it to touch the radio from elsewhere.
+  // Created by rf_light_tx_sched_start unless set before.
+  SemaphoreHandle_t radio_lock;
+  // radio used for listen before talk, cc1101 unless set before starting. A transmit only
+  // radio checks the channel on the receiver instead of going through RX itself.
+  cc1101_device_t* lbt_cc1101;
+  // radio_lock of lbt_cc1101 when that is another radio
+  SemaphoreHandle_t lbt_lock;
+  // return to IDLE instead of RX after a TX window
+  bool tx_only;
+
+  rf_light_tx_pending_t pending[RF_LIGHT_TX_SCHED_MAX_PENDING];
+  size_t num_pending;
+  uint32_t next_seq;
+
+  uint32_t airtime_buckets[RF_LIGHT_TX_SCHED_BUCKETS];
+  int64_t bucket_started_at;
+  size_t bucket;
+
+  rf_light_tx_sched_stats_t stats;
+} rf_light_tx_sched_t;
+
+/**
+ * @brief Start the task which owns RF transmission
+ */
+esp_err_t rf_light_tx_sched_start(rf_light_tx_sched_t* sched, rf_light_tx_t* tx, cc1101_device_t* cc1101);
+
+/**
+ * @brief Submit commands to be sent as one unit, without waiting for them to go out
+ *
+ * Returns ESP_ERR_NO_MEM when every pending slot was taken for some of them. accepted, if not
+ * NULL, gets bit c set for every commands[c] that was queued, count is at most 32.
+ */
+esp_err_t rf_light_tx_sched_submit(rf_light_tx_sched_t* sched, const rf_light_tx_command_t* commands, size_t count, uint32_t* accepted);
+
+void rf_light_tx_sched_set_policy(char channel, uint8_t repeats, uint16_t gap_ms);
+void rf_light_tx_sched_get_stats(rf_light_tx_sched_t* sched, rf_light_tx_sched_stats_t* stats);
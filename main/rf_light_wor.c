@@ -0,0 +1,212 @@
+#include "rf_light_wor.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <freertos/task.h>
+#include "cc1101_setup.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "mqtt.h"
+#include "mqtt_publish.h"
+
+#define TAG "RF Light WOR"
+
+#define WOR_POLL_MS 10
+// how often the energy estimate is logged and published
+#define WOR_STATS_INTERVAL_US (60 * 1000 * 1000)
+// nominal supply, the currents from Kconfig are turned into energy with it
+#define WOR_SUPPLY_MV 3300
+// lowest CPU frequency, runs from the 40 MHz crystal
+#define WOR_MIN_FREQ_MHZ 40
+
+typedef struct {
+  cc1101_device_t* cc1101;
+  rf_light_rx_data_t* rx_data;
+  SemaphoreHandle_t radio_lock;
+  gpio_num_t wake_gpio;
+  TaskHandle_t task;
+  esp_pm_lock_handle_t pm_lock;
+  volatile int64_t woken_at;
+} rf_light_wor_t;
+
+static rf_light_wor_t wor;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static rf_light_wor_stats_t stats;
+
+static void wor_wake_isr(void* arg) {
+  // level triggered, so stay off until the radio is back in WOR
+  gpio_intr_disable(wor.wake_gpio);
+  wor.woken_at = esp_timer_get_time();
+
+  BaseType_t high_task_wakeup = pdFALSE;
+  vTaskNotifyGiveFromISR(wor.task, &high_task_wakeup);
+  portYIELD_FROM_ISR(high_task_wakeup);
+}
+
+// Radio to continuous RX and capture back on
+static esp_err_t wor_leave(void) {
+  ESP_RETURN_ON_ERROR(esp_pm_lock_acquire(wor.pm_lock), TAG, "Failed to take PM lock");
+
+  xSemaphoreTake(wor.radio_lock, portMAX_DELAY);
+  esp_err_t err = cc1101_start_rx(wor.cc1101);
+  xSemaphoreGive(wor.radio_lock);
+  ESP_RETURN_ON_ERROR(err, TAG, "Failed to leave WOR");
+
+  return rf_light_rx_resume(wor.rx_data);
+}
+
+// Capture off and radio to WOR, after which the ESP is free to sleep
+static esp_err_t wor_enter(void) {
+  ESP_RETURN_ON_ERROR(rf_light_rx_suspend(wor.rx_data), TAG, "Failed to stop capture");
+
+  xSemaphoreTake(wor.radio_lock, portMAX_DELAY);
+  esp_err_t err = cc1101_start_wor(wor.cc1101);
+  xSemaphoreGive(wor.radio_lock);
+  ESP_RETURN_ON_ERROR(err, TAG, "Failed to enter WOR");
+
+  gpio_intr_enable(wor.wake_gpio);
+  return esp_pm_lock_release(wor.pm_lock);
+}
+
+// Band is busy if there is a carrier, a message came in, or the TX scheduler has the radio
+static bool wor_band_busy(uint32_t* messages) {
+  bool busy = false;
+  if (wor.rx_data->messages != *messages) {
+    *messages = wor.rx_data->messages;
+    busy = true;
+  }
+
+  if (xSemaphoreTake(wor.radio_lock, 0) != pdTRUE) return true;
+  int16_t rssi;
+  if (cc1101_read_rssi(wor.cc1101, &rssi) == ESP_OK && rssi >= CONFIG_RF_BRIDGE_WOR_RSSI_DBM) busy = true;
+  xSemaphoreGive(wor.radio_lock);
+
+  return busy;
+}
+
+static void wor_report(void) {
+  rf_light_wor_stats_t s;
+  rf_light_wor_get_stats(&s);
+
+  uint64_t total_us = s.active_us + s.wor_us;
+  if (total_us == 0) return;
+  // model based: time in each state times the configured current for it
+  uint64_t charge_uc = (s.active_us * CONFIG_RF_BRIDGE_WOR_ACTIVE_UA + s.wor_us * CONFIG_RF_BRIDGE_WOR_SLEEP_UA) / 1000000;
+  uint32_t avg_ua = charge_uc * 1000000 / total_us;
+  uint32_t uj_per_message = s.messages ? charge_uc * WOR_SUPPLY_MV / 1000 / s.messages : 0;
+  uint32_t wake_avg_us = s.wakes ? s.wake_latency_total_us / s.wakes : 0;
+
+  ESP_LOGI(TAG, "%" PRIu32 " wakes (%" PRIu32 " empty) | %" PRIu32 " messages | active %.1f%% | avg %" PRIu32 " uA | %" PRIu32 " uJ/message | wake latency avg %" PRIu32 " us max %" PRIu32 " us (+ up to %d ms WOR interval)",
+           s.wakes, s.empty_wakes, s.messages, 100.0f * s.active_us / total_us, avg_ua, uj_per_message, wake_avg_us, s.wake_latency_max_us,
+           CONFIG_RF_BRIDGE_WOR_INTERVAL_MS);
+
+  char payload[128];
+  int len = snprintf(payload, sizeof(payload), "{\"wakes\":%" PRIu32 ",\"empty\":%" PRIu32 ",\"messages\":%" PRIu32 ",\"avg_ua\":%" PRIu32 ",\"uj_per_msg\":%" PRIu32 ",\"wake_us\":%" PRIu32 "}",
+                     s.wakes, s.empty_wakes, s.messages, avg_ua, uj_per_message, wake_avg_us);
+  mqtt_publish_enqueue(MQTT_PREFIX "wor", payload, len, 0, false);
+}
+
+static void wor_task(void* arg) {
+  TickType_t poll_ticks = pdMS_TO_TICKS(WOR_POLL_MS);
+  if (poll_ticks == 0) poll_ticks = 1;
+
+  // the radio starts out in RX with capture running
+  bool active = true;
+  ESP_ERROR_CHECK(esp_pm_lock_acquire(wor.pm_lock));
+  uint32_t messages = wor.rx_data->messages;
+  uint32_t wake_messages = messages;
+  int64_t state_since = esp_timer_get_time();
+  int64_t last_busy = state_since;
+  int64_t reported_at = state_since;
+
+  while (1) {
+    int64_t now;
+
+    if (active) {
+      vTaskDelay(poll_ticks);
+      now = esp_timer_get_time();
+      if (wor_band_busy(&messages)) last_busy = now;
+
+      if (now - last_busy >= CONFIG_RF_BRIDGE_WOR_QUIET_MS * 1000) {
+        ESP_ERROR_CHECK(wor_enter());
+        active = false;
+
+        portENTER_CRITICAL(&stats_lock);
+        stats.active_us += now - state_since;
+        stats.messages += messages - wake_messages;
+        if (messages == wake_messages) stats.empty_wakes++;
+        portEXIT_CRITICAL(&stats_lock);
+        state_since = now;
+      }
+    } else {
+      // a wake interrupt, or the TX scheduler took the radio out of WOR and GDO2 is data again
+      bool woken = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(1000)) > 0;
+      if (woken || !cc1101_is_sleeping()) {
+        ESP_ERROR_CHECK(wor_leave());
+        now = esp_timer_get_time();
+        active = true;
+
+        uint32_t latency = now - (woken ? wor.woken_at : now);
+        portENTER_CRITICAL(&stats_lock);
+        stats.wor_us += now - state_since;
+        stats.wakes++;
+        stats.wake_latency_total_us += latency;
+        if (stats.wake_latency_min_us == 0 || latency < stats.wake_latency_min_us) stats.wake_latency_min_us = latency;
+        if (latency > stats.wake_latency_max_us) stats.wake_latency_max_us = latency;
+        portEXIT_CRITICAL(&stats_lock);
+
+        state_since = now;
+        last_busy = now;
+        messages = wake_messages = wor.rx_data->messages;
+      } else {
+        now = esp_timer_get_time();
+      }
+    }
+
+    if (now - reported_at >= WOR_STATS_INTERVAL_US) {
+      // close the current state so the report is up to date
+      portENTER_CRITICAL(&stats_lock);
+      if (active) stats.active_us += now - state_since;
+      else stats.wor_us += now - state_since;
+      portEXIT_CRITICAL(&stats_lock);
+      state_since = now;
+      reported_at = now;
+      wor_report();
+    }
+  }
+}
+
+esp_err_t rf_light_wor_start(cc1101_device_t* cc1101, rf_light_rx_data_t* rx_data, SemaphoreHandle_t radio_lock, gpio_num_t wake_gpio) {
+  wor.cc1101 = cc1101;
+  wor.rx_data = rx_data;
+  wor.radio_lock = radio_lock;
+  wor.wake_gpio = wake_gpio;
+
+  esp_pm_config_t pm_config = {
+    .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+    .min_freq_mhz = WOR_MIN_FREQ_MHZ,
+    .light_sleep_enable = true,
+  };
+  ESP_RETURN_ON_ERROR(esp_pm_configure(&pm_config), TAG, "Failed to enable automatic light sleep");
+  // decoding runs at full speed, and holding this also keeps the chip out of light sleep
+  ESP_RETURN_ON_ERROR(esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "rf_capture", &wor.pm_lock), TAG, "Failed to create PM lock");
+
+  // GDO2 carries carrier sense in WOR, high wakes the chip and raises the interrupt
+  ESP_RETURN_ON_ERROR(gpio_wakeup_enable(wake_gpio, GPIO_INTR_HIGH_LEVEL), TAG, "Failed to enable GPIO wake");
+  ESP_RETURN_ON_ERROR(esp_sleep_enable_gpio_wakeup(), TAG, "Failed to enable GPIO wake");
+  ESP_RETURN_ON_ERROR(gpio_isr_handler_add(wake_gpio, wor_wake_isr, NULL), TAG, "Failed to add wake ISR");
+  gpio_intr_disable(wake_gpio);
+
+  // above the main loop so a wake is not delayed by dispatching
+  ESP_RETURN_ON_FALSE(xTaskCreate(wor_task, "rf_wor", 3072, NULL, 2, &wor.task) == pdPASS, ESP_ERR_NO_MEM, TAG, "Failed to create WOR task");
+  return ESP_OK;
+}
+
+void rf_light_wor_get_stats(rf_light_wor_stats_t* out) {
+  portENTER_CRITICAL(&stats_lock);
+  *out = stats;
+  portEXIT_CRITICAL(&stats_lock);
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "cc1101.h"
+#include "driver/gpio.h"
+#include "esp_err.h"
+#include "rf_light_rx.h"
+
+typedef struct {
+  // carrier sense wake ups, and the ones that did not decode anything
+  uint32_t wakes;
+  uint32_t empty_wakes;
+  uint32_t messages;
+  // from the wake interrupt until the RMT channel is capturing again
+  uint32_t wake_latency_min_us;
+  uint32_t wake_latency_max_us;
+  uint64_t wake_latency_total_us;
+  // time spent capturing, and time spent in WOR with the ESP free to light sleep
+  uint64_t active_us;
+  uint64_t wor_us;
+} rf_light_wor_stats_t;
+
+/**
+ * @brief Duty-cycle the receiver with the CC1101 Wake-on-Radio
+ *
+ * While the band is quiet the CC1101 polls RX on its own and the RMT channel is disabled,
+ * so the ESP can enter light sleep. A carrier raises GDO2 (wake_gpio), which wakes the ESP,
+ * puts the radio in continuous RX and re-enables capture until the band has been quiet for
+ * CONFIG_RF_BRIDGE_WOR_QUIET_MS. A power management lock is only held while capturing.
+ *
+ * radio_lock is taken around every radio state change, see rf_light_tx_sched_t.
+ */
+esp_err_t rf_light_wor_start(cc1101_device_t* cc1101, rf_light_rx_data_t* rx_data, SemaphoreHandle_t radio_lock, gpio_num_t wake_gpio);
+void rf_light_wor_get_stats(rf_light_wor_stats_t* stats);
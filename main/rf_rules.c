@@ -0,0 +1,311 @@
+#include "rf_rules.h"
+
+#ifdef CONFIG_RF_BRIDGE_RULES
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "binlog.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "event_queue.h"
+#include "mqtt.h"
+#include "mqtt_publish.h"
+#include "nvs.h"
+
+#define TAG "RF Rules"
+
+#define RULES_SET_TOPIC MQTT_PREFIX "rules/set"
+#define RULES_STATE_TOPIC MQTT_PREFIX "rules/state"
+
+#define NVS_NAMESPACE "rf_rules"
+#define NVS_KEY "rules"
+
+#define RELEASE_US ((int64_t) RF_RULES_RELEASE_MS * 1000)
+#define HOLD_US ((int64_t) CONFIG_RF_BRIDGE_RULES_HOLD_MS * 1000)
+#define DOUBLE_US ((int64_t) CONFIG_RF_BRIDGE_RULES_DOUBLE_MS * 1000)
+
+// the second press of a double only starts once the first was released
+_Static_assert(CONFIG_RF_BRIDGE_RULES_DOUBLE_MS > RF_RULES_RELEASE_MS, "Double press gap must be longer than the release time");
+
+// longest line that can hold a rule, with room for spaces
+#define MAX_LINE 48
+
+typedef struct {
+  bool used;
+  // the hold rule fired for this press
+  bool held;
+  // this press was the second of a double, so the next one starts over
+  bool doubled;
+  uint16_t code;
+  int64_t started_us;
+  int64_t last_seen_us;
+} press_t;
+
+static radio_manager_t* rules_radios;
+static rf_rules_table_t table;
+static press_t presses[RF_RULES_MAX_PRESSES];
+// last known state of the lights a to z
+static bool lights[26];
+static rf_rules_stats_t stats;
+
+static const char* const trigger_names[] = {"press", "hold", "double"};
+static const char* const action_names[] = {"tx", "state"};
+static const char* const state_names[] = {"off", "on", "toggle"};
+
+static int find_name(const char* const* names, size_t count, const char* name) {
+  for (size_t i = 0; i < count; i++) {
+    if (strcmp(names[i], name) == 0) return i;
+  }
+  return -1;
+}
+
+static int compare_rules(const void* a, const void* b) {
+  const rf_rule_t* x = a;
+  const rf_rule_t* y = b;
+  if (x->code != y->code) return (x->code > y->code) - (x->code < y->code);
+  return (x->trigger > y->trigger) - (x->trigger < y->trigger);
+}
+
+// Shared by parsing and loading, the blob in NVS is only as good as the firmware that wrote it
+static bool valid_rule(const rf_rule_t* rule) {
+  // only the lights the bridge has state topics for
+  return rule->trigger <= RF_RULE_DOUBLE && rule->action <= RF_RULE_STATE && rule->state <= RF_RULE_TOGGLE &&
+         rule->channel >= 'a' && rule->channel <= 'z' && mqtt_light_state_topic(rule->channel) != NULL;
+}
+
+static esp_err_t parse_line(const char* line, rf_rule_t* rule) {
+  unsigned code;
+  char trigger[8], action[8], state[8];
+  char channel;
+  int end = 0;
+  if (sscanf(line, "%x %7s %7s %c %7s %n", &code, trigger, action, &channel, state, &end) != 5 || line[end] != '\0') return ESP_ERR_INVALID_ARG;
+
+  int t = find_name(trigger_names, 3, trigger);
+  int a = find_name(action_names, 2, action);
+  int s = find_name(state_names, 3, state);
+  if (code > UINT16_MAX || t < 0 || a < 0 || s < 0) return ESP_ERR_INVALID_ARG;
+  *rule = (rf_rule_t) { .code = code, .trigger = t, .action = a, .channel = channel, .state = s };
+  return valid_rule(rule) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t rf_rules_parse(const char* data, size_t len, rf_rules_table_t* out, size_t* bad_line) {
+  out->count = 0;
+  size_t line_number = 0;
+  size_t pos = 0;
+  while (pos < len) {
+    size_t end = pos;
+    while (end < len && data[end] != '\n' && data[end] != ';') end++;
+    size_t start = pos;
+    pos = end + 1;
+    line_number++;
+    *bad_line = line_number;
+
+    // without leading blanks and a trailing \r
+    while (start < end && (data[start] == ' ' || data[start] == '\t')) start++;
+    if (end > start && data[end - 1] == '\r') end--;
+    if (start == end || data[start] == '#') continue;
+
+    char line[MAX_LINE];
+    ESP_RETURN_ON_FALSE(end - start < sizeof(line), ESP_ERR_INVALID_SIZE, TAG, "Line %zu too long", line_number);
+    memcpy(line, &data[start], end - start);
+    line[end - start] = '\0';
+
+    ESP_RETURN_ON_FALSE(out->count < RF_RULES_MAX, ESP_ERR_NO_MEM, TAG, "More than %d rules", RF_RULES_MAX);
+    ESP_RETURN_ON_ERROR(parse_line(line, &out->rules[out->count]), TAG, "Invalid rule on line %zu: %s", line_number, line);
+    out->count++;
+  }
+  *bad_line = 0;
+  qsort(out->rules, out->count, sizeof(rf_rule_t), compare_rules);
+  return ESP_OK;
+}
+
+int rf_rules_subscribe(esp_mqtt_client_handle_t client) {
+  return esp_mqtt_client_subscribe(client, RULES_SET_TOPIC, 1) >= 0 ? 1 : 0;
+}
+
+bool rf_rules_handle_message(QueueHandle_t queue, const char* topic, size_t topic_len, const char* data, size_t data_len, size_t total_len) {
+  if (topic_len != strlen(RULES_SET_TOPIC) || strncmp(topic, RULES_SET_TOPIC, topic_len) != 0) return false;
+
+  if (total_len > data_len) {
+    ESP_LOGW(TAG, "Rules do not fit the MQTT buffer");
+    mqtt_publish_enqueue(RULES_STATE_TOPIC, "too large", 0, 0, true);
+    return true;
+  }
+
+  event_queue_message_t* evt = event_queue_claim(EVENT_QUEUE_MESSAGE_RULES);
+  if (evt == NULL) {
+    ESP_LOGW(TAG, "Event pool exhausted, dropping rules");
+    return true;
+  }
+  size_t bad_line;
+  if (rf_rules_parse(data, data_len, &evt->data.rules, &bad_line) != ESP_OK) {
+    event_queue_release(evt);
+    char state[32];
+    int len = snprintf(state, sizeof(state), "invalid line %zu", bad_line);
+    mqtt_publish_enqueue(RULES_STATE_TOPIC, state, len, 0, true);
+    return true;
+  }
+  event_queue_send(queue, evt);
+  return true;
+}
+
+static esp_err_t save(void) {
+  nvs_handle_t nvs;
+  ESP_RETURN_ON_ERROR(nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs), TAG, "Failed to open NVS");
+  esp_err_t ret = nvs_set_blob(nvs, NVS_KEY, table.rules, table.count * sizeof(rf_rule_t));
+  if (ret == ESP_OK) ret = nvs_commit(nvs);
+  nvs_close(nvs);
+  ESP_RETURN_ON_ERROR(ret, TAG, "Failed to save rules");
+  return ESP_OK;
+}
+
+static esp_err_t load(void) {
+  size_t size = sizeof(table.rules);
+
+  nvs_handle_t nvs;
+  esp_err_t ret = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs);
+  // nothing saved yet
+  if (ret == ESP_ERR_NVS_NOT_FOUND) return ESP_OK;
+  ESP_RETURN_ON_ERROR(ret, TAG, "Failed to open NVS");
+  ret = nvs_get_blob(nvs, NVS_KEY, table.rules, &size);
+  nvs_close(nvs);
+  if (ret == ESP_ERR_NVS_NOT_FOUND) return ESP_OK;
+  ESP_RETURN_ON_ERROR(ret, TAG, "Failed to load rules");
+
+  // a table that would not parse today is dropped as a whole, the retained rules/set replaces it
+  bool valid = size % sizeof(rf_rule_t) == 0;
+  for (size_t i = 0; valid && i < size / sizeof(rf_rule_t); i++) valid = valid_rule(&table.rules[i]);
+  if (!valid) {
+    ESP_LOGW(TAG, "Ignoring invalid saved rules");
+    return ESP_OK;
+  }
+  table.count = size / sizeof(rf_rule_t);
+  // find_rules relies on the order
+  qsort(table.rules, table.count, sizeof(rf_rule_t), compare_rules);
+  return ESP_OK;
+}
+
+static void publish_state(void) {
+  char state[16];
+  int len = snprintf(state, sizeof(state), "%u rules", table.count);
+  mqtt_publish_enqueue(RULES_STATE_TOPIC, state, len, 0, true);
+}
+
+esp_err_t rf_rules_start(radio_manager_t* radios) {
+  rules_radios = radios;
+  ESP_RETURN_ON_ERROR(load(), TAG, "Failed to load rules");
+  stats.rules = table.count;
+  ESP_LOGI(TAG, "Loaded %u rules", table.count);
+  publish_state();
+  return ESP_OK;
+}
+
+esp_err_t rf_rules_load(const rf_rules_table_t* rules) {
+  // the retained rules come again with every reconnect
+  bool changed = rules->count != table.count || memcmp(rules->rules, table.rules, rules->count * sizeof(rf_rule_t)) != 0;
+  table = *rules;
+  stats.rules = table.count;
+  memset(presses, 0, sizeof(presses));
+  publish_state();
+  if (!changed) return ESP_OK;
+  ESP_LOGI(TAG, "%u rules", table.count);
+  return save();
+}
+
+void rf_rules_set_light(char channel, bool on) {
+  if (channel >= 'a' && channel <= 'z') lights[channel - 'a'] = on;
+}
+
+static void fire(const rf_rule_t* rule, int64_t received_us) {
+  bool on = rule->state == RF_RULE_TOGGLE ? !lights[rule->channel - 'a'] : rule->state == RF_RULE_ON;
+  if (rule->action == RF_RULE_TX) {
+    rf_light_tx_command_t command = {
+      .payload.channel = rule->channel,
+      .payload.on = on,
+    };
+    if (radio_manager_submit(rules_radios, &command, 1, NULL) != ESP_OK) {
+      stats.dropped++;
+      BINLOGW(TAG, "TX scheduler full, dropped rule for code %04X", rule->code);
+      return;
+    }
+  }
+  lights[rule->channel - 'a'] = on;
+  // Home Assistant follows, or catches up once the broker is back
+  mqtt_publish_light_state(rule->channel, on);
+
+  uint32_t reaction_us = esp_timer_get_time() - received_us;
+  stats.fired++;
+  stats.reaction_last_us = reaction_us;
+  if (reaction_us > stats.reaction_max_us) stats.reaction_max_us = reaction_us;
+  BINLOGI(TAG, "Rule %04X %d -> %c %d | %" PRIu32 " us", rule->code, rule->trigger, rule->channel, on, reaction_us);
+}
+
+// Every rule of code for trigger
+static void fire_all(size_t first, uint16_t code, rf_rule_trigger_t trigger, int64_t received_us) {
+  for (size_t i = first; i < table.count && table.rules[i].code == code; i++) {
+    if (table.rules[i].trigger == trigger) fire(&table.rules[i], received_us);
+  }
+}
+
+// Index of the first rule for code, or table.count
+static size_t find_rules(uint16_t code) {
+  size_t lo = 0;
+  size_t hi = table.count;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (table.rules[mid].code < code) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo < table.count && table.rules[lo].code == code ? lo : table.count;
+}
+
+static press_t* find_press(uint16_t code) {
+  press_t* oldest = &presses[0];
+  for (size_t i = 0; i < RF_RULES_MAX_PRESSES; i++) {
+    if (presses[i].used && presses[i].code == code) return &presses[i];
+    if (!presses[i].used || (oldest->used && presses[i].last_seen_us < oldest->last_seen_us)) oldest = &presses[i];
+  }
+  *oldest = (press_t) { .code = code };
+  return oldest;
+}
+
+void rf_rules_received(uint16_t code, int64_t received_us) {
+  size_t first = find_rules(code);
+  if (first == table.count) return;
+  stats.matched++;
+
+  int64_t now = esp_timer_get_time();
+  press_t* press = find_press(code);
+  if (press->used && now - press->last_seen_us < RELEASE_US) {
+    // the remote is still repeating
+    press->last_seen_us = now;
+    if (!press->held && now - press->started_us >= HOLD_US) {
+      press->held = true;
+      fire_all(first, code, RF_RULE_HOLD, received_us);
+    }
+    return;
+  }
+
+  bool doubled = press->used && !press->doubled && now - press->last_seen_us < DOUBLE_US;
+  *press = (press_t) {
+    .used = true,
+    .doubled = doubled,
+    .code = code,
+    .started_us = now,
+    .last_seen_us = now,
+  };
+  fire_all(first, code, RF_RULE_PRESS, received_us);
+  if (doubled) fire_all(first, code, RF_RULE_DOUBLE, received_us);
+}
+
+void rf_rules_get_stats(rf_rules_stats_t* out) {
+  *out = stats;
+}
+
+#endif
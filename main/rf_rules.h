@@ -0,0 +1,129 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "esp_err.h"
+#include "mqtt_client.h"
+#include "radio_manager.h"
+
+// Local automations, a received code triggers a light command or a state publish right
+// in the dispatch loop, without the round trip through Home Assistant and while offline.
+//
+// Rules are published retained to rules/set, one per line (or separated by ';'):
+//
+//   <code hex> <press|hold|double> <tx|state> <channel> <on|off|toggle>
+//
+// "tx" sends the light command and publishes the new state, "state" only publishes it.
+// A press fires on the first frame, hold once the remote kept repeating for
+// CONFIG_RF_BRIDGE_RULES_HOLD_MS, double on a second press within
+// CONFIG_RF_BRIDGE_RULES_DOUBLE_MS of the end of the first (the press rule fires for both).
+// Toggle goes from the last state the bridge sent, was asked for or received. An empty
+// payload removes every rule. The compiled table is kept in NVS, and rules/state reports
+// the number of rules or the first line that did not parse.
+
+#define RF_RULES_MAX 32
+// a code that has not been seen for this long was released
+#define RF_RULES_RELEASE_MS 150
+// codes tracked for hold and double presses at once
+#define RF_RULES_MAX_PRESSES 4
+
+typedef enum {
+  RF_RULE_PRESS,
+  RF_RULE_HOLD,
+  RF_RULE_DOUBLE,
+} rf_rule_trigger_t;
+
+typedef enum {
+  RF_RULE_TX,
+  RF_RULE_STATE,
+} rf_rule_action_t;
+
+typedef enum {
+  RF_RULE_OFF,
+  RF_RULE_ON,
+  RF_RULE_TOGGLE,
+} rf_rule_state_t;
+
+// 6 bytes, the whole table fits in an event
+typedef struct {
+  uint16_t code;
+  uint8_t trigger;
+  uint8_t action;
+  char channel;
+  uint8_t state;
+} rf_rule_t;
+
+// sorted by code, then trigger
+typedef struct {
+  uint8_t count;
+  rf_rule_t rules[RF_RULES_MAX];
+} rf_rules_table_t;
+
+typedef struct {
+  uint32_t matched;
+  uint32_t fired;
+  // light commands the TX scheduler did not take
+  uint32_t dropped;
+  // from the frame's capture to the action, for the last and the slowest
+  uint32_t reaction_last_us;
+  uint32_t reaction_max_us;
+  size_t rules;
+} rf_rules_stats_t;
+
+#ifdef CONFIG_RF_BRIDGE_RULES
+
+/**
+ * @brief Load the saved rules
+ *
+ * Not thread safe, everything after this is called from the dispatch loop only.
+ */
+esp_err_t rf_rules_start(radio_manager_t* radios);
+
+// Subscribe to rules/set, returns the number of subscriptions made
+int rf_rules_subscribe(esp_mqtt_client_handle_t client);
+
+/**
+ * @brief Take a rules update off the MQTT task and queue it for the dispatch loop
+ *
+ * @return false if the topic is not rules/set
+ */
+bool rf_rules_handle_message(QueueHandle_t queue, const char* topic, size_t topic_len, const char* data, size_t data_len, size_t total_len);
+
+/**
+ * @brief Parse a rules/set payload into a sorted table
+ *
+ * @param bad_line set to the first line that does not parse, counted from 1
+ */
+esp_err_t rf_rules_parse(const char* data, size_t len, rf_rules_table_t* table, size_t* bad_line);
+
+// Replace the rules, saved to NVS if they changed
+esp_err_t rf_rules_load(const rf_rules_table_t* table);
+
+/**
+ * @brief Run the rules for a received code
+ *
+ * One binary search for a code without rules.
+ *
+ * @param received_us esp_timer time the frame was captured
+ */
+void rf_rules_received(uint16_t code, int64_t received_us);
+
+// Track a light's state for toggles
+void rf_rules_set_light(char channel, bool on);
+
+void rf_rules_get_stats(rf_rules_stats_t* stats);
+
+#else
+
+static inline esp_err_t rf_rules_start(radio_manager_t* radios) { return ESP_OK; }
+static inline int rf_rules_subscribe(esp_mqtt_client_handle_t client) { return 0; }
+static inline bool rf_rules_handle_message(QueueHandle_t queue, const char* topic, size_t topic_len, const char* data, size_t data_len, size_t total_len) { return false; }
+static inline esp_err_t rf_rules_load(const rf_rules_table_t* table) { return ESP_OK; }
+static inline void rf_rules_received(uint16_t code, int64_t received_us) {}
+static inline void rf_rules_set_light(char channel, bool on) {}
+
+#endif
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Latency and cycle samples, shared by the bench and the load generator
+
+static inline int sample_stats_compare(const void* a, const void* b) {
+  uint32_t x = *(const uint32_t*) a;
+  uint32_t y = *(const uint32_t*) b;
+  return (x > y) - (x < y);
+}
+
+// Ascending, in place
+static inline void sample_stats_sort(uint32_t* samples, size_t count) {
+  qsort(samples, count, sizeof(uint32_t), sample_stats_compare);
+}
@@ -7,6 +7,7 @@
    CONDITIONS OF ANY KIND, either express or implied.
 */
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -17,12 +18,16 @@
 #include <esp_log.h>
 #include <esp_wifi.h>
 #include <esp_event.h>
+#include <esp_random.h>
+#include <esp_timer.h>
+#include <nvs.h>
 #include <nvs_flash.h>
 
 #include <wifi_provisioning/manager.h>
 #include <wifi_provisioning/scheme_ble.h>
 
 #include "qrcode.h"
+#include "wifi.h"
 
 static const char *TAG = "wifi";
 
@@ -35,6 +40,190 @@ static EventGroupHandle_t wifi_event_group;
 #define PROV_TRANSPORT_BLE      "ble"
 #define QRCODE_BASE_URL         "https://espressif.github.io/esp-jumpstart/qrcode.html"
 
+#define CACHE_NAMESPACE         "wifi_cache"
+#define CACHE_KEY               "ap"
+
+/* The access point and addresses of the last connection, to skip the scan on the next one */
+typedef struct {
+  uint8_t bssid[6];
+  uint8_t channel;
+  esp_netif_ip_info_t ip_info;
+  esp_netif_dns_info_t dns;
+} wifi_cache_t;
+
+static esp_netif_t *sta_netif;
+static esp_timer_handle_t retry_timer;
+static wifi_cache_t cache;
+static bool cache_valid;
+/* The station config is pinned to the cached BSSID and channel */
+static bool cache_hinted;
+static bool connected;
+/* Failed attempts since the last connection */
+static uint32_t attempts;
+static int64_t disconnected_at;
+/* The stats are read from other tasks, and 64 bit copies are not atomic */
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static wifi_stats_t stats = {
+  .boot_to_ip_ms = -1,
+  .disconnect_to_ip_ms = -1,
+};
+
+static void load_cache(void)
+{
+  nvs_handle_t nvs;
+  if (nvs_open(CACHE_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+    return;
+  }
+  size_t size = sizeof(cache);
+  cache_valid = nvs_get_blob(nvs, CACHE_KEY, &cache, &size) == ESP_OK && size == sizeof(cache);
+  nvs_close(nvs);
+}
+
+static void save_cache(const wifi_cache_t *latest)
+{
+  /* Only when something changed, most connections go to the same AP */
+  if (cache_valid && memcmp(latest, &cache, sizeof(cache)) == 0) {
+    return;
+  }
+  cache = *latest;
+  cache_valid = true;
+
+  nvs_handle_t nvs;
+  esp_err_t ret = nvs_open(CACHE_NAMESPACE, NVS_READWRITE, &nvs);
+  if (ret == ESP_OK) {
+    ret = nvs_set_blob(nvs, CACHE_KEY, &cache, sizeof(cache));
+    if (ret == ESP_OK) {
+      ret = nvs_commit(nvs);
+    }
+    nvs_close(nvs);
+  }
+  if (ret != ESP_OK) {
+    ESP_LOGW(TAG, "Failed to cache the AP: %s", esp_err_to_name(ret));
+  }
+}
+
+/* Connect straight to the cached AP on its channel, or scan all channels again */
+static void set_cache_hint(bool hint)
+{
+  wifi_config_t wifi_config;
+  if (esp_wifi_get_config(WIFI_IF_STA, &wifi_config) != ESP_OK) {
+    return;
+  }
+  wifi_config.sta.bssid_set = hint;
+  wifi_config.sta.channel = hint ? cache.channel : 0;
+  if (hint) {
+    memcpy(wifi_config.sta.bssid, cache.bssid, sizeof(cache.bssid));
+  }
+  if (esp_wifi_set_config(WIFI_IF_STA, &wifi_config) == ESP_OK) {
+    cache_hinted = hint;
+  }
+}
+
+#ifdef CONFIG_RF_BRIDGE_WIFI_STATIC_IP
+/* Set while DHCP is stopped for the cached address */
+static bool cached_ip;
+
+/* Skip DHCP with the last lease, only safe with a reservation on the router */
+static void set_cached_ip(void)
+{
+  if (esp_netif_dhcpc_stop(sta_netif) != ESP_OK) {
+    return;
+  }
+  cached_ip = true;
+  if (esp_netif_set_ip_info(sta_netif, &cache.ip_info) == ESP_OK) {
+    esp_netif_set_dns_info(sta_netif, ESP_NETIF_DNS_MAIN, &cache.dns);
+    ESP_LOGI(TAG, "Using cached IP Address:" IPSTR, IP2STR(&cache.ip_info.ip));
+  }
+}
+
+/* The cached address belongs to the cached AP, any other network gets a lease */
+static void use_dhcp(void)
+{
+  if (cached_ip && esp_netif_dhcpc_start(sta_netif) == ESP_OK) {
+    cached_ip = false;
+    ESP_LOGI(TAG, "Back to DHCP");
+  }
+}
+#endif
+
+static void retry_connect(void *arg)
+{
+  esp_wifi_connect();
+}
+
+/* Exponential backoff with jitter, so a rebooted AP is not hit by every station at once */
+static void schedule_retry(void)
+{
+  uint32_t shift = attempts < 16 ? attempts : 16;
+  uint64_t delay_ms = (uint64_t) CONFIG_RF_BRIDGE_WIFI_RETRY_MIN_MS << shift;
+  if (delay_ms > CONFIG_RF_BRIDGE_WIFI_RETRY_MAX_MS) {
+    delay_ms = CONFIG_RF_BRIDGE_WIFI_RETRY_MAX_MS;
+  }
+  /* Somewhere in the upper half */
+  delay_ms = delay_ms / 2 + esp_random() % (delay_ms / 2 + 1);
+  attempts++;
+
+  ESP_LOGI(TAG, "Connecting to the AP again in %u ms (attempt %" PRIu32 ")", (unsigned) delay_ms, attempts);
+  esp_timer_stop(retry_timer);
+  esp_timer_start_once(retry_timer, delay_ms * 1000);
+}
+
+static void handle_disconnect(const wifi_event_sta_disconnected_t *event)
+{
+  if (connected) {
+    connected = false;
+    disconnected_at = esp_timer_get_time();
+    portENTER_CRITICAL(&stats_lock);
+    stats.disconnects++;
+    portEXIT_CRITICAL(&stats_lock);
+  }
+  ESP_LOGI(TAG, "Disconnected, reason %d", event->reason);
+
+  /* The AP may have moved, the first retry still goes to the cached one */
+  if (cache_hinted && attempts >= 1) {
+    ESP_LOGI(TAG, "Cached AP not reachable, scanning");
+    set_cache_hint(false);
+#ifdef CONFIG_RF_BRIDGE_WIFI_STATIC_IP
+    use_dhcp();
+#endif
+  }
+  schedule_retry();
+}
+
+static void handle_got_ip(const ip_event_got_ip_t *event)
+{
+  int64_t now = esp_timer_get_time();
+  if (stats.boot_to_ip_ms < 0) {
+    portENTER_CRITICAL(&stats_lock);
+    stats.boot_to_ip_ms = now / 1000;
+    portEXIT_CRITICAL(&stats_lock);
+    ESP_LOGI(TAG, "%" PRIi64 " ms from boot to IP", now / 1000);
+  }
+  if (disconnected_at) {
+    int64_t ms = (now - disconnected_at) / 1000;
+    portENTER_CRITICAL(&stats_lock);
+    stats.disconnect_to_ip_ms = ms;
+    portEXIT_CRITICAL(&stats_lock);
+    ESP_LOGI(TAG, "%" PRIi64 " ms from disconnect to IP, %" PRIu32 " attempts", ms, attempts);
+    disconnected_at = 0;
+  }
+  connected = true;
+  attempts = 0;
+
+  wifi_cache_t latest = { .ip_info = event->ip_info };
+  wifi_ap_record_t ap;
+  if (esp_wifi_sta_get_ap_info(&ap) == ESP_OK) {
+    memcpy(latest.bssid, ap.bssid, sizeof(latest.bssid));
+    latest.channel = ap.primary;
+    esp_netif_get_dns_info(sta_netif, ESP_NETIF_DNS_MAIN, &latest.dns);
+    save_cache(&latest);
+    /* Found by a scan, so the next reconnect goes straight to this AP again */
+    if (!cache_hinted && esp_wifi_set_storage(WIFI_STORAGE_RAM) == ESP_OK) {
+      set_cache_hint(true);
+    }
+  }
+}
+
 /* Event handler for catching system events */
 static void event_handler(void* arg, esp_event_base_t event_base,
                           int32_t event_id, void* event_data)
@@ -85,8 +274,7 @@ static void event_handler(void* arg, esp_event_base_t event_base,
       esp_wifi_connect();
       break;
     case WIFI_EVENT_STA_DISCONNECTED:
-      ESP_LOGI(TAG, "Disconnected. Connecting to the AP again...");
-      esp_wifi_connect();
+      handle_disconnect((wifi_event_sta_disconnected_t *) event_data);
       break;
     default:
       break;
@@ -94,6 +282,7 @@ static void event_handler(void* arg, esp_event_base_t event_base,
   } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
     ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
     ESP_LOGI(TAG, "Connected with IP Address:" IPSTR, IP2STR(&event->ip_info.ip));
+    handle_got_ip(event);
     /* Signal main application to continue execution */
     xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_EVENT);
   } else if (event_base == PROTOCOMM_TRANSPORT_BLE_EVENT) {
@@ -128,6 +317,18 @@ static void wifi_init_sta(void)
 {
   /* Start Wi-Fi in station mode */
   ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
+
+  /* Targeted association with the last AP instead of a full scan */
+  load_cache();
+  if (cache_valid) {
+    /* The hints must not replace the provisioned config in flash */
+    ESP_ERROR_CHECK(esp_wifi_set_storage(WIFI_STORAGE_RAM));
+    set_cache_hint(true);
+    ESP_LOGI(TAG, "Connecting to cached AP " MACSTR " on channel %d", MAC2STR(cache.bssid), cache.channel);
+#ifdef CONFIG_RF_BRIDGE_WIFI_STATIC_IP
+    set_cached_ip();
+#endif
+  }
   ESP_ERROR_CHECK(esp_wifi_start());
 }
 
@@ -192,7 +393,13 @@ void initialize_wifi(void)
   ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &event_handler, NULL));
 
   /* Initialize Wi-Fi including netif with default config */
-  esp_netif_create_default_wifi_sta();
+  sta_netif = esp_netif_create_default_wifi_sta();
+
+  const esp_timer_create_args_t retry_timer_args = {
+    .callback = retry_connect,
+    .name = "wifi_retry",
+  };
+  ESP_ERROR_CHECK(esp_timer_create(&retry_timer_args, &retry_timer));
 
   wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
   ESP_ERROR_CHECK(esp_wifi_init(&cfg));
@@ -319,3 +526,10 @@ void initialize_wifi(void)
   xEventGroupWaitBits(wifi_event_group, WIFI_CONNECTED_EVENT, true, true, portMAX_DELAY);
 
 }
+
+void wifi_get_stats(wifi_stats_t *out)
+{
+  portENTER_CRITICAL(&stats_lock);
+  *out = stats;
+  portEXIT_CRITICAL(&stats_lock);
+}
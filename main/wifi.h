@@ -1,2 +1,20 @@
 #pragma once
+
+#include <stdint.h>
+#include "sdkconfig.h"
+
+typedef struct {
+  // MQTT and TX are down until these, -1 before the first
+  int64_t boot_to_ip_ms;
+  int64_t disconnect_to_ip_ms;
+  uint32_t disconnects;
+} wifi_stats_t;
+
+#ifdef CONFIG_IDF_TARGET_LINUX
+// the host is already on the network
+static inline void initialize_wifi(void) {}
+static inline void wifi_get_stats(wifi_stats_t* stats) { *stats = (wifi_stats_t) { .boot_to_ip_ms = -1, .disconnect_to_ip_ms = -1 }; }
+#else
 void initialize_wifi(void);
+void wifi_get_stats(wifi_stats_t* stats);
+#endif
@@ -0,0 +1,192 @@
+#include "wifi_power.h"
+
+#ifdef CONFIG_RF_BRIDGE_WIFI_POWER
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_check.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "mqtt.h"
+#include "mqtt_publish.h"
+
+#define TAG "Wi-Fi Power"
+
+#define PROBE_TOPIC MQTT_PREFIX "wifi/probe"
+#define POWER_TOPIC MQTT_PREFIX "wifi/power"
+
+#define ACTIVE_US ((int64_t) CONFIG_RF_BRIDGE_WIFI_ACTIVE_MS * 1000)
+#define PROBE_US ((int64_t) CONFIG_RF_BRIDGE_WIFI_PROBE_S * 1000000)
+// after a failed switch, before trying again
+#define RETRY_US 1000000
+
+static const wifi_ps_type_t ps_types[WIFI_POWER_MODES] = {WIFI_PS_MIN_MODEM, WIFI_PS_NONE};
+static const char* const mode_names[WIFI_POWER_MODES] = {"sleep", "active"};
+
+static TaskHandle_t task;
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+// below under the lock
+static wifi_power_stats_t stats;
+static int64_t mode_since_us;
+static int64_t last_activity_us;
+static uint32_t probe_seq;
+// 0 while no probe is outstanding
+static int64_t probe_sent_us;
+
+static bool set_mode(wifi_power_mode_t mode) {
+  esp_err_t ret = esp_wifi_set_ps(ps_types[mode]);
+  if (ret != ESP_OK) {
+    ESP_LOGW(TAG, "Failed to switch to %s: %s", mode_names[mode], esp_err_to_name(ret));
+    return false;
+  }
+
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&lock);
+  stats.modes[stats.mode].time_us += now - mode_since_us;
+  stats.modes[mode].entered++;
+  stats.mode = mode;
+  mode_since_us = now;
+  // the round trip would mix both modes
+  if (probe_sent_us) {
+    probe_sent_us = 0;
+    stats.probes_lost++;
+  }
+  portEXIT_CRITICAL(&lock);
+  ESP_LOGD(TAG, "Switched to %s", mode_names[mode]);
+  return true;
+}
+
+static uint32_t average_ms(const wifi_power_mode_stats_t* mode) {
+  return mode->probes ? mode->rtt_total_us / mode->probes / 1000 : 0;
+}
+
+static void publish_stats(void) {
+  wifi_power_stats_t s;
+  wifi_power_get_stats(&s);
+  const wifi_power_mode_stats_t* sleep = &s.modes[WIFI_POWER_SLEEP];
+  const wifi_power_mode_stats_t* active = &s.modes[WIFI_POWER_ACTIVE];
+
+  char payload[192];
+  int len = snprintf(payload, sizeof(payload),
+                     "{\"mode\":\"%s\",\"sleep_s\":%" PRIu32 ",\"active_s\":%" PRIu32 ",\"wakes\":%" PRIu32
+                     ",\"sleep_rtt_ms\":%" PRIu32 ",\"sleep_rtt_max_ms\":%" PRIu32 ",\"active_rtt_ms\":%" PRIu32 ",\"active_rtt_max_ms\":%" PRIu32 ",\"lost\":%" PRIu32 "}",
+                     mode_names[s.mode], (uint32_t) (sleep->time_us / 1000000), (uint32_t) (active->time_us / 1000000), active->entered,
+                     average_ms(sleep), sleep->rtt_max_us / 1000, average_ms(active), active->rtt_max_us / 1000, s.probes_lost);
+  mqtt_publish_enqueue(POWER_TOPIC, payload, len, 0, false);
+}
+
+static void send_probe(void) {
+  char payload[12];
+  portENTER_CRITICAL(&lock);
+  // the last one never came back
+  if (probe_sent_us) stats.probes_lost++;
+  uint32_t seq = ++probe_seq;
+  probe_sent_us = esp_timer_get_time();
+  portEXIT_CRITICAL(&lock);
+
+  int len = snprintf(payload, sizeof(payload), "%" PRIu32, seq);
+  mqtt_publish_enqueue(PROBE_TOPIC, payload, len, 0, false);
+}
+
+static void power_task(void* arg) {
+  int64_t next_probe_us = esp_timer_get_time() + PROBE_US;
+
+  while (1) {
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&lock);
+    wifi_power_mode_t mode = stats.mode;
+    int64_t idle_at = last_activity_us + ACTIVE_US;
+    portEXIT_CRITICAL(&lock);
+
+    wifi_power_mode_t want = now < idle_at ? WIFI_POWER_ACTIVE : WIFI_POWER_SLEEP;
+    bool retry = false;
+    if (want != mode) {
+      if (set_mode(want)) {
+        mode = want;
+      } else {
+        retry = true;
+      }
+    }
+    if (now >= next_probe_us) {
+      // results of the previous probe, then the next one
+      publish_stats();
+      send_probe();
+      next_probe_us = now + PROBE_US;
+    }
+
+    // only this task switches modes
+    int64_t wake_at = next_probe_us;
+    if (retry) {
+      // idle_at may be behind us already, which would spin
+      if (now + RETRY_US < wake_at) wake_at = now + RETRY_US;
+    } else if (mode == WIFI_POWER_ACTIVE && idle_at < wake_at) {
+      wake_at = idle_at;
+    }
+    int64_t wait_us = wake_at > now ? wake_at - now : 0;
+    // woken early by wifi_power_activity()
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait_us / 1000) + 1);
+  }
+}
+
+esp_err_t wifi_power_start(void) {
+  ESP_RETURN_ON_ERROR(esp_wifi_set_ps(ps_types[WIFI_POWER_SLEEP]), TAG, "Failed to enable modem sleep");
+  mode_since_us = esp_timer_get_time();
+  last_activity_us = mode_since_us - ACTIVE_US;
+  stats.mode = WIFI_POWER_SLEEP;
+  stats.modes[WIFI_POWER_SLEEP].entered = 1;
+  ESP_RETURN_ON_FALSE(xTaskCreate(power_task, "wifi_power", 3072, NULL, 5, &task) == pdPASS, ESP_ERR_NO_MEM, TAG, "Failed to create task");
+  return ESP_OK;
+}
+
+void wifi_power_activity(void) {
+  if (task == NULL) return;
+  portENTER_CRITICAL(&lock);
+  last_activity_us = esp_timer_get_time();
+  bool wake = stats.mode == WIFI_POWER_SLEEP;
+  portEXIT_CRITICAL(&lock);
+  if (wake) xTaskNotifyGive(task);
+}
+
+int wifi_power_subscribe(esp_mqtt_client_handle_t client) {
+  return esp_mqtt_client_subscribe(client, PROBE_TOPIC, 0) >= 0 ? 1 : 0;
+}
+
+bool wifi_power_handle_message(const char* topic, size_t topic_len, const char* data, size_t data_len) {
+  if (topic_len != strlen(PROBE_TOPIC) || strncmp(topic, PROBE_TOPIC, topic_len) != 0) return false;
+
+  char payload[12];
+  if (data_len == 0 || data_len >= sizeof(payload)) return true;
+  memcpy(payload, data, data_len);
+  payload[data_len] = '\0';
+  uint32_t seq = strtoul(payload, NULL, 10);
+
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&lock);
+  // otherwise a late or foreign probe
+  if (probe_sent_us && seq == probe_seq) {
+    uint32_t rtt_us = now - probe_sent_us;
+    wifi_power_mode_stats_t* mode = &stats.modes[stats.mode];
+    mode->probes++;
+    mode->rtt_total_us += rtt_us;
+    if (rtt_us > mode->rtt_max_us) mode->rtt_max_us = rtt_us;
+    probe_sent_us = 0;
+  }
+  portEXIT_CRITICAL(&lock);
+  return true;
+}
+
+void wifi_power_get_stats(wifi_power_stats_t* out) {
+  int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&lock);
+  *out = stats;
+  // up to now for the current mode
+  out->modes[out->mode].time_us += now - mode_since_us;
+  portEXIT_CRITICAL(&lock);
+}
+
+#endif
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_err.h"
+#include "mqtt_client.h"
+
+// Adaptive Wi-Fi power save.
+//
+// In modem sleep the station only wakes for DTIM beacons, so a command from the broker can
+// wait a whole DTIM interval before it arrives. The bridge stays out of power save for
+// CONFIG_RF_BRIDGE_WIFI_ACTIVE_MS after the last command or RF activity, and goes back to
+// modem sleep when it is idle. A probe sent to the broker and back every
+// CONFIG_RF_BRIDGE_WIFI_PROBE_S measures the command receive latency in the current mode,
+// reported on wifi/power together with the time spent in each mode.
+
+typedef enum {
+  WIFI_POWER_SLEEP,
+  WIFI_POWER_ACTIVE,
+  WIFI_POWER_MODES,
+} wifi_power_mode_t;
+
+typedef struct {
+  uint64_t time_us;
+  uint32_t entered;
+  // broker round trips measured in this mode
+  uint32_t probes;
+  uint32_t rtt_max_us;
+  uint64_t rtt_total_us;
+} wifi_power_mode_stats_t;
+
+typedef struct {
+  wifi_power_mode_t mode;
+  wifi_power_mode_stats_t modes[WIFI_POWER_MODES];
+  // probes that did not come back before the next one, or crossed a mode change
+  uint32_t probes_lost;
+} wifi_power_stats_t;
+
+#ifdef CONFIG_RF_BRIDGE_WIFI_POWER
+
+// Start in modem sleep, call once Wi-Fi is connected
+esp_err_t wifi_power_start(void);
+
+/**
+ * @brief Report a command or RF activity, more commands are likely to follow
+ *
+ * Cheap while already active, safe from any task.
+ */
+void wifi_power_activity(void);
+
+// Subscribe to the probe topic, returns the number of subscriptions made
+int wifi_power_subscribe(esp_mqtt_client_handle_t client);
+
+/**
+ * @brief Take a probe off the MQTT task
+ *
+ * @return false if the topic is not the probe topic
+ */
+bool wifi_power_handle_message(const char* topic, size_t topic_len, const char* data, size_t data_len);
+
+void wifi_power_get_stats(wifi_power_stats_t* stats);
+
+#else
+
+static inline esp_err_t wifi_power_start(void) { return ESP_OK; }
+static inline void wifi_power_activity(void) {}
+static inline int wifi_power_subscribe(esp_mqtt_client_handle_t client) { return 0; }
+static inline bool wifi_power_handle_message(const char* topic, size_t topic_len, const char* data, size_t data_len) { return false; }
+
+#endif
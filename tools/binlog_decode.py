@@ -0,0 +1,113 @@
+#!/usr/bin/env python3
+"""Decode the "#BL" lines printed with CONFIG_RF_BRIDGE_BINARY_LOG.
+
+Every record carries the addresses of its format string and tag, which are looked up in the
+firmware ELF. Other lines are passed through unchanged, so this can sit behind the monitor:
+
+    idf.py monitor | python3 tools/binlog_decode.py build/rf-bridge-cc1101.elf
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+from elftools.elf.elffile import ELFFile
+
+LEVELS = {1: "E", 2: "W", 3: "I", 4: "D", 5: "V"}
+COLORS = {"E": "\033[0;31m", "W": "\033[0;33m", "I": "\033[0;32m"}
+RESET = "\033[0m"
+
+# printf conversions; length modifiers are dropped since every argument is 32 bits
+SPEC = re.compile(r"%([-+ #0]*\d*(?:\.\d+)?)(?:hh|h|ll|l|z|j|t)?([diouxXcsp%])")
+
+
+class Strings:
+    """C strings by address, from the loadable sections of the ELF."""
+
+    def __init__(self, path):
+        self.sections = []
+        with open(path, "rb") as f:
+            elf = ELFFile(f)
+            for section in elf.iter_sections():
+                if section["sh_type"] == "SHT_PROGBITS" and section["sh_addr"] and section["sh_flags"] & 0x2:
+                    self.sections.append((section["sh_addr"], section.data()))
+        self.cache = {}
+
+    def get(self, addr):
+        if addr in self.cache:
+            return self.cache[addr]
+        text = None
+        for start, data in self.sections:
+            if start <= addr < start + len(data):
+                end = data.index(b"\0", addr - start)
+                text = data[addr - start:end].decode("utf-8", "replace")
+                break
+        self.cache[addr] = text
+        return text
+
+
+def format_record(strings, fmt, args):
+    args = list(args)
+
+    def convert(match):
+        flags, conv = match.groups()
+        if conv == "%":
+            return "%"
+        value = args.pop(0) if args else 0
+        if conv in "di":
+            value = struct.unpack("<i", struct.pack("<I", value))[0]
+            conv = "d"
+        elif conv == "u":
+            conv = "d"
+        elif conv == "c":
+            value = chr(value & 0xFF)
+        elif conv == "s":
+            value = strings.get(value) or "<0x%08x>" % value
+        elif conv == "p":
+            return "0x%08x" % value
+        return ("%" + flags + conv) % value
+
+    return SPEC.sub(convert, fmt)
+
+
+def decode_line(strings, line, color):
+    payload = bytes.fromhex(line[4:].strip())
+    fmt_addr, tag_addr, timestamp_us, level, nargs = struct.unpack_from("<IIqBB", payload)
+    args = struct.unpack_from("<%dI" % nargs, payload, 18)
+    fmt = strings.get(fmt_addr)
+    tag = strings.get(tag_addr) or "?"
+    if fmt is None:
+        text = "<unknown format 0x%08x> %s" % (fmt_addr, " ".join("%08x" % a for a in args))
+    else:
+        text = format_record(strings, fmt, args)
+    letter = LEVELS.get(level, "?")
+    out = "%s (%d) %s: %s" % (letter, timestamp_us // 1000, tag, text)
+    if color and letter in COLORS:
+        out = COLORS[letter] + out + RESET
+    return out
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("elf", help="firmware ELF the log came from")
+    parser.add_argument("log", nargs="?", type=argparse.FileType("r", errors="replace"), default=sys.stdin)
+    parser.add_argument("--color", action="store_true", help="color by level like ESP_LOG")
+    args = parser.parse_args()
+
+    strings = Strings(args.elf)
+    for line in args.log:
+        # the monitor may prefix lines, so look for the marker anywhere
+        marker = line.find("#BL ")
+        if marker < 0:
+            sys.stdout.write(line)
+            continue
+        try:
+            print(decode_line(strings, line[marker:], args.color))
+        except (ValueError, struct.error):
+            sys.stdout.write(line)
+        sys.stdout.flush()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,187 @@
+#!/usr/bin/env python3
+"""Send firmware updates to the bridge over MQTT, as full images or compressed deltas.
+
+    # full image
+    python3 tools/ota.py push --broker example.org --user rf-bridge-2 build/rf-bridge-cc1101.bin
+    # another bridge on the same broker, by its CONFIG_RF_BRIDGE_ID
+    python3 tools/ota.py push --broker example.org --user rf-bridge-2 --bridge rf_bridge_3 build/rf-bridge-cc1101.bin
+    # delta against the image the bridge is running
+    python3 tools/ota.py push --broker example.org --user rf-bridge-2 --base old.bin build/rf-bridge-cc1101.bin
+    # just write the delta, to see how large it is
+    python3 tools/ota.py delta old.bin build/rf-bridge-cc1101.bin update.rfd
+
+The bridge asks for the stream a window at a time and keeps its progress, so running push again
+after an interruption continues the same update. See main/ota.h for the protocol.
+"""
+
+import argparse
+import hashlib
+import ssl
+import struct
+import sys
+import threading
+import time
+import zlib
+
+# filled in with the bridge name, CONFIG_RF_BRIDGE_ID
+PREFIX = "devices/%s/ota/"
+CHUNK_SIZE = 1024  # OTA_CHUNK_SIZE
+SECTOR_SIZE = 4096
+# OTA_DELTA_MAX_DICT, split around the sector being encoded
+DICT_BEFORE = 4096
+DICT_SIZE = 8192
+
+BLOCK_STORED = 0
+BLOCK_DEFLATE = 1
+
+
+def image_sha256(image):
+    """SHA-256 the bridge computes for an app image: the digest esptool appends, if there is one."""
+    if len(image) > 32 and hashlib.sha256(image[:-32]).digest() == image[-32:]:
+        return image[-32:]
+    return hashlib.sha256(image).digest()
+
+
+def deflate(data, zdict=None):
+    if zdict:
+        compressor = zlib.compressobj(9, zlib.DEFLATED, -15, 9, zlib.Z_DEFAULT_STRATEGY, zdict)
+    else:
+        compressor = zlib.compressobj(9, zlib.DEFLATED, -15, 9)
+    return compressor.compress(data) + compressor.flush()
+
+
+def dict_offsets(base, image, offset):
+    """Where the base image may hold this sector: the same offset, and wherever a sample of it shows up."""
+    offsets = {offset}
+    for anchor in range(0, SECTOR_SIZE, SECTOR_SIZE // 4):
+        sample = image[offset + anchor:offset + anchor + 32]
+        found = base.find(sample) if len(sample) == 32 else -1
+        if found >= 0:
+            offsets.add(found - anchor)
+    return [max(0, min(o - DICT_BEFORE, len(base) - DICT_SIZE)) for o in sorted(offsets)]
+
+
+def make_delta(base, image):
+    """One block per flash sector, each deflated with the base image around it as the dictionary."""
+    out = bytearray(b"RFD1" + struct.pack("<I", len(image)) + image_sha256(base))
+    for offset in range(0, len(image), SECTOR_SIZE):
+        sector = image[offset:offset + SECTOR_SIZE]
+        candidates = [
+            (BLOCK_STORED, sector, 0, 0),
+            (BLOCK_DEFLATE, deflate(sector), 0, 0),
+        ]
+        for dict_offset in dict_offsets(base, image, offset):
+            zdict = base[dict_offset:dict_offset + DICT_SIZE]
+            if zdict:
+                candidates.append((BLOCK_DEFLATE, deflate(sector, zdict), dict_offset, len(zdict)))
+        kind, data, dict_offset, dict_len = min(candidates, key=lambda c: len(c[1]))
+        out += struct.pack("<BBHHHI", kind, 0, len(sector), len(data), dict_len, dict_offset)
+        out += data
+    return bytes(out)
+
+
+class Sender:
+    def __init__(self, client, bridge, stream, kind, sha256):
+        self.client = client
+        self.prefix = PREFIX % bridge
+        self.stream = stream
+        self.begin = "%s %d %s" % (kind, len(stream), sha256.hex())
+        self.done = threading.Event()
+        self.result = None
+        self.started = time.monotonic()
+        self.sent = 0
+
+    def on_connect(self, client, userdata, flags, reason_code, properties=None):
+        client.subscribe(self.prefix + "request")
+        client.subscribe(self.prefix + "state")
+        client.publish(self.prefix + "begin", self.begin)
+
+    def on_message(self, client, userdata, message):
+        if message.topic == self.prefix + "request":
+            offset, length = (int(x) for x in message.payload.decode().split())
+            end = min(offset + length, len(self.stream))
+            for chunk in range(offset, end, CHUNK_SIZE):
+                data = self.stream[chunk:min(chunk + CHUNK_SIZE, end)]
+                client.publish(self.prefix + "chunk", struct.pack("<I", chunk) + data)
+                self.sent += len(data)
+            print("\r%6.1f %%  %d of %d bytes" % (100.0 * end / len(self.stream), end, len(self.stream)), end="", flush=True)
+        elif message.topic == self.prefix + "state" and not message.retain:
+            # the retained state is from an earlier update
+            state = message.payload.decode()
+            if '"rebooting"' in state or '"failed"' in state:
+                self.result = state
+                self.done.set()
+
+
+def push(args):
+    import paho.mqtt.client as mqtt
+
+    image = open(args.image, "rb").read()
+    if args.base:
+        stream = make_delta(open(args.base, "rb").read(), image)
+        kind = "delta"
+    else:
+        stream = image
+        kind = "image"
+    print("%s update, %d bytes for a %d byte image" % (kind, len(stream), len(image)))
+
+    try:
+        client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2)
+    except AttributeError:
+        client = mqtt.Client()
+    sender = Sender(client, args.bridge, stream, kind, image_sha256(image))
+    client.on_connect = sender.on_connect
+    client.on_message = sender.on_message
+    if args.user:
+        client.username_pw_set(args.user, args.password)
+    if args.port != 1883:
+        client.tls_set(ca_certs=args.cafile, cert_reqs=ssl.CERT_REQUIRED)
+    client.connect(args.broker, args.port)
+    client.loop_start()
+    finished = sender.done.wait(args.timeout)
+    client.loop_stop()
+    print()
+
+    if not finished:
+        print("no answer from the bridge, run again to resume")
+        return 1
+    elapsed = time.monotonic() - sender.started
+    print("%s after %.1f s, %d bytes sent" % (sender.result, elapsed, sender.sent))
+    return 0 if '"rebooting"' in sender.result else 1
+
+
+def delta(args):
+    stream = make_delta(open(args.base, "rb").read(), open(args.image, "rb").read())
+    open(args.out, "wb").write(stream)
+    print("%d bytes" % len(stream))
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    p = commands.add_parser("push", help="send an update")
+    p.add_argument("image", help="new firmware image (.bin)")
+    p.add_argument("--base", help="image the bridge runs now, to send a delta")
+    p.add_argument("--broker", required=True)
+    p.add_argument("--bridge", default="rf_bridge_2", help="CONFIG_RF_BRIDGE_ID of the bridge to update")
+    p.add_argument("--port", type=int, default=8883)
+    p.add_argument("--user")
+    p.add_argument("--password")
+    p.add_argument("--cafile", default="main/isrgrootx1.pem")
+    p.add_argument("--timeout", type=float, default=600, help="seconds to wait for the bridge to finish")
+    p.set_defaults(func=push)
+
+    p = commands.add_parser("delta", help="write a delta image")
+    p.add_argument("base")
+    p.add_argument("image")
+    p.add_argument("out")
+    p.set_defaults(func=delta)
+
+    args = parser.parse_args()
+    sys.exit(args.func(args))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,449 @@
+// Batch decoder for RF capture archives, on the host.
+//
+// Capture files are raw rmt_symbol_word_t arrays as the RX channel delivers them, a symbol
+// with a zero duration1 ends a frame. Every file is memory mapped and split into chunks at
+// frame ends, which worker threads decode with the rules of rf_light_rx_decode_frame_unsynced:
+// 16 payload symbols in a row within RF_LIGHT_DECODE_MARGIN of the decode durations in
+// rf_light_timing.h, the low time of the last one not checked, repeats within a frame reported
+// once. Without the header sync, payloads behind unknown headers are found too.
+//
+// Symbols are classified 64 at a time into range masks with AVX2, SSE2 or plain C, and a
+// block without a single payload-like high time is skipped as a whole, which is most of a
+// noise capture. The bit decoding then runs on the masks.
+//
+//   rf_batch_decode [-j threads] [-i avx2|sse2|scalar] [-H] [-v] capture...
+//
+// Prints the count of every decoded code, with -H histograms of the high and low times and
+// with -v every message with its file and symbol index. Throughput goes to stderr.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "hal/rmt_types.h"
+#include "rf_light_timing.h"
+
+// symbols per job, about 16 MB
+#define CHUNK_SYMBOLS (4 << 20)
+#define BLOCK_SYMBOLS 64
+// 16 us wide, up to 8 ms, the last bin takes everything longer
+#define HISTOGRAM_BIN_TICKS 8
+#define HISTOGRAM_BINS 512
+#define MAX_THREADS 256
+
+// bounds of a decode window in doubled ticks, a duration d matches if lo < 2d < hi
+#define RANGE_LO(spec) ((spec) - RF_LIGHT_DECODE_MARGIN)
+#define RANGE_HI(spec) ((spec) + RF_LIGHT_DECODE_MARGIN)
+
+// one bit per symbol of a block
+typedef struct {
+  uint64_t zero_high;
+  uint64_t zero_low;
+  uint64_t one_high;
+  uint64_t one_low;
+  // last symbol of a frame
+  uint64_t end;
+} block_masks_t;
+
+typedef void (*classify_fn)(const rmt_symbol_word_t* symbols, size_t count, block_masks_t* masks);
+
+typedef struct {
+  const char* path;
+  const rmt_symbol_word_t* symbols;
+  size_t count;
+} capture_t;
+
+typedef struct {
+  uint64_t symbol;
+  rf_light_message_t code;
+} message_t;
+
+typedef struct {
+  size_t capture;
+  size_t start;
+  size_t end;
+  // with -v
+  message_t* messages;
+  size_t num_messages;
+  size_t max_messages;
+} job_t;
+
+typedef struct {
+  uint64_t codes[1 << 16];
+  uint64_t high[HISTOGRAM_BINS];
+  uint64_t low[HISTOGRAM_BINS];
+  uint64_t frames;
+  uint64_t blocks_skipped;
+} results_t;
+
+static capture_t* captures;
+static job_t* jobs;
+static size_t num_jobs;
+static atomic_size_t next_job;
+static classify_fn classify;
+static bool histograms;
+static bool verbose;
+
+static inline bool in_range(uint32_t duration, uint32_t spec) {
+  uint32_t us = duration * RF_LIGHT_RMT_TICK_US;
+  return us > RANGE_LO(spec) && us < RANGE_HI(spec);
+}
+
+static void classify_scalar(const rmt_symbol_word_t* symbols, size_t count, block_masks_t* masks) {
+  *masks = (block_masks_t) {0};
+  for (size_t i = 0; i < count; i++) {
+    uint64_t bit = 1ULL << i;
+    if (in_range(symbols[i].duration0, RF_LIGHT_PAYLOAD_ZERO_DECODE_DURATION_0)) masks->zero_high |= bit;
+    if (in_range(symbols[i].duration1, RF_LIGHT_PAYLOAD_ZERO_DECODE_DURATION_1)) masks->zero_low |= bit;
+    if (in_range(symbols[i].duration0, RF_LIGHT_PAYLOAD_ONE_DECODE_DURATION_0)) masks->one_high |= bit;
+    if (in_range(symbols[i].duration1, RF_LIGHT_PAYLOAD_ONE_DECODE_DURATION_1)) masks->one_low |= bit;
+    if (symbols[i].duration1 == 0) masks->end |= bit;
+  }
+}
+
+#if defined(__SSE2__)
+static inline __m128i in_range_sse2(__m128i us, int32_t spec) {
+  return _mm_and_si128(_mm_cmpgt_epi32(us, _mm_set1_epi32(RANGE_LO(spec))), _mm_cmplt_epi32(us, _mm_set1_epi32(RANGE_HI(spec))));
+}
+
+static inline uint64_t movemask_sse2(__m128i mask) {
+  return (uint64_t) _mm_movemask_ps(_mm_castsi128_ps(mask));
+}
+
+static void classify_sse2(const rmt_symbol_word_t* symbols, size_t count, block_masks_t* masks) {
+  *masks = (block_masks_t) {0};
+  const __m128i duration = _mm_set1_epi32(0x7fff);
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128i words = _mm_loadu_si128((const __m128i*) &symbols[i]);
+    __m128i high = _mm_slli_epi32(_mm_and_si128(words, duration), 1);
+    __m128i low_ticks = _mm_and_si128(_mm_srli_epi32(words, 16), duration);
+    __m128i low = _mm_slli_epi32(low_ticks, 1);
+    masks->zero_high |= movemask_sse2(in_range_sse2(high, RF_LIGHT_PAYLOAD_ZERO_DECODE_DURATION_0)) << i;
+    masks->zero_low |= movemask_sse2(in_range_sse2(low, RF_LIGHT_PAYLOAD_ZERO_DECODE_DURATION_1)) << i;
+    masks->one_high |= movemask_sse2(in_range_sse2(high, RF_LIGHT_PAYLOAD_ONE_DECODE_DURATION_0)) << i;
+    masks->one_low |= movemask_sse2(in_range_sse2(low, RF_LIGHT_PAYLOAD_ONE_DECODE_DURATION_1)) << i;
+    masks->end |= movemask_sse2(_mm_cmpeq_epi32(low_ticks, _mm_setzero_si128())) << i;
+  }
+  if (i < count) {
+    block_masks_t tail;
+    classify_scalar(&symbols[i], count - i, &tail);
+    masks->zero_high |= tail.zero_high << i;
+    masks->zero_low |= tail.zero_low << i;
+    masks->one_high |= tail.one_high << i;
+    masks->one_low |= tail.one_low << i;
+    masks->end |= tail.end << i;
+  }
+}
+#endif
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define HAVE_AVX2 1
+
+__attribute__((target("avx2"))) static inline __m256i in_range_avx2(__m256i us, int32_t spec) {
+  return _mm256_and_si256(_mm256_cmpgt_epi32(us, _mm256_set1_epi32(RANGE_LO(spec))), _mm256_cmpgt_epi32(_mm256_set1_epi32(RANGE_HI(spec)), us));
+}
+
+__attribute__((target("avx2"))) static inline uint64_t movemask_avx2(__m256i mask) {
+  return (uint64_t) _mm256_movemask_ps(_mm256_castsi256_ps(mask));
+}
+
+__attribute__((target("avx2"))) static void classify_avx2(const rmt_symbol_word_t* symbols, size_t count, block_masks_t* masks) {
+  *masks = (block_masks_t) {0};
+  const __m256i duration = _mm256_set1_epi32(0x7fff);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m256i words = _mm256_loadu_si256((const __m256i*) &symbols[i]);
+    __m256i high = _mm256_slli_epi32(_mm256_and_si256(words, duration), 1);
+    __m256i low_ticks = _mm256_and_si256(_mm256_srli_epi32(words, 16), duration);
+    __m256i low = _mm256_slli_epi32(low_ticks, 1);
+    masks->zero_high |= movemask_avx2(in_range_avx2(high, RF_LIGHT_PAYLOAD_ZERO_DECODE_DURATION_0)) << i;
+    masks->zero_low |= movemask_avx2(in_range_avx2(low, RF_LIGHT_PAYLOAD_ZERO_DECODE_DURATION_1)) << i;
+    masks->one_high |= movemask_avx2(in_range_avx2(high, RF_LIGHT_PAYLOAD_ONE_DECODE_DURATION_0)) << i;
+    masks->one_low |= movemask_avx2(in_range_avx2(low, RF_LIGHT_PAYLOAD_ONE_DECODE_DURATION_1)) << i;
+    masks->end |= movemask_avx2(_mm256_cmpeq_epi32(low_ticks, _mm256_setzero_si256())) << i;
+  }
+  if (i < count) {
+    block_masks_t tail;
+    classify_scalar(&symbols[i], count - i, &tail);
+    masks->zero_high |= tail.zero_high << i;
+    masks->zero_low |= tail.zero_low << i;
+    masks->one_high |= tail.one_high << i;
+    masks->one_low |= tail.one_low << i;
+    masks->end |= tail.end << i;
+  }
+}
+#endif
+
+static void add_message(job_t* job, uint64_t symbol, rf_light_message_t code) {
+  if (job->num_messages == job->max_messages) {
+    job->max_messages = job->max_messages ? job->max_messages * 2 : 256;
+    job->messages = realloc(job->messages, job->max_messages * sizeof(message_t));
+    if (job->messages == NULL) {
+      perror("realloc");
+      exit(1);
+    }
+  }
+  job->messages[job->num_messages++] = (message_t) { .symbol = symbol, .code = code };
+}
+
+static void add_histograms(const rmt_symbol_word_t* symbols, size_t count, results_t* results) {
+  for (size_t i = 0; i < count; i++) {
+    uint32_t high = symbols[i].duration0 / HISTOGRAM_BIN_TICKS;
+    uint32_t low = symbols[i].duration1 / HISTOGRAM_BIN_TICKS;
+    results->high[high < HISTOGRAM_BINS ? high : HISTOGRAM_BINS - 1]++;
+    // the end of frame has no low time
+    if (symbols[i].duration1) results->low[low < HISTOGRAM_BINS ? low : HISTOGRAM_BINS - 1]++;
+  }
+}
+
+// Same decision per symbol as rf_light_rx_decode_frame_unsynced, frames end on the end mask
+static void decode_job(job_t* job, results_t* results) {
+  const rmt_symbol_word_t* symbols = captures[job->capture].symbols;
+  int bit = 0;
+  rf_light_message_t message = 0;
+  rf_light_message_t previous = 0;
+
+  for (size_t base = job->start; base < job->end; base += BLOCK_SYMBOLS) {
+    size_t count = job->end - base < BLOCK_SYMBOLS ? job->end - base : BLOCK_SYMBOLS;
+    if (histograms) add_histograms(&symbols[base], count, results);
+
+    block_masks_t masks;
+    classify(&symbols[base], count, &masks);
+    results->frames += __builtin_popcountll(masks.end);
+    if (bit == 0 && (masks.zero_high | masks.one_high) == 0) {
+      // nothing here can be a payload bit
+      results->blocks_skipped++;
+      if (masks.end) previous = 0;
+      continue;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+      uint64_t mask = 1ULL << i;
+      bool last = bit == 15;
+      bool zero = (masks.zero_high & mask) && (last || (masks.zero_low & mask));
+      bool one = (masks.one_high & mask) && (last || (masks.one_low & mask));
+      if (zero) {
+        message &= ~(1 << (bit++));
+      } else if (one) {
+        message |= (1 << (bit++));
+      } else {
+        bit = 0;
+      }
+
+      if (bit == 16) {
+        bit = 0;
+        if (message != previous) {
+          results->codes[message]++;
+          if (verbose) add_message(job, base + i, message);
+        }
+        previous = message;
+      }
+      if (masks.end & mask) {
+        bit = 0;
+        previous = 0;
+      }
+    }
+  }
+}
+
+static void* worker(void* arg) {
+  results_t* results = arg;
+  size_t i;
+  while ((i = atomic_fetch_add(&next_job, 1)) < num_jobs) decode_job(&jobs[i], results);
+  return NULL;
+}
+
+// First symbol after a frame end at or after position, so no frame spans two jobs
+static size_t frame_boundary(const capture_t* capture, size_t position) {
+  if (position == 0 || position >= capture->count) return position < capture->count ? position : capture->count;
+  for (size_t i = position - 1; i < capture->count; i++) {
+    if (capture->symbols[i].duration1 == 0) return i + 1;
+  }
+  return capture->count;
+}
+
+static int map_capture(const char* path, capture_t* capture) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  if (st.st_size % sizeof(rmt_symbol_word_t)) {
+    fprintf(stderr, "%s: ignoring %d trailing bytes\n", path, (int) (st.st_size % sizeof(rmt_symbol_word_t)));
+  }
+  *capture = (capture_t) { .path = path, .count = st.st_size / sizeof(rmt_symbol_word_t) };
+  if (capture->count) {
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      fprintf(stderr, "%s: %s\n", path, strerror(errno));
+      close(fd);
+      return -1;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+    capture->symbols = data;
+  }
+  close(fd);
+  return 0;
+}
+
+static const char* pick_implementation(const char* name) {
+#ifdef HAVE_AVX2
+  if ((name == NULL || strcmp(name, "avx2") == 0) && __builtin_cpu_supports("avx2")) {
+    classify = classify_avx2;
+    return "avx2";
+  }
+#endif
+#if defined(__SSE2__)
+  if (name == NULL || strcmp(name, "sse2") == 0 || strcmp(name, "avx2") == 0) {
+    classify = classify_sse2;
+    return "sse2";
+  }
+#endif
+  classify = classify_scalar;
+  return "scalar";
+}
+
+static void print_histogram(const char* name, const uint64_t* bins) {
+  for (int i = 0; i < HISTOGRAM_BINS; i++) {
+    if (bins[i] == 0) continue;
+    uint32_t from = i * HISTOGRAM_BIN_TICKS * RF_LIGHT_RMT_TICK_US;
+    if (i == HISTOGRAM_BINS - 1) {
+      printf("%s %" PRIu32 "+ us %" PRIu64 "\n", name, from, bins[i]);
+    } else {
+      printf("%s %" PRIu32 "-%" PRIu32 " us %" PRIu64 "\n", name, from, from + HISTOGRAM_BIN_TICKS * RF_LIGHT_RMT_TICK_US, bins[i]);
+    }
+  }
+}
+
+static int compare_counts(const void* a, const void* b) {
+  const uint64_t* x = a;
+  const uint64_t* y = b;
+  // by count, most first
+  return (x[1] < y[1]) - (x[1] > y[1]);
+}
+
+static void usage(void) {
+  fprintf(stderr, "usage: rf_batch_decode [-j threads] [-i avx2|sse2|scalar] [-H] [-v] capture...\n");
+  exit(2);
+}
+
+int main(int argc, char** argv) {
+  long threads = sysconf(_SC_NPROCESSORS_ONLN);
+  const char* implementation = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "j:i:Hv")) != -1) {
+    switch (opt) {
+    case 'j':
+      threads = strtol(optarg, NULL, 10);
+      break;
+    case 'i':
+      implementation = optarg;
+      break;
+    case 'H':
+      histograms = true;
+      break;
+    case 'v':
+      verbose = true;
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind == argc) usage();
+  if (threads < 1) threads = 1;
+  if (threads > MAX_THREADS) threads = MAX_THREADS;
+  implementation = pick_implementation(implementation);
+
+  size_t num_captures = argc - optind;
+  captures = calloc(num_captures, sizeof(capture_t));
+  uint64_t total_symbols = 0;
+  for (size_t i = 0; i < num_captures; i++) {
+    if (map_capture(argv[optind + i], &captures[i]) != 0) return 1;
+    total_symbols += captures[i].count;
+    num_jobs += captures[i].count / CHUNK_SYMBOLS + 1;
+  }
+
+  jobs = calloc(num_jobs, sizeof(job_t));
+  num_jobs = 0;
+  for (size_t i = 0; i < num_captures; i++) {
+    for (size_t start = 0; start < captures[i].count; start += CHUNK_SYMBOLS) {
+      jobs[num_jobs] = (job_t) {
+        .capture = i,
+        .start = frame_boundary(&captures[i], start),
+        .end = frame_boundary(&captures[i], start + CHUNK_SYMBOLS),
+      };
+      if (jobs[num_jobs].start < jobs[num_jobs].end) num_jobs++;
+    }
+  }
+
+  results_t* results = calloc(threads, sizeof(results_t));
+  pthread_t workers[MAX_THREADS];
+  struct timespec started, finished;
+  clock_gettime(CLOCK_MONOTONIC, &started);
+  for (long i = 0; i < threads; i++) pthread_create(&workers[i], NULL, worker, &results[i]);
+  for (long i = 0; i < threads; i++) pthread_join(workers[i], NULL);
+  clock_gettime(CLOCK_MONOTONIC, &finished);
+  double seconds = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+
+  // into the first thread's
+  results_t* total = &results[0];
+  for (long t = 1; t < threads; t++) {
+    for (size_t i = 0; i < 1 << 16; i++) total->codes[i] += results[t].codes[i];
+    for (size_t i = 0; i < HISTOGRAM_BINS; i++) {
+      total->high[i] += results[t].high[i];
+      total->low[i] += results[t].low[i];
+    }
+    total->frames += results[t].frames;
+    total->blocks_skipped += results[t].blocks_skipped;
+  }
+
+  if (verbose) {
+    for (size_t i = 0; i < num_jobs; i++) {
+      for (size_t m = 0; m < jobs[i].num_messages; m++) {
+        printf("%s:%" PRIu64 " %04X\n", captures[jobs[i].capture].path, jobs[i].messages[m].symbol, jobs[i].messages[m].code);
+      }
+    }
+  }
+
+  uint64_t (*counts)[2] = malloc(sizeof(uint64_t[2]) << 16);
+  size_t num_codes = 0;
+  uint64_t messages = 0;
+  for (size_t i = 0; i < 1 << 16; i++) {
+    if (total->codes[i] == 0) continue;
+    counts[num_codes][0] = i;
+    counts[num_codes][1] = total->codes[i];
+    num_codes++;
+    messages += total->codes[i];
+  }
+  qsort(counts, num_codes, sizeof(uint64_t[2]), compare_counts);
+  for (size_t i = 0; i < num_codes; i++) printf("code %04" PRIX64 " %" PRIu64 "\n", counts[i][0], counts[i][1]);
+
+  if (histograms) {
+    print_histogram("high", total->high);
+    print_histogram("low", total->low);
+  }
+
+  fprintf(stderr, "%zu files | %" PRIu64 " symbols | %" PRIu64 " frames | %" PRIu64 " messages | %" PRIu64 " blocks skipped\n",
+          num_captures, total_symbols, total->frames, messages, total->blocks_skipped);
+  fprintf(stderr, "%s | %ld threads | %.3f s | %.1f Msymbols/s\n", implementation, threads, seconds, seconds > 0 ? total_symbols / seconds / 1e6 : 0);
+  return 0;
+}